@@ -25,26 +25,149 @@
  */
 
 
+#include "config.h"
 #include "checksum.h"
 
-uint32_t add_checksum(void *buffer, uint16_t length) {
-        uint32_t sum = 0;
-        uint16_t * buff = (uint16_t *) buffer;
-        uint16_t count = length;
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define CHECKSUM_X86 1
+#endif
+
+/* Buffers shorter than this, such as IP headers, are not worth the vector
+ * kernels */
+#define CHECKSUM_SHORT 64
+
+/* The Internet checksum is a one's complement sum of 16 bit words, which is
+ * the same whatever size of word it is added up in, so long as the carries
+ * are folded back in at the end. The kernels below add 32 bit words into 64
+ * bit accumulators, which cannot overflow for anything that fits in a
+ * packet.
+ *
+ * Words are loaded in host byte order, as add_checksum() always has done, so
+ * the final sum needs to be byte swapped by anyone wanting it in network
+ * order.
+ */
+
+/* Folds a 64 bit sum down to 16 bits */
+static inline uint32_t fold_checksum(uint64_t sum) {
+	sum = (sum & 0xffffffff) + (sum >> 32);
+	sum = (sum & 0xffffffff) + (sum >> 32);
+	sum = (sum & 0xffff) + (sum >> 16);
+	sum = (sum & 0xffff) + (sum >> 16);
+	return (uint32_t) sum;
+}
+
+static uint64_t sum_generic(const uint8_t *buff, size_t count, uint64_t sum) {
+	uint32_t a, b, c, d;
 	uint16_t val;
 
-        while(count > 1 ) {
-                val = *buff;
+	while (count >= 16) {
+		memcpy(&a, buff, 4);
+		memcpy(&b, buff + 4, 4);
+		memcpy(&c, buff + 8, 4);
+		memcpy(&d, buff + 12, 4);
+		sum += (uint64_t)a + b + c + d;
+		buff += 16;
+		count -= 16;
+	}
+	while (count >= 4) {
+		memcpy(&a, buff, 4);
+		sum += a;
+		buff += 4;
+		count -= 4;
+	}
+	if (count >= 2) {
+		memcpy(&val, buff, 2);
+		sum += val;
+		buff += 2;
+		count -= 2;
+	}
+	if (count > 0) {
+		/* Padded with a zero byte on the end */
+		val = 0;
+		memcpy(&val, buff, 1);
 		sum += val;
-		buff ++;
-                count = count -2;
-        }
+	}
+	return sum;
+}
 
-        if(count > 0) {
-		sum += *(uint8_t *)buff;
-        }
+static uint64_t sum_scalar(const uint8_t *buff, size_t count) {
+	return sum_generic(buff, count, 0);
+}
 
-	return sum;
+#ifdef CHECKSUM_X86
+__attribute__((target("sse2")))
+static uint64_t sum_sse2(const uint8_t *buff, size_t count) {
+	__m128i zero = _mm_setzero_si128();
+	__m128i acc0 = zero, acc1 = zero;
+	__m128i v0, v1;
+	uint64_t lanes[2];
+
+	/* Widen each 32 bit word to 64 bits before adding it */
+	while (count >= 32) {
+		v0 = _mm_loadu_si128((const __m128i *)buff);
+		v1 = _mm_loadu_si128((const __m128i *)(buff + 16));
+		acc0 = _mm_add_epi64(acc0, _mm_unpacklo_epi32(v0, zero));
+		acc1 = _mm_add_epi64(acc1, _mm_unpackhi_epi32(v0, zero));
+		acc0 = _mm_add_epi64(acc0, _mm_unpacklo_epi32(v1, zero));
+		acc1 = _mm_add_epi64(acc1, _mm_unpackhi_epi32(v1, zero));
+		buff += 32;
+		count -= 32;
+	}
+	_mm_storeu_si128((__m128i *)lanes, _mm_add_epi64(acc0, acc1));
+	return sum_generic(buff, count, lanes[0] + lanes[1]);
+}
+
+__attribute__((target("avx2")))
+static uint64_t sum_avx2(const uint8_t *buff, size_t count) {
+	__m256i zero = _mm256_setzero_si256();
+	__m256i acc0 = zero, acc1 = zero;
+	__m256i v0, v1;
+	uint64_t lanes[4];
+
+	while (count >= 64) {
+		v0 = _mm256_loadu_si256((const __m256i *)buff);
+		v1 = _mm256_loadu_si256((const __m256i *)(buff + 32));
+		acc0 = _mm256_add_epi64(acc0, _mm256_unpacklo_epi32(v0, zero));
+		acc1 = _mm256_add_epi64(acc1, _mm256_unpackhi_epi32(v0, zero));
+		acc0 = _mm256_add_epi64(acc0, _mm256_unpacklo_epi32(v1, zero));
+		acc1 = _mm256_add_epi64(acc1, _mm256_unpackhi_epi32(v1, zero));
+		buff += 64;
+		count -= 64;
+	}
+	_mm256_storeu_si256((__m256i *)lanes, _mm256_add_epi64(acc0, acc1));
+	return sum_generic(buff, count,
+			lanes[0] + lanes[1] + lanes[2] + lanes[3]);
+}
+#endif
+
+static uint64_t sum_resolve(const uint8_t *buff, size_t count);
+
+/* Picked the first time a long buffer is summed. Every thread picks the same
+ * kernel, so it doesn't matter if more than one does it. */
+static uint64_t (*sum_kernel)(const uint8_t *, size_t) = sum_resolve;
+
+static uint64_t sum_resolve(const uint8_t *buff, size_t count) {
+	uint64_t (*best)(const uint8_t *, size_t) = sum_scalar;
+
+#ifdef CHECKSUM_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		best = sum_avx2;
+	else if (__builtin_cpu_supports("sse2"))
+		best = sum_sse2;
+#endif
+	sum_kernel = best;
+	return best(buff, count);
+}
+
+uint32_t add_checksum(void *buffer, uint16_t length) {
+	if (length < CHECKSUM_SHORT)
+		return fold_checksum(sum_generic((const uint8_t *)buffer,
+					length, 0));
+	return fold_checksum(sum_kernel((const uint8_t *)buffer, length));
 }
 
 uint16_t finish_checksum(uint32_t sum) {
@@ -99,4 +222,30 @@ uint32_t ipv6_pseudo_checksum(libtrace_ip6_t *ip) {
 
 }
 
+/* RFC 1624 eqn. 3, HC' = ~(~HC + ~m + m'). The values may be in either byte
+ * order, so long as they are all the same. */
+DLLEXPORT uint16_t trace_checksum_update16(uint16_t csum, uint16_t old_val,
+		uint16_t new_val) {
+	uint32_t sum = (uint16_t)~csum + (uint16_t)~old_val + new_val;
+
+	return (uint16_t)~fold_checksum(sum);
+}
+
+DLLEXPORT uint16_t trace_checksum_update32(uint16_t csum, uint32_t old_val,
+		uint32_t new_val) {
+	uint32_t sum = (uint16_t)~csum;
 
+	sum += (uint16_t)~(old_val >> 16) + (uint16_t)~old_val;
+	sum += (new_val >> 16) + (new_val & 0xffff);
+	return (uint16_t)~fold_checksum(sum);
+}
+
+DLLEXPORT uint16_t trace_checksum_update(uint16_t csum, const void *old_data,
+		const void *new_data, size_t len) {
+	uint64_t sum = (uint16_t)~csum;
+
+	sum += (uint16_t)~fold_checksum(sum_generic(
+				(const uint8_t *)old_data, len, 0));
+	sum += fold_checksum(sum_generic((const uint8_t *)new_data, len, 0));
+	return (uint16_t)~fold_checksum(sum);
+}
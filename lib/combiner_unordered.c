@@ -51,7 +51,7 @@ static void publish(libtrace_t *trace, int t_id, libtrace_combine_t *c, libtrace
 	libtrace_deque_push_back(queue, res); // Automatically locking for us :)
 
 	if (libtrace_deque_get_size(queue) >= trace->config.reporter_thold) {
-		trace_post_reporter(trace);
+		notify_reporter(trace);
 	}
 }
 
@@ -0,0 +1,143 @@
+/*
+ *
+ * Copyright (c) 2007-2016 The University of Waikato, Hamilton, New Zealand.
+ * All rights reserved.
+ *
+ * This file is part of libtrace.
+ *
+ * This code has been developed by the University of Waikato WAND
+ * research group. For further information please see http://www.wand.net.nz/
+ *
+ * libtrace is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libtrace is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ */
+#include "config.h"
+#include "adaptive_wait.h"
+
+#include <limits.h>
+#include <time.h>
+#ifdef HAVE_LINUX_FUTEX_H
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+/* Without futexes parked threads poll at this interval instead */
+#define WAIT_SLEEP_NS 50000
+
+void libtrace_waiter_init(libtrace_waiter_t *w) {
+	w->seq = 0;
+	w->parked = 0;
+}
+
+static uint64_t wait_clock(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Sleeps while the sequence number is still seq, for at most timeout
+ * nanoseconds (0 for no limit). Returning early is harmless. */
+static void wait_park(libtrace_waiter_t *w, uint32_t seq, uint64_t timeout) {
+	struct timespec ts;
+
+#ifdef HAVE_LINUX_FUTEX_H
+	ts.tv_sec = timeout / 1000000000;
+	ts.tv_nsec = timeout % 1000000000;
+	syscall(SYS_futex, &w->seq, FUTEX_WAIT_PRIVATE, seq,
+			timeout ? &ts : NULL, NULL, 0);
+#else
+	(void) w;
+	(void) seq;
+	if (!timeout || timeout > WAIT_SLEEP_NS)
+		timeout = WAIT_SLEEP_NS;
+	ts.tv_sec = 0;
+	ts.tv_nsec = timeout;
+	nanosleep(&ts, NULL);
+#endif
+}
+
+/**
+ * Busy waits for ready() to become true, without ever sleeping.
+ *
+ * @param spin The number of checks to make straight away, the same number
+ * are then made with a few pause instructions in between.
+ * @return true if ready() became true, false if we gave up
+ */
+int libtrace_wait_spin(uint32_t spin, libtrace_wait_ready_t ready,
+		void *data) {
+	uint32_t i;
+	int j;
+
+	for (i = 0; i < spin; i++) {
+		if (ready(data))
+			return 1;
+	}
+	for (i = 0; i < spin; i++) {
+		for (j = 0; j < LIBTRACE_WAIT_PAUSES; j++)
+			libtrace_cpu_relax();
+		if (ready(data))
+			return 1;
+	}
+	return ready(data);
+}
+
+/**
+ * Waits until ready() is true, spinning and then parking the thread.
+ *
+ * Whoever makes ready() true must call libtrace_waiter_wake() afterwards.
+ *
+ * @param spin The spin budget, see libtrace_wait_spin()
+ * @param deadline A CLOCK_MONOTONIC time in nanoseconds to wake up at
+ * regardless, 0 for none. ready() is expected to account for it.
+ */
+void libtrace_wait(libtrace_waiter_t *w, uint32_t spin,
+		libtrace_wait_ready_t ready, void *data, uint64_t deadline) {
+	uint64_t now, timeout = 0;
+	uint32_t seq;
+
+	if (libtrace_wait_spin(spin, ready, data))
+		return;
+
+	for (;;) {
+		/* Read the sequence number before announcing ourselves, so
+		 * that a wake from this point on stops us from sleeping */
+		seq = __atomic_load_n(&w->seq, __ATOMIC_ACQUIRE);
+		__atomic_add_fetch(&w->parked, 1, __ATOMIC_SEQ_CST);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		if (ready(data)) {
+			__atomic_sub_fetch(&w->parked, 1, __ATOMIC_SEQ_CST);
+			return;
+		}
+		if (deadline) {
+			now = wait_clock();
+			timeout = deadline > now ? deadline - now : 1;
+		}
+		wait_park(w, seq, timeout);
+		__atomic_sub_fetch(&w->parked, 1, __ATOMIC_SEQ_CST);
+		if (ready(data))
+			return;
+	}
+}
+
+/* The slow path of libtrace_waiter_wake() */
+void libtrace_waiter_wake_parked(libtrace_waiter_t *w) {
+	__atomic_add_fetch(&w->seq, 1, __ATOMIC_RELEASE);
+#ifdef HAVE_LINUX_FUTEX_H
+	syscall(SYS_futex, &w->seq, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL,
+			0);
+#endif
+}
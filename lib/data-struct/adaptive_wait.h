@@ -0,0 +1,107 @@
+/*
+ *
+ * Copyright (c) 2007-2016 The University of Waikato, Hamilton, New Zealand.
+ * All rights reserved.
+ *
+ * This file is part of libtrace.
+ *
+ * This code has been developed by the University of Waikato WAND
+ * research group. For further information please see http://www.wand.net.nz/
+ *
+ * libtrace is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libtrace is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ */
+#include <stdint.h>
+#include <sched.h>
+/* Need libtrace.h for DLLEXPORT defines */
+#include "../libtrace.h"
+
+#ifndef LIBTRACE_ADAPTIVE_WAIT_H
+#define LIBTRACE_ADAPTIVE_WAIT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Waiting for another thread in three steps. The waiter first spins,
+ * checking as often as it can, then keeps checking with a pause between
+ * each, and finally parks itself in the kernel (a futex on Linux) until it
+ * is woken.
+ *
+ * A producer only makes a syscall to wake a waiter that has actually
+ * parked, so a busy queue costs no more than a fence and a load per write.
+ */
+
+/* The number of checks made in each of the first two steps, if not told */
+#define LIBTRACE_WAIT_DEFAULT_SPIN 1000
+
+/* The number of pause instructions between checks in the second step */
+#define LIBTRACE_WAIT_PAUSES 16
+
+typedef struct libtrace_waiter {
+	/* Changed every time parked threads are woken, it is what they sleep
+	 * on */
+	uint32_t seq;
+	/* The number of threads parked, or about to be */
+	uint32_t parked;
+} libtrace_waiter_t;
+
+/* Returns true once the thing being waited for has happened */
+typedef int (*libtrace_wait_ready_t)(void *data);
+
+/* Tells the CPU we are spinning, letting a sibling hyperthread run */
+static inline void libtrace_cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__)
+	__asm__ __volatile__("yield" ::: "memory");
+#else
+	__asm__ __volatile__("" ::: "memory");
+#endif
+}
+
+/* Backs off while spinning on something that is expected to change very
+ * soon, such as another thread finishing a copy. Start with round at 0. */
+static inline void libtrace_wait_backoff(unsigned int *round) {
+	if (*round < LIBTRACE_WAIT_PAUSES) {
+		libtrace_cpu_relax();
+		(*round) ++;
+	} else {
+		sched_yield();
+	}
+}
+
+DLLEXPORT void libtrace_waiter_init(libtrace_waiter_t *w);
+DLLEXPORT int libtrace_wait_spin(uint32_t spin, libtrace_wait_ready_t ready,
+		void *data);
+DLLEXPORT void libtrace_wait(libtrace_waiter_t *w, uint32_t spin,
+		libtrace_wait_ready_t ready, void *data, uint64_t deadline);
+DLLEXPORT void libtrace_waiter_wake_parked(libtrace_waiter_t *w);
+
+/* Wakes anyone parked on the waiter. Call this after making whatever they
+ * are waiting for visible. */
+static inline void libtrace_waiter_wake(libtrace_waiter_t *w) {
+	/* Pairs with the fence in libtrace_wait(), either we see the waiter
+	 * parking or it sees our change */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&w->parked, __ATOMIC_RELAXED))
+		libtrace_waiter_wake_parked(w);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,345 @@
+/*
+ *
+ * Copyright (c) 2007-2016 The University of Waikato, Hamilton, New Zealand.
+ * All rights reserved.
+ *
+ * This file is part of libtrace.
+ *
+ * This code has been developed by the University of Waikato WAND
+ * research group. For further information please see http://www.wand.net.nz/
+ *
+ * libtrace is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libtrace is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ */
+#include "flow_table.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* Flows are stored in chunks of this many entries, so that the values never
+ * move once they have been handed out */
+#define FLOW_CHUNK_BITS 12
+#define FLOW_CHUNK_SIZE (1U << FLOW_CHUNK_BITS)
+
+/* Each slot in the hash table is only 8 bytes, so a probe sequence usually
+ * stays within a single cache line. Part of the hash is kept in the slot so
+ * that the full key only needs comparing when it is likely to match. */
+typedef struct flow_slot {
+	uint32_t hash;
+	uint32_t entry;		/* Entry number + 1, or 0 if the slot is free */
+} flow_slot_t;
+
+struct libtrace_flow_table {
+	flow_slot_t *slots;
+	size_t mask;		/* Number of slots - 1 */
+	size_t count;
+	size_t value_size;
+	size_t entry_size;	/* Tuple, followed by the value */
+	char **chunks;
+	size_t nchunks;
+	uint32_t next_entry;	/* Next entry that has never been used */
+	uint32_t free_entry;	/* Head of the list of removed entries + 1 */
+};
+
+static inline uint64_t rotl64(uint64_t x, int r) {
+	return (x << r) | (x >> (64 - r));
+}
+
+static uint32_t hash_tuple(const libtrace_flow_tuple_t *tuple) {
+	uint64_t words[sizeof(libtrace_flow_tuple_t) / sizeof(uint64_t)];
+	uint64_t h = 0x9e3779b97f4a7c15ULL;
+	size_t i;
+
+	memcpy(words, tuple, sizeof(words));
+	for (i = 0; i < sizeof(words) / sizeof(words[0]); i++) {
+		h ^= rotl64(words[i] * 0x87c37b91114253d5ULL, 31) *
+				0x4cf5ad432745937fULL;
+		h = rotl64(h, 27) * 5 + 0x52dce729;
+	}
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return (uint32_t)h;
+}
+
+static inline char *get_entry(libtrace_flow_table_t *table, uint32_t entry) {
+	return table->chunks[entry >> FLOW_CHUNK_BITS] +
+			(entry & (FLOW_CHUNK_SIZE - 1)) * table->entry_size;
+}
+
+static inline void *entry_value(char *entry) {
+	return entry + sizeof(libtrace_flow_tuple_t);
+}
+
+static int resize_slots(libtrace_flow_table_t *table, size_t nslots) {
+	flow_slot_t *slots = (flow_slot_t *)calloc(nslots, sizeof(flow_slot_t));
+	size_t mask = nslots - 1;
+	size_t i, pos;
+
+	if (!slots)
+		return -1;
+	if (table->slots) {
+		for (i = 0; i <= table->mask; i++) {
+			if (table->slots[i].entry == 0)
+				continue;
+			pos = table->slots[i].hash & mask;
+			while (slots[pos].entry != 0)
+				pos = (pos + 1) & mask;
+			slots[pos] = table->slots[i];
+		}
+		free(table->slots);
+	}
+	table->slots = slots;
+	table->mask = mask;
+	return 0;
+}
+
+DLLEXPORT libtrace_flow_table_t *libtrace_flow_table_create(size_t value_size,
+		size_t expected_flows) {
+	libtrace_flow_table_t *table;
+	size_t nslots = 16;
+
+	table = (libtrace_flow_table_t *)calloc(1, sizeof(libtrace_flow_table_t));
+	if (!table)
+		return NULL;
+
+	/* Keep the values 8 byte aligned */
+	table->value_size = value_size;
+	table->entry_size = (sizeof(libtrace_flow_tuple_t) + value_size + 7) &
+			~((size_t)7);
+
+	while (nslots / 2 < expected_flows)
+		nslots *= 2;
+	if (resize_slots(table, nslots) == -1) {
+		free(table);
+		return NULL;
+	}
+	return table;
+}
+
+DLLEXPORT void libtrace_flow_table_destroy(libtrace_flow_table_t *table) {
+	size_t i;
+
+	if (!table)
+		return;
+	for (i = 0; i < table->nchunks; i++)
+		free(table->chunks[i]);
+	free(table->chunks);
+	free(table->slots);
+	free(table);
+}
+
+/* Returns the slot holding the tuple, or the free slot where it should be
+ * inserted */
+static inline flow_slot_t *find_slot(libtrace_flow_table_t *table,
+		const libtrace_flow_tuple_t *tuple, uint32_t hash) {
+	size_t pos = hash & table->mask;
+	flow_slot_t *slot;
+
+	for (;;) {
+		slot = &table->slots[pos];
+		if (slot->entry == 0)
+			return slot;
+		if (slot->hash == hash && memcmp(get_entry(table,
+				slot->entry - 1), tuple,
+				sizeof(libtrace_flow_tuple_t)) == 0)
+			return slot;
+		pos = (pos + 1) & table->mask;
+	}
+}
+
+DLLEXPORT void *libtrace_flow_table_find(libtrace_flow_table_t *table,
+		const libtrace_flow_tuple_t *tuple) {
+	flow_slot_t *slot = find_slot(table, tuple, hash_tuple(tuple));
+
+	if (slot->entry == 0)
+		return NULL;
+	return entry_value(get_entry(table, slot->entry - 1));
+}
+
+static int alloc_entry(libtrace_flow_table_t *table, uint32_t *entry) {
+	char **chunks;
+
+	if (table->free_entry) {
+		*entry = table->free_entry - 1;
+		memcpy(&table->free_entry, get_entry(table, *entry),
+				sizeof(uint32_t));
+		return 0;
+	}
+
+	if ((table->next_entry >> FLOW_CHUNK_BITS) == table->nchunks) {
+		/* Entry numbers are stored + 1 in a 32 bit slot */
+		if (table->next_entry == UINT32_MAX)
+			return -1;
+		chunks = (char **)realloc(table->chunks,
+				(table->nchunks + 1) * sizeof(char *));
+		if (!chunks)
+			return -1;
+		table->chunks = chunks;
+		table->chunks[table->nchunks] = (char *)malloc(
+				FLOW_CHUNK_SIZE * table->entry_size);
+		if (!table->chunks[table->nchunks])
+			return -1;
+		table->nchunks ++;
+	}
+	*entry = table->next_entry++;
+	return 0;
+}
+
+DLLEXPORT void *libtrace_flow_table_insert(libtrace_flow_table_t *table,
+		const libtrace_flow_tuple_t *tuple, int *created) {
+	uint32_t hash = hash_tuple(tuple);
+	flow_slot_t *slot = find_slot(table, tuple, hash);
+	uint32_t entry;
+	char *e;
+
+	if (slot->entry != 0) {
+		if (created)
+			*created = 0;
+		return entry_value(get_entry(table, slot->entry - 1));
+	}
+
+	/* Keep the table no more than half full, so that probe sequences
+	 * stay short */
+	if ((table->count + 1) * 2 > table->mask + 1) {
+		if (resize_slots(table, (table->mask + 1) * 2) == -1)
+			return NULL;
+		slot = find_slot(table, tuple, hash);
+	}
+
+	if (alloc_entry(table, &entry) == -1)
+		return NULL;
+
+	e = get_entry(table, entry);
+	memcpy(e, tuple, sizeof(libtrace_flow_tuple_t));
+	memset(entry_value(e), 0, table->value_size);
+	slot->hash = hash;
+	slot->entry = entry + 1;
+	table->count ++;
+
+	if (created)
+		*created = 1;
+	return entry_value(e);
+}
+
+DLLEXPORT int libtrace_flow_table_remove(libtrace_flow_table_t *table,
+		const libtrace_flow_tuple_t *tuple) {
+	flow_slot_t *slot = find_slot(table, tuple, hash_tuple(tuple));
+	size_t hole, pos, home;
+	uint32_t entry;
+
+	if (slot->entry == 0)
+		return 0;
+
+	entry = slot->entry - 1;
+	memcpy(get_entry(table, entry), &table->free_entry, sizeof(uint32_t));
+	table->free_entry = entry + 1;
+	table->count --;
+
+	/* Shift back any later slots in the same run that would no longer
+	 * be found past the hole, rather than leaving a tombstone */
+	hole = slot - table->slots;
+	pos = hole;
+	for (;;) {
+		pos = (pos + 1) & table->mask;
+		if (table->slots[pos].entry == 0)
+			break;
+		home = table->slots[pos].hash & table->mask;
+		if (((pos - home) & table->mask) >= ((pos - hole) & table->mask)) {
+			table->slots[hole] = table->slots[pos];
+			hole = pos;
+		}
+	}
+	table->slots[hole].entry = 0;
+	return 1;
+}
+
+DLLEXPORT size_t libtrace_flow_table_get_size(libtrace_flow_table_t *table) {
+	return table->count;
+}
+
+DLLEXPORT void libtrace_flow_table_clear(libtrace_flow_table_t *table) {
+	memset(table->slots, 0, (table->mask + 1) * sizeof(flow_slot_t));
+	table->count = 0;
+	table->next_entry = 0;
+	table->free_entry = 0;
+}
+
+DLLEXPORT int libtrace_flow_table_next(libtrace_flow_table_t *table,
+		size_t *iter, const libtrace_flow_tuple_t **tuple, void **value) {
+	char *e;
+
+	while (*iter <= table->mask) {
+		flow_slot_t *slot = &table->slots[(*iter)++];
+		if (slot->entry == 0)
+			continue;
+		e = get_entry(table, slot->entry - 1);
+		if (tuple)
+			*tuple = (const libtrace_flow_tuple_t *)e;
+		if (value)
+			*value = entry_value(e);
+		return 1;
+	}
+	return 0;
+}
+
+DLLEXPORT void libtrace_flow_table_merge(libtrace_flow_table_t *dst,
+		libtrace_flow_table_t *src, flow_table_merge_fn fn, void *data) {
+	const libtrace_flow_tuple_t *tuple;
+	size_t iter = 0;
+	void *value, *existing;
+	int created;
+
+	while (libtrace_flow_table_next(src, &iter, &tuple, &value)) {
+		existing = libtrace_flow_table_insert(dst, tuple, &created);
+		if (!existing)
+			continue;
+		if (created)
+			memcpy(existing, value, dst->value_size);
+		else if (fn)
+			fn(existing, value, data);
+	}
+}
+
+DLLEXPORT int libtrace_flow_tuple_from_packet(libtrace_packet_t *packet,
+		libtrace_flow_tuple_t *tuple) {
+	libtrace_flow_keys_t keys;
+	uint8_t ip_version;
+	uint32_t src_ip4, dst_ip4;
+
+	memset(tuple, 0, sizeof(libtrace_flow_tuple_t));
+	memset(&keys, 0, sizeof(keys));
+	keys.ip_version = &ip_version;
+	keys.protocol = &tuple->protocol;
+	keys.src_ip4 = &src_ip4;
+	keys.dst_ip4 = &dst_ip4;
+	keys.src_ip6 = (uint8_t (*)[16])tuple->src_ip;
+	keys.dst_ip6 = (uint8_t (*)[16])tuple->dst_ip;
+	keys.src_port = &tuple->src_port;
+	keys.dst_port = &tuple->dst_port;
+
+	if (trace_get_flow_keys(&packet, 1, &keys) == 0) {
+		memset(tuple, 0, sizeof(libtrace_flow_tuple_t));
+		return 0;
+	}
+	tuple->ip_version = ip_version;
+	if (ip_version == 4) {
+		memcpy(tuple->src_ip, &src_ip4, sizeof(src_ip4));
+		memcpy(tuple->dst_ip, &dst_ip4, sizeof(dst_ip4));
+	}
+	return 1;
+}
@@ -0,0 +1,102 @@
+/*
+ *
+ * Copyright (c) 2007-2016 The University of Waikato, Hamilton, New Zealand.
+ * All rights reserved.
+ *
+ * This file is part of libtrace.
+ *
+ * This code has been developed by the University of Waikato WAND
+ * research group. For further information please see http://www.wand.net.nz/
+ *
+ * libtrace is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libtrace is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ */
+#include <stdint.h>
+/* Need libtrace.h for DLLEXPORT defines */
+#include "../libtrace.h"
+
+#ifndef LIBTRACE_FLOW_TABLE_H
+#define LIBTRACE_FLOW_TABLE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* A flow table maps 5-tuples to fixed size values using open addressing,
+ * which keeps lookups to a couple of cache lines no matter how many flows
+ * there are. Values are allocated from pooled chunks, so a pointer to a
+ * value remains valid until that flow is removed or the table is cleared.
+ *
+ * A flow table is not thread safe. Parallel programs should give each
+ * thread its own table and merge them in the reporter.
+ */
+
+/* The key for a flow. Any unused fields (including the padding and the
+ * unused part of the addresses for IPv4) must be zero, so always memset
+ * the tuple before filling it in by hand.
+ */
+typedef struct libtrace_flow_tuple {
+	uint8_t src_ip[16];	/* IPv4 addresses use the first 4 bytes */
+	uint8_t dst_ip[16];
+	uint16_t src_port;	/* Host byte order */
+	uint16_t dst_port;
+	uint8_t protocol;
+	uint8_t ip_version;	/* 4, 6 or 0 for keys that aren't IP */
+	uint8_t pad[2];
+} libtrace_flow_tuple_t;
+
+typedef struct libtrace_flow_table libtrace_flow_table_t;
+
+/* Combines the value for a flow from one table into the value for the same
+ * flow in another, as part of libtrace_flow_table_merge() */
+typedef void (*flow_table_merge_fn)(void *dst, const void *src, void *data);
+
+DLLEXPORT libtrace_flow_table_t *libtrace_flow_table_create(size_t value_size,
+		size_t expected_flows);
+DLLEXPORT void libtrace_flow_table_destroy(libtrace_flow_table_t *table);
+
+// Returns the value for the flow, or NULL if it isn't in the table
+DLLEXPORT void *libtrace_flow_table_find(libtrace_flow_table_t *table,
+		const libtrace_flow_tuple_t *tuple);
+// Returns the value for the flow, adding a zeroed value if the flow is new.
+// created (if not NULL) is set to 1 for a new flow and 0 otherwise.
+DLLEXPORT void *libtrace_flow_table_insert(libtrace_flow_table_t *table,
+		const libtrace_flow_tuple_t *tuple, int *created);
+DLLEXPORT int libtrace_flow_table_remove(libtrace_flow_table_t *table,
+		const libtrace_flow_tuple_t *tuple);
+DLLEXPORT size_t libtrace_flow_table_get_size(libtrace_flow_table_t *table);
+// Removes every flow, but keeps the memory for reuse
+DLLEXPORT void libtrace_flow_table_clear(libtrace_flow_table_t *table);
+
+// Walks the flows in no particular order. *iter must start at 0. Returns 0
+// once every flow has been visited. The table must not be changed while
+// iterating.
+DLLEXPORT int libtrace_flow_table_next(libtrace_flow_table_t *table,
+		size_t *iter, const libtrace_flow_tuple_t **tuple, void **value);
+
+// Adds every flow in src to dst. Flows that are already in dst are combined
+// using fn, new flows have their value copied. src is left unchanged.
+DLLEXPORT void libtrace_flow_table_merge(libtrace_flow_table_t *dst,
+		libtrace_flow_table_t *src, flow_table_merge_fn fn, void *data);
+
+// Fills in the 5-tuple for a packet. Returns 0 if the packet is not IP, in
+// which case the tuple is zeroed.
+DLLEXPORT int libtrace_flow_tuple_from_packet(libtrace_packet_t *packet,
+		libtrace_flow_tuple_t *tuple);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -23,89 +23,347 @@
  *
  *
  */
+#include "config.h"
 #include "message_queue.h"
 
 #include <unistd.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <limits.h>
 #include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sched.h>
+#include <time.h>
+#ifdef HAVE_SYS_EVENTFD_H
+#include <sys/eventfd.h>
+#endif
+#if defined(HAVE_SYS_TIMERFD_H) && defined(HAVE_SYS_EPOLL_H)
+#include <sys/timerfd.h>
+#include <sys/epoll.h>
+#define MQ_TIMERFD 1
+#endif
 
-/**
- * TODO look into using eventfd instead of a pipe if we have it available XXX
- */
+/* How far behind CLOCK_MONOTONIC the coarse clock can be, it is updated
+ * once per kernel tick */
+#define MQ_COARSE_SLACK 10000000ULL
+
+/* The sequence number at the start of each slot says whose turn it is:
+ * a sender with ticket t may fill the slot once it reads t, and the receiver
+ * with ticket t may empty it once it reads t + 1. */
+#define SLOT(mq, pos) ((mq)->slots + ((pos) & (LIBTRACE_MQ_SIZE - 1)) * \
+		(mq)->slot_len)
+#define SLOT_SEQ(slot) ((uint64_t *)(slot))
+#define SLOT_DATA(slot) ((slot) + sizeof(uint64_t))
+
+/* A message that did not fit in the ring */
+struct libtrace_mq_overflow {
+	struct libtrace_mq_overflow *next;
+	char message[];
+};
+
+/* Makes the file descriptor readable, unless it already is */
+static void mq_signal(libtrace_message_queue_t *mq)
+{
+	uint64_t one = 1;
+
+	if (__atomic_exchange_n(&mq->signalled, 1, __ATOMIC_SEQ_CST))
+		return;
+#ifdef HAVE_SYS_EVENTFD_H
+	ASSERT_RET(write(mq->fd[1], &one, sizeof(one)), == sizeof(one));
+#else
+	ASSERT_RET(write(mq->fd[1], &one, 1), == 1);
+#endif
+}
+
+/* Clears the file descriptor, which must be done by a receiver once the
+ * queue is empty. A message may have arrived in the meantime, in which case
+ * it is signalled again. */
+static void mq_unsignal(libtrace_message_queue_t *mq)
+{
+	uint64_t value;
+
+	if (!__atomic_load_n(&mq->signalled, __ATOMIC_SEQ_CST))
+		return;
+	/* Only one write is made each time the flag is set. If it has not
+	 * landed yet, leave the flag alone so that we try again later rather
+	 * than leave the descriptor readable with nothing to read. */
+	if (read(mq->fd[0], &value, sizeof(value)) <= 0)
+		return;
+	__atomic_store_n(&mq->signalled, 0, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&mq->message_count, __ATOMIC_SEQ_CST) > 0)
+		mq_signal(mq);
+}
 
 /** 
  * @param mq A pointer to allocated space for a libtrace message queue
- * @param message_len The size in bytes of the message item, to ensure thread safety this
- * 		  should be less than PIPE_BUF (normally at least 512bytes)
- * 		  see: man 7 pipe notes on atomic operations
+ * @param message_len The size in bytes of the message item
  */
 void libtrace_message_queue_init(libtrace_message_queue_t *mq, size_t message_len)
 {
+	uint64_t i;
+
 	if (!message_len) {
 		fprintf(stderr, "Message length cannot be 0 in libtrace_message_queue_init()\n");
 		return;
 	}
-	ASSERT_RET(pipe(mq->pipefd), != -1);
+	mq->deadline = 0;
+	mq->spin = 0;
+	mq->waiter = NULL;
+	mq->overflow_head = NULL;
+	mq->overflow_tail = NULL;
+	mq->overflowed = 0;
+	ASSERT_RET(pthread_spin_init(&mq->overflow_lock, 0), == 0);
+	mq->timer_fd = -1;
+	mq->poll_fd = -1;
+	/* Keep the sequence numbers aligned */
+	mq->slot_len = (sizeof(uint64_t) + message_len + 7) & ~((size_t)7);
+	mq->slots = malloc(mq->slot_len * LIBTRACE_MQ_SIZE);
+	if (!mq->slots) {
+		fprintf(stderr, "Unable to allocate memory for the message queue in libtrace_message_queue_init()\n");
+		mq->message_len = 0;
+		return;
+	}
+	for (i = 0; i < LIBTRACE_MQ_SIZE; i++)
+		*SLOT_SEQ(SLOT(mq, i)) = i;
+#ifdef HAVE_SYS_EVENTFD_H
+	mq->fd[0] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	ASSERT_RET(mq->fd[0], != -1);
+	mq->fd[1] = mq->fd[0];
+#else
+	ASSERT_RET(pipe(mq->fd), != -1);
+	fcntl(mq->fd[0], F_SETFL, fcntl(mq->fd[0], F_GETFL) | O_NONBLOCK);
+#endif
 	mq->message_count = 0;
-	if (message_len > PIPE_BUF)
-		fprintf(stderr, "Warning message queue wont be atomic (thread safe) message_len(%zu) > PIPE_BUF(%d)\n",
-					message_len, PIPE_BUF);
+	mq->waiters = 0;
+	mq->fd_used = 0;
+	mq->signalled = 0;
 	mq->message_len = message_len;
-	pthread_spin_init(&mq->spin, 0);
+	mq->head = 0;
+	mq->tail = 0;
+}
+
+/* Copies a message into the ring, returning 0 if it is full */
+static int mq_ring_put(libtrace_message_queue_t *mq, const void *message)
+{
+	uint64_t pos = __atomic_load_n(&mq->tail, __ATOMIC_RELAXED);
+	uint64_t seq;
+	char *slot;
+
+	for (;;) {
+		slot = SLOT(mq, pos);
+		seq = __atomic_load_n(SLOT_SEQ(slot), __ATOMIC_ACQUIRE);
+		if (seq == pos) {
+			/* Our turn, unless another sender gets there first */
+			if (__atomic_compare_exchange_n(&mq->tail, &pos,
+					pos + 1, true, __ATOMIC_RELAXED,
+					__ATOMIC_RELAXED))
+				break;
+		} else if (seq < pos) {
+			/* Still holds a message from the last time around */
+			return 0;
+		} else {
+			pos = __atomic_load_n(&mq->tail, __ATOMIC_RELAXED);
+		}
+	}
+	memcpy(SLOT_DATA(slot), message, mq->message_len);
+	__atomic_store_n(SLOT_SEQ(slot), pos + 1, __ATOMIC_RELEASE);
+	return 1;
+}
+
+/* Copies the oldest message out of the ring, returning 0 if there is none
+ * ready */
+static int mq_ring_take(libtrace_message_queue_t *mq, void *message)
+{
+	uint64_t pos = __atomic_load_n(&mq->head, __ATOMIC_RELAXED);
+	uint64_t seq;
+	char *slot;
+
+	for (;;) {
+		slot = SLOT(mq, pos);
+		seq = __atomic_load_n(SLOT_SEQ(slot), __ATOMIC_ACQUIRE);
+		if (seq == pos + 1) {
+			if (__atomic_compare_exchange_n(&mq->head, &pos,
+					pos + 1, true, __ATOMIC_RELAXED,
+					__ATOMIC_RELAXED))
+				break;
+		} else if (seq < pos + 1) {
+			/* Empty, or a sender is still copying its message
+			 * in */
+			return 0;
+		} else {
+			pos = __atomic_load_n(&mq->head, __ATOMIC_RELAXED);
+		}
+	}
+	memcpy(message, SLOT_DATA(slot), mq->message_len);
+	__atomic_store_n(SLOT_SEQ(slot), pos + LIBTRACE_MQ_SIZE,
+			__ATOMIC_RELEASE);
+	return 1;
+}
+
+/* Adds a message to the overflow list */
+static void mq_overflow_put(libtrace_message_queue_t *mq, const void *message)
+{
+	struct libtrace_mq_overflow *entry;
+	unsigned int round = 0;
+
+	entry = malloc(sizeof(struct libtrace_mq_overflow) + mq->message_len);
+	if (!entry) {
+		/* Nothing else for it but to wait for the receiver */
+		while (!mq_ring_put(mq, message))
+			libtrace_wait_backoff(&round);
+		return;
+	}
+	memcpy(entry->message, message, mq->message_len);
+	entry->next = NULL;
+
+	ASSERT_RET(pthread_spin_lock(&mq->overflow_lock), == 0);
+	if (mq->overflow_tail)
+		mq->overflow_tail->next = entry;
+	else
+		mq->overflow_head = entry;
+	mq->overflow_tail = entry;
+	__atomic_store_n(&mq->overflowed, 1, __ATOMIC_SEQ_CST);
+	ASSERT_RET(pthread_spin_unlock(&mq->overflow_lock), == 0);
+}
+
+/* Takes the oldest message off the overflow list, returning 0 if it is
+ * empty */
+static int mq_overflow_take(libtrace_message_queue_t *mq, void *message)
+{
+	struct libtrace_mq_overflow *entry;
+
+	if (!__atomic_load_n(&mq->overflowed, __ATOMIC_SEQ_CST))
+		return 0;
+	ASSERT_RET(pthread_spin_lock(&mq->overflow_lock), == 0);
+	entry = mq->overflow_head;
+	if (entry) {
+		mq->overflow_head = entry->next;
+		if (!mq->overflow_head) {
+			mq->overflow_tail = NULL;
+			__atomic_store_n(&mq->overflowed, 0,
+					__ATOMIC_SEQ_CST);
+		}
+	}
+	ASSERT_RET(pthread_spin_unlock(&mq->overflow_lock), == 0);
+	if (!entry)
+		return 0;
+	memcpy(message, entry->message, mq->message_len);
+	free(entry);
+	return 1;
 }
 
 /**
  * Posts a message to the given message queue.
  * 
- * This will block if a reader is not keeping up and the underlying pipe
- * fills up.
+ * This never blocks, if the receiver is not keeping up and the ring fills
+ * up the message is put on the overflow list.
  * 
  * @param mq A pointer to a initilised libtrace message queue structure (NOT NULL)
  * @param message A pointer to the message data you wish to send
- * @return A number representing the number of messages already in the queue,
- *         0 implies a thread was waiting and will read your message, negative
- *         numbers implies threads are still waiting. Positive implies a backlog
- *         of messages.
+ * @return The number of messages in the queue, including this one
  */
 int libtrace_message_queue_put(libtrace_message_queue_t *mq, const void *message)
 {
 	int ret;
+
 	if (!mq->message_len) {
 		fprintf(stderr, "Message queue must be initialised with libtrace_message_queue_init()"
 			"before inserting messages in libtrace_message_queue_put()\n");
 		return 0;
 	}
-	ASSERT_RET(write(mq->pipefd[1], message, mq->message_len), == (int) mq->message_len);
-	// Update after we've written
-	pthread_spin_lock(&mq->spin);
-	ret = ++mq->message_count; // Should be CAS!
-	pthread_spin_unlock(&mq->spin);
+
+	/* Once anything has overflowed, later messages follow it rather
+	 * than overtake it through the ring */
+	if (__atomic_load_n(&mq->overflowed, __ATOMIC_SEQ_CST) ||
+			!mq_ring_put(mq, message))
+		mq_overflow_put(mq, message);
+
+	/* Only the first message into an empty queue needs to wake anyone */
+	ret = __atomic_add_fetch(&mq->message_count, 1, __ATOMIC_SEQ_CST);
+	if (ret == 1 && (__atomic_load_n(&mq->waiters, __ATOMIC_SEQ_CST) ||
+			__atomic_load_n(&mq->fd_used, __ATOMIC_SEQ_CST)))
+		mq_signal(mq);
+	if (mq->waiter)
+		libtrace_waiter_wake(mq->waiter);
 	return ret;
 }
 
+/* Copies out a message that has already been accounted for in
+ * message_count, returning the number of messages left */
+static int mq_take(libtrace_message_queue_t *mq, void *message)
+{
+	unsigned int round = 0;
+	int ret;
+
+	/* Anything in the ring was sent before the overflow list was
+	 * started. A sender may still be copying its message in. */
+	while (!mq_ring_take(mq, message) && !mq_overflow_take(mq, message))
+		libtrace_wait_backoff(&round);
+
+	ret = __atomic_load_n(&mq->message_count, __ATOMIC_SEQ_CST);
+	if (ret == 0)
+		mq_unsignal(mq);
+	return ret;
+}
+
+/* Claims a message, if there is one */
+static int mq_reserve(libtrace_message_queue_t *mq)
+{
+	int count = __atomic_load_n(&mq->message_count, __ATOMIC_SEQ_CST);
+
+	while (count > 0) {
+		if (__atomic_compare_exchange_n(&mq->message_count, &count,
+				count - 1, false, __ATOMIC_SEQ_CST,
+				__ATOMIC_SEQ_CST))
+			return 1;
+	}
+	return 0;
+}
+
+static int mq_has_message(void *data)
+{
+	libtrace_message_queue_t *mq = (libtrace_message_queue_t *) data;
+
+	return __atomic_load_n(&mq->message_count, __ATOMIC_RELAXED) > 0;
+}
+
 /**
  * Retrieves a message from the given message queue.
  * 
- * This will block if a reader is not keeping up and the underlying pipe
- * fills up.
+ * This will block until a message is available, after spinning for a while
+ * if the queue has a spin budget.
  * 
  * @param mq A pointer to a initilised libtrace message queue structure (NOT NULL)
- * @param message A pointer to the message data you wish to send
- * @return The number of messages remaining in the queue less any threads waiting,
- *         0 implies a thread was waiting and will read your message, negative
- *         numbers implies threads are still waiting. Positive implies a backlog
- *         of messages.
+ * @param message A pointer to the space to copy the message into
+ * @return The number of messages that were in the queue, including the one
+ *         just retrieved
  */
 int libtrace_message_queue_get(libtrace_message_queue_t *mq, void *message)
 {
-	int ret;
-	// Safely decrease count first - Yes this might make us negative, however thats ok once a write comes in everything will be fine
-	pthread_spin_lock(&mq->spin);
-	ret = mq->message_count--;
-	pthread_spin_unlock(&mq->spin);
-	ASSERT_RET(read(mq->pipefd[0], message, mq->message_len), == (int) mq->message_len);
-	return ret;
+	struct pollfd pfd;
+
+	if (mq->spin && !mq_has_message(mq))
+		libtrace_wait_spin(mq->spin, mq_has_message, mq);
+	while (!mq_reserve(mq)) {
+		/* Register as a waiter before checking again, so that a
+		 * sender either sees us or we see its message */
+		__atomic_add_fetch(&mq->waiters, 1, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&mq->message_count, __ATOMIC_SEQ_CST) <= 0) {
+			pfd.fd = mq->fd[0];
+			pfd.events = POLLIN;
+			pfd.revents = 0;
+			poll(&pfd, 1, -1);
+		}
+		__atomic_sub_fetch(&mq->waiters, 1, __ATOMIC_SEQ_CST);
+		/* A signal left over from an earlier message would stop us
+		 * from ever blocking */
+		if (__atomic_load_n(&mq->message_count, __ATOMIC_SEQ_CST) <= 0)
+			mq_unsignal(mq);
+	}
+	return mq_take(mq, message) + 1;
 }
 
 /**
@@ -115,54 +373,199 @@ int libtrace_message_queue_get(libtrace_message_queue_t *mq, void *message)
  * no message is available.
  * 
  * @param mq A pointer to a initilised libtrace message queue structure (NOT NULL)
- * @param message A pointer to the message data you wish to send
- * @return The number of messages remaining in the queue less any threads waiting,
- *         0 implies a thread was waiting and will read your message, negative
- *         numbers implies threads are still waiting. Positive implies a backlog
- *         of messages.
+ * @param message A pointer to the space to copy the message into
+ * @return The number of messages remaining in the queue, or
+ *         LIBTRACE_MQ_FAILED if there were none
  */
 int libtrace_message_queue_try_get(libtrace_message_queue_t *mq, void *message)
 {
-	int ret;
-	// Safely decrease count first - Yes this might make us negative, however thats ok once a write comes in everything will be fine
-	// ->Fast path avoid the lock
-	if (mq->message_count <= 0)
+	// Fast path, no atomic read-modify-write unless there is a message
+	if (__atomic_load_n(&mq->message_count, __ATOMIC_RELAXED) <= 0) {
+		if (__atomic_load_n(&mq->signalled, __ATOMIC_RELAXED))
+			mq_unsignal(mq);
 		return LIBTRACE_MQ_FAILED;
-	// Else grab lock and confirm this is so
-	pthread_spin_lock(&mq->spin);
-	if (mq->message_count > 0) {
-		ret = --mq->message_count;
-		// :( read(...) needs to be done within the *spin* lock otherwise blocking might steal our read
-		ASSERT_RET(read(mq->pipefd[0], message, mq->message_len), == (int) mq->message_len);
-	} else {
-		ret = LIBTRACE_MQ_FAILED;
-	}
-	pthread_spin_unlock(&mq->spin);
-	return ret;
+	}
+	if (!mq_reserve(mq))
+		return LIBTRACE_MQ_FAILED;
+	return mq_take(mq, message);
 }
 
-/**
- * May be negative if threads blocking and waiting for a message.
- */
 int libtrace_message_queue_count(const libtrace_message_queue_t *mq)
 {
-	// This is only ok because we know int is atomic
-	return mq->message_count;
+	return __atomic_load_n(&mq->message_count, __ATOMIC_RELAXED);
 }
 
 void libtrace_message_queue_destroy(libtrace_message_queue_t *mq)
 {
+	if (!mq->slots)
+		return;
 	mq->message_count = 0;
 	mq->message_len = 0;
-	close(mq->pipefd[0]);
-	close(mq->pipefd[1]);
-	pthread_spin_destroy(&mq->spin);
+	close(mq->fd[0]);
+	if (mq->fd[1] != mq->fd[0])
+		close(mq->fd[1]);
+	if (mq->poll_fd != -1) {
+		close(mq->poll_fd);
+		close(mq->timer_fd);
+		mq->poll_fd = -1;
+		mq->timer_fd = -1;
+	}
+	while (mq->overflow_head) {
+		struct libtrace_mq_overflow *next = mq->overflow_head->next;
+
+		free(mq->overflow_head);
+		mq->overflow_head = next;
+	}
+	mq->overflow_tail = NULL;
+	mq->overflowed = 0;
+	ASSERT_RET(pthread_spin_destroy(&mq->overflow_lock), == 0);
+	free(mq->slots);
+	mq->slots = NULL;
 }
 
 /**
  * @return a file descriptor for the queue, can be used with select() poll() etc.
+ * It is readable whenever there are messages in the queue, but reading
+ * from it does not retrieve them.
  */
 int libtrace_message_queue_get_fd(libtrace_message_queue_t *mq)
 {
-	return mq->pipefd[0];
+	if (!mq->fd_used) {
+		__atomic_store_n(&mq->fd_used, 1, __ATOMIC_SEQ_CST);
+		/* Anything already queued was sent without a signal */
+		if (__atomic_load_n(&mq->message_count, __ATOMIC_SEQ_CST) > 0)
+			mq_signal(mq);
+	}
+	if (mq->poll_fd != -1)
+		return mq->poll_fd;
+	return mq->fd[0];
+}
+
+/**
+ * Gives the queue a timerfd, so that the file descriptor returned by
+ * libtrace_message_queue_get_fd() also becomes readable once the deadline
+ * passes. Without this (or where timerfd is not available), the deadline is
+ * only seen by libtrace_message_queue_ready().
+ *
+ * This must be called before libtrace_message_queue_get_fd().
+ */
+void libtrace_message_queue_enable_deadline(libtrace_message_queue_t *mq)
+{
+#ifdef MQ_TIMERFD
+	struct epoll_event ev;
+
+	if (!mq->slots || mq->poll_fd != -1)
+		return;
+	mq->timer_fd = timerfd_create(CLOCK_MONOTONIC,
+			TFD_NONBLOCK | TFD_CLOEXEC);
+	if (mq->timer_fd == -1)
+		return;
+	mq->poll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (mq->poll_fd == -1) {
+		close(mq->timer_fd);
+		mq->timer_fd = -1;
+		return;
+	}
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	if (epoll_ctl(mq->poll_fd, EPOLL_CTL_ADD, mq->fd[0], &ev) == -1 ||
+			epoll_ctl(mq->poll_fd, EPOLL_CTL_ADD, mq->timer_fd,
+				&ev) == -1) {
+		close(mq->poll_fd);
+		close(mq->timer_fd);
+		mq->poll_fd = -1;
+		mq->timer_fd = -1;
+	}
+#else
+	(void) mq;
+#endif
+}
+
+/**
+ * Sets the deadline after which the queue is ready even if it is empty.
+ * Only the receiving thread may call this.
+ *
+ * @param deadline A CLOCK_MONOTONIC time in nanoseconds, or 0 for none
+ */
+void libtrace_message_queue_set_deadline(libtrace_message_queue_t *mq,
+		uint64_t deadline)
+{
+#ifdef MQ_TIMERFD
+	struct itimerspec its;
+#endif
+
+	/* Rearming the timer is a syscall, so only do it when needed */
+	if (deadline == mq->deadline)
+		return;
+	mq->deadline = deadline;
+#ifdef MQ_TIMERFD
+	if (mq->timer_fd != -1) {
+		/* This also clears the timerfd if it had fired, and a
+		 * zero value disarms it */
+		memset(&its, 0, sizeof(its));
+		its.it_value.tv_sec = deadline / 1000000000;
+		its.it_value.tv_nsec = deadline % 1000000000;
+		timerfd_settime(mq->timer_fd, TFD_TIMER_ABSTIME, &its, NULL);
+	}
+#endif
+}
+
+/**
+ * @return true if there is a message waiting or the deadline has passed.
+ * This is cheap enough to be called every time a format polls for packets.
+ */
+int libtrace_message_queue_ready(const libtrace_message_queue_t *mq)
+{
+	if (__atomic_load_n(&mq->message_count, __ATOMIC_RELAXED) > 0)
+		return 1;
+	if (!mq->deadline)
+		return 0;
+#ifdef CLOCK_MONOTONIC_COARSE
+	{
+		struct timespec ts;
+
+		/* The coarse clock avoids reading the TSC, which is
+		 * enough to rule out most calls */
+		clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+		if ((uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec +
+				MQ_COARSE_SLACK < mq->deadline)
+			return 0;
+	}
+#endif
+	return libtrace_message_queue_clock() >= mq->deadline;
+}
+
+/**
+ * @return the current CLOCK_MONOTONIC time in nanoseconds, the clock used
+ * for deadlines
+ */
+uint64_t libtrace_message_queue_clock(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * Sets how long libtrace_message_queue_get() spins waiting for a message
+ * before it blocks, see libtrace_wait_spin(). Defaults to 0.
+ */
+void libtrace_message_queue_set_spin(libtrace_message_queue_t *mq,
+		uint32_t spin)
+{
+	mq->spin = spin;
+}
+
+/**
+ * Makes every put also call libtrace_waiter_wake() on the given waiter, so
+ * that a receiver parked waiting on something else as well as this queue
+ * will notice the message.
+ *
+ * @param waiter The waiter, or NULL to stop
+ */
+void libtrace_message_queue_set_waiter(libtrace_message_queue_t *mq,
+		libtrace_waiter_t *waiter)
+{
+	mq->waiter = waiter;
 }
@@ -27,16 +27,73 @@
 #include <limits.h>
 #include "libtrace.h"
 #include "pthread_spinlock.h"
+#include "adaptive_wait.h"
 
 #ifndef LIBTRACE_MESSAGE_QUEUE
 #define LIBTRACE_MESSAGE_QUEUE
 
 #define LIBTRACE_MQ_FAILED INT_MIN
+
+/* The number of messages the ring of a queue holds, any more are kept on
+ * its overflow list */
+#define LIBTRACE_MQ_SIZE 1024
+
+/* A multiple producer queue of fixed length messages.
+ *
+ * Messages are copied in and out of a ring of slots without taking any
+ * locks. Sending never blocks: while the ring is full, messages are kept on
+ * a locked overflow list instead, and later messages join them there until
+ * the receiver has drained it, so each sender's messages stay in order.
+ * The file descriptor is only written to when a receiver might be
+ * waiting for it, i.e. when a thread is blocked in
+ * libtrace_message_queue_get() or once libtrace_message_queue_get_fd() has
+ * been called. From then on it is readable whenever the queue is not empty,
+ * so it can be used with select(), poll() or epoll.
+ *
+ * A queue can also be given a deadline, after which it is treated as ready
+ * even when it is empty. This is how a thread blocked in a format's read
+ * is woken up to run its timers.
+ *
+ * libtrace_message_queue_get() spins for a while before it blocks, see
+ * libtrace_message_queue_set_spin().
+ */
 typedef struct libtrace_message_queue_t {
-	int pipefd[2];
-	volatile int message_count;
+	/* Each slot is a sequence number followed by the message */
+	char *slots;
+	size_t slot_len;
 	size_t message_len;
-	pthread_spinlock_t spin;
+	volatile int message_count;
+	/* The number of threads blocked waiting for a message */
+	int waiters;
+	/* Set once the file descriptor has been given out */
+	int fd_used;
+	/* Set while the file descriptor has been signalled */
+	int signalled;
+	/* An eventfd, if available, otherwise a pipe */
+	int fd[2];
+	/* The CLOCK_MONOTONIC time in nanoseconds after which the queue is
+	 * ready regardless of its contents, 0 if there is none. This is only
+	 * used by the receiver. */
+	uint64_t deadline;
+	/* A timerfd that becomes readable at the deadline and an epoll set
+	 * holding both it and fd[0], or -1 if deadlines are not enabled */
+	int timer_fd;
+	int poll_fd;
+	/* The spin budget of libtrace_message_queue_get() */
+	uint32_t spin;
+	/* Also woken by every put, for a receiver waiting on something else
+	 * as well as this queue, or NULL */
+	libtrace_waiter_t *waiter;
+	/* Messages sent while the ring was full, oldest first */
+	pthread_spinlock_t overflow_lock;
+	struct libtrace_mq_overflow *overflow_head;
+	struct libtrace_mq_overflow *overflow_tail;
+	/* Set while the overflow list is not empty */
+	int overflowed;
+	/* Kept on their own cache lines, as senders and the receiver both
+	 * hammer on these */
+	uint64_t tail ALIGNED(CACHE_LINE_SIZE);
+	uint64_t head ALIGNED(CACHE_LINE_SIZE);
 } libtrace_message_queue_t;
 
 DLLEXPORT void libtrace_message_queue_init(libtrace_message_queue_t *mq,
@@ -50,5 +107,15 @@ DLLEXPORT int libtrace_message_queue_try_get(libtrace_message_queue_t *mq,
         void *message);
 DLLEXPORT void libtrace_message_queue_destroy(libtrace_message_queue_t *mq);
 DLLEXPORT int libtrace_message_queue_get_fd(libtrace_message_queue_t *mq);
+DLLEXPORT void libtrace_message_queue_enable_deadline(
+        libtrace_message_queue_t *mq);
+DLLEXPORT void libtrace_message_queue_set_deadline(libtrace_message_queue_t *mq,
+        uint64_t deadline);
+DLLEXPORT int libtrace_message_queue_ready(const libtrace_message_queue_t *mq);
+DLLEXPORT uint64_t libtrace_message_queue_clock(void);
+DLLEXPORT void libtrace_message_queue_set_spin(libtrace_message_queue_t *mq,
+        uint32_t spin);
+DLLEXPORT void libtrace_message_queue_set_waiter(libtrace_message_queue_t *mq,
+        libtrace_waiter_t *waiter);
 
 #endif
@@ -43,6 +43,13 @@
 
 #define USE_CHECK_EARLY 1
 
+/* The reader and writer each move one of start and end and only read the
+ * other, so a release store publishing the elements written (or freeing
+ * those read) and an acquire load are all that is needed between them */
+#define LOAD_INDEX(index) __atomic_load_n(&rb->index, __ATOMIC_ACQUIRE)
+#define STORE_INDEX(index, value) \
+	__atomic_store_n(&rb->index, (value), __ATOMIC_RELEASE)
+
 #define USE_LOCK_TYPE LOCK_TYPE_MUTEX
 #if USE_LOCK_TYPE == LOCK_TYPE_SPIN
 #	define LOCK(dir) ASSERT_RET(pthread_spin_lock(&rb->s ## dir ## lock), == 0)
@@ -69,7 +76,9 @@
  * @param rb A pointer to a ringbuffer structure.
  * @param size The maximum size of the ring buffer. (NOTE: one extra slot is allocated so use -1 if attempting memory alignment)
  * @param mode The mode allows selection to use semaphores to signal when data
- * 				becomes available. LIBTRACE_RINGBUFFER_BLOCKING or LIBTRACE_RINGBUFFER_POLLING.
+ * 				becomes available. LIBTRACE_RINGBUFFER_BLOCKING, LIBTRACE_RINGBUFFER_POLLING
+ * 				or LIBTRACE_RINGBUFFER_ADAPTIVE, which spins for a while before
+ * 				sleeping and only wakes the other side if it is asleep.
  * 				NOTE: this mainly applies to the blocking functions
  * @return If successful returns 0 otherwise -1 upon failure.
  */
@@ -91,6 +100,9 @@ DLLEXPORT int libtrace_ringbuffer_init(libtrace_ringbuffer_t * rb, size_t size,
 		ASSERT_RET(pthread_mutex_init(&rb->empty_lock, NULL), == 0);
 		ASSERT_RET(pthread_mutex_init(&rb->full_lock, NULL), == 0);
 	}
+	libtrace_waiter_init(&rb->empty_waiter);
+	libtrace_waiter_init(&rb->full_waiter);
+	rb->spin = LIBTRACE_WAIT_DEFAULT_SPIN;
 	/* The mutual exclusion part */
 #if USE_LOCK_TYPE == LOCK_TYPE_SPIN
 #warning "using spinners"
@@ -134,7 +146,7 @@ DLLEXPORT void libtrace_ringbuffer_destroy(libtrace_ringbuffer_t * rb) {
  * write/read try instead.
  */
 DLLEXPORT int libtrace_ringbuffer_is_empty(const libtrace_ringbuffer_t * rb) {
-	return rb->start == rb->end;
+	return LOAD_INDEX(start) == LOAD_INDEX(end);
 }
 
 /**
@@ -143,25 +155,55 @@ DLLEXPORT int libtrace_ringbuffer_is_empty(const libtrace_ringbuffer_t * rb) {
  * write/read try instead.
  */
 DLLEXPORT int libtrace_ringbuffer_is_full(const libtrace_ringbuffer_t * rb) {
-	return rb->start == ((rb->end + 1) % rb->size);
+	return LOAD_INDEX(start) == ((LOAD_INDEX(end) + 1) % rb->size);
 }
 
 static inline size_t libtrace_ringbuffer_nb_full(const libtrace_ringbuffer_t *rb) {
-	if (rb->end < rb->start)
-		return rb->end + rb->size - rb->start;
+	size_t start = LOAD_INDEX(start);
+	size_t end = LOAD_INDEX(end);
+
+	if (end < start)
+		return end + rb->size - start;
 	else
-		return rb->end - rb->start;
+		return end - start;
 	// return (rb->end + rb->size - rb->start) % rb->size;
 }
 
+/**
+ * Returns the number of elements in the ringbuffer, which may already be out
+ * of date when using multiple threads.
+ */
+DLLEXPORT size_t libtrace_ringbuffer_count(const libtrace_ringbuffer_t * rb) {
+	return libtrace_ringbuffer_nb_full(rb);
+}
+
+/**
+ * Sets how long a LIBTRACE_RINGBUFFER_ADAPTIVE buffer spins before sleeping,
+ * see libtrace_wait_spin().
+ */
+DLLEXPORT void libtrace_ringbuffer_set_spin(libtrace_ringbuffer_t * rb, uint32_t spin) {
+	rb->spin = spin;
+}
+
 static inline size_t libtrace_ringbuffer_nb_empty(const libtrace_ringbuffer_t *rb) {
-	if (rb->start <= rb->end)
-		return rb->start + rb->size - rb->end - 1;
+	size_t start = LOAD_INDEX(start);
+	size_t end = LOAD_INDEX(end);
+
+	if (start <= end)
+		return start + rb->size - end - 1;
 	else
-		return rb->start - rb->end - 1;
+		return start - end - 1;
 	// return (rb->start + rb->size - rb->end - 1) % rb->size;
 }
 
+static int has_empty(void *data) {
+	return !libtrace_ringbuffer_is_full((libtrace_ringbuffer_t *) data);
+}
+
+static int has_full(void *data) {
+	return !libtrace_ringbuffer_is_empty((libtrace_ringbuffer_t *) data);
+}
+
 /**
  * Waits for a empty slot, that we can write to.
  * @param rb The ringbuffer
@@ -173,6 +215,9 @@ static inline void wait_for_empty(libtrace_ringbuffer_t *rb) {
 		while (libtrace_ringbuffer_is_full(rb))
 			pthread_cond_wait(&rb->empty_cond, &rb->empty_lock);
 		pthread_mutex_unlock(&rb->empty_lock);
+	} else if (rb->mode == LIBTRACE_RINGBUFFER_ADAPTIVE) {
+		if (libtrace_ringbuffer_is_full(rb))
+			libtrace_wait(&rb->empty_waiter, rb->spin, has_empty, rb, 0);
 	} else {
 		while (libtrace_ringbuffer_is_full(rb))
 			/* Yield our time, why?, we tried and failed to write an item
@@ -194,6 +239,9 @@ static inline void wait_for_full(libtrace_ringbuffer_t *rb) {
 		while (libtrace_ringbuffer_is_empty(rb))
 			pthread_cond_wait(&rb->full_cond, &rb->full_lock);
 		pthread_mutex_unlock(&rb->full_lock);
+	} else if (rb->mode == LIBTRACE_RINGBUFFER_ADAPTIVE) {
+		if (libtrace_ringbuffer_is_empty(rb))
+			libtrace_wait(&rb->full_waiter, rb->spin, has_full, rb, 0);
 	} else {
 		while (libtrace_ringbuffer_is_empty(rb))
 			/* Yield our time, why?, we tried and failed to write an item
@@ -214,6 +262,8 @@ static inline void notify_full(libtrace_ringbuffer_t *rb) {
 		pthread_mutex_lock(&rb->full_lock);
 		pthread_cond_broadcast(&rb->full_cond);
 		pthread_mutex_unlock(&rb->full_lock);
+	} else if (rb->mode == LIBTRACE_RINGBUFFER_ADAPTIVE) {
+		libtrace_waiter_wake(&rb->full_waiter);
 	}
 }
 
@@ -227,6 +277,8 @@ static inline void notify_empty(libtrace_ringbuffer_t *rb) {
 		pthread_mutex_lock(&rb->empty_lock);
 		pthread_cond_broadcast(&rb->empty_cond);
 		pthread_mutex_unlock(&rb->empty_lock);
+	} else if (rb->mode == LIBTRACE_RINGBUFFER_ADAPTIVE) {
+		libtrace_waiter_wake(&rb->empty_waiter);
 	}
 }
 
@@ -244,7 +296,7 @@ DLLEXPORT void libtrace_ringbuffer_write(libtrace_ringbuffer_t * rb, void* value
 	/* Need an empty to start with */
 	wait_for_empty(rb);
 	rb->elements[rb->end] = value;
-	rb->end = (rb->end + 1) % rb->size;
+	STORE_INDEX(end, (rb->end + 1) % rb->size);
 	notify_full(rb);
 }
 
@@ -287,7 +339,7 @@ DLLEXPORT size_t libtrace_ringbuffer_write_bulk(libtrace_ringbuffer_t * rb, void
 			rb->elements[end] = values[i];
 			end = (end + 1) % rb->size;
 		}
-		rb->end = end;
+		STORE_INDEX(end, end);
 		notify_full(rb);
 	} while (i < min_nb_buffers);
 	return i;
@@ -323,7 +375,7 @@ DLLEXPORT void* libtrace_ringbuffer_read(libtrace_ringbuffer_t *rb) {
 	/* We need a full slot */
 	wait_for_full(rb);
 	value = rb->elements[rb->start];
-	rb->start = (rb->start + 1) % rb->size;
+	STORE_INDEX(start, (rb->start + 1) % rb->size);
 	/* Now that's an empty slot */
 	notify_empty(rb);
 	return value;
@@ -371,7 +423,7 @@ DLLEXPORT size_t libtrace_ringbuffer_read_bulk(libtrace_ringbuffer_t *rb, void *
 			values[i] = rb->elements[start];
 			start = (start + 1) % rb->size;
 		}
-		rb->start = start;
+		STORE_INDEX(start, start);
 		/* Now that's an empty slot */
 		notify_empty(rb);
 	} while (i < min_nb_buffers);
@@ -27,12 +27,14 @@
 #include <semaphore.h>
 #include "libtrace.h"
 #include "pthread_spinlock.h"
+#include "adaptive_wait.h"
 
 #ifndef LIBTRACE_RINGBUFFER_H
 #define LIBTRACE_RINGBUFFER_H
 
 #define LIBTRACE_RINGBUFFER_BLOCKING 0
 #define LIBTRACE_RINGBUFFER_POLLING 1
+#define LIBTRACE_RINGBUFFER_ADAPTIVE 2
 
 // All of start, elements and end must be accessed in the listed order
 // if LIBTRACE_RINGBUFFER_POLLING is to work.
@@ -53,6 +55,10 @@ typedef struct libtrace_ringbuffer {
 	pthread_mutex_t full_lock;
 	pthread_cond_t empty_cond; // Signal when empties are ready
 	pthread_cond_t full_cond; // Signal when fulls are ready
+	// Used instead of the above with LIBTRACE_RINGBUFFER_ADAPTIVE
+	libtrace_waiter_t empty_waiter;
+	libtrace_waiter_t full_waiter;
+	uint32_t spin;
 	// Aim to get this on a separate cache line to start - important if spinning
 	volatile size_t end;
 } libtrace_ringbuffer_t;
@@ -62,6 +68,8 @@ DLLEXPORT void libtrace_zero_ringbuffer(libtrace_ringbuffer_t * rb);
 DLLEXPORT void libtrace_ringbuffer_destroy(libtrace_ringbuffer_t * rb);
 DLLEXPORT int libtrace_ringbuffer_is_empty(const libtrace_ringbuffer_t * rb);
 DLLEXPORT int libtrace_ringbuffer_is_full(const libtrace_ringbuffer_t * rb);
+DLLEXPORT size_t libtrace_ringbuffer_count(const libtrace_ringbuffer_t * rb);
+DLLEXPORT void libtrace_ringbuffer_set_spin(libtrace_ringbuffer_t * rb, uint32_t spin);
 
 DLLEXPORT void libtrace_ringbuffer_write(libtrace_ringbuffer_t * rb, void* value);
 DLLEXPORT int libtrace_ringbuffer_try_write(libtrace_ringbuffer_t * rb, void* value);
@@ -0,0 +1,533 @@
+/*
+ *
+ * Copyright (c) 2007-2016 The University of Waikato, Hamilton, New Zealand.
+ * All rights reserved.
+ *
+ * This file is part of libtrace.
+ *
+ * This code has been developed by the University of Waikato WAND
+ * research group. For further information please see http://www.wand.net.nz/
+ *
+ * libtrace is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libtrace is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ */
+#include "sketch.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+static inline uint64_t rotl64(uint64_t x, int r) {
+	return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t fmix64(uint64_t h) {
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return h;
+}
+
+/* 64 bit hash of an arbitrary key, mixed well enough that any of its bits
+ * can be used on their own */
+static uint64_t sketch_hash(const void *key, size_t len, uint64_t seed) {
+	const unsigned char *p = (const unsigned char *)key;
+	uint64_t h = seed ^ (len * 0x9e3779b97f4a7c15ULL);
+	uint64_t w;
+
+	while (len >= 8) {
+		memcpy(&w, p, 8);
+		h ^= rotl64(w * 0x87c37b91114253d5ULL, 31) *
+				0x4cf5ad432745937fULL;
+		h = rotl64(h, 27) * 5 + 0x52dce729;
+		p += 8;
+		len -= 8;
+	}
+	if (len > 0) {
+		w = 0;
+		memcpy(&w, p, len);
+		h ^= rotl64(w * 0x87c37b91114253d5ULL, 31) *
+				0x4cf5ad432745937fULL;
+	}
+	return fmix64(h);
+}
+
+/* Count-Min */
+
+struct libtrace_countmin {
+	uint32_t width;		/* Always a power of two */
+	uint32_t depth;
+	uint64_t *counters;	/* depth rows of width counters */
+};
+
+DLLEXPORT libtrace_countmin_t *libtrace_countmin_create(uint32_t width,
+		uint32_t depth) {
+	libtrace_countmin_t *cm;
+	uint32_t w = 16;
+
+	if (depth == 0 || width == 0 || width > (1U << 31))
+		return NULL;
+	while (w < width)
+		w *= 2;
+
+	cm = (libtrace_countmin_t *)malloc(sizeof(libtrace_countmin_t));
+	if (!cm)
+		return NULL;
+	cm->width = w;
+	cm->depth = depth;
+	cm->counters = (uint64_t *)calloc((size_t)w * depth, sizeof(uint64_t));
+	if (!cm->counters) {
+		free(cm);
+		return NULL;
+	}
+	return cm;
+}
+
+DLLEXPORT void libtrace_countmin_destroy(libtrace_countmin_t *cm) {
+	if (!cm)
+		return;
+	free(cm->counters);
+	free(cm);
+}
+
+/* Each row uses a different combination of two halves of the one hash,
+ * which is as good as independent hashes for this purpose and much
+ * cheaper */
+static inline uint64_t *countmin_counter(libtrace_countmin_t *cm, uint64_t h,
+		uint32_t row) {
+	uint32_t h1 = (uint32_t)h;
+	uint32_t h2 = (uint32_t)(h >> 32) | 1;
+
+	return &cm->counters[(size_t)row * cm->width +
+			((h1 + row * h2) & (cm->width - 1))];
+}
+
+DLLEXPORT void libtrace_countmin_update(libtrace_countmin_t *cm,
+		const void *key, size_t len, uint64_t weight) {
+	uint64_t h = sketch_hash(key, len, 0);
+	uint32_t i;
+
+	for (i = 0; i < cm->depth; i++)
+		*countmin_counter(cm, h, i) += weight;
+}
+
+DLLEXPORT uint64_t libtrace_countmin_estimate(libtrace_countmin_t *cm,
+		const void *key, size_t len) {
+	uint64_t h = sketch_hash(key, len, 0);
+	uint64_t min = UINT64_MAX, c;
+	uint32_t i;
+
+	for (i = 0; i < cm->depth; i++) {
+		c = *countmin_counter(cm, h, i);
+		if (c < min)
+			min = c;
+	}
+	return min;
+}
+
+DLLEXPORT int libtrace_countmin_merge(libtrace_countmin_t *dst,
+		libtrace_countmin_t *src) {
+	size_t i;
+
+	if (dst->width != src->width || dst->depth != src->depth)
+		return -1;
+	for (i = 0; i < (size_t)dst->width * dst->depth; i++)
+		dst->counters[i] += src->counters[i];
+	return 0;
+}
+
+DLLEXPORT void libtrace_countmin_clear(libtrace_countmin_t *cm) {
+	memset(cm->counters, 0, (size_t)cm->width * cm->depth *
+			sizeof(uint64_t));
+}
+
+/* Space-Saving top-k
+ *
+ * The k entries are kept in a min-heap ordered by count, so that the entry
+ * to replace is always at the top, and are found by key through a small
+ * open addressing hash index laid out the same way as the flow table's. */
+
+typedef struct topk_slot {
+	uint32_t hash;
+	uint32_t entry;		/* Entry number + 1, or 0 if the slot is free */
+} topk_slot_t;
+
+struct libtrace_topk {
+	size_t k;
+	size_t count;
+	size_t key_size;
+	size_t value_size;
+	size_t value_offset;	/* Key, padded to keep the value aligned */
+	size_t entry_size;
+	char *entries;
+	uint64_t *counts;
+	uint64_t *errors;
+	uint32_t *hashes;
+	uint32_t *heap;		/* Entry numbers, lowest count first */
+	uint32_t *heap_pos;	/* Position of each entry within the heap */
+	topk_slot_t *slots;
+	size_t mask;		/* Number of slots - 1 */
+};
+
+DLLEXPORT libtrace_topk_t *libtrace_topk_create(size_t k, size_t key_size,
+		size_t value_size) {
+	libtrace_topk_t *topk;
+	size_t nslots = 16;
+
+	if (k == 0 || key_size == 0 || k >= UINT32_MAX)
+		return NULL;
+
+	topk = (libtrace_topk_t *)calloc(1, sizeof(libtrace_topk_t));
+	if (!topk)
+		return NULL;
+	topk->k = k;
+	topk->key_size = key_size;
+	topk->value_size = value_size;
+	topk->value_offset = (key_size + 7) & ~((size_t)7);
+	topk->entry_size = (topk->value_offset + value_size + 7) &
+			~((size_t)7);
+
+	while (nslots / 2 < k)
+		nslots *= 2;
+	topk->mask = nslots - 1;
+
+	topk->entries = (char *)malloc(k * topk->entry_size);
+	topk->counts = (uint64_t *)malloc(k * sizeof(uint64_t));
+	topk->errors = (uint64_t *)malloc(k * sizeof(uint64_t));
+	topk->hashes = (uint32_t *)malloc(k * sizeof(uint32_t));
+	topk->heap = (uint32_t *)malloc(k * sizeof(uint32_t));
+	topk->heap_pos = (uint32_t *)malloc(k * sizeof(uint32_t));
+	topk->slots = (topk_slot_t *)calloc(nslots, sizeof(topk_slot_t));
+	if (!topk->entries || !topk->counts || !topk->errors ||
+			!topk->hashes || !topk->heap || !topk->heap_pos ||
+			!topk->slots) {
+		libtrace_topk_destroy(topk);
+		return NULL;
+	}
+	return topk;
+}
+
+DLLEXPORT void libtrace_topk_destroy(libtrace_topk_t *topk) {
+	if (!topk)
+		return;
+	free(topk->entries);
+	free(topk->counts);
+	free(topk->errors);
+	free(topk->hashes);
+	free(topk->heap);
+	free(topk->heap_pos);
+	free(topk->slots);
+	free(topk);
+}
+
+static inline char *topk_key(libtrace_topk_t *topk, uint32_t entry) {
+	return topk->entries + (size_t)entry * topk->entry_size;
+}
+
+static inline void *topk_value(libtrace_topk_t *topk, uint32_t entry) {
+	return topk_key(topk, entry) + topk->value_offset;
+}
+
+/* Returns the slot holding the key, or the free slot where it should be
+ * inserted */
+static inline topk_slot_t *topk_find_slot(libtrace_topk_t *topk,
+		const void *key, uint32_t hash) {
+	size_t pos = hash & topk->mask;
+	topk_slot_t *slot;
+
+	for (;;) {
+		slot = &topk->slots[pos];
+		if (slot->entry == 0)
+			return slot;
+		if (slot->hash == hash && memcmp(topk_key(topk,
+				slot->entry - 1), key, topk->key_size) == 0)
+			return slot;
+		pos = (pos + 1) & topk->mask;
+	}
+}
+
+static void topk_remove_slot(libtrace_topk_t *topk, topk_slot_t *slot) {
+	size_t hole = slot - topk->slots;
+	size_t pos = hole, home;
+
+	for (;;) {
+		pos = (pos + 1) & topk->mask;
+		if (topk->slots[pos].entry == 0)
+			break;
+		home = topk->slots[pos].hash & topk->mask;
+		if (((pos - home) & topk->mask) >= ((pos - hole) & topk->mask)) {
+			topk->slots[hole] = topk->slots[pos];
+			hole = pos;
+		}
+	}
+	topk->slots[hole].entry = 0;
+}
+
+static inline void heap_set(libtrace_topk_t *topk, size_t pos,
+		uint32_t entry) {
+	topk->heap[pos] = entry;
+	topk->heap_pos[entry] = pos;
+}
+
+static void heap_sift_up(libtrace_topk_t *topk, size_t pos) {
+	uint32_t entry = topk->heap[pos];
+	size_t parent;
+
+	while (pos > 0) {
+		parent = (pos - 1) / 2;
+		if (topk->counts[topk->heap[parent]] <= topk->counts[entry])
+			break;
+		heap_set(topk, pos, topk->heap[parent]);
+		pos = parent;
+	}
+	heap_set(topk, pos, entry);
+}
+
+static void heap_sift_down(libtrace_topk_t *topk, size_t pos) {
+	uint32_t entry = topk->heap[pos];
+	size_t child;
+
+	for (;;) {
+		child = pos * 2 + 1;
+		if (child >= topk->count)
+			break;
+		if (child + 1 < topk->count && topk->counts[topk->heap[child + 1]]
+				< topk->counts[topk->heap[child]])
+			child ++;
+		if (topk->counts[entry] <= topk->counts[topk->heap[child]])
+			break;
+		heap_set(topk, pos, topk->heap[child]);
+		pos = child;
+	}
+	heap_set(topk, pos, entry);
+}
+
+/* Adds weight to a key, returning the number of the entry tracking it */
+static uint32_t topk_update(libtrace_topk_t *topk, const void *key,
+		uint64_t weight, int *created) {
+	uint32_t hash = (uint32_t)sketch_hash(key, topk->key_size, 0);
+	topk_slot_t *slot = topk_find_slot(topk, key, hash);
+	uint32_t entry;
+
+	if (slot->entry != 0) {
+		entry = slot->entry - 1;
+		topk->counts[entry] += weight;
+		heap_sift_down(topk, topk->heap_pos[entry]);
+		*created = 0;
+		return entry;
+	}
+
+	if (topk->count < topk->k) {
+		entry = topk->count++;
+		topk->counts[entry] = weight;
+		topk->errors[entry] = 0;
+		heap_set(topk, entry, entry);
+		memcpy(topk_key(topk, entry), key, topk->key_size);
+		heap_sift_up(topk, entry);
+	} else {
+		/* Take over the entry with the lowest count. The new key may
+		 * have been seen up to that many times before, while it was
+		 * not being tracked */
+		entry = topk->heap[0];
+		topk_remove_slot(topk, topk_find_slot(topk,
+				topk_key(topk, entry), topk->hashes[entry]));
+		slot = topk_find_slot(topk, key, hash);
+		topk->errors[entry] = topk->counts[entry];
+		topk->counts[entry] += weight;
+		memcpy(topk_key(topk, entry), key, topk->key_size);
+		heap_sift_down(topk, 0);
+	}
+
+	topk->hashes[entry] = hash;
+	slot->hash = hash;
+	slot->entry = entry + 1;
+	memset(topk_value(topk, entry), 0, topk->value_size);
+	*created = 1;
+	return entry;
+}
+
+DLLEXPORT void *libtrace_topk_update(libtrace_topk_t *topk, const void *key,
+		uint64_t weight) {
+	int created;
+	return topk_value(topk, topk_update(topk, key, weight, &created));
+}
+
+DLLEXPORT void *libtrace_topk_find(libtrace_topk_t *topk, const void *key) {
+	topk_slot_t *slot = topk_find_slot(topk, key,
+			(uint32_t)sketch_hash(key, topk->key_size, 0));
+
+	if (slot->entry == 0)
+		return NULL;
+	return topk_value(topk, slot->entry - 1);
+}
+
+DLLEXPORT size_t libtrace_topk_get_size(libtrace_topk_t *topk) {
+	return topk->count;
+}
+
+static int compare_items(const void *a, const void *b) {
+	const libtrace_topk_item_t *ia = (const libtrace_topk_item_t *)a;
+	const libtrace_topk_item_t *ib = (const libtrace_topk_item_t *)b;
+
+	if (ia->count > ib->count)
+		return -1;
+	if (ia->count < ib->count)
+		return 1;
+	return 0;
+}
+
+DLLEXPORT size_t libtrace_topk_get_items(libtrace_topk_t *topk,
+		libtrace_topk_item_t *items) {
+	uint32_t i;
+
+	for (i = 0; i < topk->count; i++) {
+		items[i].key = topk_key(topk, i);
+		items[i].value = topk_value(topk, i);
+		items[i].count = topk->counts[i];
+		items[i].error = topk->errors[i];
+	}
+	qsort(items, topk->count, sizeof(libtrace_topk_item_t), compare_items);
+	return topk->count;
+}
+
+DLLEXPORT int libtrace_topk_merge(libtrace_topk_t *dst, libtrace_topk_t *src,
+		topk_merge_fn fn, void *data) {
+	uint32_t i, entry;
+	void *value;
+	int created;
+
+	if (dst->key_size != src->key_size ||
+			dst->value_size != src->value_size)
+		return -1;
+
+	for (i = 0; i < src->count; i++) {
+		entry = topk_update(dst, topk_key(src, i), src->counts[i],
+				&created);
+		dst->errors[entry] += src->errors[i];
+		value = topk_value(dst, entry);
+		if (created)
+			memcpy(value, topk_value(src, i), dst->value_size);
+		else if (fn)
+			fn(value, topk_value(src, i), data);
+	}
+	return 0;
+}
+
+DLLEXPORT void libtrace_topk_clear(libtrace_topk_t *topk) {
+	memset(topk->slots, 0, (topk->mask + 1) * sizeof(topk_slot_t));
+	topk->count = 0;
+}
+
+/* HyperLogLog */
+
+struct libtrace_hll {
+	int precision;
+	size_t m;		/* Number of registers, 2^precision */
+	uint8_t *registers;
+};
+
+DLLEXPORT libtrace_hll_t *libtrace_hll_create(int precision) {
+	libtrace_hll_t *hll;
+
+	if (precision < 4 || precision > 18)
+		return NULL;
+
+	hll = (libtrace_hll_t *)malloc(sizeof(libtrace_hll_t));
+	if (!hll)
+		return NULL;
+	hll->precision = precision;
+	hll->m = (size_t)1 << precision;
+	hll->registers = (uint8_t *)calloc(hll->m, sizeof(uint8_t));
+	if (!hll->registers) {
+		free(hll);
+		return NULL;
+	}
+	return hll;
+}
+
+DLLEXPORT void libtrace_hll_destroy(libtrace_hll_t *hll) {
+	if (!hll)
+		return;
+	free(hll->registers);
+	free(hll);
+}
+
+DLLEXPORT void libtrace_hll_add(libtrace_hll_t *hll, const void *key,
+		size_t len) {
+	uint64_t h = sketch_hash(key, len, 0x5bd1e9955bd1e995ULL);
+	size_t index = h >> (64 - hll->precision);
+	uint64_t rest = h << hll->precision;
+	uint8_t rank;
+
+	/* Position of the first set bit in what is left of the hash */
+	if (rest == 0)
+		rank = 64 - hll->precision + 1;
+	else
+		rank = __builtin_clzll(rest) + 1;
+	if (rank > hll->registers[index])
+		hll->registers[index] = rank;
+}
+
+DLLEXPORT uint64_t libtrace_hll_estimate(libtrace_hll_t *hll) {
+	double m = (double)hll->m;
+	double sum = 0.0, alpha, estimate;
+	size_t zeros = 0;
+	size_t i;
+
+	for (i = 0; i < hll->m; i++) {
+		sum += 1.0 / (double)((uint64_t)1 << hll->registers[i]);
+		if (hll->registers[i] == 0)
+			zeros ++;
+	}
+
+	switch (hll->m) {
+	case 16:
+		alpha = 0.673;
+		break;
+	case 32:
+		alpha = 0.697;
+		break;
+	case 64:
+		alpha = 0.709;
+		break;
+	default:
+		alpha = 0.7213 / (1.0 + 1.079 / m);
+	}
+	estimate = alpha * m * m / sum;
+
+	/* Small cardinalities are estimated much better by counting how many
+	 * registers are still empty */
+	if (estimate <= 2.5 * m && zeros > 0)
+		estimate = m * log(m / (double)zeros);
+	return (uint64_t)(estimate + 0.5);
+}
+
+DLLEXPORT int libtrace_hll_merge(libtrace_hll_t *dst, libtrace_hll_t *src) {
+	size_t i;
+
+	if (dst->precision != src->precision)
+		return -1;
+	for (i = 0; i < dst->m; i++) {
+		if (src->registers[i] > dst->registers[i])
+			dst->registers[i] = src->registers[i];
+	}
+	return 0;
+}
+
+DLLEXPORT void libtrace_hll_clear(libtrace_hll_t *hll) {
+	memset(hll->registers, 0, hll->m);
+}
@@ -0,0 +1,116 @@
+/*
+ *
+ * Copyright (c) 2007-2016 The University of Waikato, Hamilton, New Zealand.
+ * All rights reserved.
+ *
+ * This file is part of libtrace.
+ *
+ * This code has been developed by the University of Waikato WAND
+ * research group. For further information please see http://www.wand.net.nz/
+ *
+ * libtrace is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libtrace is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ */
+#include <stdint.h>
+#include <stddef.h>
+/* Need libtrace.h for DLLEXPORT defines */
+#include "../libtrace.h"
+
+#ifndef LIBTRACE_SKETCH_H
+#define LIBTRACE_SKETCH_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Fixed size summaries of a stream of keys, for when keeping an exact count
+ * for every key would use too much memory.
+ *
+ * None of these are thread safe. Parallel programs should give each thread
+ * its own sketch, which can then be updated without any locking, and merge
+ * them in the reporter. Sketches that are merged must have been created
+ * with the same parameters.
+ */
+
+/* Count-Min sketch: estimates the total weight seen for any key. Estimates
+ * are never too low, and are too high by at most 2/width of the total
+ * weight with probability 1 - (1/2)^depth. */
+typedef struct libtrace_countmin libtrace_countmin_t;
+
+DLLEXPORT libtrace_countmin_t *libtrace_countmin_create(uint32_t width,
+		uint32_t depth);
+DLLEXPORT void libtrace_countmin_destroy(libtrace_countmin_t *cm);
+DLLEXPORT void libtrace_countmin_update(libtrace_countmin_t *cm,
+		const void *key, size_t len, uint64_t weight);
+DLLEXPORT uint64_t libtrace_countmin_estimate(libtrace_countmin_t *cm,
+		const void *key, size_t len);
+DLLEXPORT int libtrace_countmin_merge(libtrace_countmin_t *dst,
+		libtrace_countmin_t *src);
+DLLEXPORT void libtrace_countmin_clear(libtrace_countmin_t *cm);
+
+/* Space-Saving top-k: tracks the (at most) k heaviest keys. Any key with
+ * more than 1/k of the total weight is guaranteed to be tracked. The count
+ * of a tracked key may be too high by up to its error.
+ *
+ * Each tracked key also has a value of value_size bytes for the caller's own
+ * counters. The value is zeroed whenever a key starts being tracked, so it
+ * only covers what has been seen since then. */
+typedef struct libtrace_topk libtrace_topk_t;
+
+typedef struct libtrace_topk_item {
+	const void *key;
+	void *value;
+	uint64_t count;
+	uint64_t error;
+} libtrace_topk_item_t;
+
+/* Combines the value for a key from one top-k into the value for the same
+ * key in another, as part of libtrace_topk_merge() */
+typedef void (*topk_merge_fn)(void *dst, const void *src, void *data);
+
+DLLEXPORT libtrace_topk_t *libtrace_topk_create(size_t k, size_t key_size,
+		size_t value_size);
+DLLEXPORT void libtrace_topk_destroy(libtrace_topk_t *topk);
+// Adds weight to a key, returning the value for that key
+DLLEXPORT void *libtrace_topk_update(libtrace_topk_t *topk, const void *key,
+		uint64_t weight);
+// Returns the value for a key, or NULL if the key is not being tracked
+DLLEXPORT void *libtrace_topk_find(libtrace_topk_t *topk, const void *key);
+DLLEXPORT size_t libtrace_topk_get_size(libtrace_topk_t *topk);
+// Fills items (which must have room for k items) with the tracked keys,
+// heaviest first, and returns how many there are
+DLLEXPORT size_t libtrace_topk_get_items(libtrace_topk_t *topk,
+		libtrace_topk_item_t *items);
+DLLEXPORT int libtrace_topk_merge(libtrace_topk_t *dst, libtrace_topk_t *src,
+		topk_merge_fn fn, void *data);
+DLLEXPORT void libtrace_topk_clear(libtrace_topk_t *topk);
+
+/* HyperLogLog: estimates the number of distinct keys seen, using 2^precision
+ * bytes. The standard error is about 1.04 / sqrt(2^precision), e.g. 0.8%
+ * for a precision of 14. */
+typedef struct libtrace_hll libtrace_hll_t;
+
+DLLEXPORT libtrace_hll_t *libtrace_hll_create(int precision);
+DLLEXPORT void libtrace_hll_destroy(libtrace_hll_t *hll);
+DLLEXPORT void libtrace_hll_add(libtrace_hll_t *hll, const void *key,
+		size_t len);
+DLLEXPORT uint64_t libtrace_hll_estimate(libtrace_hll_t *hll);
+DLLEXPORT int libtrace_hll_merge(libtrace_hll_t *dst, libtrace_hll_t *src);
+DLLEXPORT void libtrace_hll_clear(libtrace_hll_t *hll);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
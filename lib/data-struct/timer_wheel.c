@@ -0,0 +1,273 @@
+/*
+ *
+ * Copyright (c) 2007-2016 The University of Waikato, Hamilton, New Zealand.
+ * All rights reserved.
+ *
+ * This file is part of libtrace.
+ *
+ * This code has been developed by the University of Waikato WAND
+ * research group. For further information please see http://www.wand.net.nz/
+ *
+ * libtrace is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libtrace is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ */
+#include "timer_wheel.h"
+
+#include <string.h>
+
+#define SLOT_MASK (LIBTRACE_TIMER_SLOTS - 1)
+#define LEVEL_SHIFT(level) ((level) * LIBTRACE_TIMER_SLOT_BITS)
+/* The number of ticks covered by the whole wheel */
+#define WHEEL_SPAN (1ULL << LEVEL_SHIFT(LIBTRACE_TIMER_LEVELS))
+/* Beyond this many ticks, it is quicker to empty the wheel and put the
+ * timers back than to step through every tick */
+#define MAX_STEPS (LIBTRACE_TIMER_SLOTS * LIBTRACE_TIMER_SLOTS)
+
+static void timer_link(libtrace_timer_t **head, libtrace_timer_t *timer) {
+	timer->next = *head;
+	if (*head)
+		(*head)->pprev = &timer->next;
+	*head = timer;
+	timer->pprev = head;
+}
+
+static void timer_unlink(libtrace_timer_t *timer) {
+	*timer->pprev = timer->next;
+	if (timer->next)
+		timer->next->pprev = timer->pprev;
+	timer->next = NULL;
+	timer->pprev = NULL;
+}
+
+/* Puts a timer into the slot for its expiry, which must not be before the
+ * current tick */
+static void wheel_insert(libtrace_timer_wheel_t *wheel,
+		libtrace_timer_t *timer) {
+	uint64_t delta = timer->expires - wheel->now;
+	uint64_t when = timer->expires;
+	int level;
+
+	for (level = 0; level < LIBTRACE_TIMER_LEVELS - 1; level++) {
+		if (delta < (1ULL << LEVEL_SHIFT(level + 1)))
+			break;
+	}
+	/* Too far away for the wheel, so park it as far out as possible. It
+	 * will be put back in when that slot comes around */
+	if (delta >= WHEEL_SPAN)
+		when = wheel->now + WHEEL_SPAN - 1;
+
+	timer_link(&wheel->slots[level][(when >> LEVEL_SHIFT(level)) & SLOT_MASK],
+			timer);
+}
+
+/* Removes an expired timer, reschedules it if it is periodic and then calls
+ * it. 'target' is the tick the wheel is being advanced to. */
+static void wheel_fire(libtrace_timer_wheel_t *wheel,
+		libtrace_timer_t *timer, uint64_t target) {
+	uint64_t expired = timer->expires;
+
+	timer_unlink(timer);
+	wheel->count --;
+
+	if (timer->period) {
+		timer->expires = expired + timer->period;
+		/* Skip any periods that have been missed entirely */
+		if (timer->expires <= target) {
+			timer->expires = expired + timer->period *
+				((target - expired) / timer->period + 1);
+		}
+		wheel_insert(wheel, timer);
+		wheel->count ++;
+	}
+
+	timer->fn(timer, expired * wheel->resolution, timer->data);
+}
+
+/* Moves every timer in a slot down to where it now belongs */
+static void wheel_cascade(libtrace_timer_wheel_t *wheel, int level, int slot) {
+	libtrace_timer_t *list = wheel->slots[level][slot];
+	libtrace_timer_t *timer;
+
+	if (!list)
+		return;
+	wheel->slots[level][slot] = NULL;
+	list->pprev = &list;
+	while ((timer = list) != NULL) {
+		timer_unlink(timer);
+		wheel_insert(wheel, timer);
+	}
+}
+
+/* Steps the wheel forward one tick at a time */
+static size_t wheel_step(libtrace_timer_wheel_t *wheel, uint64_t target) {
+	libtrace_timer_t **slot;
+	size_t fired = 0;
+	int level;
+
+	while (wheel->now < target) {
+		wheel->now ++;
+
+		/* Once a level wraps around, the next slot of the level above
+		 * is due to be spread out over the levels below */
+		for (level = LIBTRACE_TIMER_LEVELS - 1; level > 0; level--) {
+			if ((wheel->now & ((1ULL << LEVEL_SHIFT(level)) - 1)) == 0) {
+				wheel_cascade(wheel, level,
+					(wheel->now >> LEVEL_SHIFT(level)) &
+					SLOT_MASK);
+			}
+		}
+
+		slot = &wheel->slots[0][wheel->now & SLOT_MASK];
+		while (*slot) {
+			wheel_fire(wheel, *slot, target);
+			fired ++;
+		}
+		if (wheel->count == 0) {
+			wheel->now = target;
+			break;
+		}
+	}
+	return fired;
+}
+
+/* Jumps straight to the target, firing anything that has expired along the
+ * way. Timers are fired in no particular order. */
+static size_t wheel_jump(libtrace_timer_wheel_t *wheel, uint64_t target) {
+	libtrace_timer_t *list = NULL;
+	libtrace_timer_t *timer;
+	size_t fired = 0;
+	int level, slot;
+
+	for (level = 0; level < LIBTRACE_TIMER_LEVELS; level++) {
+		for (slot = 0; slot < LIBTRACE_TIMER_SLOTS; slot++) {
+			while ((timer = wheel->slots[level][slot]) != NULL) {
+				timer_unlink(timer);
+				timer_link(&list, timer);
+			}
+		}
+	}
+
+	wheel->now = target;
+	while ((timer = list) != NULL) {
+		if (timer->expires <= target) {
+			wheel_fire(wheel, timer, target);
+			fired ++;
+		} else {
+			timer_unlink(timer);
+			wheel_insert(wheel, timer);
+		}
+	}
+	return fired;
+}
+
+void libtrace_timer_wheel_init(libtrace_timer_wheel_t *wheel,
+		uint64_t resolution, uint64_t now) {
+	memset(wheel, 0, sizeof(libtrace_timer_wheel_t));
+	wheel->resolution = resolution ? resolution : 1;
+	wheel->now = now / wheel->resolution;
+}
+
+void libtrace_timer_init(libtrace_timer_t *timer, libtrace_timer_fn fn,
+		void *data) {
+	memset(timer, 0, sizeof(libtrace_timer_t));
+	timer->fn = fn;
+	timer->data = data;
+}
+
+void libtrace_timer_wheel_add(libtrace_timer_wheel_t *wheel,
+		libtrace_timer_t *timer, uint64_t expiry, uint64_t period) {
+
+	libtrace_timer_wheel_cancel(wheel, timer);
+
+	timer->expires = (expiry + wheel->resolution - 1) / wheel->resolution;
+	/* The slot for the current tick has already been fired */
+	if (timer->expires <= wheel->now)
+		timer->expires = wheel->now + 1;
+	timer->period = (period + wheel->resolution - 1) / wheel->resolution;
+
+	wheel_insert(wheel, timer);
+	wheel->count ++;
+}
+
+void libtrace_timer_wheel_cancel(libtrace_timer_wheel_t *wheel,
+		libtrace_timer_t *timer) {
+	if (timer->pprev) {
+		timer_unlink(timer);
+		wheel->count --;
+	}
+}
+
+int libtrace_timer_is_active(const libtrace_timer_t *timer) {
+	return timer->pprev != NULL;
+}
+
+size_t libtrace_timer_wheel_advance(libtrace_timer_wheel_t *wheel,
+		uint64_t now) {
+	uint64_t target = now / wheel->resolution;
+
+	if (target <= wheel->now)
+		return 0;
+	if (wheel->count == 0) {
+		wheel->now = target;
+		return 0;
+	}
+	if (target - wheel->now > MAX_STEPS)
+		return wheel_jump(wheel, target);
+	return wheel_step(wheel, target);
+}
+
+uint64_t libtrace_timer_wheel_next(const libtrace_timer_wheel_t *wheel) {
+	const libtrace_timer_t *timer;
+	uint64_t tick, best = UINT64_MAX;
+	int level, slot;
+
+	if (wheel->count == 0)
+		return 0;
+
+	/* Anything in the first level before it next wraps around is due
+	 * sooner than everything in the levels above */
+	for (tick = wheel->now + 1; (tick & SLOT_MASK) != 0; tick++) {
+		if (wheel->slots[0][tick & SLOT_MASK])
+			return tick * wheel->resolution;
+	}
+
+	for (level = 0; level < LIBTRACE_TIMER_LEVELS; level++) {
+		for (slot = 0; slot < LIBTRACE_TIMER_SLOTS; slot++) {
+			for (timer = wheel->slots[level][slot]; timer;
+					timer = timer->next) {
+				if (timer->expires < best)
+					best = timer->expires;
+			}
+		}
+	}
+	return best * wheel->resolution;
+}
+
+void libtrace_timer_wheel_clear(libtrace_timer_wheel_t *wheel,
+		void (*release)(libtrace_timer_t *timer)) {
+	libtrace_timer_t *timer;
+	int level, slot;
+
+	for (level = 0; level < LIBTRACE_TIMER_LEVELS; level++) {
+		for (slot = 0; slot < LIBTRACE_TIMER_SLOTS; slot++) {
+			while ((timer = wheel->slots[level][slot]) != NULL) {
+				timer_unlink(timer);
+				wheel->count --;
+				if (release)
+					release(timer);
+			}
+		}
+	}
+}
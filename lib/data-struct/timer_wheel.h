@@ -0,0 +1,120 @@
+/*
+ *
+ * Copyright (c) 2007-2016 The University of Waikato, Hamilton, New Zealand.
+ * All rights reserved.
+ *
+ * This file is part of libtrace.
+ *
+ * This code has been developed by the University of Waikato WAND
+ * research group. For further information please see http://www.wand.net.nz/
+ *
+ * libtrace is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libtrace is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ */
+#include <stdint.h>
+#include <stddef.h>
+/* Need libtrace.h for DLLEXPORT defines */
+#include "../libtrace.h"
+
+#ifndef LIBTRACE_TIMER_WHEEL_H
+#define LIBTRACE_TIMER_WHEEL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* A hierarchical timer wheel, for keeping track of a large number of timers
+ * that are mostly cancelled or rescheduled before they expire.
+ *
+ * Adding and cancelling a timer is O(1). Time is divided into ticks of a
+ * fixed resolution; the first level of the wheel has a slot for each of the
+ * next 64 ticks, and each level above covers 64 times as much time as the
+ * one below it. Timers in the upper levels move down a level each time the
+ * level below wraps around.
+ *
+ * Times are given in nanoseconds, on whatever clock the caller likes, as
+ * long as it never goes backwards. A wheel is not thread safe, so each
+ * thread should have its own.
+ */
+
+#define LIBTRACE_TIMER_LEVELS 4
+#define LIBTRACE_TIMER_SLOT_BITS 6
+#define LIBTRACE_TIMER_SLOTS (1 << LIBTRACE_TIMER_SLOT_BITS)
+
+typedef struct libtrace_timer libtrace_timer_t;
+
+/* Called when a timer expires, with the time that it was due to expire */
+typedef void (*libtrace_timer_fn)(libtrace_timer_t *timer, uint64_t expiry,
+		void *data);
+
+/* A timer, which is normally embedded in some larger structure. The fields
+ * should only be changed through the functions below. */
+struct libtrace_timer {
+	libtrace_timer_t *next;
+	/* Whatever points to this timer, NULL if it is not in a wheel */
+	libtrace_timer_t **pprev;
+	/* The tick this timer is due to expire on */
+	uint64_t expires;
+	/* The number of ticks between expiries, 0 for a one shot timer */
+	uint64_t period;
+	libtrace_timer_fn fn;
+	void *data;
+};
+
+typedef struct libtrace_timer_wheel {
+	/* Every timer due on or before this tick has been fired */
+	uint64_t now;
+	/* The length of a tick in nanoseconds */
+	uint64_t resolution;
+	/* The number of timers in the wheel */
+	size_t count;
+	libtrace_timer_t *slots[LIBTRACE_TIMER_LEVELS][LIBTRACE_TIMER_SLOTS];
+} libtrace_timer_wheel_t;
+
+DLLEXPORT void libtrace_timer_wheel_init(libtrace_timer_wheel_t *wheel,
+		uint64_t resolution, uint64_t now);
+DLLEXPORT void libtrace_timer_init(libtrace_timer_t *timer,
+		libtrace_timer_fn fn, void *data);
+
+/* Schedules a timer to expire at 'expiry', and then every 'period'
+ * nanoseconds after that if period is not 0. A timer that is already
+ * scheduled is moved. Times are rounded up to the resolution of the wheel.
+ * A periodic timer that falls behind skips the periods it missed. */
+DLLEXPORT void libtrace_timer_wheel_add(libtrace_timer_wheel_t *wheel,
+		libtrace_timer_t *timer, uint64_t expiry, uint64_t period);
+DLLEXPORT void libtrace_timer_wheel_cancel(libtrace_timer_wheel_t *wheel,
+		libtrace_timer_t *timer);
+DLLEXPORT int libtrace_timer_is_active(const libtrace_timer_t *timer);
+
+/* Fires every timer due on or before 'now', returning how many were fired.
+ * Timers may be added and cancelled from within the callbacks. */
+DLLEXPORT size_t libtrace_timer_wheel_advance(libtrace_timer_wheel_t *wheel,
+		uint64_t now);
+
+/* Returns the time at which the next timer is due, or 0 if the wheel is
+ * empty */
+DLLEXPORT uint64_t libtrace_timer_wheel_next(
+		const libtrace_timer_wheel_t *wheel);
+
+/* Removes every timer from the wheel, passing each to 'release' (if not
+ * NULL) so that it can be freed */
+DLLEXPORT void libtrace_timer_wheel_clear(libtrace_timer_wheel_t *wheel,
+		void (*release)(libtrace_timer_t *timer));
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -384,6 +384,9 @@ static int bpf_config_input(libtrace_t *libtrace,
 		case TRACE_OPTION_XDP_HARDWARE_OFFLOAD:
 		case TRACE_OPTION_XDP_ZERO_COPY_MODE:
 		case TRACE_OPTION_XDP_COPY_MODE:
+		case TRACE_OPTION_SEEK_INDEX_INTERVAL:
+		case TRACE_OPTION_SEEK_INDEX_FILE:
+		case TRACE_OPTION_EAGER_PARSE:
 		case TRACE_OPTION_XDP_DRV_MODE:
 		case TRACE_OPTION_XDP_SKB_MODE:
 			break;
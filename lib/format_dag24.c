@@ -242,6 +242,9 @@ static int dag_config_input(libtrace_t *libtrace, trace_option_t option,
 		case TRACE_OPTION_XDP_DRV_MODE:
 		case TRACE_OPTION_XDP_ZERO_COPY_MODE:
 		case TRACE_OPTION_XDP_COPY_MODE:
+		case TRACE_OPTION_SEEK_INDEX_INTERVAL:
+		case TRACE_OPTION_SEEK_INDEX_FILE:
+		case TRACE_OPTION_EAGER_PARSE:
 			return -1;
         }
 	return -1;
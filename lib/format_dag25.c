@@ -652,6 +652,9 @@ static int dag_config_input(libtrace_t *libtrace, trace_option_t option,
         case TRACE_OPTION_XDP_DRV_MODE:
         case TRACE_OPTION_XDP_ZERO_COPY_MODE:
         case TRACE_OPTION_XDP_COPY_MODE:
+        case TRACE_OPTION_SEEK_INDEX_INTERVAL:
+        case TRACE_OPTION_SEEK_INDEX_FILE:
+        case TRACE_OPTION_EAGER_PARSE:
             return -1;
 	}
 	return -1;
@@ -1360,7 +1363,7 @@ static int dag_read_packet_stream(libtrace_t *libtrace,
 			/* if we have access to the message queue check for a message
                          * otherwise we need to return and let libtrace check for a message
                          */
-			if ((t && libtrace_message_queue_count(&t->messages) > 0) || !t)
+			if ((t && libtrace_message_queue_ready(&t->messages)) || !t)
 				return READ_MESSAGE;
 
 			if ((numbytes=is_halted(libtrace)) != -1)
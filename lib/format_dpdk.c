@@ -975,6 +975,7 @@ int dpdk_config_input (libtrace_t *libtrace,
 			FORMAT(libtrace)->rss_key = NULL;
 			return 0;
 		case HASHER_CUSTOM:
+		case HASHER_FRAGMENT:
 			// Let libtrace do this
 			return -1;
 		}
@@ -991,6 +992,9 @@ int dpdk_config_input (libtrace_t *libtrace,
         case TRACE_OPTION_XDP_DRV_MODE:
         case TRACE_OPTION_XDP_ZERO_COPY_MODE:
         case TRACE_OPTION_XDP_COPY_MODE:
+        case TRACE_OPTION_SEEK_INDEX_INTERVAL:
+        case TRACE_OPTION_SEEK_INDEX_FILE:
+        case TRACE_OPTION_EAGER_PARSE:
 		break;
 	/* Avoid default: so that future options will cause a warning
 	 * here to remind us to implement it, or flag it as
@@ -2357,7 +2361,7 @@ int dpdk_read_packet_stream (libtrace_t *libtrace,
 		/* Check the message queue this could be less than 0.
                  * If the message queue is not available return and let libtrace
                  * check for new messages. */
-		if ((mesg && libtrace_message_queue_count(mesg) > 0) || !mesg) {
+		if ((mesg && libtrace_message_queue_ready(mesg)) || !mesg) {
 #if ENABLE_DTRACE
                         DTRACE_PROBE(libtrace, dpdk_read_message);
 #endif
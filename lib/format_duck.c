@@ -149,9 +149,9 @@ static int duck_fin_input(libtrace_t *libtrace) {
 }
 
 static int duck_fin_output(libtrace_out_t *libtrace) {
-	wandio_wdestroy(OUTPUT->file);
+	int ret = trace_close_file_out(libtrace, OUTPUT->file);
 	free(libtrace->format_data);
-	return 0;
+	return ret;
 }
 
 static int duck_prepare_packet(libtrace_t *libtrace, libtrace_packet_t *packet,
@@ -266,6 +266,8 @@ static int erf_init_input(libtrace_t *libtrace) {
 
 	IN_OPTIONS.real_time = 0;
 	DATA(libtrace)->drops = 0;
+	DATA(libtrace)->seek.exists = INDEX_UNKNOWN;
+	DATA(libtrace)->seek.index = NULL;
 
 	DATA(libtrace)->discard_meta = 0;
 
@@ -316,7 +318,7 @@ static int erf_start_input(libtrace_t *libtrace)
                 return -1;
 
         DATA(libtrace)->drops = 0;
-        return 0; /* success */
+        return trace_seek_index_start(libtrace, NULL);
 }
 
 /* Raw ERF is a special case -- we want to force libwandio to treat the file
@@ -337,7 +339,7 @@ static int rawerf_start_input(libtrace_t *libtrace)
 
 	DATA(libtrace)->drops = 0;
 
-	return 0; /* success */
+	return trace_seek_index_start(libtrace, NULL);
 }
 
 /* Binary search through the index to find the closest point before
@@ -384,20 +386,6 @@ static int erf_fast_seek_start(libtrace_t *libtrace,uint64_t erfts)
 	return 0; /* success */
 }
 
-/* There is no index.  Seek through the entire trace from the start, nice
- * and slowly.
- */
-static int erf_slow_seek_start(libtrace_t *libtrace,uint64_t erfts UNUSED)
-{
-	if (libtrace->io) {
-		wandio_destroy(libtrace->io);
-	}
-	libtrace->io = trace_open_file(libtrace);
-	if (!libtrace->io)
-		return -1;
-	return 0;
-}
-
 /* Seek within an ERF trace based on an ERF timestamp */
 static int erf_seek_erf(libtrace_t *libtrace,uint64_t erfts)
 {
@@ -417,16 +405,15 @@ static int erf_seek_erf(libtrace_t *libtrace,uint64_t erfts)
 	}
 
 	/* If theres an index, use it to find the nearest packet that isn't
-	 * after the time we're looking for.  If there is no index we need
-	 * to seek slowly through the trace from the beginning.  Sigh.
+	 * after the time we're looking for.  If there is no index, fall back
+	 * to the index that libtrace builds as the trace is read.
 	 */
 	switch(DATA(libtrace)->seek.exists) {
 		case INDEX_EXISTS:
 			erf_fast_seek_start(libtrace,erfts);
 			break;
 		case INDEX_NONE:
-			erf_slow_seek_start(libtrace,erfts);
-			break;
+			return trace_seek_index_erf(libtrace, erfts);
 		case INDEX_UNKNOWN:
 			trace_set_err(libtrace, TRACE_ERR_SEEK_ERF, "Cannot seek to erf timestamp with unknown index in erf_seek_erf()");
 			return -1;
@@ -490,15 +477,16 @@ static int erf_config_output(libtrace_out_t *libtrace,
 static int erf_fin_input(libtrace_t *libtrace) {
 	if (libtrace->io)
 		wandio_destroy(libtrace->io);
+	if (DATA(libtrace)->seek.index)
+		wandio_destroy(DATA(libtrace)->seek.index);
 	free(libtrace->format_data);
 	return 0;
 }
 
 static int erf_fin_output(libtrace_out_t *libtrace) {
-	if (OUTPUT->file)
-		wandio_wdestroy(OUTPUT->file);
+	int ret = trace_close_file_out(libtrace, OUTPUT->file);
 	free(libtrace->format_data);
-	return 0;
+	return ret;
 }
  
 static int erf_prepare_packet(libtrace_t *libtrace, libtrace_packet_t *packet,
@@ -633,16 +621,20 @@ static int erf_read_packet(libtrace_t *libtrace, libtrace_packet_t *packet) {
 			linktype = TRACE_RT_ERF_META;
 		} else { linktype = TRACE_RT_DATA_ERF; }
 
-		/* If this is a meta packet and TRACE_OPTION_DISCARD_META is set
-		 * ignore this packet and get another */
-		if ((linktype == TRACE_RT_ERF_META && !DATA(libtrace)->discard_meta) ||
-			linktype == TRACE_RT_DATA_ERF) {
-			gotpacket = 1;
+		if (erf_prepare_packet(libtrace, packet, packet->buffer, linktype, flags)) {
+			return -1;
+		}
 
-			if (erf_prepare_packet(libtrace, packet, packet->buffer, linktype, flags)) {
-				return -1;
+		/* The interface properties are kept up to date even if
+		 * TRACE_OPTION_DISCARD_META is set, in which case the meta
+		 * packet is then ignored and we get another */
+		if (linktype == TRACE_RT_ERF_META) {
+			trace_update_interface_meta(libtrace, packet, -1);
+			if (DATA(libtrace)->discard_meta) {
+				continue;
 			}
 		}
+		gotpacket = 1;
 	}
 
 	return rlen;
@@ -739,18 +731,16 @@ static int erf_dump_packet(libtrace_out_t *libtrace, dag_record_t *erfptr,
 	int framinglen, void *buffer, int caplen) {
 
 	int numbytes;
+	struct iovec iov[2];
 
-	// write out ERF header
-	numbytes = wandio_wwrite(OUTPUT->file, erfptr, (size_t)(framinglen));
-	if (numbytes != framinglen) {
-		trace_set_err_out(libtrace,errno,
-			"write(%s)",libtrace->uridata);
-		return -1;
-	}
+	// write out ERF header and packet payload as a single record
+	iov[0].iov_base = erfptr;
+	iov[0].iov_len = framinglen;
+	iov[1].iov_base = buffer;
+	iov[1].iov_len = caplen;
 
-	// write out packet payload
-	numbytes = wandio_wwrite(OUTPUT->file, buffer, (size_t)caplen);
-	if (numbytes != caplen) {
+	numbytes = trace_write_iov(OUTPUT->file, iov, 2);
+	if (numbytes != framinglen + caplen) {
 		trace_set_err_out(libtrace,errno,
 			"write(%s)",libtrace->uridata);
 		return -1;
@@ -1229,6 +1219,76 @@ libtrace_meta_t *erf_get_all_meta(libtrace_packet_t *packet) {
         }
 }
 
+int erf_meta_iter_start(libtrace_meta_iter_t *iter, libtrace_packet_t *packet) {
+
+	dag_record_t *hdr;
+	uint32_t offset;
+	uint16_t rlen;
+
+	if (packet->buffer == NULL || packet->payload == NULL) { return -1; }
+
+	hdr = (dag_record_t *)packet->buffer;
+	if ((hdr->type & 127) != ERF_META_TYPE) { return -1; }
+
+	rlen = ntohs(hdr->rlen);
+	offset = (char *)packet->payload - (char *)packet->buffer;
+
+	iter->packet = packet;
+	iter->next = (char *)packet->payload;
+	iter->remaining = rlen > offset ? rlen - offset : 0;
+	iter->section = 0;
+	iter->sections = 0;
+	/* Provenance records are always big endian */
+	iter->byteswapped = (ntohs(1) != 1);
+	return 0;
+}
+
+int erf_meta_iter_next(libtrace_meta_iter_t *iter, libtrace_meta_item_t *item) {
+
+	dag_sec_t *sec;
+	uint16_t type, len;
+	uint32_t skip;
+
+	while (iter->remaining > sizeof(dag_sec_t)) {
+		sec = (dag_sec_t *)iter->next;
+		type = ntohs(sec->type);
+		len = ntohs(sec->len);
+
+		if (sizeof(dag_sec_t) + len > iter->remaining) {
+			break;
+		}
+
+		/* Options and section headers are padded to 32 bits */
+		skip = sizeof(dag_sec_t) + ((len + 3) & ~3);
+		if (skip > iter->remaining) {
+			skip = iter->remaining;
+		}
+		iter->next += skip;
+		iter->remaining -= skip;
+
+		if (type == ERF_PROV_SECTION_CAPTURE
+				|| type == ERF_PROV_SECTION_HOST
+				|| type == ERF_PROV_SECTION_MODULE
+				|| type == ERF_PROV_SECTION_STREAM
+				|| type == ERF_PROV_SECTION_INTERFACE) {
+			iter->section = type;
+			iter->sections ++;
+			continue;
+		}
+
+		item->section = iter->section;
+		item->option = type;
+		item->option_name = erf_get_option_name(type);
+		item->len = len;
+		item->datatype = erf_get_datatype(type);
+		item->data = (char *)sec + sizeof(struct dag_opthdr);
+		return 1;
+	}
+
+	iter->remaining = 0;
+	return 0;
+}
+
 static void erf_help(void) {
 	printf("erf format module: $Revision: 1752 $\n");
 	printf("Supported input URIs:\n");
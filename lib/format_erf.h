@@ -138,6 +138,8 @@ int erf_get_wire_length(const libtrace_packet_t *packet);
 size_t erf_set_capture_length(libtrace_packet_t *packet, size_t size);
 int erf_is_color_type(uint8_t erf_type);
 libtrace_meta_t *erf_get_all_meta(libtrace_packet_t *packet);
+int erf_meta_iter_start(libtrace_meta_iter_t *iter, libtrace_packet_t *packet);
+int erf_meta_iter_next(libtrace_meta_iter_t *iter, libtrace_meta_item_t *item);
 bool find_compatible_linktype(libtrace_out_t *libtrace,
         libtrace_packet_t *packet);
 int erf_get_padding(const libtrace_packet_t *packet);
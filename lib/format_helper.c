@@ -253,7 +253,12 @@ struct libtrace_eventobj_t trace_event_trace(struct libtrace_t *trace, struct li
 /* Open a file for reading using the new Libtrace IO system */
 io_t *trace_open_file(libtrace_t *trace)
 {
-	io_t *io=wandio_create(trace->uridata);
+	/* Block compressed files are valid gzip files, so we have to check
+	 * for them before wandio gets a chance to claim them */
+	io_t *io=trace_open_bgzf(trace->uridata);
+
+	if (!io)
+		io=wandio_create(trace->uridata);
 
 	if (!io) {
 		if (errno != 0) {
@@ -284,8 +289,24 @@ iow_t *trace_open_file_out(libtrace_out_t *trace, int compress_type, int level,
                 return NULL;
         }
 
-	io = wandio_wcreate(trace->uridata, compress_type, level, fileflag);
+	if (trace->compress_blocksize > 0) {
+		if (compress_type != TRACE_OPTION_COMPRESSTYPE_ZLIB) {
+			trace_set_err_out(trace, TRACE_ERR_UNSUPPORTED_COMPRESS,
+				"Block compression is only supported for gzip output");
+			return NULL;
+		}
+		io = trace_open_bgzf_out(trace->uridata, level,
+				trace->compress_blocksize, fileflag);
+	} else {
+		io = wandio_wcreate(trace->uridata, compress_type, level,
+				fileflag);
+	}
 
+	/* Only the compressors that deflate each write as it arrives need
+	 * the staging buffer, the other writers buffer for themselves */
+	if (compress_type != TRACE_OPTION_COMPRESSTYPE_NONE && level > 0 &&
+			trace->compress_blocksize <= 0)
+		io = trace_open_buffered_out(io, TRACE_OUTPUT_BUFSIZE);
 	if (!io) {
 		trace_set_err_out(trace, errno, "Unable to create output file %s", trace->uridata);
 	}
@@ -27,6 +27,7 @@
 #define FORMAT_HELPER_H
 #include "common.h"
 #include "wandio.h"
+#include <sys/uio.h>
 
 /** @file
  *
@@ -87,6 +88,78 @@ iow_t *trace_open_file_out(libtrace_out_t *libtrace,
 		int level,
 		int filemode);
 
+/** The largest amount of uncompressed data that can be stored in a single
+ * block of a block compressed (BGZF) file */
+#define BGZF_MAX_DATA_LEN 65280
+
+/** Opens a block compressed (BGZF) trace file for reading
+ *
+ * @param filename	The name of the file to open
+ * @return A seekable libtrace IO reader for the file, or NULL if the file
+ * could not be opened or is not block compressed
+ *
+ * trace_open_file() tries this first, so format modules do not need to
+ * call it themselves.
+ */
+io_t *trace_open_bgzf(const char *filename);
+
+/** Opens a block compressed (BGZF) trace file for writing
+ *
+ * @param filename	The name of the file to create
+ * @param level		The compression level to use, ranging from 0 to 9
+ * @param blocksize	The amount of uncompressed data to store in each
+ * 			block, up to BGZF_MAX_DATA_LEN bytes
+ * @param filemode	The file status flags for the file, bitwise-ORed.
+ * @return A libtrace IO writer for the newly opened file or NULL if the file
+ * was unable to be opened
+ */
+iow_t *trace_open_bgzf_out(const char *filename, int level, int blocksize,
+		int filemode);
+
+/** The size of the staging buffer placed in front of compressed output
+ * files */
+#define TRACE_OUTPUT_BUFSIZE (256 * 1024)
+
+/** Places a staging buffer in front of an output file, so that the writer
+ * beneath only ever sees large writes
+ *
+ * @param child		The writer to buffer writes for. It is destroyed along
+ * 			with the new writer, or immediately if this fails.
+ * @param bufsize	The size of the staging buffer in bytes
+ * @return A libtrace IO writer that buffers writes to the child, or NULL if
+ * it could not be created
+ *
+ * trace_open_file_out() does this for any output file whose writer does not
+ * already collect writes into a buffer of its own, so format modules do not
+ * need to call it themselves.
+ */
+iow_t *trace_open_buffered_out(iow_t *child, size_t bufsize);
+
+/** Closes an output file opened with trace_open_file_out()
+ *
+ * @param trace		The output trace that the file belongs to
+ * @param iow		The writer to close, which may be NULL
+ * @return 0 if everything written to the file made it out, or -1 if it
+ * did not, in which case the error is set on the trace
+ *
+ * Anything still sitting in the staging buffer is written out first, so
+ * that a failure can be reported rather than lost when the writer is
+ * destroyed.
+ */
+int trace_close_file_out(libtrace_out_t *trace, iow_t *iow);
+
+/** Writes a record made up of several separate pieces to an output file
+ *
+ * @param iow		The writer to write the record to
+ * @param iov		The pieces of the record, in order
+ * @param iovcnt	The number of pieces in the record
+ * @return The number of bytes written, or -1 if an error occurred
+ *
+ * If the writer has a staging buffer, the whole record is copied into it in
+ * one go, rather than piece by piece.
+ */
+int64_t trace_write_iov(iow_t *iow, const struct iovec *iov, int iovcnt);
+
 /** Determines the number of cores available on the host.
  *
  * @return The number of cores detected by this function.
@@ -105,4 +178,86 @@ uint32_t trace_get_number_of_cores(void);
  */
 libtrace_direction_t pcap_get_direction(const libtrace_packet_t *packet);
 
+/** Prepares the sparse time index for a trace file that has just been
+ * opened. Trace file formats that use libtrace->io and can resume reading
+ * from the start of any packet record should call this at the end of their
+ * start_input function, once any file header has been consumed.
+ *
+ * @param libtrace	The input trace to index
+ * @param resync	Optional callback used when seeking to an offset
+ * 			beyond the furthest point that has been read. It must
+ * 			advance libtrace->io to the given offset, updating any
+ * 			format state (e.g. interface tables) on the way. If
+ * 			NULL, the reader is simply moved to the offset.
+ * @return 0 if successful, -1 if an error occurred
+ */
+int trace_seek_index_start(libtrace_t *libtrace,
+		int (*resync)(libtrace_t *libtrace, int64_t offset));
+
+/** Checks whether the next packet read from an indexed trace may be added
+ * to the sparse time index, i.e. whether its offset needs to be recorded.
+ *
+ * @param libtrace	The input trace about to be read from
+ * @return true if the offset of the next packet should be passed to
+ * trace_seek_index_update(), false otherwise
+ */
+bool trace_seek_index_due(libtrace_t *libtrace);
+
+/** Records a packet that has just been read in the sparse time index
+ *
+ * @param libtrace	The input trace the packet was read from
+ * @param packet	The packet that was read
+ * @param offset	The offset of libtrace->io before the packet was read,
+ * 			or -1 if the packet is not to be added to the index
+ *
+ * This is called by trace_read_packet() for every packet read from an
+ * indexed trace, so format modules do not need to call it themselves.
+ */
+void trace_seek_index_update(libtrace_t *libtrace, libtrace_packet_t *packet,
+		int64_t offset);
+
+/** Seeks within an indexed trace file, so that the next packet read is the
+ * first packet at or after the given time.
+ *
+ * @param libtrace	The input trace to seek within
+ * @param erfts		The time to seek to, as an ERF timestamp
+ * @return 0 if successful, -1 if an error occurred
+ */
+int trace_seek_index_erf(libtrace_t *libtrace, uint64_t erfts);
+
+/** Applies one of the TRACE_OPTION_SEEK_INDEX_* options to an input trace
+ *
+ * @param libtrace	The input trace to configure
+ * @param option	The option being set
+ * @param value		A pointer to the value of the option
+ * @return 0 if successful, -1 if an error occurred
+ */
+int trace_seek_index_config(libtrace_t *libtrace, trace_option_t option,
+		void *value);
+
+/** Frees the sparse time index for a trace, writing it to the sidecar file
+ * first if one was configured and the index has changed.
+ *
+ * @param libtrace	The input trace whose index is to be destroyed
+ */
+void trace_seek_index_destroy(libtrace_t *libtrace);
+
+/** Records the interface properties found in a meta packet that has just
+ * been read, so that they can be looked up with trace_get_interface_meta()
+ *
+ * @param libtrace	The input trace the packet was read from
+ * @param packet	The meta packet
+ * @param ifid		The interface described by the packet, or -1 if the
+ * 			packet numbers its own interfaces (as ERF provenance
+ * 			records do)
+ */
+void trace_update_interface_meta(libtrace_t *libtrace,
+		libtrace_packet_t *packet, int ifid);
+
+/** Frees the interface properties recorded for a trace
+ *
+ * @param libtrace	The input trace
+ */
+void trace_destroy_interface_meta(libtrace_t *libtrace);
+
 #endif /* FORMAT_HELPER_H */
@@ -158,6 +158,7 @@ int linuxcommon_config_input(libtrace_t *libtrace,
 					FORMAT_DATA->fanout_flags = PACKET_FANOUT_HASH;
 					return 0;
 				case HASHER_CUSTOM:
+				case HASHER_FRAGMENT:
 					return -1;
 			}
 			break;
@@ -177,6 +178,9 @@ int linuxcommon_config_input(libtrace_t *libtrace,
 		case TRACE_OPTION_XDP_DRV_MODE:
 		case TRACE_OPTION_XDP_ZERO_COPY_MODE:
 		case TRACE_OPTION_XDP_COPY_MODE:
+		case TRACE_OPTION_SEEK_INDEX_INTERVAL:
+		case TRACE_OPTION_SEEK_INDEX_FILE:
+		case TRACE_OPTION_EAGER_PARSE:
 			break;
 		/* Avoid default: so that future options will cause a warning
 		 * here to remind us to implement it, or flag it as
@@ -197,6 +201,7 @@ int linuxcommon_config_output(libtrace_out_t *libtrace,
                 case TRACE_OPTION_OUTPUT_FILEFLAGS:
                 case TRACE_OPTION_OUTPUT_COMPRESS:
                 case TRACE_OPTION_OUTPUT_COMPRESSTYPE:
+                case TRACE_OPTION_OUTPUT_COMPRESS_BLOCKSIZE:
                     break;
                 case TRACE_OPTION_TX_MAX_QUEUE:
                         FORMAT_DATA_OUT->tx_max_queue = *(int *)data;
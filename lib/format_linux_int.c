@@ -34,6 +34,10 @@
  * RT-speaking programs.
  */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include "config.h"
 #include "libtrace.h"
 #include "libtrace_int.h"
@@ -146,32 +150,33 @@ static int linuxnative_prepare_packet(libtrace_t *libtrace UNUSED,
 #define CMSG_BUF_SIZE 128
 
 #ifdef HAVE_NETPACKET_PACKET_H
-inline static int linuxnative_read_stream(libtrace_t *libtrace,
-                                          libtrace_packet_t *packet,
-                                          struct linux_per_stream_t *stream,
-                                          libtrace_message_queue_t *queue)
+/* Most packets that can be received with a single recvmmsg() call */
+#define LINUX_RECV_BATCH 64
+
+/* Points a msghdr at the buffer of a packet, so that the kernel writes the
+ * sll header and the captured packet straight into it. Returns the number of
+ * bytes that can be captured, or -1 if the packet has no buffer. */
+static int linuxnative_prepare_msghdr(libtrace_t *libtrace,
+                                      libtrace_packet_t *packet,
+                                      struct msghdr *msghdr,
+                                      struct iovec *iovec,
+                                      unsigned char *controlbuf)
 {
 	struct libtrace_linuxnative_header *hdr;
-	struct msghdr msghdr;
-	struct iovec iovec;
-	unsigned char controlbuf[CMSG_BUF_SIZE];
-	struct cmsghdr *cmsg;
 	int snaplen;
 
-	uint32_t flags = 0;
-	fd_set readfds;
-	struct timeval tout;
-	int ret;
-	
 	if (!packet->buffer || packet->buf_control == TRACE_CTRL_EXTERNAL) {
 		packet->buffer = malloc((size_t)LIBTRACE_PACKET_BUFSIZE);
 		if (!packet->buffer) {
-			perror("Cannot allocate buffer");
+			trace_set_err(libtrace, TRACE_ERR_OUT_OF_MEMORY,
+					"Cannot allocate buffer");
+			return -1;
 		}
+		/* Owned from here on, even if we fail before the packet is
+		 * prepared */
+		packet->buf_control = TRACE_CTRL_PACKET;
 	}
 
-	flags |= TRACE_PREP_OWN_BUFFER;
-	
 	packet->type = TRACE_RT_DATA_LINUX_NATIVE;
 
 	hdr=(struct libtrace_linuxnative_header*)packet->buffer;
@@ -183,89 +188,43 @@ inline static int linuxnative_read_stream(libtrace_t *libtrace,
 	 * buffer reserved for sll header, while the iovec will point at
 	 * the buffer following the sll header. */
 
-	msghdr.msg_name = &hdr->hdr;
-	msghdr.msg_namelen = sizeof(struct sockaddr_ll);
-
-	msghdr.msg_iov = &iovec;
-	msghdr.msg_iovlen = 1;
-
-	msghdr.msg_control = &controlbuf;
-	msghdr.msg_controllen = CMSG_BUF_SIZE;
-	msghdr.msg_flags = 0;
-
-	iovec.iov_base = (void*)(packet->buffer+sizeof(*hdr));
-	iovec.iov_len = snaplen;
-
-	// Check for a packet - TODO only Linux has MSG_DONTWAIT should use fctl O_NONBLOCK
-	/* Try check ahead this should be fast if something is waiting  */
-	hdr->wirelen = recvmsg(stream->fd, &msghdr, MSG_DONTWAIT | MSG_TRUNC);
-
-	/* No data was waiting */
-	if ((int) hdr->wirelen == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
-		/* Do message queue check or select */
-		int message_fd = 0;
-		int largestfd = stream->fd;
+	msghdr->msg_name = &hdr->hdr;
+	msghdr->msg_namelen = sizeof(struct sockaddr_ll);
 
-		/* Also check the message queue */
-		if (queue) {
-			message_fd = libtrace_message_queue_get_fd(queue);
-			if (message_fd > largestfd)
-				largestfd = message_fd;
-		}
-		do {
-			/* Use select to allow us to time out occasionally to check if someone
-			 * has hit Ctrl-C or otherwise wants us to stop reading and return
-			 * so they can exit their program.
-			 */
-			tout.tv_sec = 0;
-			tout.tv_usec = 500000;
-			/* Make sure we reset these each loop */
-			FD_ZERO(&readfds);
-			FD_SET(stream->fd, &readfds);
-			if (queue)
-				FD_SET(message_fd, &readfds);
+	msghdr->msg_iov = iovec;
+	msghdr->msg_iovlen = 1;
 
-			ret = select(largestfd+1, &readfds, NULL, NULL, &tout);
-			if (ret >= 1) {
-				/* A file descriptor triggered */
-				break;
-			} else if (ret < 0 && errno != EINTR) {
-				trace_set_err(libtrace, errno, "select");
-				return -1;
-			} else {
-				if ((ret=is_halted(libtrace)) != -1)
-					return ret;
-                                /* If we dont have access to the queue we have to return
-                                 * and let libtrace check */
-                                if (!queue) {
-                                    return READ_MESSAGE;
-                                }
-			}
-		}
-		while (ret <= 0);
+	msghdr->msg_control = controlbuf;
+	msghdr->msg_controllen = CMSG_BUF_SIZE;
+	msghdr->msg_flags = 0;
 
-		/* Message waiting? */
-		if (queue && FD_ISSET(message_fd, &readfds))
-			return READ_MESSAGE;
+	iovec->iov_base = (void*)(packet->buffer+sizeof(*hdr));
+	iovec->iov_len = snaplen;
 
-		/* We must have a packet */
-		hdr->wirelen = recvmsg(stream->fd, &msghdr, MSG_TRUNC);
-	}
+	return snaplen;
+}
 
-	if (hdr->wirelen==~0U) {
-		trace_set_err(libtrace,errno,"recvmsg");
-		return -1;
-	}
+/* Fills in the rest of our header once the kernel has written a packet
+ * into its buffer, and prepares the packet */
+static int linuxnative_finish_packet(libtrace_t *libtrace,
+                                     libtrace_packet_t *packet,
+                                     struct msghdr *msghdr,
+                                     struct linux_per_stream_t *stream,
+                                     int snaplen)
+{
+	struct libtrace_linuxnative_header *hdr;
+	struct cmsghdr *cmsg;
 
+	hdr=(struct libtrace_linuxnative_header*)packet->buffer;
 	hdr->caplen=LIBTRACE_MIN((unsigned int)snaplen,(unsigned int)hdr->wirelen);
 
 	/* Extract the timestamps from the msghdr and store them in our
 	 * linux native encapsulation, so that we can preserve the formatting
 	 * across multiple architectures */
 
-	for (cmsg = CMSG_FIRSTHDR(&msghdr);
+	for (cmsg = CMSG_FIRSTHDR(msghdr);
 			cmsg != NULL;
-			cmsg = CMSG_NXTHDR(&msghdr, cmsg)) {
+			cmsg = CMSG_NXTHDR(msghdr, cmsg)) {
 		if (cmsg->cmsg_level == SOL_SOCKET
 			&& cmsg->cmsg_type == SO_TIMESTAMP
 			&& cmsg->cmsg_len <= CMSG_LEN(sizeof(struct timeval))) {
@@ -315,7 +274,7 @@ inline static int linuxnative_read_stream(libtrace_t *libtrace,
 	 * appropriately */
 	packet->trace = libtrace;
 	if (linuxnative_prepare_packet(libtrace, packet, packet->buffer,
-				packet->type, flags))
+				packet->type, TRACE_PREP_OWN_BUFFER))
 		return -1;
 	
 	if (hdr->timestamptype == TS_TIMEVAL) {
@@ -337,6 +296,92 @@ inline static int linuxnative_read_stream(libtrace_t *libtrace,
 	return hdr->wirelen+sizeof(*hdr);
 }
 
+inline static int linuxnative_read_stream(libtrace_t *libtrace,
+                                          libtrace_packet_t *packet,
+                                          struct linux_per_stream_t *stream,
+                                          libtrace_message_queue_t *queue)
+{
+	struct libtrace_linuxnative_header *hdr;
+	struct msghdr msghdr;
+	struct iovec iovec;
+	unsigned char controlbuf[CMSG_BUF_SIZE];
+	int snaplen;
+
+	fd_set readfds;
+	struct timeval tout;
+	int ret;
+	
+	snaplen = linuxnative_prepare_msghdr(libtrace, packet, &msghdr,
+			&iovec, controlbuf);
+	if (snaplen < 0)
+		return -1;
+	hdr=(struct libtrace_linuxnative_header*)packet->buffer;
+
+	// Check for a packet - TODO only Linux has MSG_DONTWAIT should use fctl O_NONBLOCK
+	/* Try check ahead this should be fast if something is waiting  */
+	hdr->wirelen = recvmsg(stream->fd, &msghdr, MSG_DONTWAIT | MSG_TRUNC);
+
+	/* No data was waiting */
+	if ((int) hdr->wirelen == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+		/* Do message queue check or select */
+		int message_fd = 0;
+		int largestfd = stream->fd;
+
+		/* Also check the message queue */
+		if (queue) {
+			message_fd = libtrace_message_queue_get_fd(queue);
+			if (message_fd > largestfd)
+				largestfd = message_fd;
+		}
+		do {
+			/* Use select to allow us to time out occasionally to check if someone
+			 * has hit Ctrl-C or otherwise wants us to stop reading and return
+			 * so they can exit their program.
+			 */
+			tout.tv_sec = 0;
+			tout.tv_usec = 500000;
+			/* Make sure we reset these each loop */
+			FD_ZERO(&readfds);
+			FD_SET(stream->fd, &readfds);
+			if (queue)
+				FD_SET(message_fd, &readfds);
+
+			ret = select(largestfd+1, &readfds, NULL, NULL, &tout);
+			if (ret >= 1) {
+				/* A file descriptor triggered */
+				break;
+			} else if (ret < 0 && errno != EINTR) {
+				trace_set_err(libtrace, errno, "select");
+				return -1;
+			} else {
+				if ((ret=is_halted(libtrace)) != -1)
+					return ret;
+                                /* If we dont have access to the queue we have to return
+                                 * and let libtrace check */
+                                if (!queue) {
+                                    return READ_MESSAGE;
+                                }
+			}
+		}
+		while (ret <= 0);
+
+		/* Message waiting? */
+		if (queue && FD_ISSET(message_fd, &readfds))
+			return READ_MESSAGE;
+
+		/* We must have a packet */
+		hdr->wirelen = recvmsg(stream->fd, &msghdr, MSG_TRUNC);
+	}
+
+	if (hdr->wirelen==~0U) {
+		trace_set_err(libtrace,errno,"recvmsg");
+		return -1;
+	}
+
+	return linuxnative_finish_packet(libtrace, packet, &msghdr, stream,
+			snaplen);
+}
+
 static int linuxnative_read_packet(libtrace_t *libtrace, libtrace_packet_t *packet) 
 {
 	return linuxnative_read_stream(libtrace, packet, FORMAT_DATA_FIRST, NULL);
@@ -346,14 +391,54 @@ static int linuxnative_read_packet(libtrace_t *libtrace, libtrace_packet_t *pack
 static int linuxnative_pread_packets(libtrace_t *libtrace,
                                      libtrace_thread_t *t,
                                      libtrace_packet_t *packets[],
-                                     UNUSED size_t nb_packets) {
-	/* For now just read one packet */
+                                     size_t nb_packets) {
+	struct linux_per_stream_t *stream = t->format_data;
+#if HAVE_DECL_RECVMMSG
+	struct mmsghdr msgs[LINUX_RECV_BATCH];
+	struct iovec iovecs[LINUX_RECV_BATCH];
+	unsigned char controlbufs[LINUX_RECV_BATCH][CMSG_BUF_SIZE];
+	int snaplen[LINUX_RECV_BATCH];
+	struct libtrace_linuxnative_header *hdr;
+	size_t i, count;
+	int ret;
+#endif
+
+	/* Wait for the first packet, checking for messages while we do */
 	packets[0]->error = linuxnative_read_stream(libtrace, packets[0],
-	                                               t->format_data, &t->messages);
-	if (packets[0]->error >= 1)
-		return 1;
-	else
+	                                               stream, &t->messages);
+	if (packets[0]->error < 1)
 		return packets[0]->error;
+
+#if HAVE_DECL_RECVMMSG
+	/* Then pick up whatever else is already waiting with a single
+	 * system call, writing straight into the packet buffers */
+	count = LIBTRACE_MIN(nb_packets - 1, LINUX_RECV_BATCH);
+	if (count == 0)
+		return 1;
+	for (i = 0; i < count; i++) {
+		snaplen[i] = linuxnative_prepare_msghdr(libtrace, packets[i + 1],
+				&msgs[i].msg_hdr, &iovecs[i], controlbufs[i]);
+		if (snaplen[i] < 0)
+			return 1;
+	}
+
+	ret = recvmmsg(stream->fd, msgs, count, MSG_DONTWAIT | MSG_TRUNC, NULL);
+	if (ret <= 0)
+		return 1;
+
+	for (i = 0; i < (size_t)ret; i++) {
+		hdr = (struct libtrace_linuxnative_header *)packets[i + 1]->buffer;
+		hdr->wirelen = msgs[i].msg_len;
+		packets[i + 1]->error = linuxnative_finish_packet(libtrace,
+				packets[i + 1], &msgs[i].msg_hdr, stream,
+				snaplen[i]);
+		if (packets[i + 1]->error < 1)
+			return i + 1;
+	}
+	return ret + 1;
+#else
+	return 1;
+#endif
 }
 #endif
 
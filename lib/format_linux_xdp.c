@@ -283,6 +283,7 @@ static int linux_xdp_set_rss_key(char *ifname, enum hasher_types hasher) {
             toeplitz_ncreate_bikey((uint8_t *)rss->rss_config + indir_bytes, rss_head.key_size);
             break;
         case HASHER_CUSTOM:
+        case HASHER_FRAGMENT:
             // should never hit this, just here to silence warnings
             free(rss);
             return 0;
@@ -1132,7 +1133,7 @@ static int linux_xdp_read_stream(libtrace_t *libtrace,
             /* if we have access to the message queue check for a message
              * otherwise we need to return and let libtrace check for a message
              */
-            if ((msg && libtrace_message_queue_count(msg) > 0) || !msg) {
+            if ((msg && libtrace_message_queue_ready(msg)) || !msg) {
 #if ENABLE_DTRACE
                 DTRACE_PROBE(libtrace, xdp_read_message);
 #endif
@@ -1709,6 +1710,7 @@ static int linux_xdp_config_input(libtrace_t *libtrace,
                     }
                     return 0;
                 case HASHER_CUSTOM:
+                case HASHER_FRAGMENT:
                     /* libtrace can handle custom hashers */
                     return -1;
             }
@@ -1719,6 +1721,9 @@ static int linux_xdp_config_input(libtrace_t *libtrace,
         case TRACE_OPTION_EVENT_REALTIME:
         case TRACE_OPTION_REPLAY_SPEEDUP:
         case TRACE_OPTION_CONSTANT_ERF_FRAMING:
+        case TRACE_OPTION_SEEK_INDEX_INTERVAL:
+        case TRACE_OPTION_SEEK_INDEX_FILE:
+        case TRACE_OPTION_EAGER_PARSE:
             break;
         case TRACE_OPTION_XDP_HARDWARE_OFFLOAD:
             XDP_FORMAT_DATA->cfg.xdp_flags &= ~XDP_FLAGS_MODES;
@@ -45,6 +45,10 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netdb.h>
+#include <poll.h>
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif
 
 #include "format_ndag.h"
 
@@ -55,6 +59,14 @@
 
 #define RECV_BATCH_SIZE (50)
 
+/* Maximum number of ready sockets to collect per epoll_wait() */
+#define NDAG_EPOLL_EVENTS (64)
+/* How long a blocking read may wait for a socket to become readable (ms) */
+#define NDAG_EPOLL_WAIT (10)
+/* epoll tags for the descriptors that are not stream sockets */
+#define NDAG_EPOLL_CONTROL (0xffffffff)
+#define NDAG_EPOLL_MESSAGES (0xfffffffe)
+
 #define FORMAT_DATA ((ndag_format_data_t *)libtrace->format_data)
 
 static struct libtrace_format_t ndag;
@@ -88,6 +100,7 @@ typedef struct streamsock {
         int savedsize[ENCAP_BUFFERS];
 	uint8_t rectype[ENCAP_BUFFERS];
         uint64_t nextts;
+        int heappos;
         uint32_t startidle;
         uint64_t recordcount;
 
@@ -115,6 +128,14 @@ typedef struct recvstream {
         uint64_t received_packets;
 
 	int maxfd;
+
+        /* Indexes into 'sources' for every source with a record ready to
+         * be read, as a min-heap ordered by the timestamp of that record */
+        int *heap;
+        int heapsize;
+
+        int epollfd;
+        int msgfd;
 } recvstream_t;
 
 typedef struct ndag_format_data {
@@ -445,8 +466,7 @@ static void *ndag_controller_run(void *tdata) {
         uint16_t ptmap[65536];
         int sock = -1;
         struct addrinfo *receiveaddr = NULL;
-        fd_set listening;
-        struct timeval timeout;
+        struct pollfd listening;
 
         /* ptmap is a dirty hack to allow us to quickly check if we've already
          * assigned a stream to a thread.
@@ -468,19 +488,20 @@ static void *ndag_controller_run(void *tdata) {
                 int ret;
                 char buf[CTRL_BUF_SIZE];
 
-                FD_ZERO(&listening);
-                FD_SET(sock, &listening);
+                listening.fd = sock;
+                listening.events = POLLIN;
+                listening.revents = 0;
 
-                timeout.tv_sec = 0;
-                timeout.tv_usec = 500000;
-
-                ret = select(sock + 1, &listening, NULL, NULL, &timeout);
+                ret = poll(&listening, 1, 500);
                 if (ret < 0) {
+                        if (errno == EINTR) {
+                                continue;
+                        }
                         fprintf(stderr, "Error while waiting for nDAG control messages: %s\n", strerror(errno));
                         break;
                 }
 
-                if (!FD_ISSET(sock, &listening)) {
+                if (ret == 0) {
                         continue;
                 }
 
@@ -539,9 +560,36 @@ static int ndag_start_threads(libtrace_t *libtrace, uint32_t maxthreads)
                 FORMAT_DATA->receivers[i].received_packets = 0;
                 FORMAT_DATA->receivers[i].missing_records = 0;
 		FORMAT_DATA->receivers[i].maxfd = -1;
+                FORMAT_DATA->receivers[i].heap = NULL;
+                FORMAT_DATA->receivers[i].heapsize = 0;
+                FORMAT_DATA->receivers[i].epollfd = -1;
+                FORMAT_DATA->receivers[i].msgfd = -1;
 
                 libtrace_message_queue_init(&(FORMAT_DATA->receivers[i].mqueue),
                                 sizeof(ndag_internal_message_t));
+
+#ifdef HAVE_SYS_EPOLL_H
+                {
+                        recvstream_t *rt = &(FORMAT_DATA->receivers[i]);
+                        struct epoll_event ev;
+
+                        rt->epollfd = epoll_create(16);
+                        if (rt->epollfd == -1) {
+                                trace_set_err(libtrace, errno,
+                                        "Unable to create epoll set for nDAG receiver");
+                                return -1;
+                        }
+
+                        /* Wake up as soon as the controller tells us about
+                         * a new stream */
+                        memset(&ev, 0, sizeof(ev));
+                        ev.events = EPOLLIN;
+                        ev.data.u32 = NDAG_EPOLL_CONTROL;
+                        epoll_ctl(rt->epollfd, EPOLL_CTL_ADD,
+                                libtrace_message_queue_get_fd(&(rt->mqueue)),
+                                &ev);
+                }
+#endif
         }
 
         /* Start the controller thread */
@@ -570,6 +618,16 @@ static void halt_ndag_receiver(recvstream_t *receiver) {
         int j, i;
         libtrace_message_queue_destroy(&(receiver->mqueue));
 
+        if (receiver->epollfd != -1) {
+                close(receiver->epollfd);
+                receiver->epollfd = -1;
+        }
+        if (receiver->heap) {
+                free(receiver->heap);
+                receiver->heap = NULL;
+        }
+        receiver->heapsize = 0;
+
         if (receiver->sources == NULL)
                 return;
         for (i = 0; i < receiver->sourcecount; i++) {
@@ -654,6 +712,106 @@ static int ndag_get_framing_length(const libtrace_packet_t *packet) {
         return 0;
 }
 
+static inline int readable_data(streamsock_t *ssock);
+
+/* The timestamp of the next record to be read from a source. Only the ERF
+ * timestamp is looked at, as has always been the case for nDAG. */
+static inline uint64_t next_record_ts(streamsock_t *ssock) {
+        dag_record_t *daghdr = (dag_record_t *)(ssock->nextread);
+        return bswap_le_to_host64(daghdr->ts);
+}
+
+static inline void ndag_heap_set(recvstream_t *rt, int pos, int srcind) {
+        rt->heap[pos] = srcind;
+        rt->sources[srcind].heappos = pos;
+}
+
+static void ndag_heap_up(recvstream_t *rt, int pos) {
+        int srcind = rt->heap[pos];
+        uint64_t ts = rt->sources[srcind].nextts;
+        int parent;
+
+        while (pos > 0) {
+                parent = (pos - 1) / 2;
+                if (rt->sources[rt->heap[parent]].nextts <= ts) {
+                        break;
+                }
+                ndag_heap_set(rt, pos, rt->heap[parent]);
+                pos = parent;
+        }
+        ndag_heap_set(rt, pos, srcind);
+}
+
+static void ndag_heap_down(recvstream_t *rt, int pos) {
+        int srcind = rt->heap[pos];
+        uint64_t ts = rt->sources[srcind].nextts;
+        int child;
+
+        while ((child = pos * 2 + 1) < rt->heapsize) {
+                if (child + 1 < rt->heapsize &&
+                                rt->sources[rt->heap[child + 1]].nextts <
+                                rt->sources[rt->heap[child]].nextts) {
+                        child ++;
+                }
+                if (ts <= rt->sources[rt->heap[child]].nextts) {
+                        break;
+                }
+                ndag_heap_set(rt, pos, rt->heap[child]);
+                pos = child;
+        }
+        ndag_heap_set(rt, pos, srcind);
+}
+
+/* Adds a source that has just gone from having no records ready to having
+ * at least one */
+static void ndag_heap_push(recvstream_t *rt, streamsock_t *ssock) {
+        int pos = rt->heapsize;
+
+        if (ssock->heappos >= 0) {
+                return;
+        }
+        ssock->nextts = next_record_ts(ssock);
+        rt->heapsize ++;
+        ndag_heap_set(rt, pos, (int)(ssock - rt->sources));
+        ndag_heap_up(rt, pos);
+}
+
+static void ndag_heap_remove(recvstream_t *rt, streamsock_t *ssock) {
+        int pos = ssock->heappos;
+        int last;
+
+        if (pos < 0) {
+                return;
+        }
+        ssock->heappos = -1;
+        rt->heapsize --;
+        if (pos == rt->heapsize) {
+                return;
+        }
+        last = rt->heap[rt->heapsize];
+        ndag_heap_set(rt, pos, last);
+        ndag_heap_up(rt, pos);
+        ndag_heap_down(rt, rt->sources[last].heappos);
+}
+
+/* Puts a source back in its place after a record has been read from it */
+static void ndag_heap_update(recvstream_t *rt, streamsock_t *ssock) {
+        if (!readable_data(ssock)) {
+                ndag_heap_remove(rt, ssock);
+                return;
+        }
+        ssock->nextts = next_record_ts(ssock);
+        ndag_heap_down(rt, ssock->heappos);
+}
+
+/* Records that have already been received from the stream can still be
+ * read after it is closed, so the source stays in the heap until
+ * ndag_heap_update() finds that it has been drained */
+static void close_streamsock(streamsock_t *ssock) {
+        close(ssock->sock);
+        ssock->sock = -1;
+}
+
 static int ndag_prepare_packet_stream_corsarotag(libtrace_t *restrict libtrace,
                 recvstream_t *restrict rt,
                 streamsock_t *restrict ssock,
@@ -821,17 +979,20 @@ static int ndag_prepare_packet_stream(libtrace_t *restrict libtrace,
                 libtrace_packet_t *restrict packet,
                 uint32_t flags UNUSED) {
 
+        int ret = -1;
+
         if (ssock->rectype[ssock->nextreadind] == NDAG_PKT_ENCAPERF) {
-                return ndag_prepare_packet_stream_encaperf(libtrace, rt,
+                ret = ndag_prepare_packet_stream_encaperf(libtrace, rt,
                                 ssock, packet);
-        }
-
-        if (ssock->rectype[ssock->nextreadind] == NDAG_PKT_CORSAROTAG) {
-                return ndag_prepare_packet_stream_corsarotag(libtrace,
+        } else if (ssock->rectype[ssock->nextreadind] == NDAG_PKT_CORSAROTAG) {
+                ret = ndag_prepare_packet_stream_corsarotag(libtrace,
                                 rt,  ssock, packet);
         }
 
-        return -1;
+        if (ret >= 0) {
+                ndag_heap_update(rt, ssock);
+        }
+        return ret;
 
 }
 
@@ -877,11 +1038,27 @@ static int add_new_streamsock(recvstream_t *rt, streamsource_t src) {
          * just setting the sock to -1 and having to check them every
          * time we want to read a packet.
          */
-        if (rt->sourcecount == 0) {
-                rt->sources = (streamsock_t *)malloc(sizeof(streamsock_t) * 10);
-        } else if ((rt->sourcecount % 10) == 0) {
-                rt->sources = (streamsock_t *)realloc(rt->sources,
+        if ((rt->sourcecount % 10) == 0) {
+                streamsock_t *sources;
+                int *heap;
+
+                sources = (streamsock_t *)realloc(rt->sources,
                         sizeof(streamsock_t) * (rt->sourcecount + 10));
+                if (sources == NULL) {
+                        fprintf(stderr, "Unable to allocate memory for nDAG stream %s:%u\n",
+                                        src.groupaddr, src.port);
+                        return -1;
+                }
+                rt->sources = sources;
+
+                heap = (int *)realloc(rt->heap,
+                        sizeof(int) * (rt->sourcecount + 10));
+                if (heap == NULL) {
+                        fprintf(stderr, "Unable to allocate memory for nDAG stream %s:%u\n",
+                                        src.groupaddr, src.port);
+                        return -1;
+                }
+                rt->heap = heap;
         }
 
         ssock = &(rt->sources[rt->sourcecount]);
@@ -906,6 +1083,7 @@ static int add_new_streamsock(recvstream_t *rt, streamsource_t src) {
 	ssock->bufwaiting = 0;
         ssock->startidle = 0;
 	ssock->nextts = 0;
+        ssock->heappos = -1;
 
         for (i = 0; i < ENCAP_BUFFERS; i++) {
                 ssock->saved[i] = (char *)malloc(ENCAP_BUFSIZE);
@@ -923,6 +1101,25 @@ static int add_new_streamsock(recvstream_t *rt, streamsource_t src) {
 		rt->maxfd = ssock->sock;
 	}
 
+#ifdef HAVE_SYS_EPOLL_H
+        {
+                struct epoll_event ev;
+
+                memset(&ev, 0, sizeof(ev));
+                ev.events = EPOLLIN;
+                ev.data.u32 = rt->sourcecount;
+                if (epoll_ctl(rt->epollfd, EPOLL_CTL_ADD, ssock->sock,
+                                &ev) < 0) {
+                        fprintf(stderr, "Unable to watch stream %s:%u -- %s\n",
+                                        src.groupaddr, src.port,
+                                        strerror(errno));
+                        close(ssock->sock);
+                        ssock->sock = -1;
+                        return -1;
+                }
+        }
+#endif
+
 #if HAVE_DECL_RECVMMSG
         for (i = 0; i < RECV_BATCH_SIZE; i++) {
                 ssock->mmsgbufs[i].msg_hdr.msg_iov = (struct iovec *)
@@ -972,9 +1169,6 @@ static int receiver_read_messages(recvstream_t *rt) {
 
 static inline int readable_data(streamsock_t *ssock) {
 
-        if (ssock->sock == -1) {
-                return 0;
-        }
         if (ssock->savedsize[ssock->nextreadind] == 0) {
                 return 0;
         }
@@ -1053,8 +1247,7 @@ static int check_ndag_received(streamsock_t *ssock, int index,
                         rectype != NDAG_PKT_CORSAROTAG) {
                 fprintf(stderr, "Received invalid record on the channel for %s:%u.\n",
                                 ssock->groupaddr, ssock->port);
-                close(ssock->sock);
-                ssock->sock = -1;
+                close_streamsock(ssock);
                 return -1;
         }
 
@@ -1151,8 +1344,7 @@ static int receive_from_single_socket(streamsock_t *ssock, struct timeval *tv,
                                         ssock->groupaddr,
                                         ssock->port);
 
-                                close(ssock->sock);
-                                ssock->sock = -1;
+                                close_streamsock(ssock);
                         }
                 } else {
 
@@ -1160,8 +1352,7 @@ static int receive_from_single_socket(streamsock_t *ssock, struct timeval *tv,
                                 "Error receiving encapsulated records from %s:%u -- %s \n",
                                 ssock->groupaddr, ssock->port,
                                 strerror(errno));
-                        close(ssock->sock);
-                        ssock->sock = -1;
+                        close_streamsock(ssock);
                 }
                 return toret;
         }
@@ -1189,10 +1380,65 @@ static int receive_from_single_socket(streamsock_t *ssock, struct timeval *tv,
 	}
 #endif
 
+        if (toret) {
+                ndag_heap_push(rt, ssock);
+        }
         return toret;
 }
 
-static int receive_from_sockets(recvstream_t *rt) {
+#ifdef HAVE_SYS_EPOLL_H
+/* Reads from every stream socket that epoll says is readable, waiting up to
+ * 'timeout' ms if there is nothing buffered already. Returns the number of
+ * sources that have records ready to be read. */
+static int receive_from_sockets(recvstream_t *rt, int timeout) {
+
+        struct epoll_event events[NDAG_EPOLL_EVENTS];
+        struct timeval tv;
+        int gottime = 0;
+        int i, nfds;
+
+        if (rt->heapsize > 0) {
+                timeout = 0;
+        }
+
+        nfds = epoll_wait(rt->epollfd, events, NDAG_EPOLL_EVENTS, timeout);
+        if (nfds < 0) {
+                if (errno == EINTR) {
+                        return rt->heapsize;
+                }
+                return -1;
+        }
+
+        for (i = 0; i < nfds; i++) {
+                streamsock_t *ssock;
+
+                if (events[i].data.u32 >= rt->sourcecount) {
+                        /* Control or message queue, dealt with elsewhere */
+                        continue;
+                }
+                ssock = &(rt->sources[events[i].data.u32]);
+                if (ssock->sock == -1) {
+                        continue;
+                }
+
+#if HAVE_DECL_RECVMMSG
+                /* Plenty of full buffers, just use the packets in those. The
+                 * socket will still be readable next time around. */
+                if (ssock->bufavail < RECV_BATCH_SIZE / 2) {
+                        continue;
+                }
+#else
+                if (ssock->bufavail == 0) {
+                        continue;
+                }
+#endif
+                receive_from_single_socket(ssock, &tv, &gottime, rt);
+        }
+
+        return rt->heapsize;
+}
+#else
+static int receive_from_sockets(recvstream_t *rt, int timeout UNUSED) {
 
         int i, readybufs, gottime;
         struct timeval tv;
@@ -1261,6 +1507,8 @@ static int receive_from_sockets(recvstream_t *rt) {
 }
 
 
+#endif
+
 static int receive_encap_records_block(libtrace_t *libtrace, recvstream_t *rt,
                 libtrace_packet_t *packet, libtrace_message_queue_t *msg) {
 
@@ -1292,7 +1540,21 @@ static int receive_encap_records_block(libtrace_t *libtrace, recvstream_t *rt,
                         continue;
                 }
 
-                if ((iserr = receive_from_sockets(rt)) < 0) {
+#ifdef HAVE_SYS_EPOLL_H
+                /* Have epoll also wake us for messages from libtrace */
+                if (msg && rt->msgfd != libtrace_message_queue_get_fd(msg)) {
+                        struct epoll_event ev;
+
+                        memset(&ev, 0, sizeof(ev));
+                        ev.events = EPOLLIN;
+                        ev.data.u32 = NDAG_EPOLL_MESSAGES;
+                        rt->msgfd = libtrace_message_queue_get_fd(msg);
+                        epoll_ctl(rt->epollfd, EPOLL_CTL_ADD, rt->msgfd, &ev);
+                }
+#endif
+
+                if ((iserr = receive_from_sockets(rt,
+                                msg ? NDAG_EPOLL_WAIT : 0)) < 0) {
                         return iserr;
                 } else if (iserr > 0) {
                         /* At least one of our input sockets has available
@@ -1303,16 +1565,18 @@ static int receive_encap_records_block(libtrace_t *libtrace, recvstream_t *rt,
                 /* if we have access to the message queue check for a message
                  * otherwise we need to return and let libtrace check for a message
                  */
-                if ((msg && libtrace_message_queue_count(msg) > 0) || !msg) {
+                if ((msg && libtrace_message_queue_ready(msg)) || !msg) {
                     return READ_MESSAGE;
                 }
 
+#ifndef HAVE_SYS_EPOLL_H
                 /* None of our sources have anything available, we can take
                  * a short break rather than immediately trying again.
                  */
                 if (iserr == 0) {
                         usleep(100);
                 }
+#endif
 
         } while (1);
 
@@ -1339,46 +1603,15 @@ static int receive_encap_records_nonblock(libtrace_t *libtrace, recvstream_t *rt
                 return 0;
         }
 
-        return receive_from_sockets(rt);
+        return receive_from_sockets(rt, 0);
 }
 
-static streamsock_t *select_next_packet(recvstream_t *rt) {
-        int i;
-        streamsock_t *ssock = NULL;
-        uint64_t earliest = 0;
-        uint64_t currentts = 0;
-        dag_record_t *daghdr;
-
-	/* If we only have one source, then no need to do any
-         * timestamp parsing or byteswapping.
-	 */
-	if (rt->sourcecount == 1) {
-		if (readable_data(&(rt->sources[0]))) {
-			return &(rt->sources[0]);
-		}
-		return NULL;
-	}
-
-
-        for (i = 0; i < rt->sourcecount; i ++) {
-                if (!readable_data(&(rt->sources[i]))) {
-                        continue;
-                }
-
-		if (rt->sources[i].nextts == 0) {
-               		daghdr = (dag_record_t *)(rt->sources[i].nextread);
-	                currentts = bswap_le_to_host64(daghdr->ts);
-			rt->sources[i].nextts = currentts;
-		} else {
-			currentts = rt->sources[i].nextts;
-		}
-
-                if (earliest == 0 || earliest > currentts) {
-                        earliest = currentts;
-                        ssock = &(rt->sources[i]);
-                }
+/* The source holding the earliest record that is ready to be read */
+static inline streamsock_t *select_next_packet(recvstream_t *rt) {
+        if (rt->heapsize == 0) {
+                return NULL;
         }
-        return ssock;
+        return &(rt->sources[rt->heap[0]]);
 }
 
 static int ndag_read_packet(libtrace_t *libtrace, libtrace_packet_t *packet) {
@@ -254,6 +254,10 @@ static int pcapfile_start_input(libtrace_t *libtrace)
 			return -1;
 		}
 
+		/* Packet records start immediately after the header, so
+		 * the file can be indexed for seeking from here */
+		if (trace_seek_index_start(libtrace, NULL) < 0)
+			return -1;
 	}
 
 	return 0;
@@ -292,6 +296,9 @@ static int pcapfile_config_input(libtrace_t *libtrace,
 		case TRACE_OPTION_XDP_DRV_MODE:
 		case TRACE_OPTION_XDP_ZERO_COPY_MODE:
 		case TRACE_OPTION_XDP_COPY_MODE:
+		case TRACE_OPTION_SEEK_INDEX_INTERVAL:
+		case TRACE_OPTION_SEEK_INDEX_FILE:
+		case TRACE_OPTION_EAGER_PARSE:
 	break;
 	}
 	trace_set_err(libtrace,TRACE_ERR_UNKNOWN_OPTION,
@@ -309,11 +316,10 @@ static int pcapfile_fin_input(libtrace_t *libtrace)
 
 static int pcapfile_fin_output(libtrace_out_t *libtrace)
 {
-	if (DATAOUT(libtrace)->file)
-		wandio_wdestroy(DATAOUT(libtrace)->file);
+	int ret = trace_close_file_out(libtrace, DATAOUT(libtrace)->file);
 	free(libtrace->format_data);
 	libtrace->format_data=NULL;
-	return 0; /* success */
+	return ret;
 }
 
 static int pcapfile_config_output(libtrace_out_t *libtrace,
@@ -464,7 +470,7 @@ static int pcapfile_write_packet(libtrace_out_t *out,
 	struct libtrace_pcapfile_pkt_hdr_t hdr;
 	struct timeval tv = trace_get_timeval(packet);
 	int numbytes;
-	int ret;
+	struct iovec iov[2];
 	void *ptr;
 	uint32_t remaining;
 	libtrace_linktype_t linktype;
@@ -553,26 +559,20 @@ static int pcapfile_write_packet(libtrace_out_t *out,
 	if (hdr.caplen > hdr.wirelen)
 		hdr.caplen = hdr.wirelen;
 
-	/* Write the packet header */
-	numbytes=wandio_wwrite(DATAOUT(out)->file,
-			&hdr, sizeof(hdr));
-
-	if (numbytes!=sizeof(hdr)) {
-                trace_set_err_out(out, TRACE_ERR_WANDIO_FAILED, "Failed to write to pcapfile: %s", strerror(errno));
-		return -1;
-        }
+	/* Write the packet header and the rest of the packet together */
+	iov[0].iov_base = &hdr;
+	iov[0].iov_len = sizeof(hdr);
+	iov[1].iov_base = ptr;
+	iov[1].iov_len = hdr.caplen;
 
-	/* Write the rest of the packet now */
-	ret=wandio_wwrite(DATAOUT(out)->file,
-			ptr,
-			hdr.caplen);
+	numbytes = trace_write_iov(DATAOUT(out)->file, iov, 2);
 
-	if (ret!=(int)hdr.caplen) {
+	if (numbytes != (int)(sizeof(hdr) + hdr.caplen)) {
                 trace_set_err_out(out, TRACE_ERR_WANDIO_FAILED, "Failed to write to pcapfile: %s", strerror(errno));
 		return -1;
         }
 
-	return numbytes+ret;
+	return numbytes;
 }
 
 static int pcapfile_flush_output(libtrace_out_t *out) {
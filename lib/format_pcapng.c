@@ -41,6 +41,7 @@
 
 static char *pcapng_parse_next_option(libtrace_t *libtrace, char **pktbuf,
                 uint16_t *code, uint16_t *length, pcapng_hdr_t *blockhdr);
+static int pcapng_seek_resync(libtrace_t *libtrace, int64_t offset);
 
 static bool pcapng_can_write(libtrace_packet_t *packet) {
 	/* Get the linktype */
@@ -588,7 +589,9 @@ static int pcapng_start_input(libtrace_t *libtrace) {
         if (!libtrace->io)
                 return -1;
 
-        return 0;
+        /* Interface blocks can appear anywhere in the file, so make sure
+         * we see them all if a seek jumps ahead of what we've read */
+        return trace_seek_index_start(libtrace, pcapng_seek_resync);
 }
 
 static int pcapng_config_input(libtrace_t *libtrace, trace_option_t option,
@@ -622,6 +625,9 @@ static int pcapng_config_input(libtrace_t *libtrace, trace_option_t option,
                 case TRACE_OPTION_XDP_DRV_MODE:
                 case TRACE_OPTION_XDP_ZERO_COPY_MODE:
                 case TRACE_OPTION_XDP_COPY_MODE:
+                case TRACE_OPTION_SEEK_INDEX_INTERVAL:
+                case TRACE_OPTION_SEEK_INDEX_FILE:
+                case TRACE_OPTION_EAGER_PARSE:
                     break;
         }
 
@@ -665,12 +671,10 @@ static int pcapng_fin_input(libtrace_t *libtrace) {
 }
 
 static int pcapng_fin_output(libtrace_out_t *libtrace) {
-	if (DATAOUT(libtrace)->file) {
-		wandio_wdestroy(DATAOUT(libtrace)->file);
-	}
+	int ret = trace_close_file_out(libtrace, DATAOUT(libtrace)->file);
 	free(libtrace->format_data);
 	libtrace->format_data = NULL;
-	return 0;
+	return ret;
 }
 
 static char *pcapng_parse_next_option(libtrace_t *libtrace, char **pktbuf,
@@ -950,7 +954,8 @@ static int pcapng_write_packet(libtrace_out_t *libtrace, libtrace_packet_t *pack
 	uint32_t padding;
 	uint32_t caplen;
 	uint32_t wirelen;
-	void *padding_data;
+	static const char padding_data[4] = {0, 0, 0, 0};
+	struct iovec iov[4];
 	pcapng_epkt_t epkthdr;
 
 	link = trace_get_packet_buffer(packet, &linktype, &remaining);
@@ -974,7 +979,6 @@ static int pcapng_write_packet(libtrace_out_t *libtrace, libtrace_packet_t *pack
 	/* calculate padding to 32bits */
 	padding = caplen % 4;
 	if (padding) { padding = 4 - padding; }
-	padding_data = calloc(1, padding);
 
 	/* get pcapng_timestamp */
         struct pcapng_timestamp ts = pcapng_get_timestamp(packet);
@@ -991,17 +995,22 @@ static int pcapng_write_packet(libtrace_out_t *libtrace, libtrace_packet_t *pack
 	epkthdr.wlen = pcapng_swap32(libtrace, wirelen);
         epkthdr.caplen = pcapng_swap32(libtrace, caplen);
 
-	/* output enhanced packet header */
-	wandio_wwrite(DATAOUT(libtrace)->file, &epkthdr, sizeof(epkthdr));
-	/* output the packet */
-	wandio_wwrite(DATAOUT(libtrace)->file, link, (size_t)caplen);
-	/* output padding */
-	wandio_wwrite(DATAOUT(libtrace)->file, padding_data, (size_t)padding);
-	/* output rest of the enhanced packet */
-	wandio_wwrite(DATAOUT(libtrace)->file, &epkthdr.blocklen, sizeof(epkthdr.blocklen));
-
-	/* release padding memory */
-	free(padding_data);
+	/* output the enhanced packet header, the packet, padding and the
+	 * rest of the enhanced packet as a single record */
+	iov[0].iov_base = &epkthdr;
+	iov[0].iov_len = sizeof(epkthdr);
+	iov[1].iov_base = link;
+	iov[1].iov_len = caplen;
+	iov[2].iov_base = (void *)padding_data;
+	iov[2].iov_len = padding;
+	iov[3].iov_base = &epkthdr.blocklen;
+	iov[3].iov_len = sizeof(epkthdr.blocklen);
+
+	if (trace_write_iov(DATAOUT(libtrace)->file, iov, 4) != blocklen) {
+		trace_set_err_out(libtrace, TRACE_ERR_WANDIO_FAILED,
+			"Failed to write to pcapng file: %s", strerror(errno));
+		return -1;
+	}
 
 	return blocklen;
 }
@@ -1108,6 +1117,8 @@ static int pcapng_read_interface(libtrace_t *libtrace,
         uint16_t optcode, optlen;
         char *optval = NULL;
         char *bodyptr = NULL;
+        int64_t offset;
+        uint16_t i;
 
         if (blocklen < sizeof(pcapng_int_t) + 4) {
                 trace_set_err(libtrace, TRACE_ERR_BAD_PACKET,
@@ -1116,6 +1127,22 @@ static int pcapng_read_interface(libtrace_t *libtrace,
         }
         inthdr = (pcapng_int_t *)packet->buffer;
 
+        /* The whole block has already been read, so work out where it
+         * started. If we've seen this block before (i.e. we have seeked
+         * backwards), we already know about this interface. */
+        offset = wandio_tell(libtrace->io) - blocklen;
+        for (i = 0; i < DATA(libtrace)->nextintid; i++) {
+                if (DATA(libtrace)->interfaces[i]->offset != offset) {
+                        continue;
+                }
+                packet->type = TRACE_RT_PCAPNG_META;
+                if (pcapng_prepare_packet(libtrace, packet, packet->buffer,
+                                packet->type, flags)) {
+                        return -1;
+                }
+                return (int) blocklen;
+        }
+
         newint = (pcapng_interface_t *)malloc(sizeof(pcapng_interface_t));
 
         newint->id = DATA(libtrace)->nextintid;
@@ -1127,6 +1154,7 @@ static int pcapng_read_interface(libtrace_t *libtrace,
         newint->osdropped = 0;
         newint->laststats = 0;
         newint->tsresol = 1000000;
+        newint->offset = offset;
 
         if (DATA(libtrace)->byteswapped) {
 		if (byteswap32(inthdr->blocktype) != PCAPNG_INTERFACE_TYPE) {
@@ -1165,6 +1193,8 @@ static int pcapng_read_interface(libtrace_t *libtrace,
                 return -1;
         }
 
+        trace_update_interface_meta(libtrace, packet, newint->id);
+
         do {
                 optval = pcapng_parse_next_option(libtrace, &bodyptr,
                                 &optcode, &optlen, (pcapng_hdr_t *) packet->buffer);
@@ -1702,6 +1732,75 @@ static int pcapng_read_packet(libtrace_t *libtrace, libtrace_packet_t *packet)
 
 }
 
+/* Moves the reader forward to the given offset, which must be the start of a
+ * block, processing any section and interface blocks on the way so that the
+ * packets after that offset can be interpreted correctly. */
+static int pcapng_seek_resync(libtrace_t *libtrace, int64_t offset) {
+
+        struct pcapng_peeker peeker;
+        libtrace_packet_t *packet;
+        int64_t current;
+        uint32_t btype, to_read;
+        int err = 1;
+
+        packet = trace_create_packet();
+        packet->trace = libtrace;
+        packet->buffer = malloc((size_t)LIBTRACE_PACKET_BUFSIZE);
+        packet->buf_control = TRACE_CTRL_PACKET;
+
+        while ((current = wandio_tell(libtrace->io)) < offset) {
+                err = wandio_peek(libtrace->io, &peeker, sizeof(peeker));
+                if (err < (int)sizeof(struct pcapng_peeker)) {
+                        trace_set_err(libtrace, TRACE_ERR_WANDIO_FAILED,
+                                "Unable to reach offset %" PRId64 " in pcapng trace",
+                                offset);
+                        err = -1;
+                        break;
+                }
+
+                if (DATA(libtrace)->byteswapped) {
+                        btype = byteswap32(peeker.blocktype);
+                        to_read = byteswap32(peeker.blocklen);
+                } else {
+                        btype = peeker.blocktype;
+                        to_read = peeker.blocklen;
+                }
+
+                if (btype == PCAPNG_SECTION_TYPE) {
+                        err = pcapng_read_section(libtrace, packet,
+                                        TRACE_PREP_OWN_BUFFER);
+                } else if (to_read > LIBTRACE_PACKET_BUFSIZE) {
+                        trace_set_err(libtrace, TRACE_ERR_BAD_PACKET,
+                                "Oversized pcapng block found, is the trace corrupted?");
+                        err = -1;
+                } else if (btype == PCAPNG_INTERFACE_TYPE) {
+                        err = pcapng_read_body(libtrace, packet->buffer,
+                                        to_read);
+                        if (err > 0) {
+                                err = pcapng_read_interface(libtrace, packet,
+                                                to_read, TRACE_PREP_OWN_BUFFER);
+                        }
+                } else if (wandio_seek(libtrace->io, current + to_read,
+                                        SEEK_SET) < 0) {
+                        /* Can't seek (e.g. compressed), so read past it */
+                        err = pcapng_read_body(libtrace, packet->buffer,
+                                        to_read);
+                }
+
+                if (err <= 0) {
+                        break;
+                }
+        }
+
+        trace_destroy_packet(packet);
+
+        if (err == 0) {
+                trace_set_err(libtrace, TRACE_ERR_BAD_IO,
+                        "pcapng trace ended before offset %" PRId64, offset);
+        }
+        return err > 0 ? 0 : -1;
+}
+
 static libtrace_linktype_t pcapng_get_link_type(const libtrace_packet_t *packet) {
 
 	if (packet->type == TRACE_RT_PCAPNG_META) {
@@ -2283,6 +2382,83 @@ libtrace_meta_t *pcapng_get_all_meta(libtrace_packet_t *packet) {
 
 }
 
+int pcapng_meta_iter_start(libtrace_meta_iter_t *iter,
+                libtrace_packet_t *packet) {
+
+	struct pcapng_peeker *hdr;
+	char *ptr;
+	uint32_t blocklen;
+	uint32_t offset;
+
+	if (packet->buffer == NULL) { return -1; }
+	ptr = pcapng_jump_to_options(packet);
+	if (ptr == NULL) { return -1; }
+
+	hdr = (struct pcapng_peeker *)packet->buffer;
+	iter->byteswapped = DATA(packet->trace)->byteswapped;
+	if (iter->byteswapped) {
+		iter->section = byteswap32(hdr->blocktype);
+		blocklen = byteswap32(hdr->blocklen);
+	} else {
+		iter->section = hdr->blocktype;
+		blocklen = hdr->blocklen;
+	}
+
+	/* Options run up to the block length that ends the block */
+	offset = ptr - (char *)packet->buffer;
+	iter->packet = packet;
+	iter->next = ptr;
+	iter->sections = 1;
+	if (blocklen < offset + sizeof(uint32_t)) {
+		iter->remaining = 0;
+	} else {
+		iter->remaining = blocklen - offset - sizeof(uint32_t);
+	}
+	return 0;
+}
+
+int pcapng_meta_iter_next(libtrace_meta_iter_t *iter,
+                libtrace_meta_item_t *item) {
+
+	struct pcapng_optheader *opthdr;
+	uint16_t optcode, optlen;
+	uint32_t skip;
+
+	if (iter->remaining < sizeof(struct pcapng_optheader)) { return 0; }
+
+	opthdr = (struct pcapng_optheader *)iter->next;
+	if (iter->byteswapped) {
+		optcode = byteswap16(opthdr->optcode);
+		optlen = byteswap16(opthdr->optlen);
+	} else {
+		optcode = opthdr->optcode;
+		optlen = opthdr->optlen;
+	}
+
+	if (optcode == PCAPNG_OPTION_END ||
+			sizeof(struct pcapng_optheader) + optlen >
+			iter->remaining) {
+		iter->remaining = 0;
+		return 0;
+	}
+
+	item->section = iter->section;
+	item->option = optcode;
+	item->option_name = NULL;
+	item->len = optlen;
+	item->datatype = pcapng_get_datatype(iter->section, optcode);
+	item->data = iter->next + sizeof(struct pcapng_optheader);
+
+	/* Options are padded to 32 bits */
+	skip = sizeof(struct pcapng_optheader) + ((optlen + 3) & ~3);
+	if (skip > iter->remaining) {
+		skip = iter->remaining;
+	}
+	iter->next += skip;
+	iter->remaining -= skip;
+	return 1;
+}
+
 static void pcapng_help(void) {
         printf("pcapng format module: \n");
         printf("Supported input URIs:\n");
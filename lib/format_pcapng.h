@@ -201,6 +201,10 @@ struct pcapng_interface_t {
         uint64_t osdropped;
         uint64_t laststats;
 
+        /* Offset of the interface block within the trace file, so that
+         * it is not added twice if the block is read again after a seek */
+        int64_t offset;
+
 };
 
 struct pcapng_format_data_t {
@@ -261,3 +265,7 @@ ct_assert(sizeof(struct pcapng_peeker) == 8);
 typedef struct pcapng_peeker pcapng_hdr_t;
 
 libtrace_meta_t *pcapng_get_all_meta(libtrace_packet_t *packet);
+int pcapng_meta_iter_start(libtrace_meta_iter_t *iter,
+                libtrace_packet_t *packet);
+int pcapng_meta_iter_next(libtrace_meta_iter_t *iter,
+                libtrace_meta_item_t *item);
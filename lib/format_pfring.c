@@ -496,6 +496,7 @@ UNUSED static int pfringzc_config_input(libtrace_t *libtrace, trace_option_t opt
 				case HASHER_BALANCE:
 					return 0;		
 				case HASHER_CUSTOM:
+				case HASHER_FRAGMENT:
 					return -1;
 			}
 			break;
@@ -509,6 +510,9 @@ UNUSED static int pfringzc_config_input(libtrace_t *libtrace, trace_option_t opt
 		case TRACE_OPTION_XDP_SKB_MODE:
 		case TRACE_OPTION_XDP_ZERO_COPY_MODE:
 		case TRACE_OPTION_XDP_COPY_MODE:
+		case TRACE_OPTION_SEEK_INDEX_INTERVAL:
+		case TRACE_OPTION_SEEK_INDEX_FILE:
+		case TRACE_OPTION_EAGER_PARSE:
 			break;
 	}
 	return -1;
@@ -537,6 +541,7 @@ static int pfring_config_input(libtrace_t *libtrace, trace_option_t option,
 				case HASHER_BALANCE:
 				case HASHER_CUSTOM:
 				case HASHER_BIDIRECTIONAL:
+				case HASHER_FRAGMENT:
 					return -1;
 			}
 			break;
@@ -550,6 +555,9 @@ static int pfring_config_input(libtrace_t *libtrace, trace_option_t option,
 		case TRACE_OPTION_XDP_SKB_MODE:
 		case TRACE_OPTION_XDP_ZERO_COPY_MODE:
 		case TRACE_OPTION_XDP_COPY_MODE:
+		case TRACE_OPTION_SEEK_INDEX_INTERVAL:
+		case TRACE_OPTION_SEEK_INDEX_FILE:
+		case TRACE_OPTION_EAGER_PARSE:
 			break;
 	}
 	return -1;
@@ -681,7 +689,7 @@ static int pfringzc_read_batch(libtrace_t *libtrace,
 		}
 
 		if (received == 0) {
-			if (queue && libtrace_message_queue_count(queue) > 0)
+			if (queue && libtrace_message_queue_ready(queue))
 				return READ_MESSAGE;
 			if (is_halted(libtrace) != -1) {
 				return is_halted(libtrace);
@@ -724,7 +732,7 @@ static int pfring_read_generic(libtrace_t *libtrace, libtrace_packet_t *packet,
 		}
 
 		if (rc == 0) {
-			if (queue && libtrace_message_queue_count(queue) > 0)
+			if (queue && libtrace_message_queue_ready(queue))
 				return READ_MESSAGE;
 			if (is_halted(libtrace) != -1) {
 				return is_halted(libtrace);
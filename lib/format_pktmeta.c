@@ -2,6 +2,7 @@
 #include "libtrace.h"
 #include "format_erf.h"
 #include "format_pcapng.h"
+#include "format_helper.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -90,9 +91,343 @@ static libtrace_meta_t *trace_get_meta_option(libtrace_packet_t *packet, uint32_
 	}
 }
 
+/* Finds the index'th occurrence of an interface option within a meta packet,
+ * without copying anything */
+static int trace_find_interface_option(libtrace_packet_t *packet,
+	uint32_t erf_option, uint32_t pcapng_option, int index,
+	libtrace_meta_item_t *item) {
+
+	libtrace_meta_iter_t iter;
+	uint32_t section, option;
+
+	if (packet->trace->format->type == TRACE_FORMAT_ERF) {
+		section = ERF_PROV_SECTION_INTERFACE;
+		option = erf_option;
+	} else if (packet->trace->format->type == TRACE_FORMAT_PCAPNG) {
+		section = PCAPNG_INTERFACE_TYPE;
+		option = pcapng_option;
+	} else {
+		return 0;
+	}
+
+	if (trace_meta_iter_start(&iter, packet) < 0) { return 0; }
+	while (trace_meta_iter_next(&iter, item) == 1) {
+		if (item->section != section || item->option != option) {
+			continue;
+		}
+		if (index == 0) { return 1; }
+		index --;
+	}
+	return 0;
+}
+
+/* Copies a meta-data value into a caller supplied buffer, truncating it if
+ * necessary, and NUL terminates it */
+static char *trace_copy_meta_value(libtrace_meta_item_t *item, char *space,
+	int spacelen) {
+
+	int len = item->len;
+
+	if (spacelen <= 0) { return NULL; }
+	if (len > spacelen - 1) { len = spacelen - 1; }
+	memcpy(space, item->data, len);
+	space[len] = '\0';
+	return space;
+}
+
+/* The option codes for the interface properties in each format */
+struct interface_options {
+	uint32_t section;
+	uint32_t name;
+	uint32_t descr;
+	uint32_t speed;
+	uint32_t ipv4;
+	uint32_t mac;
+	uint32_t fcslen;
+	uint32_t ifnum;
+};
+
+static const struct interface_options erf_interface_options = {
+	ERF_PROV_SECTION_INTERFACE, ERF_PROV_NAME, ERF_PROV_DESCR,
+	ERF_PROV_IF_SPEED, ERF_PROV_IF_IPV4, ERF_PROV_IF_MAC, ERF_PROV_FCS_LEN,
+	ERF_PROV_IF_NUM
+};
+
+/* pcapng interfaces are numbered by the order of their blocks, so there is
+ * no interface number option -- 0 marks the end of the options and is never
+ * returned as an item */
+static const struct interface_options pcapng_interface_options = {
+	PCAPNG_INTERFACE_TYPE, PCAPNG_META_IF_NAME, PCAPNG_META_IF_DESCR,
+	PCAPNG_META_IF_SPEED, PCAPNG_META_IF_IP4, PCAPNG_META_IF_MAC,
+	PCAPNG_META_IF_FCSLEN, PCAPNG_OPTION_END
+};
+
+/* Interfaces are stored in blocks of this many, allocated as they are
+ * needed */
+#define INTERFACE_BLOCK 256
+
+/* Each record that changes an interface adds a new version rather than
+ * changing the old one, as other threads may still be using it */
+struct interface_version {
+	libtrace_interface_meta_t meta;
+	/* The version this one replaced, kept until the trace is destroyed */
+	struct interface_version *older;
+};
+
+struct libtrace_interface_cache {
+	struct interface_version **blocks[0x10000 / INTERFACE_BLOCK];
+};
+
+static void trace_free_interface_meta(libtrace_interface_meta_t *intf) {
+	free(intf->name);
+	free(intf->description);
+}
+
+static bool same_string(const char *a, const char *b) {
+	if (a == NULL || b == NULL) {
+		return a == b;
+	}
+	return strcmp(a, b) == 0;
+}
+
+static bool same_interface_meta(const libtrace_interface_meta_t *a,
+	const libtrace_interface_meta_t *b) {
+
+	return same_string(a->name, b->name) &&
+		same_string(a->description, b->description) &&
+		a->speed == b->speed && a->ipv4 == b->ipv4 &&
+		a->fcslen == b->fcslen &&
+		memcmp(a->mac, b->mac, sizeof(a->mac)) == 0;
+}
+
+/* Only ever called by the thread reading the trace, but other threads may
+ * be looking up interfaces at the same time. Anything they can reach is
+ * published with a release store and never changed afterwards. */
+static void trace_store_interface_meta(libtrace_t *libtrace, uint32_t ifid,
+	libtrace_interface_meta_t *intf) {
+
+	struct libtrace_interface_cache *cache = libtrace->interfaces;
+	struct interface_version **block, *cur, *version;
+
+	/* Interface ids are 16 bits in both pcapng and ERF */
+	if (ifid > 0xffff) {
+		goto discard;
+	}
+
+	if (cache == NULL) {
+		cache = (struct libtrace_interface_cache *)calloc(1,
+				sizeof(struct libtrace_interface_cache));
+		if (cache == NULL) {
+			goto discard;
+		}
+		__atomic_store_n(&libtrace->interfaces, cache,
+				__ATOMIC_RELEASE);
+	}
+
+	block = cache->blocks[ifid / INTERFACE_BLOCK];
+	if (block == NULL) {
+		block = (struct interface_version **)calloc(INTERFACE_BLOCK,
+				sizeof(struct interface_version *));
+		if (block == NULL) {
+			goto discard;
+		}
+		__atomic_store_n(&cache->blocks[ifid / INTERFACE_BLOCK], block,
+				__ATOMIC_RELEASE);
+	}
+
+	/* Most records repeat what is already known */
+	cur = block[ifid % INTERFACE_BLOCK];
+	if (cur != NULL && same_interface_meta(&cur->meta, intf)) {
+		goto discard;
+	}
+
+	version = (struct interface_version *)malloc(
+			sizeof(struct interface_version));
+	if (version == NULL) {
+		goto discard;
+	}
+	version->meta = *intf;
+	version->meta.valid = true;
+	version->older = cur;
+	__atomic_store_n(&block[ifid % INTERFACE_BLOCK], version,
+			__ATOMIC_RELEASE);
+	return;
+
+discard:
+	trace_free_interface_meta(intf);
+}
+
+void trace_update_interface_meta(libtrace_t *libtrace,
+	libtrace_packet_t *packet, int ifid) {
+
+	const struct interface_options *opts;
+	libtrace_interface_meta_t cur;
+	libtrace_meta_iter_t iter;
+	libtrace_meta_item_t item;
+	uint16_t cursection = 0;
+	int64_t curid = ifid;
+	int ordinal = -1;
+	bool pending;
+
+	if (libtrace->format->type == TRACE_FORMAT_ERF) {
+		opts = &erf_interface_options;
+	} else if (libtrace->format->type == TRACE_FORMAT_PCAPNG) {
+		opts = &pcapng_interface_options;
+	} else {
+		return;
+	}
+
+	if (trace_meta_iter_start(&iter, packet) < 0) { return; }
+
+	memset(&cur, 0, sizeof(cur));
+	/* A pcapng interface block describes an interface even if it has no
+	 * options at all */
+	pending = (ifid >= 0);
+
+	while (trace_meta_iter_next(&iter, &item) == 1) {
+		if (item.section != opts->section) { continue; }
+
+		/* An ERF record can describe several interfaces, one per
+		 * interface section */
+		if (ifid < 0 && iter.sections != cursection) {
+			if (pending) {
+				trace_store_interface_meta(libtrace, curid,
+						&cur);
+				memset(&cur, 0, sizeof(cur));
+			}
+			cursection = iter.sections;
+			ordinal ++;
+			curid = ordinal;
+			pending = true;
+		}
+
+		if (item.option == opts->name) {
+			free(cur.name);
+			cur.name = strndup((char *)item.data, item.len);
+		} else if (item.option == opts->descr) {
+			free(cur.description);
+			cur.description = strndup((char *)item.data, item.len);
+		} else if (item.option == opts->speed) {
+			cur.speed = trace_meta_iter_get_uint(&iter, &item);
+		} else if (item.option == opts->ipv4 && item.len >= 4) {
+			memcpy(&cur.ipv4, item.data, sizeof(cur.ipv4));
+		} else if (item.option == opts->mac && item.len >= 6) {
+			memcpy(cur.mac, item.data, sizeof(cur.mac));
+		} else if (item.option == opts->fcslen) {
+			cur.fcslen = trace_meta_iter_get_uint(&iter, &item);
+		} else if (item.option == opts->ifnum) {
+			curid = trace_meta_iter_get_uint(&iter, &item);
+		}
+	}
+
+	if (pending) {
+		trace_store_interface_meta(libtrace, curid, &cur);
+	}
+}
+
+void trace_destroy_interface_meta(libtrace_t *libtrace) {
+	struct libtrace_interface_cache *cache = libtrace->interfaces;
+	struct interface_version *version, *older;
+	uint32_t i, j;
+
+	if (cache == NULL) {
+		return;
+	}
+	for (i = 0; i < 0x10000 / INTERFACE_BLOCK; i++) {
+		if (cache->blocks[i] == NULL) {
+			continue;
+		}
+		for (j = 0; j < INTERFACE_BLOCK; j++) {
+			for (version = cache->blocks[i][j]; version != NULL;
+					version = older) {
+				older = version->older;
+				trace_free_interface_meta(&version->meta);
+				free(version);
+			}
+		}
+		free(cache->blocks[i]);
+	}
+	free(cache);
+	libtrace->interfaces = NULL;
+}
+
 
 /* API FUNCTIONS */
 
+int trace_meta_iter_start(libtrace_meta_iter_t *iter,
+	libtrace_packet_t *packet) {
+
+	if (trace_meta_check_input(packet, "trace_meta_iter_start()")<0) {
+		return -1;
+	}
+
+	if (packet->trace->format->type == TRACE_FORMAT_ERF) {
+		return erf_meta_iter_start(iter, packet);
+	}
+	if (packet->trace->format->type == TRACE_FORMAT_PCAPNG) {
+		return pcapng_meta_iter_start(iter, packet);
+	}
+	return -1;
+}
+
+int trace_meta_iter_next(libtrace_meta_iter_t *iter,
+	libtrace_meta_item_t *item) {
+
+	if (iter->packet->trace->format->type == TRACE_FORMAT_ERF) {
+		return erf_meta_iter_next(iter, item);
+	}
+	if (iter->packet->trace->format->type == TRACE_FORMAT_PCAPNG) {
+		return pcapng_meta_iter_next(iter, item);
+	}
+	return 0;
+}
+
+uint64_t trace_meta_iter_get_uint(const libtrace_meta_iter_t *iter,
+	const libtrace_meta_item_t *item) {
+
+	uint16_t v16;
+	uint32_t v32;
+	uint64_t v64;
+
+	switch (item->len) {
+		case 1:
+			return *(uint8_t *)item->data;
+		case 2:
+			memcpy(&v16, item->data, sizeof(v16));
+			return iter->byteswapped ? byteswap16(v16) : v16;
+		case 4:
+			memcpy(&v32, item->data, sizeof(v32));
+			return iter->byteswapped ? byteswap32(v32) : v32;
+		case 8:
+			memcpy(&v64, item->data, sizeof(v64));
+			return iter->byteswapped ? byteswap64(v64) : v64;
+	}
+	return 0;
+}
+
+const libtrace_interface_meta_t *trace_get_interface_meta(libtrace_t *trace,
+	uint32_t ifid) {
+
+	struct libtrace_interface_cache *cache;
+	struct interface_version **block, *version;
+
+	if (trace == NULL || ifid > 0xffff) {
+		return NULL;
+	}
+	cache = __atomic_load_n(&trace->interfaces, __ATOMIC_ACQUIRE);
+	if (cache == NULL) {
+		return NULL;
+	}
+	block = __atomic_load_n(&cache->blocks[ifid / INTERFACE_BLOCK],
+			__ATOMIC_ACQUIRE);
+	if (block == NULL) {
+		return NULL;
+	}
+	version = __atomic_load_n(&block[ifid % INTERFACE_BLOCK],
+			__ATOMIC_ACQUIRE);
+	return version ? &version->meta : NULL;
+}
+
 int trace_destroy_meta(libtrace_meta_t *result) {
         int i;
         if (!result) { return -1; }
@@ -133,24 +468,16 @@ libtrace_meta_t *trace_get_interface_name_meta(libtrace_packet_t *packet) {
 char *trace_get_interface_name(libtrace_packet_t *packet, char *space, int spacelen,
 	int index) {
 
-	libtrace_meta_t *r = trace_get_interface_name_meta(packet);
-	if (r == NULL) { return NULL; }
-	/* If there is not a result for the index return */
-	if (r->num <= index) {
-		trace_destroy_meta(r);
+	libtrace_meta_item_t item;
+
+	if (trace_meta_check_input(packet, "trace_get_interface_name()")<0) {
 		return NULL;
 	}
-	/* Ensure the supplied memory allocation is enough, if not only fill
-	 * what we can. */
-	if (spacelen > r->items[index].len) {
-		memcpy(space, r->items[index].data, r->items[index].len);
-		space[r->items[index].len] = '\0';
-	} else {
-		memcpy(space, r->items[index].data, spacelen);
-		space[spacelen] = '\0';
+	if (!trace_find_interface_option(packet, ERF_PROV_NAME,
+			PCAPNG_META_IF_NAME, index, &item)) {
+		return NULL;
 	}
-	trace_destroy_meta(r);
-	return space;
+	return trace_copy_meta_value(&item, space, spacelen);
 }
 
 libtrace_meta_t *trace_get_interface_mac_meta(libtrace_packet_t *packet) {
@@ -173,21 +500,16 @@ libtrace_meta_t *trace_get_interface_mac_meta(libtrace_packet_t *packet) {
 char *trace_get_interface_mac(libtrace_packet_t *packet, char *space, int spacelen,
 	int index) {
 
-	libtrace_meta_t *r = trace_get_interface_mac_meta(packet);
-	if (r == NULL) { return NULL; }
-	if (index >= r->num) {
-		trace_destroy_meta(r);
+	libtrace_meta_item_t item;
+
+	if (trace_meta_check_input(packet, "trace_get_interface_mac()")<0) {
 		return NULL;
 	}
-	if (r->items[index].len > spacelen) {
-		memcpy(space, r->items[index].data, spacelen);
-		space[spacelen] = '\0';
-	} else {
-		memcpy(space, r->items[index].data, r->items[index].len);
-		space[r->items[index].len] = '\0';
+	if (!trace_find_interface_option(packet, ERF_PROV_IF_MAC,
+			PCAPNG_META_IF_MAC, index, &item)) {
+		return NULL;
 	}
-	trace_destroy_meta(r);
-	return space;
+	return trace_copy_meta_value(&item, space, spacelen);
 }
 
 libtrace_meta_t *trace_get_interface_speed_meta(libtrace_packet_t *packet) {
@@ -208,17 +530,19 @@ libtrace_meta_t *trace_get_interface_speed_meta(libtrace_packet_t *packet) {
 }
 
 uint64_t trace_get_interface_speed(libtrace_packet_t *packet, int index) {
-	libtrace_meta_t *r = trace_get_interface_speed_meta(packet);
-	if (r == NULL) { return 0; }
-	/* If the index wanted does not exist return 0 */
-	if (index >= r->num) {
-		trace_destroy_meta(r);
+	libtrace_meta_iter_t iter;
+	libtrace_meta_item_t item;
+
+	if (trace_meta_check_input(packet, "trace_get_interface_speed()")<0) {
 		return 0;
 	}
-	/* Need to check this more ERF reports this in network order */
-	uint64_t data = *(uint64_t *)r->items[index].data;
-	trace_destroy_meta(r);
-	return data;
+	if (!trace_find_interface_option(packet, ERF_PROV_IF_SPEED,
+			PCAPNG_META_IF_SPEED, index, &item)) {
+		return 0;
+	}
+	/* Only needed for the byte order of the record */
+	if (trace_meta_iter_start(&iter, packet) < 0) { return 0; }
+	return trace_meta_iter_get_uint(&iter, &item);
 }
 
 libtrace_meta_t *trace_get_interface_ipv4_meta(libtrace_packet_t *packet) {
@@ -239,14 +563,17 @@ libtrace_meta_t *trace_get_interface_ipv4_meta(libtrace_packet_t *packet) {
 }
 
 uint32_t trace_get_interface_ipv4(libtrace_packet_t *packet, int index) {
-	libtrace_meta_t *r = trace_get_interface_ipv4_meta(packet);
-	if (r == NULL) { return 0; }
-	if (index >= r->num) {
-		trace_destroy_meta(r);
+	libtrace_meta_item_t item;
+	uint32_t data;
+
+	if (trace_meta_check_input(packet, "trace_get_interface_ip4()")<0) {
 		return 0;
 	}
-	uint32_t data = *(uint32_t *)r->items[index].data;
-	trace_destroy_meta(r);
+	if (!trace_find_interface_option(packet, ERF_PROV_IF_IPV4,
+			PCAPNG_META_IF_IP4, index, &item) || item.len < 4) {
+		return 0;
+	}
+	memcpy(&data, item.data, sizeof(data));
 	return data;
 }
 
@@ -346,21 +673,16 @@ libtrace_meta_t *trace_get_interface_description_meta(libtrace_packet_t *packet)
 char *trace_get_interface_description(libtrace_packet_t *packet, char *space, int spacelen,
 	int index) {
 
-	libtrace_meta_t *r = trace_get_interface_description_meta(packet);
-	if (r == NULL) { return NULL; }
-	if (r->num <= index) {
-		trace_destroy_meta(r);
+	libtrace_meta_item_t item;
+
+	if (trace_meta_check_input(packet, "trace_get_interface_description()")<0) {
 		return NULL;
 	}
-	if (r->items[index].len > spacelen) {
-		memcpy(space, r->items[index].data, spacelen);
-		space[spacelen] = '\0';
-	} else {
-		memcpy(space, r->items[index].data, r->items[index].len);
-		space[r->items[index].len] = '\0';
+	if (!trace_find_interface_option(packet, ERF_PROV_DESCR,
+			PCAPNG_META_IF_DESCR, index, &item)) {
+		return NULL;
 	}
-	trace_destroy_meta(r);
-	return space;
+	return trace_copy_meta_value(&item, space, spacelen);
 }
 
 libtrace_meta_t *trace_get_host_os_meta(libtrace_packet_t *packet) {
@@ -412,15 +734,18 @@ libtrace_meta_t *trace_get_interface_fcslen_meta(libtrace_packet_t *packet) {
 }
 
 uint32_t trace_get_interface_fcslen(libtrace_packet_t *packet, int index) {
-	libtrace_meta_t *r = trace_get_interface_fcslen_meta(packet);
-	if (r == NULL) { return 0; }
-	if (r->num <= index) {
-		trace_destroy_meta(r);
+	libtrace_meta_iter_t iter;
+	libtrace_meta_item_t item;
+
+	if (trace_meta_check_input(packet, "trace_get_interface_fcslen()")<0) {
 		return 0;
 	}
-	uint32_t data = *(uint32_t *)r->items[index].data;
-	trace_destroy_meta(r);
-	return data;
+	if (!trace_find_interface_option(packet, ERF_PROV_FCS_LEN,
+			PCAPNG_META_IF_FCSLEN, index, &item)) {
+		return 0;
+	}
+	if (trace_meta_iter_start(&iter, packet) < 0) { return 0; }
+	return trace_meta_iter_get_uint(&iter, &item);
 }
 
 libtrace_meta_t *trace_get_interface_comment_meta(libtrace_packet_t *packet) {
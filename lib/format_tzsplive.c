@@ -1,3 +1,7 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include "libtrace.h"
 #include "libtrace_int.h"
 #include "format_tzsplive.h"
@@ -18,14 +22,43 @@
 #define TZSP_RECVBUF_SIZE (64 * 1024 * 1024)
 #define TZSP_SENDBUF_SIZE (64 * 1024 * 1024)
 
+/* Number of datagrams to receive with a single system call */
+#define TZSP_RECV_BATCH (32)
+
+/* Room that must be left at the end of a buffer for the timestamp that is
+ * inserted into every received packet */
+#define TZSP_TIMESTAMP_LEN (sizeof(tzsp_tagfield_t) + 2 * sizeof(uint64_t))
+
 static int tzsplive_get_framing_length(const libtrace_packet_t *packet);
 
+/* A socket and the ring of buffers that datagrams are received into. The
+ * buffers are registered with the socket once, and a received buffer is
+ * handed over to the packet by swapping it for the packet's old buffer, so
+ * that nothing is copied or allocated once every packet has a buffer. */
+typedef struct tzsp_stream {
+	int socket;
+	uint8_t *bufs[TZSP_RECV_BATCH];
+	struct iovec iovs[TZSP_RECV_BATCH];
+#if HAVE_DECL_RECVMMSG
+	struct mmsghdr msgs[TZSP_RECV_BATCH];
+#endif
+	int lens[TZSP_RECV_BATCH];
+	/* Next received datagram to hand out, and how many were received */
+	int next;
+	int count;
+	/* When the current batch was received */
+	struct timeval tv;
+	uint64_t last_timestamp;
+} tzsp_stream_t;
+
 typedef struct tzsp_format_data {
 	char *listenaddr;
 	char *listenport;
 
-	int socket;
-	uint8_t *buf;
+	/* One stream per perpkt thread, all bound to the same address with
+	 * SO_REUSEPORT so that the kernel spreads senders across them */
+	tzsp_stream_t *streams;
+	int nstreams;
 } tzsp_format_data_t;
 
 typedef struct tzsp_format_data_out {
@@ -65,7 +98,8 @@ static bool tzsplive_can_write(libtrace_packet_t *packet) {
 	return true;
 }
 
-static int tzsplive_create_socket(libtrace_t *libtrace) {
+static int tzsplive_create_socket(libtrace_t *libtrace, tzsp_stream_t *stream,
+		bool reuseport) {
 	struct addrinfo hints, *listenai;
 	int reuse = 1;
 	int recvbuf = TZSP_RECVBUF_SIZE;
@@ -88,29 +122,44 @@ static int tzsplive_create_socket(libtrace_t *libtrace) {
 		goto listenerror;
 	}
 
-	FORMAT_DATA->socket = socket(listenai->ai_family, listenai->ai_socktype, 0);
-	if (FORMAT_DATA->socket < 0) {
+	stream->socket = socket(listenai->ai_family, listenai->ai_socktype, 0);
+	if (stream->socket < 0) {
 		fprintf(stderr, "Failed to create socket for %s:%s -- %s\n",
 			FORMAT_DATA->listenaddr, FORMAT_DATA->listenport,
 			strerror(errno));
 		goto listenerror;
 	}
 
-	if (setsockopt(FORMAT_DATA->socket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) < 0) {
+	if (setsockopt(stream->socket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) < 0) {
 		fprintf(stderr, "Failed to configure socket for %s:%s -- %s\n",
 			FORMAT_DATA->listenaddr, FORMAT_DATA->listenport,
 			strerror(errno));
 		goto listenerror;
 	}
 
-	if (setsockopt(FORMAT_DATA->socket, SOL_SOCKET, SO_RCVBUF, &recvbuf, sizeof(recvbuf)) < 0) {
+	if (reuseport) {
+#ifdef SO_REUSEPORT
+		if (setsockopt(stream->socket, SOL_SOCKET, SO_REUSEPORT, &reuse,
+				sizeof(reuse)) < 0) {
+			fprintf(stderr, "Failed to set SO_REUSEPORT for %s:%s -- %s\n",
+				FORMAT_DATA->listenaddr, FORMAT_DATA->listenport,
+				strerror(errno));
+			goto listenerror;
+		}
+#else
+		fprintf(stderr, "SO_REUSEPORT is not supported on this host\n");
+		goto listenerror;
+#endif
+	}
+
+	if (setsockopt(stream->socket, SOL_SOCKET, SO_RCVBUF, &recvbuf, sizeof(recvbuf)) < 0) {
 		fprintf(stderr, "Failed to set receive buffer for %s:%s -- %s\n",
 			FORMAT_DATA->listenaddr, FORMAT_DATA->listenport,
 			strerror(errno));
 		goto listenerror;
 	}
 
-	if (bind(FORMAT_DATA->socket, (struct sockaddr *)listenai->ai_addr, listenai->ai_addrlen) < 0) {
+	if (bind(stream->socket, (struct sockaddr *)listenai->ai_addr, listenai->ai_addrlen) < 0) {
 		fprintf(stderr, "Failed to bind socket for %s:%s -- %s\n",
 			FORMAT_DATA->listenaddr, FORMAT_DATA->listenport,
 			strerror(errno));
@@ -206,16 +255,8 @@ static int tzsplive_init_input(libtrace_t *libtrace) {
         	FORMAT_DATA->listenport = strdup(scan + 1);
         }
 
-	FORMAT_DATA->socket = -1;
-
-	FORMAT_DATA->buf = malloc((size_t)LIBTRACE_PACKET_BUFSIZE);
-	if (FORMAT_DATA->buf == NULL) {
-                trace_set_err(libtrace, TRACE_ERR_OUT_OF_MEMORY, "Unable "
-                        "to allocate memory for format data in tzsplive_init_input()");
-                free(libtrace->format_data);
-                libtrace->format_data = NULL;
-                return -1;
-        }
+	FORMAT_DATA->streams = NULL;
+	FORMAT_DATA->nstreams = 0;
 
 	return 0;
 }
@@ -256,11 +297,70 @@ static int tzsplive_init_output(libtrace_out_t *libtrace) {
 	return 0;
 }
 
+static void tzsplive_destroy_streams(libtrace_t *libtrace) {
+	int i, j;
+
+	for (i = 0; i < FORMAT_DATA->nstreams; i++) {
+		tzsp_stream_t *stream = &FORMAT_DATA->streams[i];
+		if (stream->socket >= 0) {
+			close(stream->socket);
+		}
+		for (j = 0; j < TZSP_RECV_BATCH; j++) {
+			free(stream->bufs[j]);
+		}
+	}
+	free(FORMAT_DATA->streams);
+	FORMAT_DATA->streams = NULL;
+	FORMAT_DATA->nstreams = 0;
+}
+
+static int tzsplive_start_streams(libtrace_t *libtrace, int nstreams) {
+	int i, j;
+
+	FORMAT_DATA->streams = (tzsp_stream_t *)calloc(nstreams,
+		sizeof(tzsp_stream_t));
+	if (FORMAT_DATA->streams == NULL) {
+		trace_set_err(libtrace, TRACE_ERR_OUT_OF_MEMORY, "Unable "
+			"to allocate memory for streams in tzsplive_start_streams()");
+		return -1;
+	}
+	FORMAT_DATA->nstreams = nstreams;
+
+	for (i = 0; i < nstreams; i++) {
+		tzsp_stream_t *stream = &FORMAT_DATA->streams[i];
+		stream->socket = -1;
+
+		for (j = 0; j < TZSP_RECV_BATCH; j++) {
+			stream->bufs[j] = malloc((size_t)LIBTRACE_PACKET_BUFSIZE);
+			if (stream->bufs[j] == NULL) {
+				trace_set_err(libtrace, TRACE_ERR_OUT_OF_MEMORY,
+					"Unable to allocate receive buffers in "
+					"tzsplive_start_streams()");
+				tzsplive_destroy_streams(libtrace);
+				return -1;
+			}
+			stream->iovs[j].iov_base = stream->bufs[j];
+			stream->iovs[j].iov_len = LIBTRACE_PACKET_BUFSIZE -
+				TZSP_TIMESTAMP_LEN;
+#if HAVE_DECL_RECVMMSG
+			stream->msgs[j].msg_hdr.msg_iov = &stream->iovs[j];
+			stream->msgs[j].msg_hdr.msg_iovlen = 1;
+#endif
+		}
+
+		/* create the listener socket */
+		if (tzsplive_create_socket(libtrace, stream, nstreams > 1) < 0) {
+			tzsplive_destroy_streams(libtrace);
+			return -1;
+		}
+	}
+	return 0;
+}
+
 /* Called with trace_start */
 static int tzsplive_start_input(libtrace_t *libtrace) {
 
-	/* create the listener socket */
-	if (tzsplive_create_socket(libtrace) < 0) {
+	if (tzsplive_start_streams(libtrace, 1) < 0) {
 		trace_set_err(libtrace, TRACE_ERR_INIT_FAILED, "Unable to create"
 			" listening socket");
 		return -1;
@@ -269,6 +369,29 @@ static int tzsplive_start_input(libtrace_t *libtrace) {
 	return 1;
 }
 
+static int tzsplive_pstart_input(libtrace_t *libtrace) {
+
+	if (tzsplive_start_streams(libtrace,
+			libtrace->perpkt_thread_count) < 0) {
+		trace_set_err(libtrace, TRACE_ERR_INIT_FAILED, "Unable to create"
+			" listening sockets");
+		return -1;
+	}
+
+	return 0;
+}
+
+static int tzsplive_pregister_thread(libtrace_t *libtrace,
+		libtrace_thread_t *t, bool reader) {
+
+	if (!reader || t->type != THREAD_PERPKT) {
+		return 0;
+	}
+
+	t->format_data = &FORMAT_DATA->streams[t->perpkt_num];
+	return 0;
+}
+
 static int tzsplive_start_output(libtrace_out_t *libtrace) {
 
 	/* create output socket */
@@ -281,10 +404,8 @@ static int tzsplive_start_output(libtrace_out_t *libtrace) {
 	return 1;
 }
 
-static int tzsplive_pause_input(libtrace_t *libtrace UNUSED) {
-	if (FORMAT_DATA->socket >= 0) {
-		close(FORMAT_DATA->socket);
-	}
+static int tzsplive_pause_input(libtrace_t *libtrace) {
+	tzsplive_destroy_streams(libtrace);
 	return 0;
 }
 
@@ -299,12 +420,7 @@ static int tzsplive_fin_input(libtrace_t *libtrace) {
 	if (FORMAT_DATA->listenport) {
 		free(FORMAT_DATA->listenport);
 	}
-	if (FORMAT_DATA->socket >= 0) {
-		close(FORMAT_DATA->socket);
-	}
-	if (FORMAT_DATA->buf) {
-		free(FORMAT_DATA->buf);
-	}
+	tzsplive_destroy_streams(libtrace);
         free(libtrace->format_data);
 	return 0;
 }
@@ -360,25 +476,15 @@ static uint8_t *tzsplive_get_packet_payload(const libtrace_packet_t *packet) {
         return ptr + sizeof(uint8_t);
 }
 
-static int tzsplive_insert_timestamp(libtrace_t *libtrace,
-                libtrace_packet_t *packet, int pktlen) {
-	struct timeval tv;
+static void tzsplive_insert_timestamp(libtrace_packet_t *packet, int pktlen,
+		const struct timeval *tv) {
 	tzsp_tagfield_t timestamp;
 	uint8_t *ptr;
-	int ret = 0;
         uint64_t timesafe;
 
 	// Construct the tagfield
 	timestamp.type = TZSP_LIBTRACE_CUSTOM_TAG_TIMEVAL;
-	timestamp.length = sizeof(tv);
-
-	// Get the current timestamp
-	if ((ret = gettimeofday(&tv, NULL)) != 0) {
-		return 0;
-	}
-
-	// Copy over the current packet
-	memcpy(FORMAT_DATA->buf, packet->buffer, (size_t)pktlen);
+	timestamp.length = sizeof(*tv);
 
 	// pointer to begining of tagged fields
 	ptr = packet->buffer + sizeof(tzsp_header_t);
@@ -390,14 +496,11 @@ static int tzsplive_insert_timestamp(libtrace_t *libtrace,
 	memcpy(ptr, &timestamp, sizeof(tzsp_tagfield_t));
 	ptr += sizeof(tzsp_tagfield_t);
 
-        timesafe = bswap_host_to_be64((uint64_t)(tv.tv_sec));
+        timesafe = bswap_host_to_be64((uint64_t)(tv->tv_sec));
 	memcpy(ptr, &(timesafe), sizeof(timesafe));
 	ptr += sizeof(timesafe);
-        timesafe = bswap_host_to_be64((uint64_t)(tv.tv_usec));
+        timesafe = bswap_host_to_be64((uint64_t)(tv->tv_usec));
 	memcpy(ptr, &(timesafe), sizeof(timesafe));
-	ptr += sizeof(timesafe);
-
-	return 1;
 }
 
 static int tzsplive_prepare_packet(libtrace_t *libtrace UNUSED, libtrace_packet_t *packet,
@@ -423,73 +526,179 @@ static int tzsplive_prepare_packet(libtrace_t *libtrace UNUSED, libtrace_packet_
         return 0;
 }
 
-static int tzsplive_read_packet(libtrace_t *libtrace, libtrace_packet_t *packet) {
-	int ret;
-	uint32_t flags = 0;
+/* Receives as many waiting datagrams as will fit in the stream's ring.
+ * Returns the number received, 0 if none were waiting or -1 on error. */
+static int tzsplive_receive_batch(libtrace_t *libtrace, tzsp_stream_t *stream) {
+	int ret, i;
 
-	if (!libtrace->format_data) {
-		trace_set_err(libtrace, TRACE_ERR_BAD_FORMAT, "Trace format data missing, "
-			"call trace_create() before calling trace_read_packet()");
-		return -1;
+#if HAVE_DECL_RECVMMSG
+	ret = recvmmsg(stream->socket, stream->msgs, TZSP_RECV_BATCH,
+		MSG_DONTWAIT, NULL);
+	for (i = 0; i < ret; i++) {
+		stream->lens[i] = stream->msgs[i].msg_len;
 	}
-
-	if (!packet->buffer || packet->buf_control == TRACE_CTRL_EXTERNAL) {
-                packet->buffer = malloc((size_t)LIBTRACE_PACKET_BUFSIZE);
-		if (!packet->buffer) {
-			trace_set_err(libtrace, errno, "Unable to allocate memory for "
-				"packet buffer");
-			return -1;
-		}
-	}
-	flags |= TRACE_PREP_OWN_BUFFER;
-
-	/* Make sure we shouldnt be halting */
-	if ((ret = is_halted(libtrace)) != -1) {
-		return ret;
-	}
-	/* Try read a packet from the socket */
-	ret = recv(FORMAT_DATA->socket, packet->buffer, (size_t)LIBTRACE_PACKET_BUFSIZE,
+#else
+	ret = recv(stream->socket, stream->bufs[0], stream->iovs[0].iov_len,
 		MSG_DONTWAIT);
-	/* Error reading */
+	if (ret >= 0) {
+		stream->lens[0] = ret;
+		ret = 1;
+	}
+	(void)i;
+#endif
 	if (ret == -1) {
 		/* Nothing available to read */
 		if (errno == EAGAIN || errno == EWOULDBLOCK) {
-			/* sleep for a short period */
-			usleep(100);
-                        /* return and let libtrace check for new message in the
-                         * message queue.
-                         */
-                        return READ_MESSAGE;
+			return 0;
 		}
 		/* Socket error */
 		trace_set_err(libtrace, TRACE_ERR_BAD_IO, "Error receiving on socket "
-			"%d: %s", FORMAT_DATA->socket, strerror(errno));
-		if (FORMAT_DATA->socket >= 0) {
-			close(FORMAT_DATA->socket);
-			FORMAT_DATA->socket = -1;
-			return ret;
+			"%d: %s", stream->socket, strerror(errno));
+		if (stream->socket >= 0) {
+			close(stream->socket);
+			stream->socket = -1;
 		}
+		return -1;
 	}
 
-	if (ret < (int)sizeof(tzsp_header_t)) {
-		trace_set_err(libtrace, TRACE_ERR_BAD_PACKET, "Incomplete TZSP header");
+	/* All of the datagrams were waiting by the time we asked, so they
+	 * share a timestamp */
+	gettimeofday(&stream->tv, NULL);
+	stream->next = 0;
+	stream->count = ret;
+	return ret;
+}
+
+/* Hands the next received datagram in the ring over to a packet. If the
+ * datagram can't be used it is left where it is, and the error is only set
+ * on the trace if 'report' is true, so that a caller that already has some
+ * packets can hand those over first and see the error on its next call. */
+static int tzsplive_next_packet(libtrace_t *libtrace, tzsp_stream_t *stream,
+		libtrace_packet_t *packet, bool report) {
+	int i = stream->next;
+	int len = stream->lens[i];
+	uint8_t *buf = stream->bufs[i];
+	uint8_t *replacement;
+
+	if (len < (int)sizeof(tzsp_header_t)) {
+		if (report) {
+			/* Don't trip over it again next time */
+			stream->next++;
+			trace_set_err(libtrace, TRACE_ERR_BAD_PACKET,
+				"Incomplete TZSP header");
+		}
 		return -1;
 	}
 
+	/* Receive into the packet's old buffer next time around */
+	if (packet->buffer && packet->buf_control == TRACE_CTRL_PACKET) {
+		replacement = packet->buffer;
+	} else {
+		replacement = malloc((size_t)LIBTRACE_PACKET_BUFSIZE);
+		if (!replacement) {
+			if (report) {
+				trace_set_err(libtrace, errno, "Unable to "
+					"allocate memory for packet buffer");
+			}
+			return -1;
+		}
+	}
+	stream->next++;
+	stream->bufs[i] = replacement;
+	stream->iovs[i].iov_base = replacement;
+
+	packet->trace = libtrace;
+	packet->buffer = buf;
+	packet->buf_control = TRACE_CTRL_PACKET;
+	trace_clear_cache(packet);
+
 	/* insert the timestamp */
-	tzsplive_insert_timestamp(libtrace, packet, ret);
+	tzsplive_insert_timestamp(packet, len, &stream->tv);
 
 	/* Cache the captured length */
         packet->cached.framing_length = trace_get_framing_length(packet);
-        packet->cached.capture_length = ret;
+        packet->cached.capture_length = len;
 
 	if (tzsplive_prepare_packet(libtrace, packet, packet->buffer,
-		TRACE_RT_DATA_TZSP, flags)) {
+		TRACE_RT_DATA_TZSP, TRACE_PREP_OWN_BUFFER)) {
 
 		return -1;
 	}
 
-	return ret;
+	packet->order = (((uint64_t)stream->tv.tv_sec) << 32)
+		+ ((((uint64_t)stream->tv.tv_usec) << 32) / 1000000);
+	if (packet->order <= stream->last_timestamp) {
+		packet->order = stream->last_timestamp + 1;
+	}
+	stream->last_timestamp = packet->order;
+
+	return len;
+}
+
+static int tzsplive_read_stream(libtrace_t *libtrace, tzsp_stream_t *stream,
+		libtrace_packet_t **packets, size_t nb_packets) {
+	size_t read_packets = 0;
+	int ret;
+
+	if (stream->next == stream->count) {
+		/* Make sure we shouldnt be halting */
+		if ((ret = is_halted(libtrace)) != -1) {
+			return ret;
+		}
+		ret = tzsplive_receive_batch(libtrace, stream);
+		if (ret < 0) {
+			return -1;
+		}
+		if (ret == 0) {
+			/* sleep for a short period */
+			usleep(100);
+                        /* return and let libtrace check for new message in the
+                         * message queue.
+                         */
+                        return READ_MESSAGE;
+		}
+	}
+
+	while (read_packets < nb_packets && stream->next < stream->count) {
+		ret = tzsplive_next_packet(libtrace, stream,
+			packets[read_packets], read_packets == 0);
+		if (ret < 0) {
+			/* Hand over what we have, the datagram is still in
+			 * the ring so the error will be seen next time
+			 * around */
+			if (read_packets > 0) {
+				break;
+			}
+			return -1;
+		}
+		packets[read_packets]->error = ret;
+		read_packets++;
+	}
+
+	return read_packets;
+}
+
+static int tzsplive_read_packet(libtrace_t *libtrace, libtrace_packet_t *packet) {
+	int ret;
+
+	if (!libtrace->format_data || !FORMAT_DATA->streams) {
+		trace_set_err(libtrace, TRACE_ERR_BAD_FORMAT, "Trace format data missing, "
+			"call trace_create() before calling trace_read_packet()");
+		return -1;
+	}
+
+	ret = tzsplive_read_stream(libtrace, &FORMAT_DATA->streams[0], &packet, 1);
+	if (ret <= 0) {
+		return ret;
+	}
+	return packet->error;
+}
+
+static int tzsplive_pread_packets(libtrace_t *libtrace, libtrace_thread_t *t,
+		libtrace_packet_t **packets, size_t nb_packets) {
+
+	return tzsplive_read_stream(libtrace, (tzsp_stream_t *)t->format_data,
+		packets, nb_packets);
 }
 
 static int tzsplive_write_packet(libtrace_out_t *libtrace, libtrace_packet_t *packet) {
@@ -725,7 +934,14 @@ static struct libtrace_format_t tzsplive = {
         NULL,				/* trace_event */
         NULL,                           /* help */
         NULL,                           /* next pointer */
-        NON_PARALLEL(true)
+        {true, -1},                     /* Live, no thread limit */
+        tzsplive_pstart_input,          /* pstart_input */
+        tzsplive_pread_packets,         /* pread_packets */
+        tzsplive_pause_input,           /* ppause */
+        NULL,                           /* p_fin */
+        tzsplive_pregister_thread,      /* register thread */
+        NULL,                           /* unregister thread */
+        NULL                            /* get thread stats */
 };
 
 void tzsplive_constructor(void) {
@@ -33,6 +33,7 @@
  * 
  */
 #include "hash_toeplitz.h"
+#include "protocols.h"
 #include <string.h>
 #include <stdlib.h>
 #include <time.h>
@@ -224,3 +225,37 @@ uint64_t toeplitz_hash_packet(const libtrace_packet_t * pkt, const toeplitz_conf
 
 	return res;
 }
+
+uint64_t toeplitz_hash_fragment(const libtrace_packet_t * pkt, const toeplitz_conf_t *cnf) {
+	uint16_t eth_type;
+	uint32_t remaining;
+	uint32_t res = 0;
+	void *layer3 = trace_get_layer3(pkt, &eth_type, &remaining);
+
+	if (!layer3)
+		return 0;
+
+	switch (eth_type) {
+		case TRACE_ETHERTYPE_IP:
+			if (remaining >= sizeof(libtrace_ip_t)) {
+				libtrace_ip_t * ip = (libtrace_ip_t *)layer3;
+				res = toeplitz_first_hash(cnf, (uint8_t *)&ip->ip_src, 8);
+				res = toeplitz_hash(cnf, (uint8_t *)&ip->ip_id, 8, 2, res);
+				res = toeplitz_hash(cnf, &ip->ip_p, 10, 1, res);
+			}
+			break;
+		case TRACE_ETHERTYPE_IPV6:
+			if (remaining >= sizeof(libtrace_ip6_t)) {
+				libtrace_ip6_t * ip6 = (libtrace_ip6_t *)layer3;
+				libtrace_ip6_frag_t *frag;
+
+				res = toeplitz_first_hash(cnf, (uint8_t *)&ip6->ip_src, 32);
+				// Unfragmented packets hash on the addresses alone
+				frag = trace_get_fragment_from_ip6(ip6, remaining, NULL);
+				if (frag)
+					res = toeplitz_hash(cnf, (uint8_t *)&frag->ident, 32, 4, res);
+			}
+			break;
+	}
+	return res;
+}
@@ -58,6 +58,7 @@ DLLEXPORT uint32_t toeplitz_hash(const toeplitz_conf_t *tc, const uint8_t *data,
 DLLEXPORT uint32_t toeplitz_first_hash(const toeplitz_conf_t *tc, const uint8_t *data, size_t n);
 DLLEXPORT void toeplitz_init_config(toeplitz_conf_t *conf, bool bidirectional);
 DLLEXPORT uint64_t toeplitz_hash_packet(const libtrace_packet_t * pkt, const toeplitz_conf_t *cnf);
+DLLEXPORT uint64_t toeplitz_hash_fragment(const libtrace_packet_t * pkt, const toeplitz_conf_t *cnf);
 DLLEXPORT void toeplitz_ncreate_bikey(uint8_t *key, size_t num);
 DLLEXPORT void toeplitz_create_bikey(uint8_t *key);
 DLLEXPORT void toeplitz_ncreate_unikey(uint8_t *key, size_t num);
@@ -0,0 +1,569 @@
+/*
+ *
+ * Copyright (c) 2007-2016 The University of Waikato, Hamilton, New Zealand.
+ * All rights reserved.
+ *
+ * This file is part of libtrace.
+ *
+ * This code has been developed by the University of Waikato WAND
+ * research group. For further information please see http://www.wand.net.nz/
+ *
+ * libtrace is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libtrace is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ */
+#include "config.h"
+#include "libtrace.h"
+#include "libtrace_int.h"
+#include "format_helper.h"
+#include "wandio.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+/* Block compressed gzip (BGZF) support.
+ *
+ * A BGZF file is a series of gzip members, each holding at most 64KB of
+ * compressed data, with the size of each member stored in a gzip "extra"
+ * field. Any gzip reader can still read the file as a whole, but because
+ * each member can be decompressed on its own we can jump straight to the
+ * member that holds any given offset in the uncompressed data -- reading
+ * just the member headers along the way rather than decompressing
+ * everything before it.
+ *
+ * The readers and writers here are wandio IO modules, so the format modules
+ * don't need to know anything about them. Offsets reported by the reader
+ * are offsets within the uncompressed data, exactly as for any other file,
+ * so they can be used directly by the seek index.
+ */
+
+#ifdef HAVE_LIBZ
+#include <zlib.h>
+
+#define BGZF_HEADER_LEN 18
+#define BGZF_TRAILER_LEN 8
+#define BGZF_MAX_BLOCK_LEN 65536
+
+static const unsigned char bgzf_eof_block[28] = {
+	0x1f, 0x8b, 0x08, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00, 0xff, 0x06, 0x00,
+	0x42, 0x43, 0x02, 0x00, 0x1b, 0x00, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x00
+};
+
+static inline uint32_t bgzf_get16(const unsigned char *ptr) {
+	return ptr[0] | (ptr[1] << 8);
+}
+
+static inline uint32_t bgzf_get32(const unsigned char *ptr) {
+	return ptr[0] | (ptr[1] << 8) | (ptr[2] << 16) | ((uint32_t)ptr[3] << 24);
+}
+
+static inline void bgzf_put16(unsigned char *ptr, uint32_t value) {
+	ptr[0] = value & 0xff;
+	ptr[1] = (value >> 8) & 0xff;
+}
+
+static inline void bgzf_put32(unsigned char *ptr, uint32_t value) {
+	ptr[0] = value & 0xff;
+	ptr[1] = (value >> 8) & 0xff;
+	ptr[2] = (value >> 16) & 0xff;
+	ptr[3] = (value >> 24) & 0xff;
+}
+
+/* Checks for a gzip member header carrying the BGZF block size field.
+ * Returns the total length of the block, or 0 if this is not BGZF */
+static uint32_t bgzf_block_len(const unsigned char *hdr) {
+	if (hdr[0] != 0x1f || hdr[1] != 0x8b || hdr[2] != 0x08 ||
+			(hdr[3] & 0x04) == 0)
+		return 0;
+	if (bgzf_get16(hdr + 10) != 6 || hdr[12] != 'B' || hdr[13] != 'C' ||
+			bgzf_get16(hdr + 14) != 2)
+		return 0;
+	return bgzf_get16(hdr + 16) + 1;
+}
+
+/* Reader */
+
+typedef struct bgzf_block {
+	/* Offset of the block within the compressed file */
+	int64_t coff;
+	/* Offset of the start of the block within the uncompressed data */
+	int64_t uoff;
+	/* Compressed and uncompressed lengths of the block */
+	uint32_t clen;
+	uint32_t ulen;
+} bgzf_block_t;
+
+struct bgzf_reader_t {
+	io_t *parent;
+	int64_t parentpos;
+	z_stream strm;
+
+	unsigned char cbuf[BGZF_MAX_BLOCK_LEN];
+	unsigned char ubuf[BGZF_MAX_BLOCK_LEN];
+
+	/* The block currently held in ubuf, and where we are within it */
+	bgzf_block_t current;
+	uint32_t upos;
+	bool loaded;
+
+	/* Every block we have come across so far, in file order */
+	bgzf_block_t *blocks;
+	size_t blockcount;
+	size_t blockalloc;
+};
+
+#define RDATA(io) ((struct bgzf_reader_t *)((io)->data))
+
+static void bgzf_add_block(struct bgzf_reader_t *rd, bgzf_block_t *block) {
+
+	if (rd->blockcount > 0 &&
+			rd->blocks[rd->blockcount - 1].coff >= block->coff)
+		return;
+
+	if (rd->blockcount == rd->blockalloc) {
+		size_t newsize = rd->blockalloc ? rd->blockalloc * 2 : 128;
+		bgzf_block_t *tmp = (bgzf_block_t *)realloc(rd->blocks,
+				newsize * sizeof(bgzf_block_t));
+		/* The block list is just a shortcut, so we can live
+		 * without the new entry */
+		if (!tmp)
+			return;
+		rd->blocks = tmp;
+		rd->blockalloc = newsize;
+	}
+	rd->blocks[rd->blockcount ++] = *block;
+}
+
+static int bgzf_read_parent(struct bgzf_reader_t *rd, int64_t offset,
+		void *buffer, int64_t len) {
+
+	int64_t ret;
+
+	if (rd->parentpos != offset) {
+		if (wandio_seek(rd->parent, offset, SEEK_SET) < 0)
+			return -1;
+		rd->parentpos = offset;
+	}
+
+	ret = wandio_read(rd->parent, buffer, len);
+	if (ret > 0)
+		rd->parentpos += ret;
+	return ret;
+}
+
+/* Reads just the header and trailer of the block at the given offset, so
+ * that we know where it starts and ends in both the compressed and the
+ * uncompressed data. Returns 1 on success, 0 at EOF, -1 on error. */
+static int bgzf_scan_block(struct bgzf_reader_t *rd, int64_t coff,
+		int64_t uoff, bgzf_block_t *block) {
+
+	unsigned char hdr[BGZF_HEADER_LEN];
+	unsigned char isize[4];
+	int64_t ret;
+
+	ret = bgzf_read_parent(rd, coff, hdr, sizeof(hdr));
+	if (ret <= 0)
+		return ret;
+	if (ret != (int64_t)sizeof(hdr))
+		return -1;
+
+	block->coff = coff;
+	block->uoff = uoff;
+	block->clen = bgzf_block_len(hdr);
+	if (block->clen < BGZF_HEADER_LEN + BGZF_TRAILER_LEN)
+		return -1;
+
+	if (bgzf_read_parent(rd, coff + block->clen - 4, isize,
+				sizeof(isize)) != (int)sizeof(isize))
+		return -1;
+	block->ulen = bgzf_get32(isize);
+	if (block->ulen > BGZF_MAX_BLOCK_LEN)
+		return -1;
+
+	bgzf_add_block(rd, block);
+	return 1;
+}
+
+/* Reads and decompresses the block at the given offset into ubuf. Returns
+ * 1 on success, 0 at EOF, -1 on error. */
+static int bgzf_load_block(struct bgzf_reader_t *rd, int64_t coff,
+		int64_t uoff) {
+
+	bgzf_block_t block;
+	int64_t ret;
+	uint32_t datalen;
+
+	ret = bgzf_read_parent(rd, coff, rd->cbuf, BGZF_HEADER_LEN);
+	if (ret <= 0)
+		return ret;
+	if (ret != BGZF_HEADER_LEN)
+		return -1;
+
+	block.coff = coff;
+	block.uoff = uoff;
+	block.clen = bgzf_block_len(rd->cbuf);
+	if (block.clen < BGZF_HEADER_LEN + BGZF_TRAILER_LEN)
+		return -1;
+
+	datalen = block.clen - BGZF_HEADER_LEN;
+	if (bgzf_read_parent(rd, coff + BGZF_HEADER_LEN,
+				rd->cbuf + BGZF_HEADER_LEN, datalen) != (int)datalen)
+		return -1;
+
+	block.ulen = bgzf_get32(rd->cbuf + block.clen - 4);
+	if (block.ulen > BGZF_MAX_BLOCK_LEN)
+		return -1;
+
+	if (inflateReset(&rd->strm) != Z_OK)
+		return -1;
+	rd->strm.next_in = rd->cbuf + BGZF_HEADER_LEN;
+	rd->strm.avail_in = datalen - BGZF_TRAILER_LEN;
+	rd->strm.next_out = rd->ubuf;
+	rd->strm.avail_out = sizeof(rd->ubuf);
+
+	if (inflate(&rd->strm, Z_FINISH) != Z_STREAM_END ||
+			rd->strm.total_out != block.ulen)
+		return -1;
+	if (crc32(crc32(0L, Z_NULL, 0), rd->ubuf, block.ulen) !=
+			bgzf_get32(rd->cbuf + block.clen - BGZF_TRAILER_LEN))
+		return -1;
+
+	bgzf_add_block(rd, &block);
+	rd->current = block;
+	rd->upos = 0;
+	rd->loaded = true;
+	return 1;
+}
+
+static int64_t bgzf_read(io_t *io, void *buffer, int64_t len) {
+
+	struct bgzf_reader_t *rd = RDATA(io);
+	int64_t copied = 0;
+
+	while (copied < len) {
+		uint32_t avail;
+		int ret;
+
+		if (!rd->loaded || rd->upos == rd->current.ulen) {
+			if (rd->loaded)
+				ret = bgzf_load_block(rd,
+					rd->current.coff + rd->current.clen,
+					rd->current.uoff + rd->current.ulen);
+			else
+				ret = bgzf_load_block(rd, 0, 0);
+			if (ret < 0) {
+				errno = EIO;
+				return copied ? copied : -1;
+			}
+			if (ret == 0)
+				break;
+			continue;
+		}
+
+		avail = rd->current.ulen - rd->upos;
+		if ((int64_t)avail > len - copied)
+			avail = len - copied;
+		memcpy((char *)buffer + copied, rd->ubuf + rd->upos, avail);
+		rd->upos += avail;
+		copied += avail;
+	}
+	return copied;
+}
+
+static int64_t bgzf_tell(io_t *io) {
+
+	struct bgzf_reader_t *rd = RDATA(io);
+
+	if (!rd->loaded)
+		return 0;
+	return rd->current.uoff + rd->upos;
+}
+
+static int64_t bgzf_seek(io_t *io, int64_t offset, int whence) {
+
+	struct bgzf_reader_t *rd = RDATA(io);
+	bgzf_block_t block;
+	size_t lo, hi;
+	int ret;
+
+	if (whence == SEEK_CUR)
+		offset += bgzf_tell(io);
+	else if (whence != SEEK_SET)
+		return -1;
+	if (offset < 0)
+		return -1;
+
+	/* Within the block we already have? */
+	if (rd->loaded && offset >= rd->current.uoff &&
+			offset <= rd->current.uoff + rd->current.ulen) {
+		rd->upos = offset - rd->current.uoff;
+		return offset;
+	}
+
+	/* Find the last block we know of that starts at or before the
+	 * offset, then skip forward through the block headers from there
+	 * until we find the block that holds it */
+	lo = 0;
+	hi = rd->blockcount;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (rd->blocks[mid].uoff <= offset)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	if (lo > 0) {
+		block = rd->blocks[lo - 1];
+	} else {
+		ret = bgzf_scan_block(rd, 0, 0, &block);
+		if (ret <= 0)
+			return (ret == 0 && offset == 0) ? 0 : -1;
+		lo = 1;
+	}
+
+	while (offset >= block.uoff + block.ulen) {
+		if (lo < rd->blockcount) {
+			block = rd->blocks[lo ++];
+			continue;
+		}
+		ret = bgzf_scan_block(rd, block.coff + block.clen,
+				block.uoff + block.ulen, &block);
+		if (ret < 0)
+			return -1;
+		if (ret == 0) {
+			/* Seeking to the very end of the file is fine */
+			if (offset != block.uoff + block.ulen)
+				return -1;
+			break;
+		}
+		lo = rd->blockcount;
+	}
+
+	if (bgzf_load_block(rd, block.coff, block.uoff) < 0)
+		return -1;
+	rd->upos = offset - block.uoff;
+	return offset;
+}
+
+static void bgzf_close(io_t *io) {
+
+	struct bgzf_reader_t *rd = RDATA(io);
+
+	inflateEnd(&rd->strm);
+	wandio_destroy(rd->parent);
+	if (rd->blocks)
+		free(rd->blocks);
+	free(rd);
+	free(io);
+}
+
+static io_source_t bgzf_source = {
+	.name = "bgzf",
+	.read = bgzf_read,
+	.peek = NULL,
+	.tell = bgzf_tell,
+	.seek = bgzf_seek,
+	.close = bgzf_close,
+};
+
+io_t *trace_open_bgzf(const char *filename) {
+
+	unsigned char hdr[BGZF_HEADER_LEN];
+	struct bgzf_reader_t *rd;
+	struct stat st;
+	io_t *parent, *io;
+
+	/* We need to be able to seek, so don't bother with stdin, pipes and
+	 * the like. Looking at their header would also take it away from
+	 * the reader that is opened instead. */
+	if (strcmp(filename, "-") == 0)
+		return NULL;
+	if (stat(filename, &st) != 0 || !S_ISREG(st.st_mode))
+		return NULL;
+
+	parent = stdio_open(filename);
+	if (!parent)
+		return NULL;
+
+	if (wandio_read(parent, hdr, sizeof(hdr)) != sizeof(hdr) ||
+			bgzf_block_len(hdr) == 0 ||
+			wandio_seek(parent, 0, SEEK_SET) != 0) {
+		wandio_destroy(parent);
+		return NULL;
+	}
+
+	rd = (struct bgzf_reader_t *)calloc(1, sizeof(struct bgzf_reader_t));
+	io = (io_t *)malloc(sizeof(io_t));
+	if (!rd || !io || inflateInit2(&rd->strm, -MAX_WBITS) != Z_OK) {
+		free(rd);
+		free(io);
+		wandio_destroy(parent);
+		return NULL;
+	}
+	rd->parent = parent;
+	rd->parentpos = 0;
+
+	io->source = &bgzf_source;
+	io->data = rd;
+
+	/* wandio_peek() needs a peeking reader on top */
+	return peek_open(io);
+}
+
+/* Writer */
+
+struct bgzf_writer_t {
+	iow_t *child;
+	z_stream strm;
+
+	/* Uncompressed data waiting to be written as a block */
+	unsigned char ubuf[BGZF_MAX_BLOCK_LEN];
+	uint32_t ulen;
+	uint32_t blocksize;
+
+	unsigned char cbuf[BGZF_MAX_BLOCK_LEN];
+};
+
+#define WDATA(iow) ((struct bgzf_writer_t *)((iow)->data))
+
+static int bgzf_write_block(struct bgzf_writer_t *wr) {
+
+	uint32_t clen;
+
+	if (deflateReset(&wr->strm) != Z_OK)
+		return -1;
+	wr->strm.next_in = wr->ubuf;
+	wr->strm.avail_in = wr->ulen;
+	wr->strm.next_out = wr->cbuf + BGZF_HEADER_LEN;
+	wr->strm.avail_out = sizeof(wr->cbuf) - BGZF_HEADER_LEN -
+			BGZF_TRAILER_LEN;
+
+	/* The block size is limited so that even incompressible data will
+	 * fit, so anything else here is a genuine error */
+	if (deflate(&wr->strm, Z_FINISH) != Z_STREAM_END)
+		return -1;
+
+	clen = BGZF_HEADER_LEN + wr->strm.total_out + BGZF_TRAILER_LEN;
+
+	memcpy(wr->cbuf, bgzf_eof_block, BGZF_HEADER_LEN);
+	bgzf_put16(wr->cbuf + 16, clen - 1);
+	bgzf_put32(wr->cbuf + clen - 8,
+			crc32(crc32(0L, Z_NULL, 0), wr->ubuf, wr->ulen));
+	bgzf_put32(wr->cbuf + clen - 4, wr->ulen);
+
+	if (wandio_wwrite(wr->child, wr->cbuf, clen) != clen)
+		return -1;
+	wr->ulen = 0;
+	return 0;
+}
+
+static int64_t bgzf_wwrite(iow_t *iow, const char *buffer, int64_t len) {
+
+	struct bgzf_writer_t *wr = WDATA(iow);
+	int64_t written = 0;
+
+	while (written < len) {
+		uint32_t space = wr->blocksize - wr->ulen;
+
+		if ((int64_t)space > len - written)
+			space = len - written;
+		memcpy(wr->ubuf + wr->ulen, buffer + written, space);
+		wr->ulen += space;
+		written += space;
+
+		if (wr->ulen == wr->blocksize && bgzf_write_block(wr) < 0)
+			return -1;
+	}
+	return written;
+}
+
+static int bgzf_wflush(iow_t *iow) {
+
+	struct bgzf_writer_t *wr = WDATA(iow);
+
+	if (wr->ulen > 0 && bgzf_write_block(wr) < 0)
+		return -1;
+	return wandio_wflush(wr->child);
+}
+
+static void bgzf_wclose(iow_t *iow) {
+
+	struct bgzf_writer_t *wr = WDATA(iow);
+
+	if (wr->ulen > 0)
+		bgzf_write_block(wr);
+	wandio_wwrite(wr->child, bgzf_eof_block, sizeof(bgzf_eof_block));
+	wandio_wdestroy(wr->child);
+	deflateEnd(&wr->strm);
+	free(wr);
+	free(iow);
+}
+
+static iow_source_t bgzf_wsource = {
+	.name = "bgzfw",
+	.write = bgzf_wwrite,
+	.flush = bgzf_wflush,
+	.close = bgzf_wclose,
+};
+
+iow_t *trace_open_bgzf_out(const char *filename, int level, int blocksize,
+		int fileflag) {
+
+	struct bgzf_writer_t *wr;
+	iow_t *child, *iow;
+
+	if (blocksize <= 0 || blocksize > BGZF_MAX_DATA_LEN) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	child = stdio_wopen(filename, fileflag);
+	if (!child)
+		return NULL;
+
+	wr = (struct bgzf_writer_t *)calloc(1, sizeof(struct bgzf_writer_t));
+	iow = (iow_t *)malloc(sizeof(iow_t));
+	if (!wr || !iow || deflateInit2(&wr->strm, level, Z_DEFLATED,
+				-MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+		free(wr);
+		free(iow);
+		wandio_wdestroy(child);
+		errno = ENOMEM;
+		return NULL;
+	}
+	wr->child = child;
+	wr->blocksize = blocksize;
+
+	iow->source = &bgzf_wsource;
+	iow->data = wr;
+	return iow;
+}
+
+#else
+
+io_t *trace_open_bgzf(const char *filename UNUSED) {
+	return NULL;
+}
+
+iow_t *trace_open_bgzf_out(const char *filename UNUSED, int level UNUSED,
+		int blocksize UNUSED, int fileflag UNUSED) {
+	errno = ENOTSUP;
+	return NULL;
+}
+
+#endif
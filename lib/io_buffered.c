@@ -0,0 +1,210 @@
+/*
+ *
+ * Copyright (c) 2007-2016 The University of Waikato, Hamilton, New Zealand.
+ * All rights reserved.
+ *
+ * This file is part of libtrace.
+ *
+ * This code has been developed by the University of Waikato WAND
+ * research group. For further information please see http://www.wand.net.nz/
+ *
+ * libtrace is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libtrace is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ */
+#include "config.h"
+#include "libtrace.h"
+#include "libtrace_int.h"
+#include "format_helper.h"
+#include "wandio.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+/* Staging buffer for output files.
+ *
+ * Format modules tend to write each record as several small pieces (a
+ * header, the packet itself, some padding, a trailer), and every one of
+ * those writes has to make its way through the compression layers below
+ * us. Instead we copy the pieces into one large buffer and only pass it
+ * down once it is full, so the layers below always see big, contiguous
+ * writes.
+ *
+ * trace_write_iov() lets a format hand over all the pieces of a record at
+ * once, which lets the whole record be copied in with one bounds check.
+ *
+ * Writers that already gather their input into a buffer (wandio's
+ * uncompressed writer and our BGZF writer) are left alone, as staging in
+ * front of them would just copy every record twice.
+ */
+
+struct buffered_writer_t {
+	iow_t *child;
+	char *buf;
+	size_t used;
+	size_t size;
+};
+
+#define WDATA(iow) ((struct buffered_writer_t *)((iow)->data))
+
+static iow_source_t buffered_wsource;
+
+static int buffered_drain(struct buffered_writer_t *wr) {
+
+	if (wr->used == 0)
+		return 0;
+	if (wandio_wwrite(wr->child, wr->buf, wr->used) != (int64_t)wr->used)
+		return -1;
+	wr->used = 0;
+	return 0;
+}
+
+static int64_t buffered_wwrite(iow_t *iow, const char *buffer, int64_t len) {
+
+	struct buffered_writer_t *wr = WDATA(iow);
+
+	if (len <= (int64_t)(wr->size - wr->used)) {
+		memcpy(wr->buf + wr->used, buffer, len);
+		wr->used += len;
+		return len;
+	}
+
+	if (buffered_drain(wr) < 0)
+		return -1;
+
+	/* Don't bother copying anything that would fill the buffer by
+	 * itself */
+	if (len >= (int64_t)wr->size)
+		return wandio_wwrite(wr->child, buffer, len);
+
+	memcpy(wr->buf, buffer, len);
+	wr->used = len;
+	return len;
+}
+
+static int buffered_wflush(iow_t *iow) {
+
+	struct buffered_writer_t *wr = WDATA(iow);
+
+	if (buffered_drain(wr) < 0)
+		return -1;
+	return wandio_wflush(wr->child);
+}
+
+static void buffered_wclose(iow_t *iow) {
+
+	struct buffered_writer_t *wr = WDATA(iow);
+
+	/* There is no way to report a failure from here, which is why
+	 * trace_close_file_out() drains the buffer before destroying us */
+	buffered_drain(wr);
+	wandio_wdestroy(wr->child);
+	free(wr->buf);
+	free(wr);
+	free(iow);
+}
+
+static iow_source_t buffered_wsource = {
+	.name = "bufferw",
+	.write = buffered_wwrite,
+	.flush = buffered_wflush,
+	.close = buffered_wclose,
+};
+
+iow_t *trace_open_buffered_out(iow_t *child, size_t bufsize) {
+
+	struct buffered_writer_t *wr;
+	iow_t *iow;
+
+	if (!child)
+		return NULL;
+
+	wr = (struct buffered_writer_t *)calloc(1,
+			sizeof(struct buffered_writer_t));
+	iow = (iow_t *)malloc(sizeof(iow_t));
+	if (wr)
+		wr->buf = (char *)malloc(bufsize);
+	if (!wr || !iow || !wr->buf) {
+		if (wr)
+			free(wr->buf);
+		free(wr);
+		free(iow);
+		wandio_wdestroy(child);
+		errno = ENOMEM;
+		return NULL;
+	}
+	wr->child = child;
+	wr->size = bufsize;
+
+	iow->source = &buffered_wsource;
+	iow->data = wr;
+	return iow;
+}
+
+int trace_close_file_out(libtrace_out_t *trace, iow_t *iow) {
+
+	int ret = 0;
+
+	if (!iow)
+		return 0;
+
+	if (iow->source == &buffered_wsource &&
+			buffered_drain(WDATA(iow)) < 0) {
+		trace_set_err_out(trace, errno, "Unable to write to %s",
+				trace->uridata);
+		ret = -1;
+	}
+	wandio_wdestroy(iow);
+	return ret;
+}
+
+int64_t trace_write_iov(iow_t *iow, const struct iovec *iov, int iovcnt) {
+
+	struct buffered_writer_t *wr;
+	int64_t total = 0;
+	int64_t ret;
+	int i;
+
+	/* A record that is already in one piece gains nothing from being
+	 * gathered up */
+	if (iovcnt == 1)
+		return wandio_wwrite(iow, iov[0].iov_base, iov[0].iov_len);
+
+	for (i = 0; i < iovcnt; i++)
+		total += iov[i].iov_len;
+
+	if (iow->source == &buffered_wsource) {
+		wr = WDATA(iow);
+		if (total > (int64_t)(wr->size - wr->used) &&
+				buffered_drain(wr) < 0)
+			return -1;
+		if (total <= (int64_t)(wr->size - wr->used)) {
+			for (i = 0; i < iovcnt; i++) {
+				memcpy(wr->buf + wr->used, iov[i].iov_base,
+						iov[i].iov_len);
+				wr->used += iov[i].iov_len;
+			}
+			return total;
+		}
+	}
+
+	/* Not buffered, or too large to be staged in one go */
+	for (i = 0; i < iovcnt; i++) {
+		ret = wandio_wwrite(iow, iov[i].iov_base, iov[i].iov_len);
+		if (ret != (int64_t)iov[i].iov_len)
+			return -1;
+	}
+	return total;
+}
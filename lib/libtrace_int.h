@@ -51,6 +51,7 @@ extern "C" {
 #include "libtrace_parallel.h"
 #include "wandio.h"
 #include "lt_bswap.h"
+#include <stdlib.h>
 
 #ifdef _MSC_VER
 // warning: deprecated function
@@ -182,7 +183,13 @@ static inline int posix_memalign(void **memptr, size_t alignment, size_t size)
 #include "data-struct/linked_list.h"
 #include "data-struct/sliding_window.h"
 #include "data-struct/buckets.h"
+#include "data-struct/timer_wheel.h"
 #include "pthread_spinlock.h"
+#include "reassembly.h"
+#include "tcp_stream.h"
+#include "thread_stats.h"
+#include "stage_latency.h"
+#include "result_pool.h"
 
 //#define RP_BUFSIZE 65536U
 
@@ -212,8 +219,7 @@ enum thread_types {
 	THREAD_EMPTY,
 	THREAD_HASHER,
 	THREAD_PERPKT,
-	THREAD_REPORTER,
-	THREAD_KEEPALIVE
+	THREAD_REPORTER
 };
 
 enum thread_states {
@@ -233,13 +239,24 @@ enum hash_owner {
  * Information of this thread
  */
 struct libtrace_thread_t {
-	uint64_t accepted_packets; // The number of packets accepted only used if pread
-	uint64_t filtered_packets;
-	// is retreving packets
+	// Counters for this thread, only used by perpkt threads
+	libtrace_stat_shard_t *stats;
+	// Stage timings for this thread, NULL unless they are turned on
+	libtrace_stage_latency_t *latency;
 	// Set to true once the first packet has been stored
 	bool recorded_first;
 	// For thread safety reason we actually must store this here
-	int64_t tracetime_offset_usec;
+	// Added to a packet's timestamp (in ns) to give the CLOCK_MONOTONIC
+	// time it should be released at, 0 until it is known
+	int64_t tracetime_offset;
+	// Timers run by this thread, only used by perpkt threads
+	libtrace_timer_wheel_t *timers;
+	// Wakes the reporter for our results, active while any are waiting
+	libtrace_timer_t result_timer;
+	// Fragments waiting for reassembly, only used by perpkt threads
+	libtrace_reassembly_t *reassembly;
+	// TCP streams being put back in order, only used by perpkt threads
+	libtrace_tcp_tracker_t *tcp;
 	void* user_data; // TLS for the user to use
 	void* format_data; // TLS for the format to use
 	libtrace_message_queue_t messages; // Message handling
@@ -319,7 +336,15 @@ struct user_configuration {
 	bool hasher_polling;
 	bool reporter_polling;
 	size_t reporter_thold;
+	size_t reporter_latency;
+	size_t result_size;
+	size_t wait_spin;
 	bool debug_state;
+	size_t reassembly_timeout;
+	size_t tcp_max_streams;
+	size_t tcp_memory_limit;
+	size_t tcp_idle_timeout;
+	int latency_histograms;
 	int coremap[MAX_THREADS];
 };
 #define ZERO_USER_CONFIG(config) {\
@@ -337,10 +362,12 @@ struct callback_set {
         fn_cb_packet message_packet;
 	fn_cb_packet message_meta_packet;
         fn_cb_result message_result;
+        fn_cb_result_batch message_result_batch;
         fn_cb_first_packet message_first_packet;
         fn_cb_tick message_tick_count;
         fn_cb_tick message_tick_interval;
         fn_cb_usermessage message_user;
+        fn_cb_tcp_payload message_tcp_payload;
 };
 
 /** A libtrace input trace 
@@ -362,6 +389,9 @@ struct libtrace_t {
         /** Speed up the packet rate when using trace_event() to process trace
          * files by this factor. */
         int replayspeedup;
+	/** If true, the headers of each packet are parsed and cached as
+	 * soon as the packet is read */
+	bool eager_parse;
 	/** Count of the number of packets returned to the libtrace user */
 	uint64_t accepted_packets;
 	/** Count of the number of packets filtered by libtrace */
@@ -375,6 +405,11 @@ struct libtrace_t {
 	char *uridata;
 	/** The libtrace IO reader for this trace (if applicable) */
 	io_t *io;
+	/** Sparse time index used to seek within trace files (if applicable) */
+	struct libtrace_seek_index *seekindex;
+	/** Interface properties from meta-data records, indexed by interface
+	 * id */
+	struct libtrace_interface_cache *interfaces;
 	/** Error information for the trace */
 	libtrace_err_t err;
 	/** Boolean flag indicating whether the trace has been started */
@@ -409,9 +444,25 @@ struct libtrace_t {
 
 	libtrace_thread_t hasher_thread;
 	libtrace_thread_t reporter_thread;
-	libtrace_thread_t keepalive_thread;
+	/** A CLOCK_MONOTONIC time in ns and the matching wall clock time,
+	 * taken when the trace was started. Tick intervals count from here
+	 * and timer expiries are converted using these. */
+	uint64_t timer_base;
+	struct timeval timer_base_tv;
 	int perpkt_thread_count;
 	libtrace_thread_t * perpkt_threads; // All our perpkt threads
+	libtrace_stat_shard_t *perpkt_stats; // Counters for each perpkt thread
+	// Stage timings for the perpkt threads, then the hasher and reporter
+	libtrace_latency_set_t *latency;
+	// The number of SIGUSR1s handled by the latency dump
+	int latency_dumps;
+	// Buffers for results, kept until the trace is destroyed
+	libtrace_result_pool_t *result_pool;
+	// Set once the reporter has been told there are results to read
+	int reporter_posted;
+	// Results waiting for the reporter's batch result callback
+	libtrace_result_t result_batch[LIBTRACE_RESULT_BATCH];
+	int result_batch_count;
 	// Used to keep track of the first packet seen on each thread
 	struct first_packets first_packets;
 	int tracetime;
@@ -443,6 +494,7 @@ libtrace_thread_t * get_thread_table(libtrace_t *libtrace);
 void send_message(libtrace_t *trace, libtrace_thread_t *target,
                 const enum libtrace_messages type,
                 libtrace_generic_t data, libtrace_thread_t *sender);
+void notify_reporter(libtrace_t *trace);
 
 /** A libtrace output trace
  * @internal
@@ -458,6 +510,9 @@ struct libtrace_out_t {
 	libtrace_err_t err;
 	/** Boolean flag indicating whether the trace has been started */
 	bool started;
+	/** Uncompressed size of each block when writing a block compressed
+	 * trace file, or 0 for a regular compressed file */
+	int compress_blocksize;
 };
 
 /** Sets the error status on an input trace
@@ -484,6 +539,48 @@ void trace_set_err_out(libtrace_out_t *trace, int errcode, const char *msg,...)
  */
 void trace_clear_cache(libtrace_packet_t *packet);
 
+/** Turns a packet into a PCAP packet with room for its contents, leaving the
+ * caller to fill them in
+ *
+ * @param packet	The packet to construct
+ * @param linktype	The link type of the contents
+ * @param len		The length of the contents, in bytes
+ * @param tv		The timestamp for the packet
+ * @return A pointer to len bytes for the contents, or NULL on error
+ *
+ * @see trace_construct_packet()
+ */
+void *trace_construct_packet_buffer(libtrace_packet_t *packet,
+		libtrace_linktype_t linktype, uint32_t len, struct timeval tv);
+
+/** A pool of reusable packets, see trace_create_packet_pool() */
+struct libtrace_packet_pool_t {
+	/** Protects the stack of idle packets */
+	pthread_spinlock_t lock;
+	/** Stack of idle packets, most recently released on top so that
+	 * their buffers are still likely to be in cache */
+	libtrace_packet_t **packets;
+	/** Number of idle packets currently in the pool */
+	size_t count;
+	/** Maximum number of idle packets the pool will hold */
+	size_t size;
+};
+
+/** Releases a right-sized buffer created by trace_copy_packet_into() so that
+ * the packet can be handed to a format module, which all expect an owned
+ * buffer to be LIBTRACE_PACKET_BUFSIZE bytes long
+ *
+ * @param packet	The packet that is about to be read into
+ */
+static inline void trace_release_small_buffer(libtrace_packet_t *packet) {
+	if (packet->buf_size != 0) {
+		if (packet->buf_control == TRACE_CTRL_PACKET)
+			free(packet->buffer);
+		packet->buffer = NULL;
+		packet->buf_size = 0;
+	}
+}
+
 /**
  * An internal version of trace_set_configuration that can parse the
  * settings from the start of a libtrace uri.
@@ -1325,10 +1422,40 @@ struct libtrace_filter_t {
 	int flag;			/**< Indicates if the filter is valid */
 	struct bpf_jit_t *jitfilter;
 };
+
+/** Internal representation of a set of BPF filters that are applied
+ * together */
+struct libtrace_filter_set_t {
+	/** Number of filters in the set */
+	int count;
+	/** Number of filters that space has been allocated for */
+	int allocated;
+	/** The filter strings */
+	char **filterstrings;
+	/** Index of the program run for each filter, or -1 if the filter
+	 * failed to compile */
+	int *program;
+	/** The distinct BPF programs, shared by filters that compile to
+	 * exactly the same code */
+	struct bpf_program *programs;
+	/** JIT compiled versions of the programs */
+	struct bpf_jit_t **jitprograms;
+	/** For each program, a bitmap of the filters that use it */
+	uint64_t *members;
+	/** Number of distinct programs */
+	int nprograms;
+	/** Number of 64 bit words in a bitmap of the filters */
+	int words;
+	/** Set once the filters have been compiled */
+	int compiled;
+	/** Set if any of the filters failed to compile */
+	int failed;
+};
 #else
 /** BPF not supported by this system, but we still need to define a structure
  * for the filter */
 struct libtrace_filter_t {};
+struct libtrace_filter_set_t {};
 #endif
 
 /** Local definition of a PCAP header */
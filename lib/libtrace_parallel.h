@@ -291,7 +291,18 @@ enum hasher_types {
 	 * This value indicates that the hasher is a custom user-defined
          * function. 
 	 */
-	HASHER_CUSTOM
+	HASHER_CUSTOM,
+
+	/** Use a hash of the IP addresses, protocol and IP identification,
+	 * such that every fragment of a datagram is sent to the same
+	 * processing thread. Fragments of IPv6 datagrams are hashed on the
+	 * addresses and fragment identification, and unfragmented IPv6
+	 * packets on the addresses alone.
+	 *
+	 * Use this with trace_set_reassembly_timeout() so that each thread
+	 * can reassemble the datagrams it is sent.
+	 */
+	HASHER_FRAGMENT
 };
 
 typedef struct libtrace_info_t {
@@ -503,6 +514,24 @@ typedef void (*fn_cb_tick)(libtrace_t *libtrace,
                            void *tls,
                            uint64_t order);
 
+/**
+ * A callback function for a timer added with trace_add_timer(), which is run
+ * by the processing thread that added it.
+ *
+ * @param libtrace The parallel trace.
+ * @param t The thread that is running.
+ * @param global The global storage.
+ * @param tls The thread local storage.
+ * @param ts The time the timer was due to expire, as an ERF timestamp.
+ * @param data The data passed to trace_add_timer().
+ */
+typedef void (*fn_cb_timer)(libtrace_t *libtrace,
+                            libtrace_thread_t *t,
+                            void *global,
+                            void *tls,
+                            uint64_t ts,
+                            void *data);
+
 /**
  * A callback function triggered when a processing thread receives a packet.
  *
@@ -555,6 +584,23 @@ typedef libtrace_packet_t* (*fn_cb_meta_packet)(libtrace_t *libtrace,
 typedef void (*fn_cb_result)(libtrace_t *libtrace, libtrace_thread_t *sender,
                 void *global, void *tls, libtrace_result_t *result);
 
+/**
+ * Callback for handling a batch of results. Should only be required by the
+ * reporter thread.
+ *
+ * @param libtrace The parallel trace.
+ * @param sender The thread that generated these results.
+ * @param global The global storage.
+ * @param tls The thread local storage.
+ * @param results The results, in the order the combiner produced them.
+ * These are only valid until the callback returns.
+ * @param count The number of results, at most LIBTRACE_RESULT_BATCH.
+ *
+ */
+typedef void (*fn_cb_result_batch)(libtrace_t *libtrace,
+                libtrace_thread_t *sender, void *global, void *tls,
+                libtrace_result_t *results, int count);
+
 
 /**
  * Callback for handling any user-defined message types. This will handle
@@ -573,6 +619,66 @@ typedef void (*fn_cb_usermessage) (libtrace_t *libtrace, libtrace_thread_t *t,
                 void *global, void *tls, int mesg, libtrace_generic_t data,
                 libtrace_thread_t *sender);
 
+/** A TCP connection followed by a processing thread, see
+ * trace_set_tcp_payload_cb() */
+typedef struct libtrace_tcp_stream {
+	/** 4 or 6 */
+	uint8_t ip_version;
+	/** The host that sent the first SYN, or the sender of the first
+	 * packet seen if the handshake was missed. IPv4 addresses use the
+	 * first 4 bytes. */
+	uint8_t client_ip[16];
+	uint8_t server_ip[16];
+	/** Ports in host byte order */
+	uint16_t client_port;
+	uint16_t server_port;
+	/** Free for the user to keep per connection state in, NULL when the
+	 * stream is first seen. Anything it points to should be released
+	 * when the TCP_PAYLOAD_END callback is made. */
+	void *user_data;
+} libtrace_tcp_stream_t;
+
+/** Which way payload delivered to a TCP payload callback was sent */
+enum libtrace_tcp_direction {
+	/** Sent by the client */
+	TCP_FROM_CLIENT = 0,
+	/** Sent by the server */
+	TCP_FROM_SERVER = 1
+};
+
+/** Flags passed to a TCP payload callback */
+enum libtrace_tcp_payload_flags {
+	/** Some payload before this chunk was never seen, either because it
+	 * was lost or because the stream had to be flushed to stay within
+	 * its memory limit */
+	TCP_PAYLOAD_GAP = 1,
+	/** All of the payload in this direction has been delivered and a FIN
+	 * was seen. No data comes with this callback. */
+	TCP_PAYLOAD_FIN = 2,
+	/** The stream has finished, timed out or been evicted, and this is
+	 * the last callback for it. No data comes with this callback. */
+	TCP_PAYLOAD_END = 4
+};
+
+/**
+ * A callback function triggered when a processing thread has TCP payload
+ * ready to deliver in sequence order.
+ *
+ * @param libtrace The parallel trace.
+ * @param t The thread that is running
+ * @param global The global storage.
+ * @param tls The thread local storage.
+ * @param stream The stream the payload belongs to.
+ * @param direction Which way the payload was sent, see
+ * enum libtrace_tcp_direction.
+ * @param data The payload, which is only valid until the callback returns.
+ * @param len The length of the payload in bytes.
+ * @param flags Any of enum libtrace_tcp_payload_flags.
+ */
+typedef void (*fn_cb_tcp_payload)(libtrace_t *libtrace, libtrace_thread_t *t,
+                void *global, void *tls, libtrace_tcp_stream_t *stream,
+                int direction, const uint8_t *data, size_t len, int flags);
+
 
 /**
  * Registers a starting callback against a callback set.
@@ -654,6 +760,24 @@ DLLEXPORT int trace_set_first_packet_cb(libtrace_callback_set_t *cbset,
 DLLEXPORT int trace_set_result_cb(libtrace_callback_set_t *cbset,
                 fn_cb_result handler);
 
+/** The most results passed to a batch result callback at once */
+#define LIBTRACE_RESULT_BATCH 64
+
+/**
+ * Registers a batch result callback against a callback set.
+ *
+ * Instead of a call per result, the reporter collects the results read by
+ * the combiner each time it wakes up and passes them on in batches of up
+ * to LIBTRACE_RESULT_BATCH. This takes the place of the result callback if
+ * both are set.
+ *
+ * @param cbset The callback set.
+ * @param handler The batch result callback function.
+ * @return 0 if successful, -1 otherwise.
+ */
+DLLEXPORT int trace_set_result_batch_cb(libtrace_callback_set_t *cbset,
+                fn_cb_result_batch handler);
+
 /**
  * Registers a tick counter callback against a callback set.
  *
@@ -684,6 +808,30 @@ DLLEXPORT int trace_set_tick_interval_cb(libtrace_callback_set_t *cbset,
 DLLEXPORT int trace_set_user_message_cb(libtrace_callback_set_t *cbset,
                 fn_cb_usermessage handler);
 
+/**
+ * Registers a TCP payload callback against a callback set.
+ *
+ * Registering this callback turns on TCP stream tracking in each processing
+ * thread. Every TCP segment is put back in sequence order, and the payload
+ * of each direction of each connection is passed to the callback in order,
+ * before the packet that completed it is given to the packet callback.
+ * Retransmitted and overlapping payload is only delivered once.
+ *
+ * Both directions of a connection must be sent to the same thread, so
+ * this should be used with HASHER_BIDIRECTIONAL when there is more than one
+ * processing thread. A packet callback is not needed if this is all the
+ * user wants to see.
+ *
+ * @param cbset The callback set.
+ * @param handler The TCP payload callback function.
+ * @return 0 if successful, -1 otherwise.
+ *
+ * @see trace_set_tcp_max_streams(), trace_set_tcp_memory_limit(),
+ * trace_set_tcp_idle_timeout()
+ */
+DLLEXPORT int trace_set_tcp_payload_cb(libtrace_callback_set_t *cbset,
+                fn_cb_tcp_payload handler);
+
 /** Create a callback set that can be used to define callbacks for parallel
   * libtrace threads.
   *
@@ -785,7 +933,8 @@ DLLEXPORT int trace_set_perpkt_threads(libtrace_t *trace, int nb);
  * When enabled, MESSAGE_TICK_INTERVAL will be sent every tick interval to all
  * processing threads. This allows results to be published even in cases where
  * new packets are not being directed to a processing thread, while still
- * maintaining order etc.
+ * maintaining order etc. Each thread runs its own tick timer, and every
+ * thread sees the same timestamps.
  *
  * @see MESSAGE_TICK_INTERVAL, trace_set_tick_count()
  */
@@ -903,12 +1052,13 @@ DLLEXPORT int trace_set_hasher_queue_size(libtrace_t *trace, size_t size);
  * If enabled, the processing threads will poll on the hasher queue, yielding
  * if no data is available.
  *
- * If disabled, the processing threads will block on a condition variable
- * if there is no data available from the hasher.
+ * If disabled, the processing threads will spin for a short while if there
+ * is no data available from the hasher, and then sleep until the hasher
+ * wakes them. See trace_set_wait_spin().
  *
  * @param trace A parallel input trace
  * @param polling If true the hasher will poll waiting for data, otherwise
- * it will use a condition variable. Defaults to false.
+ * it will spin and then sleep. Defaults to false.
  *
  * We note polling is likely to waste many CPU cycles and could even decrease
  * performance.
@@ -936,6 +1086,25 @@ DLLEXPORT int trace_set_hasher_polling(libtrace_t *trace, bool polling);
  */
 DLLEXPORT int trace_set_reporter_polling(libtrace_t *trace, bool polling);
 
+/**
+ * Sets how long a thread spins waiting for another before going to sleep.
+ *
+ * This applies to the processing threads waiting on the hasher (and the
+ * hasher waiting on them when their queues are full), and to the reporter
+ * waiting for results, unless polling has been enabled for them.
+ *
+ * A waiting thread first checks as fast as it can this many times, then
+ * the same number of times again with pause instructions in between, before
+ * it sleeps. The thread it is waiting for only makes a system call to wake
+ * it once it is asleep, so larger values trade CPU time for fewer system
+ * calls and lower latency.
+ *
+ * @param trace A parallel input trace
+ * @param spin The number of times to check in each step. Defaults to 1000.
+ * @return 0 if successful otherwise -1
+ */
+DLLEXPORT int trace_set_wait_spin(libtrace_t *trace, size_t spin);
+
 /**
  * Set the number of results that are required in the result queue before
  * a MESSAGE_POST_REPORTER is sent to the reporter so that it can read the
@@ -944,6 +1113,11 @@ DLLEXPORT int trace_set_reporter_polling(libtrace_t *trace, bool polling);
  * Set this to 1 to ensure if you require your results to reach the reporter
  * as soon as possible.
  *
+ * Only one message is outstanding at a time, another is not sent until the
+ * reporter has started reading the results it was told about. To bound how
+ * long results wait when the threshold is not reached, see
+ * trace_set_reporter_latency().
+ *
  * @param trace A parallel input trace
  * @param thold The threshold on the number of results to enqueue before
  * notifying the reporter thread to read them.
@@ -957,6 +1131,34 @@ DLLEXPORT int trace_set_reporter_polling(libtrace_t *trace, bool polling);
  */
 DLLEXPORT int trace_set_reporter_thold(libtrace_t *trace, size_t thold);
 
+/**
+ * Sets the longest a result should wait before the reporter is told about
+ * it, regardless of the threshold set by trace_set_reporter_thold().
+ *
+ * A processing thread that publishes a result starts a timer, and if it
+ * fires before the reporter has been sent a MESSAGE_POST_REPORTER, one is
+ * sent then. Only one timer is running per thread at a time, and the
+ * reporter is only sent another message once it has started reading the
+ * results it was last told about.
+ *
+ * @param trace A parallel input trace
+ * @param msec The latency budget in milliseconds, or 0 to only use the
+ * threshold. Defaults to 0.
+ * @return 0 if successful otherwise -1
+ * @see trace_set_reporter_thold()
+ */
+DLLEXPORT int trace_set_reporter_latency(libtrace_t *trace, size_t msec);
+
+/**
+ * Sets the size of the buffers kept by the result pool, see
+ * trace_alloc_result().
+ *
+ * @param trace A parallel input trace
+ * @param size The size of each buffer in bytes. Defaults to 128.
+ * @return 0 if successful otherwise -1
+ */
+DLLEXPORT int trace_set_result_size(libtrace_t *trace, size_t size);
+
 /**
  * Enable or disable debug output for parallel libtrace.
  *
@@ -972,6 +1174,77 @@ DLLEXPORT int trace_set_reporter_thold(libtrace_t *trace, size_t thold);
  */
 DLLEXPORT int trace_set_debug_state(libtrace_t *trace, bool debug_state);
 
+/**
+ * Reassemble fragmented IPv4 and IPv6 datagrams before they reach the
+ * per packet callback.
+ *
+ * Each processing thread collects the fragments it is sent, and once all of
+ * the fragments of a datagram have arrived passes the whole datagram to the
+ * packet callback in place of the last of them. The reassembled packet has
+ * the link layer header of the first fragment and the timestamp of the
+ * last, and is a PCAP packet whatever the format of the input trace.
+ *
+ * All of the fragments of a datagram must be sent to the same thread, so
+ * this should be used with HASHER_FRAGMENT when there is more than one
+ * processing thread.
+ *
+ * @param trace A parallel input trace
+ * @param timeout_ms How long to wait for the rest of a datagram after the
+ * first of its fragments arrives, in milliseconds of packet time. Fragments
+ * of datagrams that are still incomplete after this are discarded. 0, the
+ * default, disables reassembly.
+ * @return 0 if successful otherwise -1
+ *
+ * @note Each thread holds at most 1024 incomplete datagrams, after which the
+ * oldest is discarded.
+ */
+DLLEXPORT int trace_set_reassembly_timeout(libtrace_t *trace,
+		size_t timeout_ms);
+
+/**
+ * Set the most TCP streams each processing thread follows at once, when a
+ * TCP payload callback is registered.
+ *
+ * @param trace A parallel input trace
+ * @param max_streams The most streams per thread. Once a thread has this
+ * many the least recently active is ended to make room for a new one. 0
+ * selects the default of 65536.
+ * @return 0 if successful otherwise -1
+ *
+ * @see trace_set_tcp_payload_cb()
+ */
+DLLEXPORT int trace_set_tcp_max_streams(libtrace_t *trace,
+		size_t max_streams);
+
+/**
+ * Set how much out of order TCP payload each processing thread buffers
+ * while waiting for missing segments, when a TCP payload callback is
+ * registered.
+ *
+ * @param trace A parallel input trace
+ * @param bytes The buffer limit for each thread in bytes. Once it is
+ * reached, the least recently active streams with buffered payload are
+ * flushed with TCP_PAYLOAD_GAP. 0 selects the default of 64MB.
+ * @return 0 if successful otherwise -1
+ *
+ * @see trace_set_tcp_payload_cb()
+ */
+DLLEXPORT int trace_set_tcp_memory_limit(libtrace_t *trace, size_t bytes);
+
+/**
+ * Set how long a TCP stream can go without a packet before it is ended,
+ * when a TCP payload callback is registered.
+ *
+ * @param trace A parallel input trace
+ * @param timeout_ms The idle timeout in milliseconds of packet time. 0
+ * selects the default of 60 seconds.
+ * @return 0 if successful otherwise -1
+ *
+ * @see trace_set_tcp_payload_cb()
+ */
+DLLEXPORT int trace_set_tcp_idle_timeout(libtrace_t *trace,
+		size_t timeout_ms);
+
 /**
  * Bind per-packet threads affinities to specified CPU cores
  *
@@ -1086,6 +1359,31 @@ DLLEXPORT void trace_publish_result(libtrace_t *libtrace,
                                     libtrace_generic_t value,
                                     int type);
 
+/** Allocates memory for a result from a pool kept by the trace.
+ *
+ * This is much cheaper than malloc() for results that are published often,
+ * as each processing thread has its own pool and memory freed by the
+ * reporter is handed back to the thread that allocated it.
+ *
+ * @param[in] libtrace The parallel input trace
+ * @param[in] t The current per-packet thread
+ * @param[in] size The number of bytes needed. Requests larger than the
+ * pool's buffers (see trace_set_result_size()), or made from any other
+ * thread, are passed on to malloc().
+ * @return The memory, which is not zeroed, or NULL if it could not be
+ * allocated. It must be freed with trace_free_result().
+ */
+DLLEXPORT void *trace_alloc_result(libtrace_t *libtrace, libtrace_thread_t *t,
+                                   size_t size);
+
+/** Frees memory from trace_alloc_result(). This can be called by any
+ * thread, usually the reporter once it is done with the result.
+ *
+ * @param[in] libtrace The parallel input trace
+ * @param[in] result The memory to free
+ */
+DLLEXPORT void trace_free_result(libtrace_t *libtrace, void *result);
+
 /** Check if a dedicated hasher thread is being used.
  *
  * @param[in] libtrace The parallel input trace
@@ -1200,6 +1498,48 @@ DLLEXPORT int trace_message_thread(libtrace_t * libtrace,
                                    libtrace_thread_t *t,
                                    libtrace_message_t * message);
 
+/** Adds a timer to a processing thread.
+ *
+ * @param[in] libtrace The parallel trace
+ * @param[in] t The processing thread, which must be the calling thread
+ * @param[in] delay The number of milliseconds until the timer first expires
+ * @param[in] period The number of milliseconds between expiries after that,
+ * or 0 for a timer that only expires once
+ * @param[in] fn The function to call when the timer expires
+ * @param[in] data Passed to fn
+ *
+ * @return The timer, or NULL upon error in which case the libtrace error
+ * is set.
+ *
+ * Timers are run by the processing thread between packets, with a resolution
+ * of a millisecond, and wake the thread if it is waiting for packets. A
+ * periodic timer that falls behind skips the expiries it missed.
+ *
+ * A timer that only expires once is freed after its callback returns. Any
+ * timers left when the thread stops are freed.
+ *
+ * @see trace_cancel_timer(), trace_set_tick_interval()
+ */
+DLLEXPORT libtrace_thread_timer_t *trace_add_timer(libtrace_t *libtrace,
+                                                   libtrace_thread_t *t,
+                                                   uint64_t delay,
+                                                   uint64_t period,
+                                                   fn_cb_timer fn,
+                                                   void *data);
+
+/** Cancels and frees a timer added with trace_add_timer().
+ *
+ * @param[in] libtrace The parallel trace
+ * @param[in] t The processing thread, which must be the calling thread
+ * @param[in] timer The timer to cancel
+ *
+ * @return 0 if successful, otherwise -1. Cancelling a timer that only
+ * expires once from within its own callback fails, as it has already
+ * expired.
+ */
+DLLEXPORT int trace_cancel_timer(libtrace_t *libtrace, libtrace_thread_t *t,
+                                 libtrace_thread_timer_t *timer);
+
 /** Checks if a parallel trace has finished reading packets.
  *
  * @return true if the trace has finished reading packets (even if all results
@@ -1415,7 +1755,15 @@ DLLEXPORT libtrace_info_t *trace_get_information(libtrace_t * libtrace);
  * * \b hasher_polling,\b hp see trace_set_hasher_polling() [bool]
  * * \b reporter_polling,\b rp see trace_set_reporter_polling() [bool]
  * * \b reporter_thold,\b rt see trace_set_reporter_thold() [size_t]
+ * * \b reporter_latency,\b rl see trace_set_reporter_latency() [size_t]
+ * * \b result_size,\b rs see trace_set_result_size() [size_t]
+ * * \b wait_spin,\b ws see trace_set_wait_spin() [size_t]
  * * \b debug_state,\b ds see trace_set_debug_state() [bool]
+ * * \b reassembly_timeout,\b rto see trace_set_reassembly_timeout() [size_t]
+ * * \b tcp_max_streams,\b tms see trace_set_tcp_max_streams() [size_t]
+ * * \b tcp_memory_limit,\b tml see trace_set_tcp_memory_limit() [size_t]
+ * * \b tcp_idle_timeout,\b tit see trace_set_tcp_idle_timeout() [size_t]
+ * * \b latency_histograms,\b lh see trace_set_latency_histograms() [int]
  * * \b coremap see trace_set_coremap() [string of comma-separated integers]
  *   e.g. coremap=[1,3,5,7] (square brackets required)
  *
@@ -1459,6 +1807,158 @@ DLLEXPORT int trace_get_perpkt_threads(libtrace_t* t);
  */
 DLLEXPORT int trace_get_perpkt_thread_id(libtrace_thread_t *thread);
 
+/** The number of buckets in each histogram of libtrace_thread_counters_t */
+#define LIBTRACE_COUNTER_BUCKETS 16
+
+/**
+ * Counters kept by each processing thread of a parallel trace.
+ *
+ * These are counted entirely within libtrace, unlike libtrace_stat_t which
+ * also asks the capture format, so they are cheap enough to poll frequently.
+ * Each thread updates its own private copy and publishes it after every
+ * batch of packets, so a snapshot may be up to one batch behind.
+ */
+typedef struct libtrace_thread_counters {
+	/** Packets read by the thread, including meta packets and packets
+	 * that were then filtered */
+	uint64_t received;
+	/** Packets passed on to the user */
+	uint64_t accepted;
+	/** Packets discarded by the filter */
+	uint64_t filtered;
+	/** IP fragments discarded because their datagram was never
+	 * completed */
+	uint64_t dropped;
+	/** Sum of the wire lengths of the accepted packets */
+	uint64_t bytes;
+	/** Batches of packets read by the thread */
+	uint64_t bursts;
+	/** Histogram of batch sizes, bucket i counts batches of between 2^i
+	 * and 2^(i+1)-1 packets */
+	uint64_t burst_sizes[LIBTRACE_COUNTER_BUCKETS];
+	/** Messages and packets waiting for the thread when it last
+	 * published its counters */
+	uint64_t queue_depth;
+	/** The largest queue_depth seen */
+	uint64_t queue_depth_max;
+	/** Histogram of the time taken by the packet callback, sampled once
+	 * every 64 packets. Bucket 0 counts calls under 128ns and bucket i
+	 * calls of between 2^(i+6) and 2^(i+7)-1 ns, the last bucket also
+	 * counts anything slower. */
+	uint64_t callback_latency[LIBTRACE_COUNTER_BUCKETS];
+} libtrace_thread_counters_t;
+
+/** Takes a consistent snapshot of the counters of a processing thread.
+ *
+ * @param trace The parallel trace
+ * @param thread The ID of the processing thread, see
+ * trace_get_perpkt_thread_id()
+ * @param counters Filled with the thread's counters upon return
+ * @return 0 if successful, otherwise -1
+ *
+ * This never waits for the thread, and may be called from any thread at any
+ * point between starting the trace and destroying it.
+ */
+DLLEXPORT int trace_get_thread_counters(libtrace_t *trace, int thread,
+		libtrace_thread_counters_t *counters);
+
+/** Sums the counters of every processing thread of a parallel trace.
+ *
+ * @param trace The parallel trace
+ * @param counters Filled with the totals upon return, queue_depth_max is the
+ * largest of any thread rather than the sum
+ * @return 0 if successful, otherwise -1
+ *
+ * Unlike trace_get_statistics() this does not call into the capture format.
+ */
+DLLEXPORT int trace_get_counters(libtrace_t *trace,
+		libtrace_thread_counters_t *counters);
+
+/** The stages of the parallel engine that can be timed, see
+ * trace_set_latency_histograms() */
+typedef enum {
+	/** Reading a batch of packets from the capture format, by either a
+	 * processing thread or the hasher thread */
+	LIBTRACE_STAGE_READ,
+	/** Running the hasher function on a packet */
+	LIBTRACE_STAGE_HASHER,
+	/** Waiting on a hasher ring buffer, either in a processing thread for
+	 * a packet to arrive or in the hasher thread for space to write one */
+	LIBTRACE_STAGE_RING_WAIT,
+	/** Running the packet callback */
+	LIBTRACE_STAGE_CALLBACK,
+	/** Publishing a result with trace_publish_result() */
+	LIBTRACE_STAGE_PUBLISH,
+	/** Reading results from the combiner in the reporter thread, which
+	 * includes running the result callback */
+	LIBTRACE_STAGE_COMBINER,
+	LIBTRACE_STAGE_COUNT
+} libtrace_stage_t;
+
+/** Options for trace_set_latency_histograms(), which can be combined */
+enum libtrace_latency_options {
+	/** Record a latency histogram for each stage of each thread */
+	LATENCY_RECORD = 1,
+	/** Print the histograms to stderr in trace_join() */
+	LATENCY_DUMP_ON_JOIN = 2,
+	/** Print the histograms to stderr whenever the process receives
+	 * SIGUSR1, unless the application has its own handler for it */
+	LATENCY_DUMP_ON_SIGUSR1 = 4,
+};
+
+/** A summary of the latency histogram of a stage, all in nanoseconds */
+typedef struct libtrace_latency_summary {
+	/** The number of times the stage was timed */
+	uint64_t count;
+	uint64_t min;
+	uint64_t mean;
+	uint64_t p50;
+	uint64_t p90;
+	uint64_t p99;
+	uint64_t p999;
+	uint64_t max;
+} libtrace_latency_summary_t;
+
+/**
+ * Sets whether to time each stage of the parallel engine, to help find out
+ * where the time goes when a trace is not keeping up.
+ *
+ * Timing is only available if libtrace was configured with
+ * --enable-latency-histograms, otherwise none of the timing code is
+ * compiled in. Percentiles are accurate to within about 6%.
+ *
+ * @param trace A parallel input trace
+ * @param options A combination of enum libtrace_latency_options, 0 turns
+ * timing off. Any dump option also turns on LATENCY_RECORD.
+ * @return 0 if successful otherwise -1
+ *
+ * @see trace_get_stage_latency(), trace_dump_latency_histograms()
+ */
+DLLEXPORT int trace_set_latency_histograms(libtrace_t *trace, int options);
+
+/** Summarises the latency histogram of one stage.
+ *
+ * @param trace The parallel trace
+ * @param thread The ID of a processing thread, or -1 to combine every
+ * thread including the hasher and reporter threads
+ * @param stage The stage
+ * @param summary Filled with the summary upon return
+ * @return 0 if successful, otherwise -1 if timing is not turned on or the
+ * thread does not exist
+ *
+ * This can be called while the trace is running and after it has been
+ * joined, until it is destroyed.
+ */
+DLLEXPORT int trace_get_stage_latency(libtrace_t *trace, int thread,
+		libtrace_stage_t stage, libtrace_latency_summary_t *summary);
+
+/** Prints a summary of every latency histogram with something in it.
+ *
+ * @param trace The parallel trace
+ * @param out Where to print the summaries
+ */
+DLLEXPORT void trace_dump_latency_histograms(libtrace_t *trace, FILE *out);
+
 /**
  * Sets a combiner function for an input trace.
  *
@@ -28,19 +28,159 @@
 #include "libtrace_int.h" 
 #include "libtrace.h"
 
+#include <stddef.h>
+#include <string.h>
+
 /* The file contains all the functions necessary to access various measurement
  * values that are specific to wireless MACs ( RadioTap in particular ).
  *
  * Credit for all this code goes to Scott Raynel.
  */
 
-/* Used for Radiotap fields which must be naturally aligned */
-#define ALIGN_NATURAL_64(_p,_s) \
-	while ( (_p - _s) % sizeof(uint64_t)) _p++
-#define ALIGN_NATURAL_32(_p,_s) \
-	while ( (_p - _s) % sizeof(uint32_t)) _p++
-#define ALIGN_NATURAL_16(_p,_s) \
-	while ( (_p - _s) % sizeof(uint16_t)) _p++
+/* The alignment and size of each field in the Radiotap namespace, which
+ * are needed to find the fields that come after it */
+static const struct {
+	uint8_t align;
+	uint8_t size;
+} radiotap_fields[TRACE_RADIOTAP_INDEX_FIELDS] = {
+	{8, 8},		/* TSFT */
+	{1, 1},		/* Flags */
+	{1, 1},		/* Rate */
+	{2, 4},		/* Channel */
+	{2, 2},		/* FHSS */
+	{1, 1},		/* dBm antenna signal */
+	{1, 1},		/* dBm antenna noise */
+	{2, 2},		/* Lock quality */
+	{2, 2},		/* TX attenuation */
+	{2, 2},		/* dB TX attenuation */
+	{1, 1},		/* dBm TX power */
+	{1, 1},		/* Antenna */
+	{1, 1},		/* dB antenna signal */
+	{1, 1},		/* dB antenna noise */
+	{2, 2},		/* RX flags */
+	{2, 2},		/* TX flags */
+	{1, 1},		/* RTS retries */
+	{1, 1},		/* Data retries */
+	{4, 8},		/* XChannel */
+	{1, 3},		/* MCS */
+	{4, 8},		/* A-MPDU status */
+	{2, 12},	/* VHT */
+	{8, 12},	/* Timestamp */
+	{2, 12},	/* HE */
+	{2, 12},	/* HE-MU */
+	{2, 6},		/* HE-MU other user */
+	{1, 1},		/* Zero length PSDU */
+	{2, 4},		/* L-SIG */
+};
+
+/* The most presence bitmaps a remembered layout can have */
+#define RADIOTAP_LAYOUT_WORDS 8
+
+/* Finds where every field of a Radiotap header is in a single pass.
+ *
+ * Fields are aligned relative to the start of the header. Bitmaps in the
+ * Radiotap namespace number their fields from 32 times the number of
+ * bitmaps since the namespace began, and vendor namespaces are skipped
+ * using the length in their header. Parsing stops at the first field that
+ * libtrace doesn't know the size of, as nothing after it can be found.
+ *
+ * Returns the number of presence bitmaps, or 0 if any of them are in a
+ * vendor namespace, in which case the layout depends on more than the
+ * bitmaps.
+ */
+static int radiotap_build_index(void *link, libtrace_radiotap_index_t *idx)
+{
+	uint8_t *hdr = (uint8_t *)link;
+	uint16_t len = bswap_le_to_host16(((libtrace_radiotap_t *)link)->it_len);
+	uint8_t *bitmap = hdr + offsetof(libtrace_radiotap_t, it_present);
+	uint32_t p, word;
+	int nwords = 0, ns_word = 0, vendor = 0, cacheable = 1;
+	int w, bit, field;
+
+	idx->header = hdr;
+	idx->present = 0;
+
+	/* The data begins after the last presence bitmap */
+	p = bitmap - hdr;
+	do {
+		if (p + sizeof(uint32_t) > len)
+			return 0;
+		memcpy(&word, hdr + p, sizeof(word));
+		p += sizeof(uint32_t);
+		nwords ++;
+	} while (bswap_le_to_host32(word) & (1U << TRACE_RADIOTAP_EXT));
+
+	for (w = 0; w < nwords; w++) {
+		int next_vendor = vendor;
+		int reset = 0;
+
+		memcpy(&word, bitmap + w * sizeof(uint32_t), sizeof(word));
+		word = bswap_le_to_host32(word);
+
+		for (bit = 0; bit < TRACE_RADIOTAP_EXT; bit++) {
+			if (!(word & (1U << bit)))
+				continue;
+
+			if (bit == TRACE_RADIOTAP_RADIOTAP_NAMESPACE) {
+				next_vendor = 0;
+				reset = 1;
+				continue;
+			}
+			if (bit == TRACE_RADIOTAP_VENDOR_NAMESPACE) {
+				uint16_t skip;
+
+				/* OUI, sub namespace and skip length */
+				p = (p + 1) & ~1U;
+				if (p + 6 > len)
+					return 0;
+				memcpy(&skip, hdr + p + 4, sizeof(skip));
+				p += 6 + bswap_le_to_host16(skip);
+				next_vendor = 1;
+				reset = 1;
+				cacheable = 0;
+				continue;
+			}
+			if (vendor)
+				continue;
+
+			field = ns_word * 32 + bit;
+			if (field >= TRACE_RADIOTAP_INDEX_FIELDS)
+				return cacheable ? nwords : 0;
+			p = (p + radiotap_fields[field].align - 1) &
+				~(uint32_t)(radiotap_fields[field].align - 1);
+			if (p + radiotap_fields[field].size > len)
+				return cacheable ? nwords : 0;
+			if (!(idx->present & (1U << field))) {
+				idx->present |= 1U << field;
+				idx->offset[field] = p;
+			}
+			p += radiotap_fields[field].size;
+		}
+
+		vendor = next_vendor;
+		ns_word = reset ? 0 : ns_word + 1;
+	}
+	return cacheable ? nwords : 0;
+}
+
+static inline void *radiotap_index_lookup(libtrace_radiotap_index_t *idx,
+		libtrace_radiotap_field_t field)
+{
+	if ((unsigned)field >= TRACE_RADIOTAP_INDEX_FIELDS ||
+			!(idx->present & (1U << field)))
+		return NULL;
+	return idx->header + idx->offset[field];
+}
+
+/* The layout of the last Radiotap header seen by this thread. Captures
+ * almost always give every frame the same set of fields, so the index only
+ * needs to be built again when the presence bitmaps change. */
+static __thread struct {
+	uint16_t len;
+	int nwords;
+	uint32_t words[RADIOTAP_LAYOUT_WORDS];
+	libtrace_radiotap_index_t idx;
+} radiotap_layout;
 
 /** Gets a field from a Radiotap header.
  * @param link the radiotap header
@@ -49,122 +189,53 @@
  * appropriate type.
  * @note Radiotap fields are always little-endian
  */
-static void *trace_get_radiotap_field(void *link, libtrace_radiotap_field_t field)
+static void *radiotap_field(void *link, libtrace_radiotap_field_t field)
 {
 	struct libtrace_radiotap_t *rtap = (struct libtrace_radiotap_t *)link;
-	uint8_t *p;
-	uint8_t *s;
-
-	/* Check if the field exists in the radiotap header before proceeding
-	*/
-	if ((bswap_le_to_host32(rtap->it_present) & (1 << field)) == 0) return NULL;
-
-	/* Skip over any extended bitmasks */
-	p = (uint8_t *) &(rtap->it_present);
-
-	while ( bswap_le_to_host32(*((uint32_t*)p)) & (1U << TRACE_RADIOTAP_EXT) ) {
-		p += sizeof (uint32_t);
-	}
-
-	/* Point p at the first field of radiotap data and remember it for later
-	 * when we're doing field alignment 
-	 */
-	p += sizeof(uint32_t);
-	s = p;
-
-	if (field == TRACE_RADIOTAP_TSFT) 
-		/* Always aligned */
-		return (void*)p;
-	if (bswap_le_to_host32(rtap->it_present) & (1 << TRACE_RADIOTAP_TSFT))
-		p += sizeof (uint64_t);
-
-	if (field == TRACE_RADIOTAP_FLAGS)
-		/* Always aligned */
-		return (void*)p;
-	if (bswap_le_to_host32(rtap->it_present) & (1 << TRACE_RADIOTAP_FLAGS))
-		p += sizeof (uint8_t);
-
-	if (field == TRACE_RADIOTAP_RATE)
-		/* Always aligned */
-		return (void*)p;
-	if (bswap_le_to_host32(rtap->it_present) & (1 << TRACE_RADIOTAP_RATE))
-		p+= sizeof (uint8_t);
-
-	if (field == TRACE_RADIOTAP_CHANNEL)
-	{
-		ALIGN_NATURAL_16(p,s);
-		return (void *)p;
-	}
-	if (bswap_le_to_host32(rtap->it_present) & (1 << TRACE_RADIOTAP_CHANNEL))
-		p+= sizeof (uint32_t);
-
-	if (field == TRACE_RADIOTAP_FHSS)
-	{
-		ALIGN_NATURAL_16(p,s);
-		return (void *)p;
-	}
-	if (bswap_le_to_host32(rtap->it_present) & (1 << TRACE_RADIOTAP_FHSS))
-		p+= sizeof (uint16_t);
-
-	if (field == TRACE_RADIOTAP_DBM_ANTSIGNAL)
-		return (void *)p;
-	if (bswap_le_to_host32(rtap->it_present) & (1 << TRACE_RADIOTAP_DBM_ANTSIGNAL))
-		p+= sizeof (uint8_t);
-
-	if (field == TRACE_RADIOTAP_DBM_ANTNOISE)
-		return (void *)p;
-	if (bswap_le_to_host32(rtap->it_present) & (1 << TRACE_RADIOTAP_DBM_ANTNOISE))
-		p+= sizeof (uint8_t);
-
-	if (field == TRACE_RADIOTAP_LOCK_QUALITY)
-	{
-		ALIGN_NATURAL_16(p,s);
-		return (void *)p;
+	int nwords = radiotap_layout.nwords;
+
+	/* Reuse the last layout if the length and bitmaps are the same */
+	if (nwords > 0 && rtap->it_len == radiotap_layout.len &&
+			memcmp(&rtap->it_present, radiotap_layout.words,
+				nwords * sizeof(uint32_t)) == 0) {
+		radiotap_layout.idx.header = (uint8_t *)link;
+		return radiotap_index_lookup(&radiotap_layout.idx, field);
 	}
-	if (bswap_le_to_host32(rtap->it_present) & (1 << TRACE_RADIOTAP_LOCK_QUALITY))
-		p+= sizeof (uint16_t);
 
-	if (field == TRACE_RADIOTAP_TX_ATTENUATION)
-	{
-		ALIGN_NATURAL_16(p,s);
-		return (void *)p;
-	}
-	if (bswap_le_to_host32(rtap->it_present) & (1 << TRACE_RADIOTAP_TX_ATTENUATION))
-		p+= sizeof (uint16_t);
+	nwords = radiotap_build_index(link, &radiotap_layout.idx);
+	if (nwords > RADIOTAP_LAYOUT_WORDS)
+		nwords = 0;
+	radiotap_layout.nwords = nwords;
+	radiotap_layout.len = rtap->it_len;
+	memcpy(radiotap_layout.words, &rtap->it_present,
+			nwords * sizeof(uint32_t));
+	return radiotap_index_lookup(&radiotap_layout.idx, field);
+}
 
-	if (field == TRACE_RADIOTAP_DB_TX_ATTENUATION)
-	{
-		ALIGN_NATURAL_16(p,s);
-		return (void *)p;
+DLLEXPORT void *trace_get_radiotap_field(libtrace_packet_t *packet,
+		libtrace_radiotap_field_t field)
+{
+	libtrace_linktype_t linktype;
+	uint32_t remaining;
+	void *meta;
+
+	if (!packet->cached.radiotap_indexed) {
+		packet->cached.radiotap_indexed = 1;
+		packet->cached.radiotap.header = NULL;
+		packet->cached.radiotap.present = 0;
+
+		/* Radiotap may be inside another meta-data header, e.g. SLL */
+		meta = trace_get_packet_meta(packet, &linktype, &remaining);
+		while (meta && linktype != TRACE_TYPE_80211_RADIO)
+			meta = trace_get_payload_from_meta(meta, &linktype,
+					&remaining);
+		if (meta && remaining >= sizeof(libtrace_radiotap_t) &&
+				bswap_le_to_host16(((libtrace_radiotap_t *)
+					meta)->it_len) <= remaining)
+			radiotap_build_index(meta, &packet->cached.radiotap);
 	}
-	if (bswap_le_to_host32(rtap->it_present) & (1 << TRACE_RADIOTAP_DB_TX_ATTENUATION))
-		p+= sizeof (uint16_t);
-
-	if (field == TRACE_RADIOTAP_DBM_TX_POWER)
-		return (void *)p;
-	if (bswap_le_to_host32(rtap->it_present) & (1 << TRACE_RADIOTAP_DBM_TX_POWER))
-		p+= sizeof (uint8_t);
-
-	if (field == TRACE_RADIOTAP_ANTENNA)
-		return (void *)p;
-	if (bswap_le_to_host32(rtap->it_present) & (1 << TRACE_RADIOTAP_ANTENNA))
-		p+= sizeof (uint8_t);
-
-	if (field == TRACE_RADIOTAP_DB_ANTSIGNAL)
-		return (void *)p;
-	if (bswap_le_to_host32(rtap->it_present) & (1 << TRACE_RADIOTAP_DB_ANTSIGNAL))
-		p+= sizeof (uint8_t);
-
-	if (field == TRACE_RADIOTAP_DB_ANTNOISE)
-		return (void *) p;
-	/*
-	if (bswap_le_to_host32(rtap->it_present) & (1 << TRACE_RADIOTAP_DB_ANTNOISE))
-		p+= sizeof (uint8_t);
-	*/
-
-	/* Unknown field */
-	return NULL;
-} 
+	return radiotap_index_lookup(&packet->cached.radiotap, field);
+}
 
 DLLEXPORT bool trace_get_wireless_tsft(void *link, 
 		libtrace_linktype_t linktype, uint64_t *tsft)
@@ -176,7 +247,7 @@ DLLEXPORT bool trace_get_wireless_tsft(void *link,
 
 	switch (linktype) {
 		case TRACE_TYPE_80211_RADIO:
-			if( (p = (uint64_t *) trace_get_radiotap_field(link, 
+			if( (p = (uint64_t *) radiotap_field(link, 
 							TRACE_RADIOTAP_TSFT))) {
 				*tsft = bswap_le_to_host64(*p);
 				return true;
@@ -211,7 +282,7 @@ bool trace_get_wireless_flags(void *link,
 
 	switch(linktype) {
 		case TRACE_TYPE_80211_RADIO:
-			if (( p = (uint8_t *) trace_get_radiotap_field(link,
+			if (( p = (uint8_t *) radiotap_field(link,
 							TRACE_RADIOTAP_FLAGS))) {
 				*flags = *p;
 				return true;
@@ -235,7 +306,7 @@ DLLEXPORT bool trace_get_wireless_rate(void *link,
 	if (link == NULL || rate == NULL) return false ;
 	switch (linktype) {
 		case TRACE_TYPE_80211_RADIO:
-			if ( (p = (uint8_t *) trace_get_radiotap_field(link,
+			if ( (p = (uint8_t *) radiotap_field(link,
 							TRACE_RADIOTAP_RATE))) {
 				*rate = *p;
 				return true;
@@ -263,7 +334,7 @@ DLLEXPORT bool trace_get_wireless_freq(void *link,
 			 * The chan_freq field is the first of those two, so we
 			 * just cast it to a uint16_t.
 			 */
-			if (( p = (uint16_t *) trace_get_radiotap_field(link,
+			if (( p = (uint16_t *) radiotap_field(link,
 							TRACE_RADIOTAP_CHANNEL))) {
 				*freq = bswap_le_to_host16(*p);
 				return true;
@@ -299,7 +370,7 @@ bool trace_get_wireless_channel_flags(void *link,
 			 * to take the pointer returned by getting the channel field
 			 * and increment it.
 			 */
-			if ((p = (uint16_t *) trace_get_radiotap_field(link,
+			if ((p = (uint16_t *) radiotap_field(link,
 							TRACE_RADIOTAP_CHANNEL))) {
 				*flags = bswap_le_to_host16(*(++p));
 				return true;
@@ -330,7 +401,7 @@ bool trace_get_wireless_fhss_hopset(void *link,
 			/* NB: As above with the channel field, the fhss field is
 			 * similar.
 			 */
-			if( (p = (uint8_t *) trace_get_radiotap_field(link,
+			if( (p = (uint8_t *) radiotap_field(link,
 							TRACE_RADIOTAP_FHSS))) {
 				*hopset = *p;
 				return true;
@@ -357,7 +428,7 @@ bool trace_get_wireless_fhss_hoppattern(void *link,
 	if (link == NULL || hoppattern == NULL) return false;
 	switch (linktype) {
 		case TRACE_TYPE_80211_RADIO:
-			if((p = (uint8_t *) trace_get_radiotap_field(link,
+			if((p = (uint8_t *) radiotap_field(link,
 							TRACE_RADIOTAP_FHSS))) {
 				*hoppattern = *(++p);
 				return true;
@@ -383,7 +454,7 @@ DLLEXPORT bool trace_get_wireless_signal_strength_dbm(void *link,
 	if (link == NULL || strength == NULL) return false;
 	switch(linktype) {
 		case TRACE_TYPE_80211_RADIO:
-			if ((p =  (int8_t *) trace_get_radiotap_field(link,
+			if ((p =  (int8_t *) radiotap_field(link,
 							TRACE_RADIOTAP_DBM_ANTSIGNAL))) {
 				*strength = *p;
 				return true;
@@ -407,7 +478,7 @@ DLLEXPORT bool trace_get_wireless_noise_strength_dbm(void *link,
 	if (link == NULL || strength == NULL) return false;
 	switch (linktype) {
 		case TRACE_TYPE_80211_RADIO:
-			if (( p = (uint8_t *) trace_get_radiotap_field(link,
+			if (( p = (uint8_t *) radiotap_field(link,
 					TRACE_RADIOTAP_DBM_ANTNOISE))) {
 				*strength = *p;
 				return true;
@@ -431,7 +502,7 @@ DLLEXPORT bool trace_get_wireless_signal_strength_db(void *link,
 	if (link == NULL || strength == NULL) return false;
 	switch (linktype) {
 		case TRACE_TYPE_80211_RADIO:
-			if ((p =  (uint8_t *) trace_get_radiotap_field(link,
+			if ((p =  (uint8_t *) radiotap_field(link,
 							TRACE_RADIOTAP_DB_ANTSIGNAL))) {
 				*strength = *p;
 				return true;
@@ -455,7 +526,7 @@ DLLEXPORT bool trace_get_wireless_noise_strength_db(void *link,
 	if (link == NULL || strength == NULL) return false;
 	switch (linktype) {
 		case TRACE_TYPE_80211_RADIO:
-			if ((p = (uint8_t *) trace_get_radiotap_field(link,
+			if ((p = (uint8_t *) radiotap_field(link,
 							TRACE_RADIOTAP_DB_ANTNOISE))) {
 				*strength = *p;
 				return true;
@@ -485,7 +556,7 @@ bool trace_get_wireless_lock_quality(void *link,
 	if (link == NULL || quality == NULL) return false;
 	switch (linktype) {
 		case TRACE_TYPE_80211_RADIO:
-			if((p = (uint16_t *) trace_get_radiotap_field(link,
+			if((p = (uint16_t *) radiotap_field(link,
 							TRACE_RADIOTAP_LOCK_QUALITY))) {
 				*quality = bswap_le_to_host16(*p);
 				return true;
@@ -511,7 +582,7 @@ DLLEXPORT bool trace_get_wireless_tx_attenuation(void *link,
 	if (link == NULL || attenuation == 0) return false;
 	switch (linktype) {
 		case TRACE_TYPE_80211_RADIO:
-			if ((p = (uint16_t *) trace_get_radiotap_field(link,
+			if ((p = (uint16_t *) radiotap_field(link,
 							TRACE_RADIOTAP_TX_ATTENUATION))) {
 				*attenuation = bswap_le_to_host16(*p);
 				return true;
@@ -535,7 +606,7 @@ DLLEXPORT bool trace_get_wireless_tx_attenuation_db(void *link,
 	if (link == NULL || attenuation == NULL) return false;
 	switch (linktype) {
 		case TRACE_TYPE_80211_RADIO:
-			if ((p = (uint16_t *) trace_get_radiotap_field(link,
+			if ((p = (uint16_t *) radiotap_field(link,
 							TRACE_RADIOTAP_DB_TX_ATTENUATION))) {
 				*attenuation = bswap_le_to_host16(*p);
 				return true;
@@ -559,7 +630,7 @@ DLLEXPORT bool trace_get_wireless_tx_power_dbm(void *link,
 	if (link == NULL || txpower == NULL) return false;
 	switch (linktype) {
 		case TRACE_TYPE_80211_RADIO:
-			if ((p=(int8_t *) trace_get_radiotap_field(link,
+			if ((p=(int8_t *) radiotap_field(link,
 							TRACE_RADIOTAP_DBM_TX_POWER))) {
 				*txpower = *p;
 				return true;
@@ -584,7 +655,7 @@ DLLEXPORT bool trace_get_wireless_antenna(void *link,
 	if (link == NULL || antenna == NULL) return false;
 	switch (linktype) {
 		case TRACE_TYPE_80211_RADIO:
-			if ((p = (uint8_t *) trace_get_radiotap_field(link,
+			if ((p = (uint8_t *) radiotap_field(link,
 							TRACE_RADIOTAP_ANTENNA))) {
 				*antenna = *p;
 				return true;
@@ -371,11 +371,10 @@ static void replacement_pcap_header(libtrace_packet_t *packet, char *payload,
                 libtrace_dlt_t linktype) {
 
 	char *tmp;
+        size_t size = trace_get_capture_length(packet)
+                        +sizeof(libtrace_pcapfile_pkt_hdr_t);
 
-        tmp=(char*)malloc(
-                        trace_get_capture_length(packet)
-                        +sizeof(libtrace_pcapfile_pkt_hdr_t)
-                        );
+        tmp=(char*)malloc(size);
 
         ((libtrace_pcapfile_pkt_hdr_t*)tmp)->ts_sec=tv->tv_sec;
         ((libtrace_pcapfile_pkt_hdr_t*)tmp)->ts_usec=tv->tv_usec;
@@ -392,6 +391,9 @@ static void replacement_pcap_header(libtrace_packet_t *packet, char *payload,
                 free(packet->buffer);
         }
         packet->buffer=tmp;
+        /* Smaller than a regular packet buffer, so make sure it is
+         * replaced before the packet is read into again */
+        packet->buf_size=size;
         packet->header=tmp;
         packet->payload=tmp+sizeof(libtrace_pcapfile_pkt_hdr_t);
         packet->type=pcap_linktype_to_rt(linktype);
@@ -83,4 +83,22 @@ struct ports_t {
 	uint16_t dst;		/**< Destination port */
 };
 
+/** Finds the fragment header in an IPv6 packet
+ *
+ * @param ip6		A pointer to the IPv6 header
+ * @param remaining	The number of captured bytes from the IPv6 header
+ * 			onwards
+ * @param[out] nxt_offset	Set to the offset from the start of the IPv6
+ * 			header of the next header field that refers to the
+ * 			fragment header. May be NULL.
+ * @return A pointer to the fragment header, or NULL if there isn't one or
+ * the packet is too short to find it
+ *
+ * Only the extension headers that may appear before a fragment header are
+ * skipped, so the fragmentable part of the packet starts straight after the
+ * fragment header.
+ */
+libtrace_ip6_frag_t *trace_get_fragment_from_ip6(libtrace_ip6_t *ip6,
+		uint32_t remaining, uint32_t *nxt_offset);
+
 #endif
@@ -429,6 +429,7 @@ libtrace_packet_t *trace_strip_packet(libtrace_packet_t *packet) {
                         (dest - (char *)packet->payload));
                 packet->payload = nextpayload - (dest - (char *)packet->payload);
                 packet->cached.l2_header = NULL;
+                packet->cached.parsed = 0;
         }
         
         return packet;
@@ -704,9 +705,9 @@ DLLEXPORT void *trace_get_layer2(const libtrace_packet_t *packet,
 	if (remaining == NULL)
 		remaining = &dummyrem;
 
-	if (packet->cached.l2_header) {
+	if (packet->cached.l2_header || packet->cached.parsed) {
 		/* Use cached values */
-		*linktype = packet->cached.link_type;
+		*linktype = packet->cached.l2_link_type;
 		*remaining = packet->cached.l2_remaining;
 		return packet->cached.l2_header;
 	}
@@ -739,6 +740,7 @@ DLLEXPORT void *trace_get_layer2(const libtrace_packet_t *packet,
 		case TRACE_TYPE_OPENBSD_LOOP:
 			((libtrace_packet_t*)packet)->cached.l2_header = meta;
 			((libtrace_packet_t*)packet)->cached.l2_remaining = *remaining;
+			((libtrace_packet_t*)packet)->cached.l2_link_type = *linktype;
 			return meta;
 		case TRACE_TYPE_LINUX_SLL:
 		case TRACE_TYPE_80211_RADIO:
@@ -825,6 +827,7 @@ DLLEXPORT void *trace_get_layer2(const libtrace_packet_t *packet,
 
         ((libtrace_packet_t*)packet)->cached.l2_header = meta;
         ((libtrace_packet_t*)packet)->cached.l2_remaining = *remaining;
+        ((libtrace_packet_t*)packet)->cached.l2_link_type = *linktype;
 
         return meta;
 }
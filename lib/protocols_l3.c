@@ -225,7 +225,7 @@ DLLEXPORT void *trace_get_layer3(const libtrace_packet_t *packet,
 	if (!remaining) remaining=&dummy_remaining;
 
 	/* use l3 cache */
-	if (packet->cached.l3_header)
+	if (packet->cached.l3_header || packet->cached.parsed)
 	{
 		/*
 		link = trace_get_packet_buffer(packet,&linktype,remaining);
@@ -243,7 +243,7 @@ DLLEXPORT void *trace_get_layer3(const libtrace_packet_t *packet,
 
         if (packet->cached.l2_header) {
                 link = packet->cached.l2_header;
-                linktype = packet->cached.link_type;
+                linktype = packet->cached.l2_link_type;
                 *remaining = packet->cached.l2_remaining;
         } else {
         	link = trace_get_layer2(packet,&linktype,remaining);
@@ -696,8 +696,8 @@ DLLEXPORT uint16_t *trace_checksum_layer3(libtrace_packet_t *packet,
 	uint16_t ethertype;
 	uint32_t remaining;
 	char *csum_ptr;
-
-	uint8_t safety[65536];
+	uint32_t sum;
+	size_t hlen;
 
 	if (csum == NULL)
 		return NULL;
@@ -713,18 +713,16 @@ DLLEXPORT uint16_t *trace_checksum_layer3(libtrace_packet_t *packet,
 			return NULL;
 
 		csum_ptr = (char *)(&ip->ip_sum);
+		hlen = ip->ip_hl * sizeof(uint32_t);
 
-		/* I hate memcpys, but this is the only truly safe way to
-		 * do this without modifying the packet. I'm trying to be
-		 * careful about not creating any more thread-safety issues
-		 * than there already are :) */
-		memcpy(safety, ip, ip->ip_hl * sizeof(uint32_t));
-		
-		/* Set the checksum to zero, so we can do the calculation */
-		ip = (libtrace_ip_t *)safety;
-		ip->ip_sum = 0;
+		/* Sum either side of the checksum field, as if it were
+		 * zero, rather than modifying the packet */
+		sum = add_checksum(ip, csum_ptr - (char *)ip);
+		if (hlen > (size_t)(csum_ptr - (char *)ip) + 2)
+			sum += add_checksum(csum_ptr + 2,
+				hlen - (csum_ptr - (char *)ip) - 2);
 
-		*csum = checksum_buffer(safety, ip->ip_hl * sizeof(uint32_t));
+		*csum = finish_checksum(sum);
 		
 		/* Remember to byteswap appropriately */
 		*csum = ntohs(*csum);
@@ -735,6 +733,48 @@ DLLEXPORT uint16_t *trace_checksum_layer3(libtrace_packet_t *packet,
 	return NULL;
 }
 
+libtrace_ip6_frag_t *trace_get_fragment_from_ip6(libtrace_ip6_t *ip6,
+		uint32_t remaining, uint32_t *nxt_offset) {
+	uint8_t *payload = (uint8_t *)(ip6 + 1);
+	uint8_t *nxt = &ip6->nxt;
+	uint32_t len;
+
+	if (remaining < sizeof(libtrace_ip6_t))
+		return NULL;
+	remaining -= sizeof(libtrace_ip6_t);
+
+	/* Adapted from trace_get_payload_from_ip6 */
+	for (;;) {
+		switch (*nxt) {
+			case 0:
+			case TRACE_IPPROTO_ROUTING:
+			case TRACE_IPPROTO_DSTOPTS:
+				if (remaining < sizeof(libtrace_ip6_ext_t))
+					return NULL;
+				/* Length does not include the first 8 bytes */
+				len = ((libtrace_ip6_ext_t *)payload)->len * 8;
+				len += 8;
+				break;
+			case TRACE_IPPROTO_FRAGMENT:
+				if (remaining < sizeof(libtrace_ip6_frag_t))
+					return NULL;
+				if (nxt_offset)
+					*nxt_offset = nxt - (uint8_t *)ip6;
+				return (libtrace_ip6_frag_t *)payload;
+			default:
+				return NULL;
+		}
+
+		if (remaining < len) {
+			/* Snap too short */
+			return NULL;
+		}
+		remaining -= len;
+		nxt = &((libtrace_ip6_ext_t *)payload)->nxt;
+		payload += len;
+	}
+}
+
 DLLEXPORT uint16_t trace_get_fragment_offset(const libtrace_packet_t *packet, 
                 uint8_t *more) {
 
@@ -764,60 +804,18 @@ DLLEXPORT uint16_t trace_get_fragment_offset(const libtrace_packet_t *packet,
         }
 
         if (ethertype == TRACE_ETHERTYPE_IPV6) {
-                libtrace_ip6_t *ip6 = (libtrace_ip6_t *)l3;
-                void *payload = ip6 + 1;
-                uint8_t nxt = ip6->nxt;
-                uint16_t len;
-                
-                /* First task, find a Fragment header if present */
-                if (remaining < sizeof(libtrace_ip6_t))
-                        return 0;
-                remaining -= sizeof(libtrace_ip6_t);
-
-                /* Adapted from trace_get_payload_from_ip6 */
-                while (1) {
-                        switch (nxt) {
-                        case 0:
-                        case TRACE_IPPROTO_ROUTING:
-			case TRACE_IPPROTO_AH: 
-			case TRACE_IPPROTO_DSTOPTS: 
-                        {
-
-				/* Length does not include the first 8 bytes */
-				len=((libtrace_ip6_ext_t*)payload)->len * 8;
-				len += 8;
-
-			        if (remaining < len) {
-                                        /* Snap too short */
-                                        return 0;
-                                }
-                                remaining-=len;
+                libtrace_ip6_frag_t *frag;
+                uint16_t offset;
 
-				nxt=((libtrace_ip6_ext_t*)payload)->nxt;
-				continue;
-			}
-			case TRACE_IPPROTO_FRAGMENT:
-                        {
-                                libtrace_ip6_frag_t *frag = (libtrace_ip6_frag_t *)payload;
-                                uint16_t offset;
-                                len = sizeof(libtrace_ip6_frag_t);
-                                if (remaining < len) {
-                                        /* Snap too short */
-                                        return 0;
-                                }
-                                remaining-=len;
-
-                                offset = ntohs(frag->frag_off);
-                                if ((offset & 0x0001) != 0) 
-                                        *more = 1;
-
-                                return ((offset & 0xFFF8) >> 3) * 8;
-                         }
-                         default:
-                                return 0;
-                         }
-                }
+                frag = trace_get_fragment_from_ip6((libtrace_ip6_t *)l3,
+                                remaining, NULL);
+                if (frag == NULL)
+                        return 0;
 
+                offset = ntohs(frag->frag_off);
+                if ((offset & 0x0001) != 0)
+                        *more = 1;
+                return offset & 0xFFF8;
         }
         return 0;
 }
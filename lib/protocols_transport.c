@@ -180,7 +180,7 @@ DLLEXPORT void *trace_get_transport(const libtrace_packet_t *packet,
 
 	if (!remaining) remaining=&dummy_remaining;
 
-	if (packet->cached.l4_header) {
+	if (packet->cached.l4_header || packet->cached.parsed) {
 		/*
 		void *link;
 		libtrace_linktype_t linktype;
@@ -227,6 +227,55 @@ DLLEXPORT void *trace_get_transport(const libtrace_packet_t *packet,
 	return transport;
 }
 
+DLLEXPORT void trace_parse_packet(libtrace_packet_t *packet) {
+	libtrace_linktype_t linktype;
+	uint16_t ethertype = 0;
+	uint8_t proto = 0;
+	uint32_t remaining = 0;
+
+	if (packet->cached.parsed)
+		return;
+
+	/* Each layer starts from the cached result of the layer below, so
+	 * the packet is only walked once. Layers that are not present are
+	 * not normally cached, so record those explicitly to stop later
+	 * lookups from walking the packet all over again. */
+	if (trace_get_layer2(packet, &linktype, &remaining) == NULL) {
+		packet->cached.l2_link_type = linktype;
+		packet->cached.l2_remaining = 0;
+	}
+
+	if (trace_get_layer3(packet, &ethertype, &remaining) == NULL) {
+		packet->cached.l3_ethertype = ethertype;
+		packet->cached.l3_remaining = 0;
+		packet->cached.transport_proto = 0;
+		packet->cached.l4_remaining = 0;
+	} else {
+		/* This caches the result even if there is no transport
+		 * header */
+		trace_get_transport(packet, &proto, &remaining);
+	}
+
+	packet->cached.parsed = 1;
+}
+
+DLLEXPORT void trace_parse_packets(libtrace_packet_t *packets[],
+		size_t nb_packets) {
+	size_t i;
+
+	for (i = 0; i < nb_packets; i++) {
+#if defined(__GNUC__)
+		/* The headers of the next packet are unlikely to be in the
+		 * CPU cache yet, so start fetching them now */
+		if (i + 1 < nb_packets && packets[i + 1]->payload) {
+			__builtin_prefetch(packets[i + 1]->payload);
+			__builtin_prefetch((char *)packets[i + 1]->payload + 64);
+		}
+#endif
+		trace_parse_packet(packets[i]);
+	}
+}
+
 DLLEXPORT libtrace_tcp_t *trace_get_tcp(libtrace_packet_t *packet) {
 	uint8_t proto;
 	uint32_t rem = 0;
@@ -464,6 +513,128 @@ DLLEXPORT uint16_t trace_get_destination_port(const libtrace_packet_t *packet)
 		return 0;
 }
 
+/* Fills in entry i of each of the requested flow key arrays, returning 1 if
+ * the packet is IP */
+static inline int get_flow_key(libtrace_packet_t *packet,
+		libtrace_flow_keys_t *keys, size_t i) {
+	uint8_t version = 0;
+	uint8_t proto = 0;
+	uint16_t ethertype;
+	uint16_t fragoff;
+	uint8_t more;
+	uint32_t remaining = 0;
+	uint32_t iplen = 0;
+	void *l3 = NULL;
+	struct ports_t *port = NULL;
+
+	if (!IS_LIBTRACE_META_PACKET(packet)) {
+		trace_parse_packet(packet);
+		l3 = trace_get_layer3(packet, &ethertype, &remaining);
+	}
+
+	if (l3 && ethertype == TRACE_ETHERTYPE_IP &&
+			remaining >= sizeof(libtrace_ip_t)) {
+		libtrace_ip_t *ip = (libtrace_ip_t *)l3;
+
+		version = 4;
+		iplen = ntohs(ip->ip_len);
+		proto = ip->ip_p;
+		if (keys->src_ip4)
+			keys->src_ip4[i] = ip->ip_src.s_addr;
+		if (keys->dst_ip4)
+			keys->dst_ip4[i] = ip->ip_dst.s_addr;
+	} else if (keys->src_ip4 || keys->dst_ip4) {
+		if (keys->src_ip4)
+			keys->src_ip4[i] = 0;
+		if (keys->dst_ip4)
+			keys->dst_ip4[i] = 0;
+	}
+
+	if (l3 && ethertype == TRACE_ETHERTYPE_IPV6 &&
+			remaining >= sizeof(libtrace_ip6_t)) {
+		libtrace_ip6_t *ip6 = (libtrace_ip6_t *)l3;
+
+		version = 6;
+		iplen = ntohs(ip6->plen) + sizeof(libtrace_ip6_t);
+		if (keys->src_ip6)
+			memcpy(keys->src_ip6[i], &ip6->ip_src, 16);
+		if (keys->dst_ip6)
+			memcpy(keys->dst_ip6[i], &ip6->ip_dst, 16);
+	} else {
+		if (keys->src_ip6)
+			memset(keys->src_ip6[i], 0, 16);
+		if (keys->dst_ip6)
+			memset(keys->dst_ip6[i], 0, 16);
+	}
+
+	if (version != 0) {
+		uint8_t tproto = 0;
+
+		port = (struct ports_t *)trace_get_transport(packet, &tproto,
+				&remaining);
+		/* Later IPv4 fragments have no transport header, but we
+		 * still know the protocol from the IP header */
+		if (port)
+			proto = tproto;
+		else if (version == 6)
+			proto = 0;
+
+		/* Ports follow the same rules as trace_get_source_port() and
+		 * trace_get_destination_port() */
+		fragoff = trace_get_fragment_offset(packet, &more);
+		if (fragoff != 0 || proto == TRACE_IPPROTO_ICMP ||
+				proto == TRACE_IPPROTO_ICMPV6)
+			port = NULL;
+	}
+
+	if (keys->ip_version)
+		keys->ip_version[i] = version;
+	if (keys->protocol)
+		keys->protocol[i] = proto;
+	if (keys->src_port)
+		keys->src_port[i] = (port && remaining >= 2) ?
+				ntohs(port->src) : 0;
+	if (keys->dst_port)
+		keys->dst_port[i] = (port && remaining >= 4) ?
+				ntohs(port->dst) : 0;
+	if (keys->ip_length)
+		keys->ip_length[i] = iplen;
+	if (keys->wire_length)
+		keys->wire_length[i] = trace_get_wire_length(packet);
+	if (keys->timestamp)
+		keys->timestamp[i] = trace_get_erf_timestamp(packet);
+
+	return version != 0;
+}
+
+DLLEXPORT size_t trace_get_flow_keys(libtrace_packet_t *packets[],
+		size_t nb_packets, libtrace_flow_keys_t *keys) {
+	size_t i;
+	size_t ip = 0;
+
+	for (i = 0; i < nb_packets; i++) {
+#if defined(__GNUC__)
+		if (i + 1 < nb_packets && packets[i + 1]->payload) {
+			__builtin_prefetch(packets[i + 1]->payload);
+			__builtin_prefetch((char *)packets[i + 1]->payload + 64);
+		}
+#endif
+		ip += get_flow_key(packets[i], keys, i);
+	}
+	return ip;
+}
+
+/* Adds up a transport header as if its checksum field were zero */
+static uint32_t sum_without_checksum(void *header, size_t len,
+		void *csum_field) {
+	size_t before = (char *)csum_field - (char *)header;
+	uint32_t sum = add_checksum(header, before);
+
+	if (len > before + 2)
+		sum += add_checksum((char *)csum_field + 2, len - before - 2);
+	return sum;
+}
+
 DLLEXPORT uint16_t *trace_checksum_transport(libtrace_packet_t *packet, 
 		uint16_t *csum) {
 
@@ -475,9 +646,6 @@ DLLEXPORT uint16_t *trace_checksum_transport(libtrace_packet_t *packet,
 	char *csum_ptr = NULL;
 	int plen = 0;
 
-	uint8_t safety[65536];
-	uint8_t *ptr = safety;
-
 	header = trace_get_layer3(packet, &ethertype, &remaining);
 
 	if (header == NULL)
@@ -508,13 +676,7 @@ DLLEXPORT uint16_t *trace_checksum_transport(libtrace_packet_t *packet,
 		header = trace_get_payload_from_tcp(tcp, &remaining);
 		
 		csum_ptr = (char *)(&tcp->check);
-
-		memcpy(ptr, tcp, tcp->doff * 4);
-
-		tcp = (libtrace_tcp_t *)ptr;
-		tcp->check = 0;
-
-		ptr += (tcp->doff * 4);
+		sum += sum_without_checksum(tcp, tcp->doff * 4, csum_ptr);
 	} 
 	
 	else if (proto == TRACE_IPPROTO_UDP) {
@@ -523,36 +685,23 @@ DLLEXPORT uint16_t *trace_checksum_transport(libtrace_packet_t *packet,
 		header = trace_get_payload_from_udp(udp, &remaining);
 		
 		csum_ptr = (char *)(&udp->check);
-		memcpy(ptr, udp, sizeof(libtrace_udp_t));
-
-		udp = (libtrace_udp_t *)ptr;
-		udp->check = 0;
-
-		ptr += sizeof(libtrace_udp_t);
+		sum += sum_without_checksum(udp, sizeof(libtrace_udp_t),
+				csum_ptr);
 	} 
 	
 	else if (proto == TRACE_IPPROTO_ICMP) {
 		/* ICMP doesn't use the pseudo header */
-		sum = 0;
-
 		libtrace_icmp_t *icmp = (libtrace_icmp_t *)header;
 		header = trace_get_payload_from_icmp(icmp, &remaining);
 		
 		csum_ptr = (char *)(&icmp->checksum);
-		memcpy(ptr, icmp, sizeof(libtrace_icmp_t));
-
-		icmp = (libtrace_icmp_t *)ptr;
-		icmp->checksum = 0;
-		
-		ptr += sizeof(libtrace_icmp_t);
-
+		sum = sum_without_checksum(icmp, sizeof(libtrace_icmp_t),
+				csum_ptr);
 	} 
 	else {
 		return NULL;
 	}
 
-	sum += add_checksum(safety, (uint16_t)(ptr - safety));
-
 	plen = trace_get_payload_length(packet);
 	if (plen < 0)
 		return NULL;
@@ -569,6 +718,129 @@ DLLEXPORT uint16_t *trace_checksum_transport(libtrace_packet_t *packet,
 	return (uint16_t *)csum_ptr;
 }
 
+/* Checks the checksums of a single packet, setting *l3_bad and
+ * *transport_bad if either is wrong. Anything that cannot be checked, because
+ * it is truncated, a fragment or not a protocol with a checksum, is left
+ * alone. */
+static void verify_checksums(libtrace_packet_t *packet, bool *l3_bad,
+		bool *transport_bad) {
+	uint16_t ethertype;
+	uint32_t remaining;
+	uint8_t proto;
+	uint32_t sum, len;
+	void *l3, *l4;
+
+	l3 = trace_get_layer3(packet, &ethertype, &remaining);
+	if (l3 == NULL)
+		return;
+
+	if (ethertype == TRACE_ETHERTYPE_IP) {
+		libtrace_ip_t *ip = (libtrace_ip_t *)l3;
+		uint32_t hlen;
+
+		if (remaining < sizeof(libtrace_ip_t) || ip->ip_v != 4)
+			return;
+		hlen = ip->ip_hl * 4;
+		if (hlen < sizeof(libtrace_ip_t) || remaining < hlen)
+			return;
+		/* A valid header sums to 0xffff, checksum included */
+		if (finish_checksum(add_checksum(ip, hlen)) != 0)
+			*l3_bad = true;
+
+		/* Only the first fragment has the transport header, and
+		 * the checksum covers all of them */
+		if ((ip->ip_off & htons(0x3fff)) != 0)
+			return;
+		if (ntohs(ip->ip_len) < hlen)
+			return;
+		len = ntohs(ip->ip_len) - hlen;
+		proto = ip->ip_p;
+		l4 = (char *)ip + hlen;
+		remaining -= hlen;
+		/* The source and destination addresses are adjacent */
+		sum = add_checksum(&ip->ip_src, 2 * sizeof(struct in_addr));
+
+		if (proto == TRACE_IPPROTO_UDP && len >= sizeof(libtrace_udp_t)
+				&& remaining >= sizeof(libtrace_udp_t) &&
+				((libtrace_udp_t *)l4)->check == 0) {
+			/* No checksum was sent */
+			return;
+		}
+		if (proto == TRACE_IPPROTO_ICMP)
+			sum = 0;
+	} else if (ethertype == TRACE_ETHERTYPE_IPV6) {
+		libtrace_ip6_t *ip6 = (libtrace_ip6_t *)l3;
+		uint32_t extlen;
+
+		if (remaining < sizeof(libtrace_ip6_t))
+			return;
+		l4 = trace_get_payload_from_ip6(ip6, &proto, &remaining);
+		if (l4 == NULL)
+			return;
+		/* The payload length includes any extension headers */
+		extlen = (char *)l4 - (char *)(ip6 + 1);
+		if (ntohs(ip6->plen) < extlen)
+			return;
+		len = ntohs(ip6->plen) - extlen;
+		sum = add_checksum(&ip6->ip_src, 2 * sizeof(struct in6_addr));
+	} else {
+		return;
+	}
+
+	switch (proto) {
+		case TRACE_IPPROTO_TCP:
+			if (len < sizeof(libtrace_tcp_t))
+				return;
+			break;
+		case TRACE_IPPROTO_UDP:
+			if (len < sizeof(libtrace_udp_t))
+				return;
+			break;
+		case TRACE_IPPROTO_ICMP:
+		case TRACE_IPPROTO_ICMPV6:
+			if (len < sizeof(libtrace_icmp_t))
+				return;
+			break;
+		default:
+			return;
+	}
+	/* The whole segment is needed to check it */
+	if (remaining < len)
+		return;
+
+	if (proto != TRACE_IPPROTO_ICMP) {
+		sum += htons(proto);
+		sum += htons(len);
+	}
+	sum += add_checksum(l4, len);
+	if (finish_checksum(sum) != 0)
+		*transport_bad = true;
+}
+
+DLLEXPORT size_t trace_verify_checksums(libtrace_packet_t *packets[],
+		size_t nb_packets, uint64_t *bad_l3, uint64_t *bad_transport) {
+	size_t i, bad = 0;
+	bool l3, transport;
+
+	if (bad_l3)
+		memset(bad_l3, 0, ((nb_packets + 63) / 64) * sizeof(uint64_t));
+	if (bad_transport)
+		memset(bad_transport, 0,
+			((nb_packets + 63) / 64) * sizeof(uint64_t));
+
+	for (i = 0; i < nb_packets; i++) {
+		l3 = transport = false;
+		verify_checksums(packets[i], &l3, &transport);
+		if (l3 && bad_l3)
+			bad_l3[i / 64] |= (uint64_t)1 << (i % 64);
+		if (transport && bad_transport)
+			bad_transport[i / 64] |= (uint64_t)1 << (i % 64);
+		if (l3 || transport)
+			bad ++;
+	}
+	return bad;
+}
+
 DLLEXPORT void *trace_get_payload_from_gre(libtrace_gre_t *gre,
         uint32_t *remaining)
 {
@@ -0,0 +1,463 @@
+/*
+ *
+ * Copyright (c) 2007-2016 The University of Waikato, Hamilton, New Zealand.
+ * All rights reserved.
+ *
+ * This file is part of libtrace.
+ *
+ * This code has been developed by the University of Waikato WAND
+ * research group. For further information please see http://www.wand.net.nz/
+ *
+ * libtrace is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libtrace is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ */
+#include "libtrace_int.h"
+#include "libtrace.h"
+#include "protocols.h"
+#include "checksum.h"
+#include "reassembly.h"
+#include "data-struct/flow_table.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+/* IP payloads are at most 64KB, and fragments are placed in 8 byte blocks */
+#define MAX_PAYLOAD 65536
+#define BITMAP_SIZE (MAX_PAYLOAD / 8 / 8)
+/* Room for the link layer and network headers of the first fragment */
+#define MAX_HEADER 256
+/* The smallest payload space to allocate for a datagram */
+#define MIN_PAYLOAD 2048
+/* How many buffers from finished datagrams are kept for reuse */
+#define MAX_SPARE 16
+
+/* Each datagram has a buffer holding a bitmap of the blocks that have
+ * arrived, the headers of the first fragment, and then the payload. The
+ * buffer grows as later parts of the payload arrive. */
+#define DATAGRAM_BITMAP(d) ((d)->buffer)
+#define DATAGRAM_HEADER(d) ((d)->buffer + BITMAP_SIZE)
+#define DATAGRAM_PAYLOAD(d) ((d)->buffer + BITMAP_SIZE + MAX_HEADER)
+
+struct datagram {
+	/* The key in the flow table, the IP identification is kept in the
+	 * ports */
+	libtrace_flow_tuple_t key;
+	/* Datagrams in the order they were started, which is also the order
+	 * they expire in */
+	struct datagram *prev;
+	struct datagram *next;
+	/* ERF timestamp after which the datagram is discarded */
+	uint64_t expires;
+	uint8_t *buffer;
+	/* Payload space in the buffer */
+	uint32_t size;
+	/* Length of the payload, 0 until the last fragment arrives */
+	uint32_t length;
+	/* Number of blocks of the payload that have arrived */
+	uint32_t blocks;
+	/* End of the furthest fragment that has arrived */
+	uint32_t end;
+	/* Number of fragments added, including any repeats */
+	uint32_t fragments;
+	/* Length of the headers, 0 until the first fragment arrives */
+	uint16_t header_len;
+	/* Offset of the network header within the headers */
+	uint16_t l3_offset;
+	/* IPv6 only, the offset of the next header field that referred to the
+	 * fragment header, and what it needs to refer to instead */
+	uint16_t nxt_offset;
+	uint8_t nxt;
+	libtrace_linktype_t linktype;
+};
+
+struct libtrace_reassembly {
+	libtrace_flow_table_t *table;
+	/* The timeout as an ERF timestamp difference */
+	uint64_t timeout;
+	size_t max_datagrams;
+	struct datagram *oldest;
+	struct datagram *newest;
+	/* Set by reassembly_add() when a datagram is completed */
+	struct datagram *complete;
+	uint8_t *spare[MAX_SPARE];
+	uint32_t spare_size[MAX_SPARE];
+	int nb_spare;
+	/* Fragments of incomplete datagrams that were given up on */
+	uint64_t discarded;
+};
+
+/* The parts of a fragment needed to reassemble it */
+struct fragment {
+	libtrace_flow_tuple_t key;
+	uint8_t *payload;
+	uint32_t offset;
+	uint32_t len;
+	bool more;
+	/* Everything up to the end of the unfragmentable part of the packet */
+	uint8_t *header;
+	uint32_t header_len;
+	uint16_t l3_offset;
+	uint16_t nxt_offset;
+	uint8_t nxt;
+	libtrace_linktype_t linktype;
+};
+
+libtrace_reassembly_t *reassembly_create(size_t timeout_ms,
+		size_t max_datagrams) {
+	libtrace_reassembly_t *r;
+
+	r = (libtrace_reassembly_t *)calloc(1, sizeof(libtrace_reassembly_t));
+	if (!r)
+		return NULL;
+	r->table = libtrace_flow_table_create(sizeof(struct datagram),
+			max_datagrams);
+	if (!r->table) {
+		free(r);
+		return NULL;
+	}
+	r->timeout = ((uint64_t)timeout_ms << 32) / 1000;
+	r->max_datagrams = max_datagrams;
+	return r;
+}
+
+static void release_datagram(libtrace_reassembly_t *r, struct datagram *d) {
+	if (r->complete != d)
+		r->discarded += d->fragments;
+	if (d->prev)
+		d->prev->next = d->next;
+	else
+		r->oldest = d->next;
+	if (d->next)
+		d->next->prev = d->prev;
+	else
+		r->newest = d->prev;
+
+	if (d->buffer) {
+		if (r->nb_spare < MAX_SPARE) {
+			r->spare[r->nb_spare] = d->buffer;
+			r->spare_size[r->nb_spare] = d->size;
+			r->nb_spare ++;
+		} else {
+			free(d->buffer);
+		}
+	}
+	if (r->complete == d)
+		r->complete = NULL;
+	libtrace_flow_table_remove(r->table, &d->key);
+}
+
+void reassembly_destroy(libtrace_reassembly_t *r) {
+	while (r->oldest)
+		release_datagram(r, r->oldest);
+	while (r->nb_spare > 0)
+		free(r->spare[--r->nb_spare]);
+	libtrace_flow_table_destroy(r->table);
+	free(r);
+}
+
+/* Finds the parts of an IPv4 fragment, returning false if the packet is not
+ * a fragment or cannot be reassembled */
+static bool parse_ip(libtrace_ip_t *ip, uint32_t remaining,
+		struct fragment *f) {
+	uint32_t hl, ip_len;
+	uint16_t off;
+
+	if (remaining < sizeof(libtrace_ip_t) || ip->ip_v != 4)
+		return false;
+	off = ntohs(ip->ip_off);
+	if ((off & 0x3fff) == 0)
+		return false;
+
+	hl = ip->ip_hl * 4;
+	ip_len = ntohs(ip->ip_len);
+	/* Truncated fragments are no use */
+	if (hl < sizeof(libtrace_ip_t) || ip_len < hl || remaining < ip_len)
+		return false;
+
+	f->offset = (off & 0x1fff) * 8;
+	f->more = (off & 0x2000) != 0;
+	f->payload = (uint8_t *)ip + hl;
+	f->len = ip_len - hl;
+	f->header_len += hl;
+	if (f->offset + f->len + hl > 65535)
+		return false;
+
+	f->key.ip_version = 4;
+	f->key.protocol = ip->ip_p;
+	memcpy(f->key.src_ip, &ip->ip_src, 4);
+	memcpy(f->key.dst_ip, &ip->ip_dst, 4);
+	f->key.src_port = ntohs(ip->ip_id);
+	return true;
+}
+
+/* Finds the parts of an IPv6 fragment, returning false if the packet is not
+ * a fragment or cannot be reassembled */
+static bool parse_ip6(libtrace_ip6_t *ip6, uint32_t remaining,
+		struct fragment *f) {
+	libtrace_ip6_frag_t *frag;
+	uint32_t nxt_offset = 0, unfrag, total;
+	uint16_t off;
+
+	frag = trace_get_fragment_from_ip6(ip6, remaining, &nxt_offset);
+	if (!frag)
+		return false;
+	off = ntohs(frag->frag_off);
+	/* Atomic fragments are processed as they are (RFC 6946) */
+	if ((off & 0xfff9) == 0)
+		return false;
+
+	unfrag = (uint8_t *)frag - (uint8_t *)ip6;
+	total = sizeof(libtrace_ip6_t) + ntohs(ip6->plen);
+	if (remaining < total || total < unfrag + sizeof(libtrace_ip6_frag_t))
+		return false;
+
+	f->offset = off & 0xfff8;
+	f->more = (off & 0x0001) != 0;
+	f->payload = (uint8_t *)(frag + 1);
+	f->len = total - unfrag - sizeof(libtrace_ip6_frag_t);
+	f->header_len += unfrag;
+	f->nxt_offset = f->l3_offset + nxt_offset;
+	f->nxt = frag->nxt;
+	if (unfrag - sizeof(libtrace_ip6_t) + f->offset + f->len > 65535)
+		return false;
+
+	/* IPv6 datagrams are identified by the addresses and identification
+	 * alone */
+	f->key.ip_version = 6;
+	memcpy(f->key.src_ip, &ip6->ip_src, 16);
+	memcpy(f->key.dst_ip, &ip6->ip_dst, 16);
+	f->key.src_port = ntohl(frag->ident) >> 16;
+	f->key.dst_port = ntohl(frag->ident) & 0xffff;
+	return true;
+}
+
+static bool parse_fragment(libtrace_packet_t *packet, struct fragment *f) {
+	uint16_t ethertype;
+	uint32_t remaining, caplen;
+	void *l3;
+
+	memset(f, 0, sizeof(struct fragment));
+	l3 = trace_get_layer3(packet, &ethertype, &remaining);
+	if (!l3)
+		return false;
+	f->header = (uint8_t *)trace_get_packet_buffer(packet, &f->linktype,
+			&caplen);
+	if (!f->header || (uint8_t *)l3 < f->header ||
+			(uint8_t *)l3 - f->header > MAX_HEADER)
+		return false;
+	f->l3_offset = f->header_len = (uint8_t *)l3 - f->header;
+
+	switch (ethertype) {
+		case TRACE_ETHERTYPE_IP:
+			if (!parse_ip((libtrace_ip_t *)l3, remaining, f))
+				return false;
+			break;
+		case TRACE_ETHERTYPE_IPV6:
+			if (!parse_ip6((libtrace_ip6_t *)l3, remaining, f))
+				return false;
+			break;
+		default:
+			return false;
+	}
+
+	/* The rest of a datagram can't be rebuilt without the headers from
+	 * the first fragment, and the other fragments have to be made of
+	 * whole blocks */
+	if (f->offset == 0 && f->header_len > MAX_HEADER)
+		return false;
+	if (f->more && (f->len == 0 || f->len % 8 != 0))
+		return false;
+	return true;
+}
+
+/* Makes room in a datagram's buffer for payload up to end */
+static int grow_datagram(libtrace_reassembly_t *r, struct datagram *d,
+		uint32_t end) {
+	uint32_t size = d->size ? d->size : MIN_PAYLOAD;
+	uint8_t *buffer;
+
+	while (size < end)
+		size *= 2;
+	if (!d->buffer && r->nb_spare > 0) {
+		r->nb_spare --;
+		d->buffer = r->spare[r->nb_spare];
+		d->size = r->spare_size[r->nb_spare];
+		memset(DATAGRAM_BITMAP(d), 0, BITMAP_SIZE);
+		if (d->size >= size)
+			return 0;
+	}
+	buffer = (uint8_t *)realloc(d->buffer, BITMAP_SIZE + MAX_HEADER + size);
+	if (!buffer)
+		return -1;
+	if (!d->buffer)
+		memset(buffer, 0, BITMAP_SIZE);
+	d->buffer = buffer;
+	d->size = size;
+	return 0;
+}
+
+static struct datagram *start_datagram(libtrace_reassembly_t *r,
+		struct fragment *f, uint64_t now) {
+	struct datagram *d;
+	int created = 0;
+
+	d = (struct datagram *)libtrace_flow_table_insert(r->table, &f->key,
+			&created);
+	if (!d || !created)
+		return d;
+
+	d->key = f->key;
+	d->expires = now + r->timeout;
+	d->prev = r->newest;
+	if (r->newest)
+		r->newest->next = d;
+	else
+		r->oldest = d;
+	r->newest = d;
+
+	if (libtrace_flow_table_get_size(r->table) > r->max_datagrams)
+		release_datagram(r, r->oldest);
+	return d;
+}
+
+/* Checks that every block of a datagram's payload has arrived */
+static bool datagram_filled(struct datagram *d) {
+	uint8_t *bitmap = DATAGRAM_BITMAP(d);
+	uint32_t blocks = (d->length + 7) / 8;
+	uint32_t i;
+
+	for (i = 0; i < blocks / 8; i++) {
+		if (bitmap[i] != 0xff)
+			return false;
+	}
+	if (blocks % 8 && bitmap[i] != (1 << (blocks % 8)) - 1)
+		return false;
+	return true;
+}
+
+enum reassembly_result reassembly_add(libtrace_reassembly_t *r,
+		libtrace_packet_t *packet) {
+	uint64_t now = trace_get_erf_timestamp(packet);
+	struct fragment f;
+	struct datagram *d;
+	uint32_t block, end;
+	uint8_t *bitmap;
+
+	/* Give up on anything that has been waiting too long */
+	while (r->oldest && r->oldest->expires <= now)
+		release_datagram(r, r->oldest);
+
+	if (!parse_fragment(packet, &f))
+		return REASSEMBLY_NOT_FRAGMENT;
+
+	d = start_datagram(r, &f, now);
+	if (!d)
+		return REASSEMBLY_NOT_FRAGMENT;
+	d->fragments ++;
+
+	/* Nothing can go past the end of the datagram once it is known, and
+	 * the last fragment has to agree with everything before it. If they
+	 * disagree there is no telling which is right, so the datagram is
+	 * thrown away. */
+	if ((d->length && f.offset + f.len > d->length) ||
+			(!f.more && (f.offset + f.len < d->end ||
+			(d->length && f.offset + f.len != d->length)))) {
+		release_datagram(r, d);
+		return REASSEMBLY_HELD;
+	}
+	if (d->size < f.offset + f.len &&
+			grow_datagram(r, d, f.offset + f.len) < 0) {
+		release_datagram(r, d);
+		return REASSEMBLY_NOT_FRAGMENT;
+	}
+	if (d->end < f.offset + f.len)
+		d->end = f.offset + f.len;
+
+	/* Overlapping fragments simply replace what came before */
+	memcpy(DATAGRAM_PAYLOAD(d) + f.offset, f.payload, f.len);
+	bitmap = DATAGRAM_BITMAP(d);
+	end = (f.offset + f.len + 7) / 8;
+	for (block = f.offset / 8; block < end; block++) {
+		if (!(bitmap[block / 8] & (1 << (block % 8)))) {
+			bitmap[block / 8] |= 1 << (block % 8);
+			d->blocks ++;
+		}
+	}
+
+	if (!f.more)
+		d->length = f.offset + f.len;
+	if (f.offset == 0) {
+		memcpy(DATAGRAM_HEADER(d), f.header, f.header_len);
+		d->header_len = f.header_len;
+		d->l3_offset = f.l3_offset;
+		d->nxt_offset = f.nxt_offset;
+		d->nxt = f.nxt;
+		d->linktype = f.linktype;
+	}
+
+	if (d->length && d->header_len && d->blocks == (d->length + 7) / 8 &&
+			datagram_filled(d)) {
+		r->complete = d;
+		return REASSEMBLY_COMPLETE;
+	}
+	return REASSEMBLY_HELD;
+}
+
+int reassembly_build(libtrace_reassembly_t *r, libtrace_packet_t *packet,
+		struct timeval tv) {
+	struct datagram *d = r->complete;
+	uint8_t *buffer, *l3;
+
+	if (!d)
+		return -1;
+
+	buffer = (uint8_t *)trace_construct_packet_buffer(packet, d->linktype,
+			d->header_len + d->length, tv);
+	if (!buffer) {
+		release_datagram(r, d);
+		return -1;
+	}
+	memcpy(buffer, DATAGRAM_HEADER(d), d->header_len);
+	memcpy(buffer + d->header_len, DATAGRAM_PAYLOAD(d), d->length);
+
+	l3 = buffer + d->l3_offset;
+	if (d->key.ip_version == 4) {
+		libtrace_ip_t *ip = (libtrace_ip_t *)l3;
+		uint16_t hl = d->header_len - d->l3_offset;
+
+		ip->ip_len = htons(hl + d->length);
+		/* Only the don't fragment flag is left */
+		ip->ip_off &= htons(0x4000);
+		ip->ip_sum = 0;
+		ip->ip_sum = checksum_buffer(ip, hl);
+	} else {
+		libtrace_ip6_t *ip6 = (libtrace_ip6_t *)l3;
+
+		ip6->plen = htons(d->header_len - d->l3_offset -
+				sizeof(libtrace_ip6_t) + d->length);
+		buffer[d->nxt_offset] = d->nxt;
+	}
+
+	release_datagram(r, d);
+	return 0;
+}
+
+uint64_t reassembly_take_discarded(libtrace_reassembly_t *r) {
+	uint64_t discarded = r->discarded;
+
+	r->discarded = 0;
+	return discarded;
+}
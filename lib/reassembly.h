@@ -0,0 +1,107 @@
+/*
+ *
+ * Copyright (c) 2007-2016 The University of Waikato, Hamilton, New Zealand.
+ * All rights reserved.
+ *
+ * This file is part of libtrace.
+ *
+ * This code has been developed by the University of Waikato WAND
+ * research group. For further information please see http://www.wand.net.nz/
+ *
+ * libtrace is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libtrace is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ */
+#ifndef LIBTRACE_REASSEMBLY_H_
+#define LIBTRACE_REASSEMBLY_H_
+
+/** @file
+ *
+ * @brief Reassembly of fragmented IPv4 and IPv6 datagrams
+ *
+ * A reassembly table collects the fragments of each datagram until they
+ * have all arrived, then rebuilds the datagram as a single packet. Datagrams
+ * that are still incomplete after a timeout, measured in packet time, are
+ * discarded.
+ *
+ * A table is not thread safe. Each per packet thread has its own, so all of
+ * the fragments of a datagram need to be sent to the same thread, e.g. by
+ * using HASHER_FRAGMENT.
+ */
+
+#include "libtrace.h"
+
+typedef struct libtrace_reassembly libtrace_reassembly_t;
+
+/** The results of adding a packet to a reassembly table */
+enum reassembly_result {
+	/** The packet is not a fragment, or cannot be reassembled, and
+	 * should be processed as it is */
+	REASSEMBLY_NOT_FRAGMENT,
+	/** The fragment has been stored until the rest of the datagram
+	 * arrives, or has been discarded along with a datagram whose
+	 * fragments do not agree on its length */
+	REASSEMBLY_HELD,
+	/** The fragment completed a datagram, which can now be built with
+	 * reassembly_build() */
+	REASSEMBLY_COMPLETE
+};
+
+/** Creates a reassembly table
+ *
+ * @param timeout_ms	How long to wait for the rest of a datagram after its
+ * 			first fragment arrives, in milliseconds of packet time
+ * @param max_datagrams	The most incomplete datagrams to hold at once. Once
+ * 			there are this many the oldest is discarded to make
+ * 			room for a new one.
+ * @return The new table, or NULL if there is not enough memory
+ */
+libtrace_reassembly_t *reassembly_create(size_t timeout_ms,
+		size_t max_datagrams);
+
+/** Destroys a reassembly table, discarding any incomplete datagrams */
+void reassembly_destroy(libtrace_reassembly_t *r);
+
+/** Adds a packet to a reassembly table
+ *
+ * @param r		The reassembly table
+ * @param packet	The packet, which is left unchanged
+ * @return What became of the packet, see enum reassembly_result
+ *
+ * Every packet should be added, not just fragments, as their timestamps
+ * are used to expire incomplete datagrams. The contents of a fragment are
+ * copied, so the packet can be reused straight away.
+ */
+enum reassembly_result reassembly_add(libtrace_reassembly_t *r,
+		libtrace_packet_t *packet);
+
+/** Builds the datagram completed by the last call to reassembly_add()
+ *
+ * @param r		The reassembly table
+ * @param packet	The packet to build the datagram in
+ * @param tv		The timestamp to give the packet
+ * @return 0 if successful, otherwise -1
+ *
+ * The datagram is built as a PCAP packet with the link layer header of its
+ * first fragment, and is then removed from the table.
+ */
+int reassembly_build(libtrace_reassembly_t *r, libtrace_packet_t *packet,
+		struct timeval tv);
+
+/** Returns how many fragments have been discarded since the last call,
+ * because their datagram timed out, was pushed out of the table or had
+ * fragments past its end */
+uint64_t reassembly_take_discarded(libtrace_reassembly_t *r);
+
+#endif
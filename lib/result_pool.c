@@ -0,0 +1,131 @@
+/*
+ *
+ * Copyright (c) 2007-2016 The University of Waikato, Hamilton, New Zealand.
+ * All rights reserved.
+ *
+ * This file is part of libtrace.
+ *
+ * This code has been developed by the University of Waikato WAND
+ * research group. For further information please see http://www.wand.net.nz/
+ *
+ * libtrace is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libtrace is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ */
+#include "libtrace_int.h"
+#include "result_pool.h"
+
+#include <stdlib.h>
+
+/* Sits in front of every buffer. Sized so that the buffer itself keeps the
+ * alignment malloc() gives. */
+struct result_pool_item {
+	/* The list to return to, NULL if from malloc() */
+	result_pool_list_t *list;
+	result_pool_item_t *next;
+} ALIGNED(16);
+
+#define ITEM_DATA(item) ((void *)((item) + 1))
+#define DATA_ITEM(buf) (((result_pool_item_t *)(buf)) - 1)
+
+libtrace_result_pool_t *result_pool_create(int count, size_t object_size) {
+	libtrace_result_pool_t *pool;
+	int i;
+
+	pool = malloc(sizeof(libtrace_result_pool_t));
+	if (!pool)
+		return NULL;
+	if (posix_memalign((void **) &pool->lists, CACHE_LINE_SIZE,
+			sizeof(result_pool_list_t) * count) != 0) {
+		free(pool);
+		return NULL;
+	}
+	for (i = 0; i < count; i++) {
+		pool->lists[i].free = NULL;
+		pool->lists[i].returned = NULL;
+	}
+	pool->count = count;
+	pool->object_size = object_size;
+	return pool;
+}
+
+static void free_items(result_pool_item_t *item) {
+	result_pool_item_t *next;
+
+	while (item) {
+		next = item->next;
+		free(item);
+		item = next;
+	}
+}
+
+void result_pool_destroy(libtrace_result_pool_t *pool) {
+	int i;
+
+	if (!pool)
+		return;
+	for (i = 0; i < pool->count; i++) {
+		free_items(pool->lists[i].free);
+		free_items(pool->lists[i].returned);
+	}
+	free(pool->lists);
+	free(pool);
+}
+
+void *result_pool_alloc(libtrace_result_pool_t *pool, int owner, size_t size) {
+	result_pool_list_t *list;
+	result_pool_item_t *item;
+
+	if (!pool || owner < 0 || owner >= pool->count ||
+			size > pool->object_size) {
+		item = malloc(sizeof(result_pool_item_t) + size);
+		if (!item)
+			return NULL;
+		item->list = NULL;
+		return ITEM_DATA(item);
+	}
+
+	list = &pool->lists[owner];
+	if (!list->free && __atomic_load_n(&list->returned, __ATOMIC_RELAXED))
+		list->free = __atomic_exchange_n(&list->returned, NULL,
+				__ATOMIC_ACQUIRE);
+	item = list->free;
+	if (item) {
+		list->free = item->next;
+	} else {
+		item = malloc(sizeof(result_pool_item_t) + pool->object_size);
+		if (!item)
+			return NULL;
+		item->list = list;
+	}
+	return ITEM_DATA(item);
+}
+
+void result_pool_free(void *buf) {
+	result_pool_item_t *item;
+	result_pool_list_t *list;
+
+	if (!buf)
+		return;
+	item = DATA_ITEM(buf);
+	list = item->list;
+	if (!list) {
+		free(item);
+		return;
+	}
+	item->next = __atomic_load_n(&list->returned, __ATOMIC_RELAXED);
+	while (!__atomic_compare_exchange_n(&list->returned, &item->next, item,
+			true, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+		;
+}
@@ -0,0 +1,89 @@
+/*
+ *
+ * Copyright (c) 2007-2016 The University of Waikato, Hamilton, New Zealand.
+ * All rights reserved.
+ *
+ * This file is part of libtrace.
+ *
+ * This code has been developed by the University of Waikato WAND
+ * research group. For further information please see http://www.wand.net.nz/
+ *
+ * libtrace is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libtrace is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ */
+#ifndef LIBTRACE_RESULT_POOL_H_
+#define LIBTRACE_RESULT_POOL_H_
+
+/** @file
+ *
+ * @brief A pool of fixed size buffers for results
+ *
+ * Lets processing threads publish results without a malloc() and free()
+ * pair for every one. Each processing thread allocates from its own free
+ * list, so allocation takes no locks. Buffers are usually freed by the
+ * reporter, which pushes them on to a lock free stack belonging to the
+ * thread that allocated them. The owner takes the whole stack in one go
+ * once its own list runs out, which avoids the ABA problem of popping
+ * single items.
+ *
+ * Buffers larger than the pool's object size, or allocated by a thread
+ * without a list of its own, come straight from malloc().
+ */
+
+#include "libtrace_parallel.h"
+
+typedef struct result_pool_item result_pool_item_t;
+
+typedef struct result_pool_list {
+	/** Only ever touched by the owning thread */
+	result_pool_item_t *free;
+	/** Buffers freed by any thread, waiting to be taken back */
+	result_pool_item_t *returned ALIGNED(CACHE_LINE_SIZE);
+} ALIGNED(CACHE_LINE_SIZE) result_pool_list_t;
+
+typedef struct libtrace_result_pool {
+	/** The usable size of each buffer */
+	size_t object_size;
+	/** The number of threads with a list */
+	int count;
+	result_pool_list_t *lists;
+} libtrace_result_pool_t;
+
+/** Creates a pool with a free list for each of a number of threads
+ *
+ * @param count The number of threads
+ * @param object_size The size of each buffer in bytes
+ * @return The pool, or NULL if there is not enough memory
+ */
+libtrace_result_pool_t *result_pool_create(int count, size_t object_size);
+
+/** Frees the pool and every buffer that has been returned to it. Buffers
+ * still in use must not be freed afterwards. */
+void result_pool_destroy(libtrace_result_pool_t *pool);
+
+/** Allocates a buffer
+ *
+ * @param pool The pool, which may be NULL
+ * @param owner The list to allocate from, which must belong to the calling
+ * thread, or -1 if it has none
+ * @param size The number of bytes needed
+ * @return The buffer, or NULL if there is not enough memory
+ */
+void *result_pool_alloc(libtrace_result_pool_t *pool, int owner, size_t size);
+
+/** Returns a buffer from result_pool_alloc(), from any thread */
+void result_pool_free(void *buf);
+
+#endif
@@ -0,0 +1,486 @@
+/*
+ *
+ * Copyright (c) 2007-2016 The University of Waikato, Hamilton, New Zealand.
+ * All rights reserved.
+ *
+ * This file is part of libtrace.
+ *
+ * This code has been developed by the University of Waikato WAND
+ * research group. For further information please see http://www.wand.net.nz/
+ *
+ * libtrace is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libtrace is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ */
+#include "config.h"
+#include "common.h"
+#include "libtrace.h"
+#include "libtrace_int.h"
+#include "format_helper.h"
+#include "wandio.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+
+/* This module implements a sparse time index for trace files, which maps
+ * packet timestamps to the offset of the packet within the (uncompressed)
+ * file. The index is built on the fly as packets are read, and can
+ * optionally be loaded from and saved to a sidecar file.
+ *
+ * Any file format that reads from libtrace->io and can resume reading from
+ * the start of any packet record can use the index to implement the
+ * trace_seek_* API, simply by calling trace_seek_index_start() once the
+ * file header has been read.
+ *
+ * Seeking within an uncompressed or block compressed (BGZF) file is then a
+ * binary search of the index followed by a short scan forward from the
+ * nearest preceding entry. Seeking within any other compressed file still
+ * requires decompressing the data before the target, but no packets need to
+ * be parsed along the way.
+ */
+
+#define SEEK_INDEX_DEFAULT_INTERVAL_MS 1000
+
+/* Convert milliseconds into an ERF timestamp delta */
+#define SEEK_INDEX_MS_TO_ERF(ms) ((((uint64_t)(ms)) << 32) / 1000)
+
+/* A single index entry -- this matches the layout of the ERF .idx files so
+ * that those can be used as sidecar files too */
+typedef struct libtrace_index_entry_t {
+	uint64_t timestamp;
+	uint64_t offset;
+} libtrace_index_entry_t;
+
+struct libtrace_seek_index {
+	/* The index entries, sorted by both timestamp and offset */
+	libtrace_index_entry_t *entries;
+	size_t count;
+	size_t allocated;
+
+	/* Minimum gap between index entries, as an ERF timestamp delta */
+	uint64_t interval;
+
+	/* Sidecar file to load the index from and save it to */
+	char *filename;
+
+	/* Offset of the first record after the file header, -1 if the reader
+	 * can't tell us where it is */
+	int64_t start;
+
+	/* The furthest offset that the format module is known to have read
+	 * up to, i.e. any format state is valid for every offset before this
+	 * one. This is only brought up to date when an entry is added or the
+	 * reader is about to be moved, so that we don't need to ask wandio
+	 * where we are for every packet. */
+	int64_t highwater;
+
+	/* Timestamp of the last packet read before the current offset */
+	uint64_t lastts;
+
+	/* Format callback for moving beyond the high water mark */
+	int (*resync)(libtrace_t *libtrace, int64_t offset);
+
+	bool started;
+	bool modified;
+};
+
+static struct libtrace_seek_index *get_seek_index(libtrace_t *libtrace) {
+
+	struct libtrace_seek_index *idx = libtrace->seekindex;
+
+	if (idx)
+		return idx;
+
+	idx = (struct libtrace_seek_index *)calloc(1,
+			sizeof(struct libtrace_seek_index));
+	if (!idx)
+		return NULL;
+
+	idx->interval = SEEK_INDEX_MS_TO_ERF(SEEK_INDEX_DEFAULT_INTERVAL_MS);
+	libtrace->seekindex = idx;
+	return idx;
+}
+
+static int add_index_entry(struct libtrace_seek_index *idx,
+		uint64_t timestamp, uint64_t offset) {
+
+	if (idx->count == idx->allocated) {
+		size_t newsize = idx->allocated ? idx->allocated * 2 : 64;
+		libtrace_index_entry_t *tmp = (libtrace_index_entry_t *)realloc(
+				idx->entries, newsize * sizeof(*tmp));
+		if (!tmp)
+			return -1;
+		idx->entries = tmp;
+		idx->allocated = newsize;
+	}
+
+	idx->entries[idx->count].timestamp = timestamp;
+	idx->entries[idx->count].offset = offset;
+	idx->count ++;
+	return 0;
+}
+
+/* Loads the sidecar file, if it exists. Entries that are not in order are
+ * treated as the end of the index. */
+static void load_seek_index(struct libtrace_seek_index *idx) {
+
+	libtrace_index_entry_t entry;
+	io_t *file = wandio_create(idx->filename);
+
+	if (!file)
+		return;
+
+	while (wandio_read(file, &entry, sizeof(entry)) ==
+			(int64_t)sizeof(entry)) {
+		if (idx->count > 0) {
+			libtrace_index_entry_t *last =
+					&idx->entries[idx->count - 1];
+			if (entry.timestamp < last->timestamp ||
+					entry.offset <= last->offset)
+				break;
+		}
+		if (add_index_entry(idx, entry.timestamp, entry.offset) < 0)
+			break;
+	}
+	wandio_destroy(file);
+}
+
+static void save_seek_index(struct libtrace_seek_index *idx) {
+
+	iow_t *file = wandio_wcreate(idx->filename,
+			TRACE_OPTION_COMPRESSTYPE_NONE, 0,
+			O_CREAT | O_WRONLY | O_TRUNC);
+
+	if (!file) {
+		fprintf(stderr, "Unable to write seek index file %s\n",
+				idx->filename);
+		return;
+	}
+
+	wandio_wwrite(file, idx->entries,
+			idx->count * sizeof(libtrace_index_entry_t));
+	wandio_wdestroy(file);
+}
+
+/* Reports that the IO reader can't tell us where it is, which means we
+ * can't tell where packets start either */
+static int tell_failed(libtrace_t *libtrace) {
+	trace_set_err(libtrace, TRACE_ERR_WANDIO_FAILED,
+		"Unable to get the position of the reader while seeking");
+	return -1;
+}
+
+/* Moves the IO reader for the trace to the given offset. If the reader
+ * cannot seek (e.g. the file is compressed) we read and discard data until
+ * we get there instead, reopening the file if we need to go backwards. */
+static int move_to_offset(libtrace_t *libtrace, int64_t offset) {
+
+	char buf[65536];
+	int64_t current = wandio_tell(libtrace->io);
+
+	if (current < 0 || offset < 0)
+		return tell_failed(libtrace);
+
+	if (current == offset)
+		return 0;
+
+	if (wandio_seek(libtrace->io, offset, SEEK_SET) >= 0 &&
+			wandio_tell(libtrace->io) == offset)
+		return 0;
+
+	if (offset < current) {
+		wandio_destroy(libtrace->io);
+		libtrace->io = trace_open_file(libtrace);
+		if (!libtrace->io)
+			return -1;
+		current = 0;
+	}
+
+	while (current < offset) {
+		int64_t toread = offset - current;
+		int64_t ret;
+
+		if (toread > (int64_t)sizeof(buf))
+			toread = sizeof(buf);
+		ret = wandio_read(libtrace->io, buf, toread);
+		if (ret <= 0) {
+			trace_set_err(libtrace, TRACE_ERR_WANDIO_FAILED,
+				"Unable to reach offset %" PRId64 " while seeking",
+				offset);
+			return -1;
+		}
+		current += ret;
+	}
+	return 0;
+}
+
+int trace_seek_index_config(libtrace_t *libtrace, trace_option_t option,
+		void *value) {
+
+	struct libtrace_seek_index *idx = get_seek_index(libtrace);
+
+	if (!idx) {
+		trace_set_err(libtrace, TRACE_ERR_OUT_OF_MEMORY,
+				"Unable to allocate memory for seek index");
+		return -1;
+	}
+
+	switch(option) {
+		case TRACE_OPTION_SEEK_INDEX_INTERVAL:
+			if (*(int *)value < 0) {
+				trace_set_err(libtrace, TRACE_ERR_BAD_STATE,
+					"Invalid seek index interval");
+				return -1;
+			}
+			idx->interval = SEEK_INDEX_MS_TO_ERF(*(int *)value);
+			return 0;
+		case TRACE_OPTION_SEEK_INDEX_FILE:
+			if (idx->started) {
+				trace_set_err(libtrace, TRACE_ERR_BAD_STATE,
+					"Seek index file must be set before the trace is started");
+				return -1;
+			}
+			if (idx->filename)
+				free(idx->filename);
+			idx->filename = value ? strdup((char *)value) : NULL;
+			return 0;
+		default:
+			break;
+	}
+
+	trace_set_err(libtrace, TRACE_ERR_UNKNOWN_OPTION,
+			"Unknown option %i", option);
+	return -1;
+}
+
+int trace_seek_index_start(libtrace_t *libtrace,
+		int (*resync)(libtrace_t *libtrace, int64_t offset)) {
+
+	struct libtrace_seek_index *idx;
+
+	if (!libtrace->io)
+		return 0;
+
+	idx = get_seek_index(libtrace);
+	if (!idx) {
+		trace_set_err(libtrace, TRACE_ERR_OUT_OF_MEMORY,
+				"Unable to allocate memory for seek index");
+		return -1;
+	}
+
+	/* Restarting after a pause -- keep everything we know */
+	if (idx->started)
+		return 0;
+
+	idx->start = wandio_tell(libtrace->io);
+	idx->highwater = idx->start;
+	idx->lastts = 0;
+	idx->resync = resync;
+	idx->started = true;
+
+	if (idx->filename)
+		load_seek_index(idx);
+
+	return 0;
+}
+
+bool trace_seek_index_due(libtrace_t *libtrace) {
+
+	struct libtrace_seek_index *idx = libtrace->seekindex;
+
+	if (!idx || !idx->started || idx->interval == 0)
+		return false;
+	if (idx->count == 0)
+		return true;
+	return idx->lastts >= idx->entries[idx->count - 1].timestamp +
+			idx->interval;
+}
+
+void trace_seek_index_update(libtrace_t *libtrace, libtrace_packet_t *packet,
+		int64_t offset) {
+
+	struct libtrace_seek_index *idx = libtrace->seekindex;
+	uint64_t ts;
+
+	if (!idx || !idx->started)
+		return;
+
+	if (offset > idx->highwater)
+		idx->highwater = offset;
+
+	if (IS_LIBTRACE_META_PACKET(packet))
+		return;
+
+	ts = trace_get_erf_timestamp(packet);
+	idx->lastts = ts;
+
+	if (idx->interval == 0 || offset < 0)
+		return;
+
+	if (idx->count > 0) {
+		libtrace_index_entry_t *last = &idx->entries[idx->count - 1];
+		if ((uint64_t)offset <= last->offset ||
+				ts < last->timestamp + idx->interval)
+			return;
+	}
+
+	if (add_index_entry(idx, ts, (uint64_t)offset) == 0)
+		idx->modified = true;
+}
+
+/* Checks whether a packet is at or after the time we are seeking to. Formats
+ * that don't store ERF timestamps are compared at the precision the packet
+ * timestamp was stored at, otherwise converting a microsecond timestamp to
+ * ERF would put a packet from the same microsecond before the target. */
+static bool seek_target_reached(libtrace_packet_t *packet, uint64_t erfts) {
+
+	struct timespec ts;
+	uint64_t sec = erfts >> 32;
+	uint64_t nsec = ((erfts & 0xFFFFFFFF) * 1000000000ULL) >> 32;
+
+	if (packet->trace->format->get_erf_timestamp)
+		return trace_get_erf_timestamp(packet) >= erfts;
+
+	ts = trace_get_timespec(packet);
+	if (ts.tv_nsec % 1000 == 0)
+		nsec -= nsec % 1000;
+
+	if ((uint64_t)ts.tv_sec != sec)
+		return (uint64_t)ts.tv_sec > sec;
+	return (uint64_t)ts.tv_nsec >= nsec;
+}
+
+int trace_seek_index_erf(libtrace_t *libtrace, uint64_t erfts) {
+
+	struct libtrace_seek_index *idx = libtrace->seekindex;
+	libtrace_packet_t *packet;
+	int64_t target, current, off = 0;
+	uint64_t prevts;
+	size_t lo, hi;
+	bool found = false;
+	int ret;
+
+	if (!idx || !idx->started || !libtrace->io) {
+		trace_set_err(libtrace, TRACE_ERR_OPTION_UNAVAIL,
+			"Seeking is not supported by this format, or the trace has not been started");
+		return -1;
+	}
+
+	/* The reader couldn't tell us where the first packet was, so the
+	 * index is no use */
+	if (idx->start < 0)
+		return tell_failed(libtrace);
+
+	/* Find the last index entry at or before the requested time */
+	lo = 0;
+	hi = idx->count;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (idx->entries[mid].timestamp <= erfts)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	target = lo > 0 ? (int64_t)idx->entries[lo - 1].offset : idx->start;
+
+	/* If the reader is already somewhere between that entry and the
+	 * requested time, just keep reading forward from here. Note that the
+	 * reader is always somewhere the format state is valid for. */
+	current = wandio_tell(libtrace->io);
+	if (current < 0)
+		return tell_failed(libtrace);
+	if (current > idx->highwater)
+		idx->highwater = current;
+	if (current >= target && idx->lastts <= erfts) {
+		prevts = idx->lastts;
+	} else if (target > idx->highwater && idx->resync) {
+		/* The format needs to see everything between where it has
+		 * read up to and the target, e.g. pcapng interface blocks */
+		if (move_to_offset(libtrace, idx->highwater) < 0)
+			return -1;
+		if (idx->resync(libtrace, target) < 0)
+			return -1;
+		prevts = 0;
+	} else {
+		if (move_to_offset(libtrace, target) < 0)
+			return -1;
+		prevts = 0;
+	}
+
+	/* Now read forward looking for the first packet at or after the
+	 * requested time */
+	packet = trace_create_packet();
+	while (1) {
+		uint64_t ts;
+
+		off = wandio_tell(libtrace->io);
+		if (off < 0) {
+			/* Don't read a packet we couldn't rewind to */
+			ret = tell_failed(libtrace);
+			break;
+		}
+		packet->trace = libtrace;
+		packet->which_trace_start = libtrace->startcount;
+		ret = libtrace->format->read_packet(libtrace, packet);
+		if (ret == READ_MESSAGE)
+			continue;
+		if (ret <= 0)
+			break;
+
+		trace_seek_index_update(libtrace, packet, off);
+		if (IS_LIBTRACE_META_PACKET(packet)) {
+			trace_fin_packet(packet);
+			continue;
+		}
+		ts = trace_get_erf_timestamp(packet);
+		found = seek_target_reached(packet, erfts);
+		trace_fin_packet(packet);
+		if (found)
+			break;
+		prevts = ts;
+	}
+	trace_destroy_packet(packet);
+
+	if (ret < 0)
+		return -1;
+
+	/* Rewind to the start of the packet we found so that it is the next
+	 * one read. If we hit EOF instead, stay there. */
+	if (found) {
+		if (move_to_offset(libtrace, off) < 0)
+			return -1;
+	}
+	idx->lastts = prevts;
+	return 0;
+}
+
+void trace_seek_index_destroy(libtrace_t *libtrace) {
+
+	struct libtrace_seek_index *idx = libtrace->seekindex;
+
+	if (!idx)
+		return;
+
+	if (idx->filename && idx->modified && idx->count > 0)
+		save_seek_index(idx);
+
+	if (idx->entries)
+		free(idx->entries);
+	if (idx->filename)
+		free(idx->filename);
+	free(idx);
+	libtrace->seekindex = NULL;
+}
@@ -0,0 +1,134 @@
+/*
+ *
+ * Copyright (c) 2007-2016 The University of Waikato, Hamilton, New Zealand.
+ * All rights reserved.
+ *
+ * This file is part of libtrace.
+ *
+ * This code has been developed by the University of Waikato WAND
+ * research group. For further information please see http://www.wand.net.nz/
+ *
+ * libtrace is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libtrace is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ */
+#include "libtrace_int.h"
+#include "stage_latency.h"
+#include "data-struct/message_queue.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define LATENCY_GET(field) __atomic_load_n(&(field), __ATOMIC_RELAXED)
+
+libtrace_latency_set_t *latency_set_create(int count) {
+	libtrace_latency_set_t *set;
+	void *threads;
+
+	set = (libtrace_latency_set_t *) calloc(1, sizeof(libtrace_latency_set_t));
+	if (!set)
+		return NULL;
+	if (posix_memalign(&threads, CACHE_LINE_SIZE,
+				count * sizeof(libtrace_stage_latency_t)) != 0) {
+		free(set);
+		return NULL;
+	}
+	memset(threads, 0, count * sizeof(libtrace_stage_latency_t));
+	set->threads = (libtrace_stage_latency_t *) threads;
+	set->count = count;
+	set->ns_base = libtrace_message_queue_clock();
+	set->clock_base = stage_clock();
+	return set;
+}
+
+void latency_set_destroy(libtrace_latency_set_t *set) {
+	if (!set)
+		return;
+	free(set->threads);
+	free(set);
+}
+
+/* How many clock units there are in a nanosecond, measured over the life of
+ * the set */
+static double clock_scale(libtrace_latency_set_t *set) {
+	uint64_t ticks = stage_clock() - set->clock_base;
+	uint64_t ns = libtrace_message_queue_clock() - set->ns_base;
+
+	if (ns == 0 || ticks == 0)
+		return 1.0;
+	return (double) ticks / ns;
+}
+
+/* The middle of a bucket, the inverse of latency_bucket() */
+static uint64_t bucket_value(int bucket) {
+	int group = bucket / LATENCY_SUB_BUCKETS;
+	int sub = bucket % LATENCY_SUB_BUCKETS;
+	uint64_t low;
+
+	if (group == 0)
+		return bucket;
+	low = (uint64_t) (LATENCY_SUB_BUCKETS + sub) << (group - 1);
+	return low + ((1ULL << (group - 1)) >> 1);
+}
+
+void latency_set_summarise(libtrace_latency_set_t *set, int first, int last,
+		libtrace_stage_t stage, libtrace_latency_summary_t *summary) {
+	static const double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+	uint64_t *results[] = {&summary->p50, &summary->p90, &summary->p99,
+		&summary->p999};
+	uint64_t buckets[LATENCY_BUCKETS];
+	uint64_t sum = 0, min = UINT64_MAX, max = 0, seen = 0;
+	double scale = clock_scale(set);
+	size_t q = 0;
+	int i, b;
+
+	memset(summary, 0, sizeof(libtrace_latency_summary_t));
+	memset(buckets, 0, sizeof(buckets));
+	for (i = first; i < last; i++) {
+		latency_histogram_t *h = &set->threads[i].stages[stage];
+
+		if (LATENCY_GET(h->count) == 0)
+			continue;
+		for (b = 0; b < LATENCY_BUCKETS; b++)
+			buckets[b] += LATENCY_GET(h->buckets[b]);
+		sum += LATENCY_GET(h->sum);
+		if (LATENCY_GET(h->min) < min)
+			min = LATENCY_GET(h->min);
+		if (LATENCY_GET(h->max) > max)
+			max = LATENCY_GET(h->max);
+	}
+	/* Count the buckets rather than trusting the counts, which may be
+	 * a little out of step while the threads are running */
+	for (b = 0; b < LATENCY_BUCKETS; b++)
+		summary->count += buckets[b];
+	if (summary->count == 0)
+		return;
+
+	for (b = 0; b < LATENCY_BUCKETS && q < 4; b++) {
+		seen += buckets[b];
+		while (q < 4 && seen >= quantiles[q] * summary->count) {
+			uint64_t value = bucket_value(b);
+
+			if (value < min)
+				value = min;
+			if (value > max)
+				value = max;
+			*results[q] = value / scale;
+			q++;
+		}
+	}
+	summary->min = min / scale;
+	summary->max = max / scale;
+	summary->mean = sum / summary->count / scale;
+}
@@ -0,0 +1,133 @@
+/*
+ *
+ * Copyright (c) 2007-2016 The University of Waikato, Hamilton, New Zealand.
+ * All rights reserved.
+ *
+ * This file is part of libtrace.
+ *
+ * This code has been developed by the University of Waikato WAND
+ * research group. For further information please see http://www.wand.net.nz/
+ *
+ * libtrace is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libtrace is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ */
+#ifndef LIBTRACE_STAGE_LATENCY_H_
+#define LIBTRACE_STAGE_LATENCY_H_
+
+/** @file
+ *
+ * @brief Latency histograms for the stages of the parallel engine
+ *
+ * Each thread has a histogram for every stage, which only that thread
+ * writes to. The histograms are log-linear, in the style of HdrHistogram:
+ * every power of two is split into LATENCY_SUB_BUCKETS buckets, so a value
+ * is always recorded to within 1/LATENCY_SUB_BUCKETS of itself.
+ *
+ * Latencies are measured with the cheapest clock available, the TSC on x86,
+ * and are only converted to nanoseconds when they are read.
+ */
+
+#include "libtrace_parallel.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include "data-struct/message_queue.h"
+#endif
+
+#define LATENCY_SUB_BITS 4
+#define LATENCY_SUB_BUCKETS (1 << LATENCY_SUB_BITS)
+#define LATENCY_BUCKETS ((64 - LATENCY_SUB_BITS + 1) * LATENCY_SUB_BUCKETS)
+
+typedef struct latency_histogram {
+	uint64_t count;
+	uint64_t sum;
+	uint64_t min;
+	uint64_t max;
+	uint64_t buckets[LATENCY_BUCKETS];
+} latency_histogram_t;
+
+/** The histograms of one thread */
+typedef struct libtrace_stage_latency {
+	latency_histogram_t stages[LIBTRACE_STAGE_COUNT];
+} ALIGNED(CACHE_LINE_SIZE) libtrace_stage_latency_t;
+
+/** The histograms of every thread of a trace */
+typedef struct libtrace_latency_set {
+	/* Clock readings taken together when the set was created, used to
+	 * work out how fast the clock runs */
+	uint64_t clock_base;
+	uint64_t ns_base;
+	int count;
+	libtrace_stage_latency_t *threads;
+} libtrace_latency_set_t;
+
+/** Allocates a zeroed set of histograms for a number of threads
+ *
+ * @return The set, or NULL if there is not enough memory
+ */
+libtrace_latency_set_t *latency_set_create(int count);
+
+void latency_set_destroy(libtrace_latency_set_t *set);
+
+/** Merges the histograms of a range of threads for one stage and works out
+ * the percentiles, in nanoseconds
+ *
+ * @param set The set of histograms
+ * @param first The first thread to include
+ * @param last One past the last thread to include
+ * @param stage The stage
+ * @param summary Filled with the summary upon return
+ */
+void latency_set_summarise(libtrace_latency_set_t *set, int first, int last,
+		libtrace_stage_t stage, libtrace_latency_summary_t *summary);
+
+/** Reads the clock used to time stages, in arbitrary units */
+static inline uint64_t stage_clock(void) {
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	return libtrace_message_queue_clock();
+#endif
+}
+
+static inline int latency_bucket(uint64_t value) {
+	int msb;
+
+	if (value < LATENCY_SUB_BUCKETS)
+		return value;
+	msb = 63 - __builtin_clzll(value);
+	return (msb - LATENCY_SUB_BITS + 1) * LATENCY_SUB_BUCKETS +
+		((value >> (msb - LATENCY_SUB_BITS)) & (LATENCY_SUB_BUCKETS - 1));
+}
+
+/* Only the owning thread writes to a histogram, but others may read it at
+ * the same time, so each word is written in one go */
+#define LATENCY_SET(field, value) \
+	__atomic_store_n(&(field), (value), __ATOMIC_RELAXED)
+
+static inline void latency_record(latency_histogram_t *h, uint64_t value) {
+	int bucket = latency_bucket(value);
+
+	LATENCY_SET(h->buckets[bucket], h->buckets[bucket] + 1);
+	LATENCY_SET(h->sum, h->sum + value);
+	if (h->count == 0 || value < h->min)
+		LATENCY_SET(h->min, value);
+	if (value > h->max)
+		LATENCY_SET(h->max, value);
+	LATENCY_SET(h->count, h->count + 1);
+}
+
+#endif
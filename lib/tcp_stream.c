@@ -0,0 +1,542 @@
+/*
+ *
+ * Copyright (c) 2007-2016 The University of Waikato, Hamilton, New Zealand.
+ * All rights reserved.
+ *
+ * This file is part of libtrace.
+ *
+ * This code has been developed by the University of Waikato WAND
+ * research group. For further information please see http://www.wand.net.nz/
+ *
+ * libtrace is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libtrace is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ */
+#include "libtrace_int.h"
+#include "libtrace.h"
+#include "tcp_stream.h"
+#include "data-struct/flow_table.h"
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+/* Out of order payload is held in blocks of this size, header included */
+#define BLOCK_SIZE 2048
+#define BLOCK_DATA (BLOCK_SIZE - offsetof(struct tcp_block, data))
+/* How many blocks from drained segments are kept for reuse */
+#define MAX_SPARE 256
+/* How many streams the table starts out with room for */
+#define INITIAL_STREAMS 1024
+
+/* Sequence number comparisons that allow for wrapping */
+#define SEQ_LT(a, b) ((int32_t)((a) - (b)) < 0)
+#define SEQ_LEQ(a, b) ((int32_t)((a) - (b)) <= 0)
+#define SEQ_GT(a, b) ((int32_t)((a) - (b)) > 0)
+
+/* A piece of an out of order segment */
+struct tcp_block {
+	struct tcp_block *next;
+	uint32_t seq;
+	/* The bytes of payload held */
+	uint32_t len;
+	/* The sequence space covered, which is more than len if the end of
+	 * the segment was not captured */
+	uint32_t span;
+	uint8_t data[];
+};
+
+/* One direction of a stream */
+struct tcp_half {
+	/* Out of order blocks, sorted by sequence number */
+	struct tcp_block *head;
+	struct tcp_block *tail;
+	/* The sequence number of the next payload to deliver */
+	uint32_t next_seq;
+	/* The sequence number of the FIN, if fin_seen is set */
+	uint32_t fin_seq;
+	uint8_t started;
+	uint8_t fin_seen;
+	uint8_t fin_done;
+	/* Set when payload has been skipped, so that the next chunk delivered
+	 * is flagged with TCP_PAYLOAD_GAP */
+	uint8_t gap;
+};
+
+struct tcp_entry {
+	libtrace_tcp_stream_t stream;
+	/* The key in the flow table, with the lower address first so that
+	 * both directions find the same entry */
+	libtrace_flow_tuple_t key;
+	/* Streams in the order they were last active */
+	struct tcp_entry *prev;
+	struct tcp_entry *next;
+	/* Streams holding blocks, in the order they started to */
+	struct tcp_entry *bprev;
+	struct tcp_entry *bnext;
+	/* ERF timestamp of the last packet */
+	uint64_t last_seen;
+	/* Bytes of blocks held by both directions */
+	size_t buffered;
+	struct tcp_half half[2];
+};
+
+struct libtrace_tcp_tracker {
+	libtrace_flow_table_t *table;
+	size_t max_streams;
+	size_t memory_limit;
+	/* The idle timeout as an ERF timestamp difference */
+	uint64_t timeout;
+	tcp_deliver_fn deliver;
+	void *data;
+	struct tcp_entry *oldest;
+	struct tcp_entry *newest;
+	struct tcp_entry *boldest;
+	struct tcp_entry *bnewest;
+	/* Bytes of blocks held by every stream */
+	size_t buffered;
+	struct tcp_block *spare;
+	size_t nb_spare;
+};
+
+/* The parts of a TCP packet needed to track it */
+struct tcp_segment {
+	libtrace_flow_tuple_t tuple;
+	libtrace_tcp_t *tcp;
+	uint8_t *payload;
+	/* The bytes of payload captured */
+	uint32_t len;
+	/* The length of the payload on the wire */
+	uint32_t span;
+};
+
+libtrace_tcp_tracker_t *tcp_tracker_create(size_t max_streams,
+		size_t memory_limit, size_t idle_timeout_ms,
+		tcp_deliver_fn deliver, void *data) {
+	libtrace_tcp_tracker_t *tr;
+
+	tr = (libtrace_tcp_tracker_t *)calloc(1,
+			sizeof(libtrace_tcp_tracker_t));
+	if (!tr)
+		return NULL;
+	tr->table = libtrace_flow_table_create(sizeof(struct tcp_entry),
+			max_streams < INITIAL_STREAMS ? max_streams :
+			INITIAL_STREAMS);
+	if (!tr->table) {
+		free(tr);
+		return NULL;
+	}
+	tr->max_streams = max_streams;
+	tr->memory_limit = memory_limit;
+	tr->timeout = ((uint64_t)idle_timeout_ms << 32) / 1000;
+	tr->deliver = deliver;
+	tr->data = data;
+	return tr;
+}
+
+void tcp_tracker_destroy(libtrace_tcp_tracker_t *tr) {
+	struct tcp_block *b;
+
+	tcp_tracker_flush(tr);
+	while ((b = tr->spare)) {
+		tr->spare = b->next;
+		free(b);
+	}
+	libtrace_flow_table_destroy(tr->table);
+	free(tr);
+}
+
+static struct tcp_block *alloc_block(libtrace_tcp_tracker_t *tr,
+		struct tcp_entry *e) {
+	struct tcp_block *b = tr->spare;
+
+	if (b) {
+		tr->spare = b->next;
+		tr->nb_spare --;
+	} else {
+		b = (struct tcp_block *)malloc(BLOCK_SIZE);
+		if (!b)
+			return NULL;
+	}
+
+	if (e->buffered == 0) {
+		e->bprev = tr->bnewest;
+		e->bnext = NULL;
+		if (tr->bnewest)
+			tr->bnewest->bnext = e;
+		else
+			tr->boldest = e;
+		tr->bnewest = e;
+	}
+	e->buffered += BLOCK_SIZE;
+	tr->buffered += BLOCK_SIZE;
+	return b;
+}
+
+static void release_block(libtrace_tcp_tracker_t *tr, struct tcp_entry *e,
+		struct tcp_block *b) {
+	e->buffered -= BLOCK_SIZE;
+	tr->buffered -= BLOCK_SIZE;
+	if (e->buffered == 0) {
+		if (e->bprev)
+			e->bprev->bnext = e->bnext;
+		else
+			tr->boldest = e->bnext;
+		if (e->bnext)
+			e->bnext->bprev = e->bprev;
+		else
+			tr->bnewest = e->bprev;
+	}
+
+	if (tr->nb_spare < MAX_SPARE) {
+		b->next = tr->spare;
+		tr->spare = b;
+		tr->nb_spare ++;
+	} else {
+		free(b);
+	}
+}
+
+/* Delivers payload starting at the next sequence number of a direction,
+ * trimming off anything before it that has already been delivered */
+static void deliver_chunk(libtrace_tcp_tracker_t *tr, struct tcp_entry *e,
+		int dir, uint32_t seq, const uint8_t *data, uint32_t len,
+		uint32_t span) {
+	struct tcp_half *h = &e->half[dir];
+	uint32_t skip = h->next_seq - seq;
+
+	if (SEQ_LT(seq, h->next_seq)) {
+		if (skip >= span)
+			return;
+		if (skip >= len) {
+			len = 0;
+		} else {
+			data += skip;
+			len -= skip;
+		}
+		span -= skip;
+	}
+
+	if (len > 0) {
+		tr->deliver(tr->data, &e->stream, dir, data, len,
+				h->gap ? TCP_PAYLOAD_GAP : 0);
+		h->gap = 0;
+	}
+	h->next_seq += span;
+	if (span > len)
+		h->gap = 1;
+}
+
+static void check_fin(libtrace_tcp_tracker_t *tr, struct tcp_entry *e,
+		int dir) {
+	struct tcp_half *h = &e->half[dir];
+
+	if (h->fin_seen && !h->fin_done && SEQ_LEQ(h->fin_seq, h->next_seq)) {
+		h->fin_done = 1;
+		tr->deliver(tr->data, &e->stream, dir, NULL, 0,
+				TCP_PAYLOAD_FIN);
+	}
+}
+
+/* Delivers any blocks that are now in order */
+static void drain_half(libtrace_tcp_tracker_t *tr, struct tcp_entry *e,
+		int dir) {
+	struct tcp_half *h = &e->half[dir];
+	struct tcp_block *b;
+
+	while ((b = h->head) && SEQ_LEQ(b->seq, h->next_seq)) {
+		h->head = b->next;
+		if (!h->head)
+			h->tail = NULL;
+		deliver_chunk(tr, e, dir, b->seq, b->data, b->len, b->span);
+		release_block(tr, e, b);
+	}
+	check_fin(tr, e, dir);
+}
+
+/* Delivers every block, skipping over any payload that is missing */
+static void flush_half(libtrace_tcp_tracker_t *tr, struct tcp_entry *e,
+		int dir) {
+	struct tcp_half *h = &e->half[dir];
+	struct tcp_block *b;
+
+	while ((b = h->head)) {
+		h->head = b->next;
+		if (SEQ_GT(b->seq, h->next_seq)) {
+			h->next_seq = b->seq;
+			h->gap = 1;
+		}
+		deliver_chunk(tr, e, dir, b->seq, b->data, b->len, b->span);
+		release_block(tr, e, b);
+	}
+	h->tail = NULL;
+	if (h->fin_seen && SEQ_GT(h->fin_seq, h->next_seq)) {
+		h->next_seq = h->fin_seq;
+		h->gap = 1;
+	}
+	check_fin(tr, e, dir);
+}
+
+/* Holds an out of order segment until the payload before it arrives */
+static void buffer_segment(libtrace_tcp_tracker_t *tr, struct tcp_entry *e,
+		int dir, uint32_t seq, const uint8_t *data, uint32_t len,
+		uint32_t span) {
+	struct tcp_half *h = &e->half[dir];
+	struct tcp_block *b, **pos;
+	uint32_t n;
+
+	do {
+		n = len < BLOCK_DATA ? len : BLOCK_DATA;
+
+		/* Most segments arrive after those already held, otherwise
+		 * find where it goes, dropping exact retransmissions */
+		if (!h->tail || SEQ_GT(seq, h->tail->seq)) {
+			pos = h->tail ? &h->tail->next : &h->head;
+		} else {
+			for (pos = &h->head; *pos && SEQ_LEQ((*pos)->seq, seq);
+					pos = &(*pos)->next) {
+				if ((*pos)->seq == seq && (*pos)->span >=
+						(n < len ? n : span))
+					return;
+			}
+		}
+
+		b = alloc_block(tr, e);
+		if (!b)
+			return;
+		b->seq = seq;
+		b->len = n;
+		b->span = n < len ? n : span;
+		memcpy(b->data, data, n);
+		b->next = *pos;
+		*pos = b;
+		if (!b->next)
+			h->tail = b;
+
+		seq += b->span;
+		data += n;
+		span -= b->span;
+		len -= n;
+	} while (len > 0);
+}
+
+static void end_stream(libtrace_tcp_tracker_t *tr, struct tcp_entry *e) {
+	libtrace_flow_tuple_t key;
+
+	flush_half(tr, e, TCP_FROM_CLIENT);
+	flush_half(tr, e, TCP_FROM_SERVER);
+	tr->deliver(tr->data, &e->stream, TCP_FROM_CLIENT, NULL, 0,
+			TCP_PAYLOAD_END);
+
+	if (e->prev)
+		e->prev->next = e->next;
+	else
+		tr->oldest = e->next;
+	if (e->next)
+		e->next->prev = e->prev;
+	else
+		tr->newest = e->prev;
+
+	key = e->key;
+	libtrace_flow_table_remove(tr->table, &key);
+}
+
+void tcp_tracker_flush(libtrace_tcp_tracker_t *tr) {
+	while (tr->oldest)
+		end_stream(tr, tr->oldest);
+}
+
+/* Finds the TCP header and payload of a packet, returning 0 if it is not
+ * TCP */
+static int get_segment(libtrace_packet_t *packet, struct tcp_segment *seg) {
+	uint16_t ethertype;
+	uint32_t rem;
+	uint8_t proto;
+	void *l3, *transport;
+	uint32_t ip_len;
+
+	l3 = trace_get_layer3(packet, &ethertype, &rem);
+	if (!l3)
+		return 0;
+	if (ethertype == TRACE_ETHERTYPE_IP && rem >= sizeof(libtrace_ip_t))
+		ip_len = ntohs(((libtrace_ip_t *)l3)->ip_len);
+	else if (ethertype == TRACE_ETHERTYPE_IPV6 &&
+			rem >= sizeof(libtrace_ip6_t))
+		ip_len = ntohs(((libtrace_ip6_t *)l3)->plen) +
+				sizeof(libtrace_ip6_t);
+	else
+		return 0;
+
+	transport = trace_get_transport(packet, &proto, &rem);
+	if (!transport || proto != TRACE_IPPROTO_TCP ||
+			rem < sizeof(libtrace_tcp_t))
+		return 0;
+	seg->tcp = (libtrace_tcp_t *)transport;
+	if ((uint32_t)seg->tcp->doff * 4 < sizeof(libtrace_tcp_t))
+		return 0;
+
+	/* The payload on the wire is whatever of the IP datagram comes after
+	 * the TCP header, which leaves out any link layer padding */
+	seg->payload = (uint8_t *)transport + seg->tcp->doff * 4;
+	if ((uint8_t *)transport - (uint8_t *)l3 + seg->tcp->doff * 4 >= ip_len)
+		seg->span = 0;
+	else
+		seg->span = ip_len - ((uint8_t *)seg->payload - (uint8_t *)l3);
+	if (rem <= (uint32_t)seg->tcp->doff * 4)
+		seg->len = 0;
+	else
+		seg->len = rem - seg->tcp->doff * 4;
+	if (seg->len > seg->span)
+		seg->len = seg->span;
+
+	return libtrace_flow_tuple_from_packet(packet, &seg->tuple);
+}
+
+static struct tcp_entry *new_stream(libtrace_tcp_tracker_t *tr,
+		libtrace_flow_tuple_t *key, struct tcp_segment *seg) {
+	libtrace_tcp_stream_t *s;
+	struct tcp_entry *e;
+
+	if (libtrace_flow_table_get_size(tr->table) >= tr->max_streams &&
+			tr->oldest)
+		end_stream(tr, tr->oldest);
+	e = (struct tcp_entry *)libtrace_flow_table_insert(tr->table, key,
+			NULL);
+	if (!e)
+		return NULL;
+	e->key = *key;
+
+	/* The SYN ACK is sent by the server, anything else is assumed to be
+	 * sent by the client */
+	s = &e->stream;
+	s->ip_version = seg->tuple.ip_version;
+	if (seg->tcp->syn && seg->tcp->ack) {
+		memcpy(s->client_ip, seg->tuple.dst_ip, 16);
+		memcpy(s->server_ip, seg->tuple.src_ip, 16);
+		s->client_port = seg->tuple.dst_port;
+		s->server_port = seg->tuple.src_port;
+	} else {
+		memcpy(s->client_ip, seg->tuple.src_ip, 16);
+		memcpy(s->server_ip, seg->tuple.dst_ip, 16);
+		s->client_port = seg->tuple.src_port;
+		s->server_port = seg->tuple.dst_port;
+	}
+	return e;
+}
+
+/* Flushes the streams that have held blocks longest until the tracker is
+ * back under its memory limit */
+static void enforce_limit(libtrace_tcp_tracker_t *tr) {
+	struct tcp_entry *e;
+
+	while (tr->buffered > tr->memory_limit && (e = tr->boldest)) {
+		flush_half(tr, e, TCP_FROM_CLIENT);
+		flush_half(tr, e, TCP_FROM_SERVER);
+		if (e->half[0].fin_done && e->half[1].fin_done)
+			end_stream(tr, e);
+	}
+}
+
+void tcp_tracker_add(libtrace_tcp_tracker_t *tr, libtrace_packet_t *packet) {
+	uint64_t now = trace_get_erf_timestamp(packet);
+	libtrace_flow_tuple_t key;
+	struct tcp_segment seg;
+	struct tcp_entry *e;
+	struct tcp_half *h;
+	uint32_t seq;
+	int dir;
+
+	while (tr->oldest && tr->oldest->last_seen + tr->timeout < now)
+		end_stream(tr, tr->oldest);
+
+	if (!get_segment(packet, &seg))
+		return;
+
+	key = seg.tuple;
+	if (memcmp(key.src_ip, key.dst_ip, 16) > 0 ||
+			(memcmp(key.src_ip, key.dst_ip, 16) == 0 &&
+			 key.src_port > key.dst_port)) {
+		memcpy(key.src_ip, seg.tuple.dst_ip, 16);
+		memcpy(key.dst_ip, seg.tuple.src_ip, 16);
+		key.src_port = seg.tuple.dst_port;
+		key.dst_port = seg.tuple.src_port;
+	}
+
+	e = (struct tcp_entry *)libtrace_flow_table_find(tr->table, &key);
+	if (!e) {
+		/* Don't start following a connection on a bare ACK or RST,
+		 * which are often all that is left after it has ended */
+		if (seg.tcp->rst || (!seg.tcp->syn && seg.span == 0))
+			return;
+		e = new_stream(tr, &key, &seg);
+		if (!e)
+			return;
+	} else {
+		/* Move it to the newest end of the list */
+		if (e->prev)
+			e->prev->next = e->next;
+		else
+			tr->oldest = e->next;
+		if (e->next)
+			e->next->prev = e->prev;
+		else
+			tr->newest = e->prev;
+	}
+	e->prev = tr->newest;
+	e->next = NULL;
+	if (tr->newest)
+		tr->newest->next = e;
+	else
+		tr->oldest = e;
+	tr->newest = e;
+	e->last_seen = now;
+
+	if (seg.tcp->rst) {
+		end_stream(tr, e);
+		return;
+	}
+
+	dir = (e->stream.client_port == seg.tuple.src_port &&
+			memcmp(e->stream.client_ip, seg.tuple.src_ip, 16) == 0) ?
+			TCP_FROM_CLIENT : TCP_FROM_SERVER;
+	h = &e->half[dir];
+
+	/* The SYN takes up the first sequence number */
+	seq = ntohl(seg.tcp->seq) + (seg.tcp->syn ? 1 : 0);
+	if (!h->started) {
+		h->started = 1;
+		h->next_seq = seq;
+	}
+	if (seg.tcp->fin && !h->fin_seen) {
+		h->fin_seen = 1;
+		h->fin_seq = seq + seg.span;
+	}
+
+	if (seg.span > 0) {
+		if (SEQ_LEQ(seq, h->next_seq)) {
+			deliver_chunk(tr, e, dir, seq, seg.payload, seg.len,
+					seg.span);
+			drain_half(tr, e, dir);
+		} else {
+			buffer_segment(tr, e, dir, seq, seg.payload, seg.len,
+					seg.span);
+		}
+	}
+	check_fin(tr, e, dir);
+
+	if (e->half[0].fin_done && e->half[1].fin_done)
+		end_stream(tr, e);
+	enforce_limit(tr);
+}
@@ -0,0 +1,89 @@
+/*
+ *
+ * Copyright (c) 2007-2016 The University of Waikato, Hamilton, New Zealand.
+ * All rights reserved.
+ *
+ * This file is part of libtrace.
+ *
+ * This code has been developed by the University of Waikato WAND
+ * research group. For further information please see http://www.wand.net.nz/
+ *
+ * libtrace is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libtrace is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ */
+#ifndef LIBTRACE_TCP_STREAM_H_
+#define LIBTRACE_TCP_STREAM_H_
+
+/** @file
+ *
+ * @brief Reordering of TCP segments into in-order payload
+ *
+ * A TCP tracker follows both directions of each TCP connection it is given
+ * packets for, holding out of order segments until the payload before them
+ * arrives and then delivering the payload of each direction in sequence
+ * order. Out of order segments are copied into fixed size blocks that are
+ * reused between streams, and the total buffered is kept under a limit by
+ * flushing streams past their missing payload.
+ *
+ * A tracker is not thread safe. Each per packet thread has its own, so both
+ * directions of a connection need to be sent to the same thread, e.g. by
+ * using HASHER_BIDIRECTIONAL.
+ */
+
+#include "libtrace.h"
+#include "libtrace_parallel.h"
+
+typedef struct libtrace_tcp_tracker libtrace_tcp_tracker_t;
+
+/** Called with each chunk of in-order payload, and for the FIN and END
+ * events, see fn_cb_tcp_payload */
+typedef void (*tcp_deliver_fn)(void *data, libtrace_tcp_stream_t *stream,
+		int direction, const uint8_t *payload, size_t len, int flags);
+
+/** Creates a TCP tracker
+ *
+ * @param max_streams	The most streams to follow at once, after which the
+ * 			least recently active is ended
+ * @param memory_limit	The most bytes of out of order payload to buffer
+ * @param idle_timeout_ms How long a stream can be idle before it is ended,
+ * 			in milliseconds of packet time
+ * @param deliver	The function to deliver payload to
+ * @param data		Passed to deliver
+ * @return The new tracker, or NULL if there is not enough memory
+ */
+libtrace_tcp_tracker_t *tcp_tracker_create(size_t max_streams,
+		size_t memory_limit, size_t idle_timeout_ms,
+		tcp_deliver_fn deliver, void *data);
+
+/** Ends every stream in a tracker, flushing any buffered payload, then
+ * destroys it */
+void tcp_tracker_destroy(libtrace_tcp_tracker_t *tracker);
+
+/** Adds a packet to a TCP tracker
+ *
+ * @param tracker	The TCP tracker
+ * @param packet	The packet, which is left unchanged
+ *
+ * Every packet should be added, not just TCP, as their timestamps are used
+ * to end idle streams. Any payload that the packet puts in order is
+ * delivered before this returns.
+ */
+void tcp_tracker_add(libtrace_tcp_tracker_t *tracker,
+		libtrace_packet_t *packet);
+
+/** Ends every stream in a tracker, flushing any buffered payload */
+void tcp_tracker_flush(libtrace_tcp_tracker_t *tracker);
+
+#endif
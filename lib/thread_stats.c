@@ -0,0 +1,103 @@
+/*
+ *
+ * Copyright (c) 2007-2016 The University of Waikato, Hamilton, New Zealand.
+ * All rights reserved.
+ *
+ * This file is part of libtrace.
+ *
+ * This code has been developed by the University of Waikato WAND
+ * research group. For further information please see http://www.wand.net.nz/
+ *
+ * libtrace is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libtrace is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ */
+#include "libtrace_int.h"
+#include "thread_stats.h"
+
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define COUNTER_WORDS (sizeof(libtrace_thread_counters_t) / sizeof(uint64_t))
+
+libtrace_stat_shard_t *thread_stats_create(int count) {
+	void *shards;
+
+	if (posix_memalign(&shards, CACHE_LINE_SIZE,
+				count * sizeof(libtrace_stat_shard_t)) != 0)
+		return NULL;
+	memset(shards, 0, count * sizeof(libtrace_stat_shard_t));
+	return (libtrace_stat_shard_t *) shards;
+}
+
+void thread_stats_destroy(libtrace_stat_shard_t *shards) {
+	free(shards);
+}
+
+void thread_stats_reset(libtrace_stat_shard_t *shard) {
+	memset(&shard->live, 0, sizeof(shard->live));
+	thread_stats_publish(shard, 0);
+}
+
+void thread_stats_publish(libtrace_stat_shard_t *shard, uint64_t queue_depth) {
+	const uint64_t *src = (const uint64_t *) &shard->live;
+	uint64_t *dst = (uint64_t *) &shard->published;
+	uint32_t seq = shard->seq;
+	size_t i;
+
+	shard->live.queue_depth = queue_depth;
+	if (queue_depth > shard->live.queue_depth_max)
+		shard->live.queue_depth_max = queue_depth;
+
+	__atomic_store_n(&shard->seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	for (i = 0; i < COUNTER_WORDS; i++)
+		__atomic_store_n(&dst[i], src[i], __ATOMIC_RELAXED);
+	__atomic_store_n(&shard->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+void thread_stats_snapshot(const libtrace_stat_shard_t *shard,
+		libtrace_thread_counters_t *counters) {
+	const uint64_t *src = (const uint64_t *) &shard->published;
+	uint64_t *dst = (uint64_t *) counters;
+	uint32_t seq;
+	size_t i;
+
+	for (;;) {
+		seq = __atomic_load_n(&shard->seq, __ATOMIC_ACQUIRE);
+		if (seq & 1) {
+			sched_yield();
+			continue;
+		}
+		for (i = 0; i < COUNTER_WORDS; i++)
+			dst[i] = __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&shard->seq, __ATOMIC_RELAXED) == seq)
+			return;
+	}
+}
+
+void thread_stats_add(libtrace_thread_counters_t *total,
+		const libtrace_thread_counters_t *counters) {
+	const uint64_t *src = (const uint64_t *) counters;
+	uint64_t *dst = (uint64_t *) total;
+	uint64_t depth_max = total->queue_depth_max;
+	size_t i;
+
+	for (i = 0; i < COUNTER_WORDS; i++)
+		dst[i] += src[i];
+	total->queue_depth_max = depth_max > counters->queue_depth_max ?
+		depth_max : counters->queue_depth_max;
+}
@@ -0,0 +1,106 @@
+/*
+ *
+ * Copyright (c) 2007-2016 The University of Waikato, Hamilton, New Zealand.
+ * All rights reserved.
+ *
+ * This file is part of libtrace.
+ *
+ * This code has been developed by the University of Waikato WAND
+ * research group. For further information please see http://www.wand.net.nz/
+ *
+ * libtrace is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libtrace is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ */
+#ifndef LIBTRACE_THREAD_STATS_H_
+#define LIBTRACE_THREAD_STATS_H_
+
+/** @file
+ *
+ * @brief Per thread counters that can be read without stopping the thread
+ *
+ * Each processing thread owns a shard holding two copies of its counters.
+ * The thread updates the live copy without any synchronisation, and now and
+ * again publishes it by copying it into the published copy under a sequence
+ * lock. Readers retry if the sequence changes while they copy, so the
+ * thread never waits for a reader.
+ *
+ * The live copy and the published copy are kept on separate cache lines so
+ * that readers polling a shard do not slow down the thread that owns it.
+ */
+
+#include "libtrace_parallel.h"
+
+typedef struct libtrace_stat_shard {
+	/** Only ever touched by the owning thread */
+	libtrace_thread_counters_t live ALIGNED(CACHE_LINE_SIZE);
+	/** Odd while the published copy is being updated */
+	uint32_t seq ALIGNED(CACHE_LINE_SIZE);
+	libtrace_thread_counters_t published;
+} ALIGNED(CACHE_LINE_SIZE) libtrace_stat_shard_t;
+
+/** Allocates a zeroed shard for each of a number of threads
+ *
+ * @param count The number of shards
+ * @return The shards, which are freed with thread_stats_destroy(), or NULL
+ * if there is not enough memory
+ */
+libtrace_stat_shard_t *thread_stats_create(int count);
+
+void thread_stats_destroy(libtrace_stat_shard_t *shards);
+
+/** Zeroes both copies of the counters, the owning thread must not be
+ * running */
+void thread_stats_reset(libtrace_stat_shard_t *shard);
+
+/** Copies the live counters to where readers can see them, must only be
+ * called by the owning thread
+ *
+ * @param shard The shard
+ * @param queue_depth How much work is waiting for the thread
+ */
+void thread_stats_publish(libtrace_stat_shard_t *shard, uint64_t queue_depth);
+
+/** Takes a consistent copy of the published counters, from any thread */
+void thread_stats_snapshot(const libtrace_stat_shard_t *shard,
+		libtrace_thread_counters_t *counters);
+
+/** Adds the counters of one thread to a running total */
+void thread_stats_add(libtrace_thread_counters_t *total,
+		const libtrace_thread_counters_t *counters);
+
+/* The histogram bucket for a value, where bucket 0 holds values below
+ * 2^shift and each bucket after that is twice as wide */
+static inline int thread_stats_bucket(uint64_t value, int shift) {
+	int bucket;
+
+	if (value >> shift == 0)
+		return 0;
+	bucket = 64 - __builtin_clzll(value >> shift);
+	return bucket < LIBTRACE_COUNTER_BUCKETS ? bucket :
+		LIBTRACE_COUNTER_BUCKETS - 1;
+}
+
+static inline void thread_stats_burst(libtrace_stat_shard_t *shard,
+		int nb_packets) {
+	shard->live.bursts ++;
+	shard->live.burst_sizes[thread_stats_bucket(nb_packets, 1)] ++;
+}
+
+static inline void thread_stats_latency(libtrace_stat_shard_t *shard,
+		uint64_t ns) {
+	shard->live.callback_latency[thread_stats_bucket(ns, 7)] ++;
+}
+
+#endif
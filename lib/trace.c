@@ -95,7 +95,7 @@ volatile int libtrace_halt = 0;
 int libtrace_parallel = 0;
 
 static const libtrace_packet_cache_t clearcache = {
-        -1, -1, -1, -1, NULL, 0, 0, NULL, 0, 0, NULL, 0, 0};
+        -1, -1, -1, -1, NULL, 0, 0, NULL, 0, 0, 0, NULL, 0, 0, 0, 0, {NULL, 0, {0}}};
 
 /* strncpy is not assured to copy the final \0, so we
  * will use our own one that does
@@ -291,10 +291,13 @@ DLLEXPORT libtrace_t *trace_create(const char *uri) {
 	libtrace->filter = NULL;
 	libtrace->snaplen = 0;
 	libtrace->replayspeedup = 1;
+	libtrace->eager_parse = false;
 	libtrace->started=false;
 	libtrace->startcount=0;
 	libtrace->uridata = NULL;
 	libtrace->io = NULL;
+	libtrace->seekindex = NULL;
+	libtrace->interfaces = NULL;
 	libtrace->filtered_packets = 0;
 	libtrace->accepted_packets = 0;
 	libtrace->last_packet = NULL;
@@ -312,10 +315,17 @@ DLLEXPORT libtrace_t *trace_create(const char *uri) {
 	libtrace_zero_ocache(&libtrace->packet_freelist);
 	libtrace_zero_thread(&libtrace->hasher_thread);
 	libtrace_zero_thread(&libtrace->reporter_thread);
-	libtrace_zero_thread(&libtrace->keepalive_thread);
+	libtrace->timer_base = 0;
+	libtrace->timer_base_tv.tv_sec = 0;
+	libtrace->timer_base_tv.tv_usec = 0;
 	libtrace->reporter_thread.type = THREAD_EMPTY;
 	libtrace->perpkt_thread_count = 0;
 	libtrace->perpkt_threads = NULL;
+	libtrace->perpkt_stats = NULL;
+	libtrace->latency = NULL;
+	libtrace->result_pool = NULL;
+	libtrace->reporter_posted = 0;
+	libtrace->result_batch_count = 0;
 	libtrace->tracetime = 0;
 	libtrace->first_packets.first = 0;
 	libtrace->first_packets.count = 0;
@@ -439,10 +449,13 @@ DLLEXPORT libtrace_t * trace_create_dead (const char *uri) {
         libtrace->event.first_now = 0;
 	libtrace->filter = NULL;
 	libtrace->snaplen = 0;
+	libtrace->eager_parse = false;
 	libtrace->started=false;
 	libtrace->startcount = 0;
 	libtrace->uridata = NULL;
 	libtrace->io = NULL;
+	libtrace->seekindex = NULL;
+	libtrace->interfaces = NULL;
 	libtrace->filtered_packets = 0;
 	libtrace->accepted_packets = 0;
 	libtrace->last_packet = NULL;
@@ -458,10 +471,17 @@ DLLEXPORT libtrace_t * trace_create_dead (const char *uri) {
 	libtrace_zero_ocache(&libtrace->packet_freelist);
 	libtrace_zero_thread(&libtrace->hasher_thread);
 	libtrace_zero_thread(&libtrace->reporter_thread);
-	libtrace_zero_thread(&libtrace->keepalive_thread);
+	libtrace->timer_base = 0;
+	libtrace->timer_base_tv.tv_sec = 0;
+	libtrace->timer_base_tv.tv_usec = 0;
 	libtrace->reporter_thread.type = THREAD_EMPTY;
 	libtrace->perpkt_thread_count = 0;
 	libtrace->perpkt_threads = NULL;
+	libtrace->perpkt_stats = NULL;
+	libtrace->latency = NULL;
+	libtrace->result_pool = NULL;
+	libtrace->reporter_posted = 0;
+	libtrace->result_batch_count = 0;
 	libtrace->tracetime = 0;
 	libtrace->stats = NULL;
 	libtrace->pread = NULL;
@@ -513,6 +533,7 @@ DLLEXPORT libtrace_out_t *trace_create_output(const char *uri) {
 	strcpy(libtrace->err.problem,"Error message set\n");
         libtrace->format = NULL;
 	libtrace->uridata = NULL;
+	libtrace->compress_blocksize = 0;
 
         /* Parse the URI to determine what capture format we want to write */
 
@@ -762,6 +783,20 @@ DLLEXPORT int trace_config(libtrace_t *libtrace,
 							"Libtrace does not support installing XDP program in SKB (generic) mode");
 			}
 			return -1;
+		case TRACE_OPTION_SEEK_INDEX_INTERVAL:
+		case TRACE_OPTION_SEEK_INDEX_FILE:
+			/* Clear the error if there was one */
+			if (trace_is_err(libtrace)) {
+				trace_get_err(libtrace);
+			}
+			return trace_seek_index_config(libtrace, option, value);
+		case TRACE_OPTION_EAGER_PARSE:
+			/* Clear the error if there was one */
+			if (trace_is_err(libtrace)) {
+				trace_get_err(libtrace);
+			}
+			libtrace->eager_parse = (*(int *)value != 0);
+			return 0;
 	}
 	if (!trace_is_err(libtrace)) {
 		trace_set_err(libtrace,TRACE_ERR_UNKNOWN_OPTION,
@@ -792,13 +827,49 @@ DLLEXPORT int trace_set_event_realtime(libtrace_t *trace, bool realtime) {
 	return trace_config(trace, TRACE_OPTION_EVENT_REALTIME, &tmp);
 }
 
+DLLEXPORT int trace_set_seek_index_interval(libtrace_t *trace, int msec) {
+	return trace_config(trace, TRACE_OPTION_SEEK_INDEX_INTERVAL, &msec);
+}
+
+DLLEXPORT int trace_set_seek_index_file(libtrace_t *trace,
+		const char *filename) {
+	return trace_config(trace, TRACE_OPTION_SEEK_INDEX_FILE,
+			(void *)filename);
+}
+
+DLLEXPORT int trace_set_eager_parse(libtrace_t *trace, bool eager) {
+	int tmp = eager;
+	return trace_config(trace, TRACE_OPTION_EAGER_PARSE, &tmp);
+}
+
 DLLEXPORT int trace_config_output(libtrace_out_t *libtrace, 
 		trace_option_output_t option,
 		void *value) {
 
-	/* Unlike the input options, libtrace does not natively support any of
-	 * the output options - the format module must be able to deal with
-	 * them. */
+	/* Block compression is applied when the output file is opened, so
+	 * libtrace handles it for every format that writes to a file */
+	if (option == TRACE_OPTION_OUTPUT_COMPRESS_BLOCKSIZE) {
+		int blocksize = *(int *)value;
+#ifdef HAVE_LIBZ
+		if (blocksize < 0 || blocksize > BGZF_MAX_DATA_LEN) {
+			trace_set_err_out(libtrace, TRACE_ERR_UNSUPPORTED_COMPRESS,
+				"Compression block size %d is invalid, must be between 0 and %d inclusive",
+				blocksize, BGZF_MAX_DATA_LEN);
+			return -1;
+		}
+		libtrace->compress_blocksize = blocksize;
+		return 0;
+#else
+		if (blocksize == 0)
+			return 0;
+		trace_set_err_out(libtrace, TRACE_ERR_UNSUPPORTED_COMPRESS,
+			"Block compression requires libtrace to be built with zlib");
+		return -1;
+#endif
+	}
+
+	/* Otherwise, libtrace does not natively support any of the output
+	 * options - the format module must be able to deal with them. */
 	if (libtrace->format->config_output) {
 		return libtrace->format->config_output(libtrace, option, value);
 	}
@@ -851,6 +922,9 @@ DLLEXPORT void trace_destroy(libtrace_t *libtrace) {
 	if (libtrace->stats)
 		free(libtrace->stats);
 
+	trace_seek_index_destroy(libtrace);
+	trace_destroy_interface_meta(libtrace);
+
 	/* Empty any packet memory */
 	if (libtrace->state != STATE_NEW) {
 		// This has all of our packets
@@ -860,8 +934,6 @@ DLLEXPORT void trace_destroy(libtrace_t *libtrace) {
 		}
 		if (libtrace->hasher_thread.type == THREAD_HASHER)
 			libtrace_message_queue_destroy(&libtrace->hasher_thread.messages);
-		if (libtrace->keepalive_thread.type == THREAD_KEEPALIVE)
-			libtrace_message_queue_destroy(&libtrace->keepalive_thread.messages);
 		if (libtrace->reporter_thread.type == THREAD_REPORTER)
 			libtrace_message_queue_destroy(&libtrace->reporter_thread.messages);
 
@@ -870,6 +942,12 @@ DLLEXPORT void trace_destroy(libtrace_t *libtrace) {
 			libtrace->combiner.destroy(libtrace, &libtrace->combiner);
 		free(libtrace->perpkt_threads);
 		libtrace->perpkt_threads = NULL;
+		thread_stats_destroy(libtrace->perpkt_stats);
+		libtrace->perpkt_stats = NULL;
+		latency_set_destroy(libtrace->latency);
+		libtrace->latency = NULL;
+		result_pool_destroy(libtrace->result_pool);
+		libtrace->result_pool = NULL;
 		libtrace->perpkt_thread_count = 0;
 
 	}
@@ -934,8 +1012,12 @@ DLLEXPORT void trace_destroy_output(libtrace_out_t *libtrace) {
 		fprintf(stderr, "NULL trace passed to trace_destroy_output()\n");
 		return;
 	}
-	if (libtrace->format && libtrace->format->fin_output)
-		libtrace->format->fin_output(libtrace);
+	/* There is no-one to hand an error back to, so at least make sure
+	 * that data lost while closing doesn't go unnoticed */
+	if (libtrace->format && libtrace->format->fin_output &&
+			libtrace->format->fin_output(libtrace) == -1 &&
+			trace_is_err_output(libtrace))
+		trace_perror_output(libtrace, "Closing output trace");
 	if (libtrace->uridata)
 		free(libtrace->uridata);
 	free(libtrace);
@@ -981,7 +1063,11 @@ DLLEXPORT libtrace_packet_t *trace_copy_packet(const libtrace_packet_t *packet)
 		abort();
 	}
 	dest->trace=packet->trace;
-	dest->buffer=malloc(65536);
+	/* Always allocate a full sized buffer here, as the copy may end up
+	 * being reused to read packets from a format module (e.g. the packet
+	 * freelist in a parallel trace). trace_copy_packet_into() is the
+	 * place to go for right-sized buffers. */
+	dest->buffer=malloc(LIBTRACE_PACKET_BUFSIZE);
 	if (!dest->buffer) {
 		printf("Out of memory allocating buffer memory\n");
 		abort();
@@ -1007,6 +1093,126 @@ DLLEXPORT libtrace_packet_t *trace_copy_packet(const libtrace_packet_t *packet)
 	return dest;
 }
 
+DLLEXPORT int trace_copy_packet_into(libtrace_packet_t *dest,
+		const libtrace_packet_t *packet) {
+	size_t framing, caplen, capacity;
+
+	if (packet->which_trace_start != packet->trace->startcount) {
+		return -1;
+	}
+
+	framing = trace_get_framing_length(packet);
+	caplen = trace_get_capture_length(packet);
+
+	/* Release anything the format module is holding for the packet we
+	 * are about to overwrite */
+	if (dest->trace)
+		trace_fin_packet(dest);
+
+	if (dest->buf_control != TRACE_CTRL_PACKET) {
+		dest->buffer = NULL;
+		dest->buf_size = 0;
+	}
+	capacity = dest->buf_size ? dest->buf_size : LIBTRACE_PACKET_BUFSIZE;
+
+	if (!dest->buffer || capacity < framing + caplen) {
+		free(dest->buffer);
+		dest->buffer = malloc(framing + caplen);
+		if (!dest->buffer) {
+			printf("Out of memory allocating buffer memory\n");
+			abort();
+		}
+		dest->buf_size = framing + caplen;
+	}
+
+	dest->trace = packet->trace;
+	dest->buf_control = TRACE_CTRL_PACKET;
+	dest->header = dest->buffer;
+	dest->payload = (void*)((char*)dest->buffer + framing);
+	dest->type = packet->type;
+	dest->order = packet->order;
+	dest->hash = packet->hash;
+	dest->error = packet->error;
+	dest->which_trace_start = packet->which_trace_start;
+	trace_clear_cache(dest);
+	memcpy(dest->header, packet->header, framing);
+	memcpy(dest->payload, packet->payload, caplen);
+
+	return 0;
+}
+
+DLLEXPORT libtrace_packet_pool_t *trace_create_packet_pool(size_t size) {
+	libtrace_packet_pool_t *pool;
+
+	if (size == 0)
+		return NULL;
+
+	pool = (libtrace_packet_pool_t *)malloc(sizeof(libtrace_packet_pool_t));
+	if (!pool)
+		return NULL;
+
+	pool->packets = (libtrace_packet_t **)malloc(
+			sizeof(libtrace_packet_t *) * size);
+	if (!pool->packets) {
+		free(pool);
+		return NULL;
+	}
+	pool->size = size;
+	pool->count = 0;
+	pthread_spin_init(&pool->lock, 0);
+	return pool;
+}
+
+DLLEXPORT libtrace_packet_t *trace_packet_pool_copy(
+		libtrace_packet_pool_t *pool, const libtrace_packet_t *packet) {
+	libtrace_packet_t *dest = NULL;
+
+	if (packet->which_trace_start != packet->trace->startcount) {
+		return NULL;
+	}
+
+	pthread_spin_lock(&pool->lock);
+	if (pool->count > 0)
+		dest = pool->packets[--pool->count];
+	pthread_spin_unlock(&pool->lock);
+
+	if (!dest) {
+		dest = trace_create_packet();
+		if (!dest) {
+			printf("Out of memory constructing packet\n");
+			abort();
+		}
+	}
+	trace_copy_packet_into(dest, packet);
+	return dest;
+}
+
+DLLEXPORT void trace_packet_pool_release(libtrace_packet_pool_t *pool,
+		libtrace_packet_t *packet) {
+	trace_fin_packet(packet);
+
+	pthread_spin_lock(&pool->lock);
+	if (pool->count < pool->size) {
+		pool->packets[pool->count++] = packet;
+		packet = NULL;
+	}
+	pthread_spin_unlock(&pool->lock);
+
+	/* The pool is full, so get rid of it properly */
+	if (packet)
+		trace_destroy_packet(packet);
+}
+
+DLLEXPORT void trace_destroy_packet_pool(libtrace_packet_pool_t *pool) {
+	size_t i;
+
+	for (i = 0; i < pool->count; i++)
+		trace_destroy_packet(pool->packets[i]);
+	pthread_spin_destroy(&pool->lock);
+	free(pool->packets);
+	free(pool);
+}
+
 /** Destroy a packet object
  */
 DLLEXPORT void trace_destroy_packet(libtrace_packet_t *packet) {
@@ -1110,15 +1316,22 @@ DLLEXPORT int trace_read_packet(libtrace_t *libtrace, libtrace_packet_t *packet)
                 if (packet->trace == libtrace) {
                         trace_fin_packet(packet);
                 }
+		trace_release_small_buffer(packet);
 		do {
 			size_t ret;
 			int filtret;
+			int64_t offset = -1;
 			if ((ret=is_halted(libtrace)) != (size_t)-1)
 				return ret;
 			/* Store the trace we are reading from into the packet opaque 
 			 * structure */
 			packet->trace = libtrace;
                         packet->which_trace_start = libtrace->startcount;
+			/* Remember where this packet starts if it is due to
+			 * be added to the seek index */
+			if (libtrace->seekindex && libtrace->io &&
+					trace_seek_index_due(libtrace))
+				offset = wandio_tell(libtrace->io);
 			ret=libtrace->format->read_packet(libtrace,packet);
 			if (ret==(size_t)READ_MESSAGE) {
 				continue;
@@ -1127,6 +1340,8 @@ DLLEXPORT int trace_read_packet(libtrace_t *libtrace, libtrace_packet_t *packet)
                                 packet->trace = NULL;
 				return ret;
 			}
+			if (libtrace->seekindex && libtrace->io)
+				trace_seek_index_update(libtrace, packet, offset);
                         if (libtrace->filter) {
 				/* If the filter doesn't match, read another
 				 * packet
@@ -1150,6 +1365,8 @@ DLLEXPORT int trace_read_packet(libtrace_t *libtrace, libtrace_packet_t *packet)
 			}
                         if (!IS_LIBTRACE_META_PACKET(packet)) {
         			++libtrace->accepted_packets;
+				if (libtrace->eager_parse)
+					trace_parse_packet(packet);
                         }
                         if (packet->order == 0) {
         			trace_packet_set_order(packet, libtrace->sequence_number);
@@ -1205,6 +1422,9 @@ int trace_prepare_packet(libtrace_t *trace, libtrace_packet_t *packet,
 		return -1;
 	}
 
+	if (packet->buffer != buffer)
+		trace_release_small_buffer(packet);
+
 	packet->trace = trace;
 	if (!libtrace_parallel)
 	        trace->last_packet = packet;
@@ -1594,6 +1814,7 @@ DLLEXPORT libtrace_eventobj_t trace_event(libtrace_t *trace,
 
 	/* Free the last packet */
 	trace_fin_packet(packet);
+	trace_release_small_buffer(packet);
 	/* Store the trace we are reading from into the packet opaque
 	 * structure */
 	packet->trace = trace;
@@ -1682,16 +1903,19 @@ DLLEXPORT void trace_destroy_filter(libtrace_filter_t *filter)
  *
  * @returns -1 on error, 0 on success
  */
+#ifdef HAVE_BPF
+/* It just so happens that the underlying libs used by pthread arn't
+ * thread safe, namely lex/flex thingys, so single threaded compile
+ * multi threaded running should be safe.
+ */
+static pthread_mutex_t compile_mutex = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
 static int trace_bpf_compile(libtrace_filter_t *filter,
 		const libtrace_packet_t *packet,
 		void *linkptr,
 		libtrace_linktype_t linktype	) {
 #ifdef HAVE_BPF
-	/* It just so happens that the underlying libs used by pthread arn't
-	 * thread safe, namely lex/flex thingys, so single threaded compile
-	 * multi threaded running should be safe.
-	 */
-	static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
 
 	if (!packet) {
 		fprintf(stderr, "NULL packet passed into trace_bpf_compile()");
@@ -1724,10 +1948,10 @@ static int trace_bpf_compile(libtrace_filter_t *filter,
 					"Unknown pcap equivalent linktype");
 			return -1;
 		}
-		pthread_mutex_lock(&mutex);
+		pthread_mutex_lock(&compile_mutex);
 		/* Make sure not one bet us to this */
 		if (filter->flag) {
-			pthread_mutex_unlock(&mutex);
+			pthread_mutex_unlock(&compile_mutex);
 			return 0;
 		}
 		pcap=(pcap_t *)pcap_open_dead(
@@ -1746,12 +1970,12 @@ static int trace_bpf_compile(libtrace_filter_t *filter,
 					filter->filterstring,
 					pcap_geterr(pcap));
 			pcap_close(pcap);
-			pthread_mutex_unlock(&mutex);
+			pthread_mutex_unlock(&compile_mutex);
 			return -1;
 		}
 		pcap_close(pcap);
 		filter->flag=1;
-		pthread_mutex_unlock(&mutex);
+		pthread_mutex_unlock(&compile_mutex);
 	}
 	return 0;
 #else
@@ -1761,38 +1985,33 @@ static int trace_bpf_compile(libtrace_filter_t *filter,
 #endif
 }
 
-DLLEXPORT int trace_apply_filter(libtrace_filter_t *filter,
-			const libtrace_packet_t *packet) {
 #ifdef HAVE_BPF
-	void *linkptr = 0;
-	uint32_t clen = 0;
-	bool free_packet_needed = false;
-	int ret;
-	libtrace_linktype_t linktype;
+/* Finds the start of the link layer that BPF filters should be run against.
+ *
+ * If pcap has no equivalent for the link type of the packet, a copy of the
+ * packet is demoted until it does. *copy is set to the packet that the
+ * returned pointers refer to, which must be destroyed by the caller if it is
+ * not the original packet.
+ *
+ * @returns 1 if the packet should match every filter, 0 if *linkptr is set
+ * (it may be NULL if there is nothing to filter) and -1 on error
+ */
+static int find_filter_link(const libtrace_packet_t *packet,
+		libtrace_packet_t **copy, void **linkptr, uint32_t *clen,
+		libtrace_linktype_t *linktype) {
 	libtrace_packet_t *packet_copy = (libtrace_packet_t*)packet;
-#ifdef HAVE_LLVM
-	static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
-#endif
 
-	if (!packet) {
-		fprintf(stderr, "NULL packet passed into trace_apply_filter()\n");
-		return TRACE_ERR_NULL_PACKET;
-	}
-	if (!filter) {
-		trace_set_err(packet->trace, TRACE_ERR_NULL_FILTER,
-			"NULL filter passed into trace_apply_filter()");
-		return -1;
-	}
+	*copy = packet_copy;
 
 	/* Match all non-data packets as we probably want them to pass
 	 * through to the caller */
-	linktype = trace_get_link_type(packet);
+	*linktype = trace_get_link_type(packet);
 
-	if (linktype == TRACE_TYPE_NONDATA || linktype == TRACE_TYPE_ERF_META
-		|| linktype == TRACE_TYPE_PCAPNG_META)
+	if (*linktype == TRACE_TYPE_NONDATA || *linktype == TRACE_TYPE_ERF_META
+		|| *linktype == TRACE_TYPE_PCAPNG_META)
 		return 1;
 
-	if (libtrace_to_pcap_dlt(linktype)==TRACE_DLT_ERROR) {
+	if (libtrace_to_pcap_dlt(*linktype)==TRACE_DLT_ERROR) {
 
 		/* If we cannot get a suitable DLT for the packet, it may
 		 * be because the packet is encapsulated in a link type that
@@ -1802,30 +2021,67 @@ DLLEXPORT int trace_apply_filter(libtrace_filter_t *filter,
 
 		/* Copy the packet, as we don't want to trash the one we
 		 * were passed in */
-		packet_copy=trace_copy_packet(packet);
+		packet_copy=trace_create_packet();
+                if (packet_copy != NULL &&
+                                trace_copy_packet_into(packet_copy, packet) < 0) {
+                        trace_destroy_packet(packet_copy);
+                        packet_copy = NULL;
+                }
                 if (packet_copy == NULL) {
                         trace_set_err(packet->trace, TRACE_ERR_NO_CONVERSION,
                                         "failed to demote packet within trace_apply_filter()");
                         return -1;
                 }
-		free_packet_needed=true;
+		*copy = packet_copy;
 
-		while (libtrace_to_pcap_dlt(linktype) == TRACE_DLT_ERROR) {
+		while (libtrace_to_pcap_dlt(*linktype) == TRACE_DLT_ERROR) {
 			if (!demote_packet(packet_copy)) {
 				trace_set_err(packet->trace,
 						TRACE_ERR_NO_CONVERSION,
 						"pcap does not support this linktype so cannot apply BPF filters");
-				if (free_packet_needed) {
-					trace_destroy_packet(packet_copy);
-				}
+				trace_destroy_packet(packet_copy);
+				*copy = NULL;
 				return -1;
 			}
-			linktype = trace_get_link_type(packet_copy);
+			*linktype = trace_get_link_type(packet_copy);
 		}
 
 	}
 
-	linkptr = trace_get_packet_buffer(packet_copy,NULL,&clen);
+	*linkptr = trace_get_packet_buffer(packet_copy,NULL,clen);
+	return 0;
+}
+#endif
+
+DLLEXPORT int trace_apply_filter(libtrace_filter_t *filter,
+			const libtrace_packet_t *packet) {
+#ifdef HAVE_BPF
+	void *linkptr = 0;
+	uint32_t clen = 0;
+	bool free_packet_needed = false;
+	int ret;
+	libtrace_linktype_t linktype;
+	libtrace_packet_t *packet_copy = NULL;
+#ifdef HAVE_LLVM
+	static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+	if (!packet) {
+		fprintf(stderr, "NULL packet passed into trace_apply_filter()\n");
+		return TRACE_ERR_NULL_PACKET;
+	}
+	if (!filter) {
+		trace_set_err(packet->trace, TRACE_ERR_NULL_FILTER,
+			"NULL filter passed into trace_apply_filter()");
+		return -1;
+	}
+
+	ret = find_filter_link(packet, &packet_copy, &linkptr, &clen,
+			&linktype);
+	if (ret != 0)
+		return ret;
+	free_packet_needed = (packet_copy != packet);
+
 	if (!linkptr) {
 		if (free_packet_needed) {
 			trace_destroy_packet(packet_copy);
@@ -1881,6 +2137,261 @@ DLLEXPORT int trace_apply_filter(libtrace_filter_t *filter,
 #endif
 }
 
+DLLEXPORT libtrace_filter_set_t *trace_create_filter_set(void) {
+#ifdef HAVE_BPF
+	return (libtrace_filter_set_t *)calloc(1,
+			sizeof(libtrace_filter_set_t));
+#else
+	fprintf(stderr,"This version of libtrace does not have bpf filter support\n");
+	return NULL;
+#endif
+}
+
+DLLEXPORT int trace_filter_set_add(libtrace_filter_set_t *set,
+		const char *filterstring) {
+#ifdef HAVE_BPF
+	if (!set || !filterstring) {
+		fprintf(stderr, "NULL set or filter string passed into trace_filter_set_add()\n");
+		return -1;
+	}
+	if (set->compiled) {
+		fprintf(stderr, "Filters cannot be added to a filter set once it has been applied\n");
+		return -1;
+	}
+
+	if (set->count == set->allocated) {
+		int allocated = set->allocated ? set->allocated * 2 : 8;
+		char **strings = (char **)realloc(set->filterstrings,
+				allocated * sizeof(char *));
+		if (!strings)
+			return -1;
+		set->filterstrings = strings;
+		set->allocated = allocated;
+	}
+	set->filterstrings[set->count] = strdup(filterstring);
+	if (!set->filterstrings[set->count])
+		return -1;
+	return set->count++;
+#else
+	fprintf(stderr,"This version of libtrace does not have bpf filter support\n");
+	return -1;
+#endif
+}
+
+DLLEXPORT int trace_filter_set_count(const libtrace_filter_set_t *set) {
+#ifdef HAVE_BPF
+	if (!set)
+		return 0;
+	return set->count;
+#else
+	return 0;
+#endif
+}
+
+#ifdef HAVE_BPF
+/* Compiles every filter in a set for the given link type, merging filters
+ * that produce identical BPF programs so that they only need to be run once.
+ *
+ * @internal
+ *
+ * @returns -1 if any of the filters failed to compile, 0 otherwise
+ */
+static int trace_bpf_compile_set(libtrace_filter_set_t *set,
+		const libtrace_packet_t *packet,
+		libtrace_linktype_t linktype) {
+	struct bpf_program prog;
+	pcap_t *pcap;
+	int ret = 0;
+	int i, j;
+
+	pthread_mutex_lock(&compile_mutex);
+	/* Someone else may have compiled the set while we were waiting */
+	if (set->compiled) {
+		pthread_mutex_unlock(&compile_mutex);
+		return 0;
+	}
+
+	/* Anything left over from an earlier failed attempt */
+	set->failed = 0;
+	free(set->program);
+	free(set->programs);
+	free(set->jitprograms);
+	free(set->members);
+
+	set->words = (set->count + 63) / 64;
+	set->program = (int *)calloc(set->count ? set->count : 1, sizeof(int));
+	set->programs = (struct bpf_program *)calloc(
+			set->count ? set->count : 1,
+			sizeof(struct bpf_program));
+	set->jitprograms = (struct bpf_jit_t **)calloc(
+			set->count ? set->count : 1,
+			sizeof(struct bpf_jit_t *));
+	set->members = (uint64_t *)calloc(
+			set->count ? set->count * set->words : 1,
+			sizeof(uint64_t));
+	if (!set->program || !set->programs || !set->jitprograms ||
+			!set->members) {
+		pthread_mutex_unlock(&compile_mutex);
+		trace_set_err(packet->trace, TRACE_ERR_OUT_OF_MEMORY,
+			"Unable to allocate memory for filter set");
+		return -1;
+	}
+
+	pcap = (pcap_t *)pcap_open_dead(
+			(int)libtrace_to_pcap_dlt(linktype), 1500U);
+	if (!pcap) {
+		pthread_mutex_unlock(&compile_mutex);
+		trace_set_err(packet->trace, TRACE_ERR_BAD_FILTER,
+			"Unable to open pcap_t to compile the filter set");
+		return -1;
+	}
+
+	for (i = 0; i < set->count; i++) {
+		if (pcap_compile(pcap, &prog, set->filterstrings[i], 1, 0)) {
+			trace_set_err(packet->trace, TRACE_ERR_BAD_FILTER,
+				"Unable to compile the filter \"%s\": %s",
+				set->filterstrings[i], pcap_geterr(pcap));
+			set->program[i] = -1;
+			set->failed = 1;
+			ret = -1;
+			continue;
+		}
+
+		/* Filters that are written differently often end up as the
+		 * same program, in which case it only needs running once */
+		for (j = 0; j < set->nprograms; j++) {
+			if (set->programs[j].bf_len == prog.bf_len &&
+					memcmp(set->programs[j].bf_insns,
+						prog.bf_insns, prog.bf_len *
+						sizeof(struct bpf_insn)) == 0)
+				break;
+		}
+		if (j < set->nprograms) {
+			pcap_freecode(&prog);
+		} else {
+			set->programs[j] = prog;
+#ifdef HAVE_LLVM
+			set->jitprograms[j] = compile_program(prog.bf_insns,
+					prog.bf_len);
+#endif
+			set->nprograms ++;
+		}
+		set->program[i] = j;
+		set->members[j * set->words + i / 64] |= 1ULL << (i % 64);
+	}
+	pcap_close(pcap);
+
+	__atomic_store_n(&set->compiled, 1, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&compile_mutex);
+	return ret;
+}
+#endif
+
+DLLEXPORT int trace_apply_filter_set(libtrace_filter_set_t *set,
+		const libtrace_packet_t *packet, uint64_t *matches) {
+#ifdef HAVE_BPF
+	void *linkptr = 0;
+	uint32_t clen = 0;
+	libtrace_linktype_t linktype;
+	libtrace_packet_t *packet_copy = NULL;
+	int words = (set ? set->count + 63 : 0) / 64;
+	int matched = 0;
+	int err = 0;
+	int ret;
+	int i, w;
+
+	if (!packet) {
+		fprintf(stderr, "NULL packet passed into trace_apply_filter_set()\n");
+		return TRACE_ERR_NULL_PACKET;
+	}
+	if (!set || !matches) {
+		trace_set_err(packet->trace, TRACE_ERR_NULL_FILTER,
+			"NULL filter set passed into trace_apply_filter_set()");
+		return -1;
+	}
+
+	memset(matches, 0, words * sizeof(uint64_t));
+
+	ret = find_filter_link(packet, &packet_copy, &linkptr, &clen,
+			&linktype);
+	if (ret == -1)
+		return -1;
+	if (ret == 1) {
+		for (i = 0; i < set->count; i++)
+			matches[i / 64] |= 1ULL << (i % 64);
+		return set->count;
+	}
+
+	if (!linkptr)
+		goto done;
+
+	if (!__atomic_load_n(&set->compiled, __ATOMIC_ACQUIRE)) {
+		err = trace_bpf_compile_set(set, packet_copy, linktype);
+		if (!set->compiled)
+			goto done;
+	}
+	/* A filter that failed to compile is an error every time the set is
+	 * applied, not just the first. The trace is only told once, as an
+	 * error left on it would stop it being read. */
+	if (set->failed)
+		err = -1;
+
+	for (i = 0; i < set->nprograms; i++) {
+#if HAVE_LLVM
+		ret = set->jitprograms[i]->bpf_run((unsigned char *)linkptr,
+				clen);
+#else
+		ret = bpf_filter(set->programs[i].bf_insns, (u_char*)linkptr,
+				(unsigned int)clen, (unsigned int)clen);
+#endif
+		if (ret == 0)
+			continue;
+		for (w = 0; w < words; w++)
+			matches[w] |= set->members[i * words + w];
+	}
+
+	for (w = 0; w < words; w++) {
+		uint64_t bits = matches[w];
+		while (bits) {
+			bits &= bits - 1;
+			matched ++;
+		}
+	}
+
+done:
+	if (packet_copy != packet)
+		trace_destroy_packet(packet_copy);
+	return err ? -1 : matched;
+#else
+	fprintf(stderr,"This version of libtrace does not have bpf filter support\n");
+	return 0;
+#endif
+}
+
+DLLEXPORT void trace_destroy_filter_set(libtrace_filter_set_t *set) {
+#ifdef HAVE_BPF
+	int i;
+
+	if (!set)
+		return;
+	for (i = 0; i < set->count; i++)
+		free(set->filterstrings[i]);
+	for (i = 0; i < set->nprograms; i++) {
+		pcap_freecode(&set->programs[i]);
+#ifdef HAVE_LLVM
+		if (set->jitprograms[i])
+			destroy_program(set->jitprograms[i]);
+#endif
+	}
+	free(set->filterstrings);
+	free(set->program);
+	free(set->programs);
+	free(set->jitprograms);
+	free(set->members);
+	free(set);
+#endif
+}
+
 /* Set the direction flag, if it has one
  * @param packet the packet opaque pointer
  * @param direction the new direction (0,1,2,3)
@@ -2271,6 +2782,9 @@ DLLEXPORT int trace_seek_erf_timestamp(libtrace_t *trace, uint64_t ts)
 				(ts>>32) + ((ts & UINT_MAX)*1.0 / UINT_MAX);
 			return trace->format->seek_seconds(trace,seconds);
 		}
+		if (trace->seekindex) {
+			return trace_seek_index_erf(trace, ts);
+		}
 		trace_set_err(trace,
 				TRACE_ERR_OPTION_UNAVAIL,
 				"Feature unimplemented");
@@ -2290,11 +2804,11 @@ DLLEXPORT int trace_seek_seconds(libtrace_t *trace, double seconds)
 			tv.tv_usec = (uint32_t)(((seconds - tv.tv_sec) * 1000000)/UINT_MAX);
 			return trace->format->seek_timeval(trace,tv);
 		}
-		if (trace->format->seek_erf) {
+		if (trace->format->seek_erf || trace->seekindex) {
 			uint64_t timestamp =
 				((uint64_t)((uint32_t)seconds) << 32) + \
 			    (uint64_t)(( seconds - (uint32_t)seconds   ) * UINT_MAX);
-			return trace->format->seek_erf(trace,timestamp);
+			return trace_seek_erf_timestamp(trace,timestamp);
 		}
 		trace_set_err(trace,
 				TRACE_ERR_OPTION_UNAVAIL,
@@ -2309,10 +2823,10 @@ DLLEXPORT int trace_seek_timeval(libtrace_t *trace, struct timeval tv)
 		return trace->format->seek_timeval(trace,tv);
 	}
 	else {
-		if (trace->format->seek_erf) {
+		if (trace->format->seek_erf || trace->seekindex) {
 			uint64_t timestamp = ((((uint64_t)tv.tv_sec) << 32) + \
 				(((uint64_t)tv.tv_usec * UINT_MAX)/1000000));
-			return trace->format->seek_erf(trace,timestamp);
+			return trace_seek_erf_timestamp(trace,timestamp);
 		}
 		if (trace->format->seek_seconds) {
 			double seconds = tv.tv_sec + ((tv.tv_usec * 1.0)/1000000);
@@ -2354,6 +2868,61 @@ DLLEXPORT uint8_t *trace_ether_aton(const char *buf, uint8_t *addr)
 }
 
 
+/* The dead PCAP trace that constructed packets are attached to */
+static libtrace_t *deadtrace = NULL;
+static pthread_once_t deadtrace_once = PTHREAD_ONCE_INIT;
+
+static void create_deadtrace(void) {
+	deadtrace = trace_create_dead("pcapfile");
+}
+
+/* Turns a packet into a PCAP packet with room for len bytes of contents,
+ * which the caller fills in. Used by trace_construct_packet() and to build
+ * reassembled datagrams.
+ */
+void *trace_construct_packet_buffer(libtrace_packet_t *packet,
+		libtrace_linktype_t linktype, uint32_t len, struct timeval tv) {
+
+	size_t size;
+	libtrace_pcapfile_pkt_hdr_t hdr;
+
+	/* We need a trace to attach the constructed packet to (and it needs
+	 * to be PCAP) */
+	pthread_once(&deadtrace_once, create_deadtrace);
+	if (!deadtrace) {
+		fprintf(stderr, "Unable to create dummy trace for use within trace_construct_packet()\n");
+		return NULL;
+	}
+
+	/* Fill in the new PCAP header */
+	hdr.ts_sec=tv.tv_sec;
+	hdr.ts_usec=tv.tv_usec;
+	hdr.caplen=len;
+	hdr.wirelen=len;
+
+	/* Now fill in the libtrace packet itself */
+	packet->trace=deadtrace;
+	packet->which_trace_start=deadtrace->startcount;
+	size=len+sizeof(hdr);
+        if (size < LIBTRACE_PACKET_BUFSIZE)
+            size = LIBTRACE_PACKET_BUFSIZE;
+	if (packet->buf_control==TRACE_CTRL_PACKET) {
+            packet->buffer = realloc(packet->buffer, size);
+	}
+	else {
+		packet->buffer = malloc(size);
+	}
+	packet->buf_control=TRACE_CTRL_PACKET;
+	packet->buf_size = 0;
+	packet->header=packet->buffer;
+	packet->payload=(void*)((char*)packet->buffer+sizeof(hdr));
+	memcpy(packet->header, &hdr, sizeof(hdr));
+	packet->type=pcap_linktype_to_rt(libtrace_to_pcap_linktype(linktype));
+
+	trace_clear_cache(packet);
+	return packet->payload;
+}
+
 /* Creates a libtrace packet from scratch using the contents of the provided
  * buffer as the packet payload.
  *
@@ -2369,6 +2938,12 @@ void trace_construct_packet(libtrace_packet_t *packet,
 		const void *data,
 		uint16_t len) {
 
+	struct timeval tv;
+#ifdef WIN32
+	struct _timeb tstruct;
+#endif
+	void *payload;
+
 	if (!packet) {
                 fprintf(stderr, "NULL packet passed into trace_contruct_packet()\n");
                 return;
@@ -2379,65 +2954,26 @@ void trace_construct_packet(libtrace_packet_t *packet,
                 return;
         }
 
-	size_t size;
-	static libtrace_t *deadtrace=NULL;
-	libtrace_pcapfile_pkt_hdr_t hdr;
-#ifdef WIN32
-	struct _timeb tstruct;
-#else
-	struct timeval tv;
-#endif
-
-	/* We need a trace to attach the constructed packet to (and it needs
-	 * to be PCAP) */
-	if (NULL == deadtrace)
-		deadtrace=trace_create_dead("pcapfile");
-
-	/* Fill in the new PCAP header */
 #ifdef WIN32
 	_ftime(&tstruct);
-	hdr.ts_sec=tstruct.time;
-	hdr.ts_usec=tstruct.millitm * 1000;
+	tv.tv_sec=tstruct.time;
+	tv.tv_usec=tstruct.millitm * 1000;
 #else
 	gettimeofday(&tv,NULL);
-	hdr.ts_sec=tv.tv_sec;
-	hdr.ts_usec=tv.tv_usec;
 #endif
 
-	hdr.caplen=len;
-	hdr.wirelen=len;
-
-	/* Now fill in the libtrace packet itself */
-	if (!deadtrace) {
-		fprintf(stderr, "Unable to create dummy trace for use within trace_construct_packet()\n");
+	payload = trace_construct_packet_buffer(packet, linktype, len, tv);
+	if (!payload)
 		return;
-	}
-	packet->trace=deadtrace;
-	size=len+sizeof(hdr);
-        if (size < LIBTRACE_PACKET_BUFSIZE)
-            size = LIBTRACE_PACKET_BUFSIZE;
-	if (packet->buf_control==TRACE_CTRL_PACKET) {
-            packet->buffer = realloc(packet->buffer, size);
-	}
-	else {
-		packet->buffer = malloc(size);
-	}
-	packet->buf_control=TRACE_CTRL_PACKET;
-	packet->header=packet->buffer;
-	packet->payload=(void*)((char*)packet->buffer+sizeof(hdr));
 
 	/* Ugh, memmove - sadly necessary, also beware that we might be
          * moving data around within this packet, so ordering is important.
          */
         if (data != NULL) {
-        	memmove(packet->payload, data, (size_t)len);
+        	memmove(payload, data, (size_t)len);
         } else {
                 packet->payload = NULL;
         }
-	memmove(packet->header, &hdr, sizeof(hdr));
-	packet->type=pcap_linktype_to_rt(libtrace_to_pcap_linktype(linktype));
-
-	trace_clear_cache(packet);
 }
 
 
@@ -2475,11 +3011,10 @@ uint64_t trace_get_filtered_packets(libtrace_t *trace)
 		fprintf(stderr, "NULL trace passed to trace_get_filtered_packets()\n");
 		return UINT64_MAX;
 	}
-	int i = 0;
+	libtrace_thread_counters_t counters;
 	uint64_t lib_filtered = trace->filtered_packets;
-	for (i = 0; i < trace->perpkt_thread_count; i++) {
-		lib_filtered += trace->perpkt_threads[i].filtered_packets;
-	}
+	if (trace_get_counters(trace, &counters) == 0)
+		lib_filtered += counters.filtered;
 	if (trace->format->get_filtered_packets) {
 		uint64_t trace_filtered = trace->format->get_filtered_packets(trace);
 		if (trace_filtered == UINT64_MAX)
@@ -2535,23 +3070,20 @@ uint64_t trace_get_accepted_packets(libtrace_t *trace)
 		fprintf(stderr, "NULL trace passed into trace_get_accepted_packets()\n");
 		return UINT64_MAX;
 	}
-	int i = 0;
-	uint64_t ret = 0;
+	libtrace_thread_counters_t counters;
 	/* We always add to a thread's accepted count before dispatching the
 	 * packet to the user. However if the underlying trace is single
 	 * threaded it will also be increasing the global count. So if we
 	 * find perpkt ignore the global count.
 	 */
-	for (i = 0; i < trace->perpkt_thread_count; i++) {
-		ret += trace->perpkt_threads[i].accepted_packets;
-	}
-	return ret ? ret : trace->accepted_packets;
+	if (trace_get_counters(trace, &counters) == 0 && counters.accepted)
+		return counters.accepted;
+	return trace->accepted_packets;
 }
 
 libtrace_stat_t *trace_get_statistics(libtrace_t *trace, libtrace_stat_t *stat)
 {
-	uint64_t ret = 0;
-	int i;
+	libtrace_thread_counters_t counters;
 	if (!trace) {
 		fprintf(stderr, "NULL trace passed into trace_get_statistics()\n");
 		return NULL;
@@ -2589,18 +3121,14 @@ libtrace_stat_t *trace_get_statistics(libtrace_t *trace, libtrace_stat_t *stat)
 	 * threaded it will also be increasing the global count. So if we
 	 * find perpkt ignore the global count.
 	 */
-	for (i = 0; i < trace->perpkt_thread_count; i++) {
-		ret += trace->perpkt_threads[i].accepted_packets;
-	}
+	trace_get_counters(trace, &counters);
 
         stat->accepted_valid = 1;
-	stat->accepted = ret ? ret : trace->accepted_packets;
+	stat->accepted = counters.accepted ? counters.accepted :
+		trace->accepted_packets;
 
 	stat->filtered_valid = 1;
-	stat->filtered = trace->filtered_packets;
-	for (i = 0; i < trace->perpkt_thread_count; i++) {
-		stat->filtered += trace->perpkt_threads[i].filtered_packets;
-	}
+	stat->filtered = trace->filtered_packets + counters.filtered;
 
 	if (trace->format->get_statistics) {
 		trace->format->get_statistics(trace, stat);
@@ -2611,6 +3139,8 @@ libtrace_stat_t *trace_get_statistics(libtrace_t *trace, libtrace_stat_t *stat)
 void trace_get_thread_statistics(libtrace_t *trace, libtrace_thread_t *t,
                                  libtrace_stat_t *stat)
 {
+	libtrace_thread_counters_t counters;
+
 	if (!trace) {
 		fprintf(stderr, "NULL trace passed into trace_get_thread_statistics()\n");
 		return;
@@ -2630,10 +3160,19 @@ void trace_get_thread_statistics(libtrace_t *trace, libtrace_thread_t *t,
 #define X(x) stat->x ##_valid= 0;
 	LIBTRACE_STAT_FIELDS;
 #undef X
+	/* A thread can read its own counters directly, anyone else takes a
+	 * snapshot of what it has published */
+	if (!t->stats) {
+		memset(&counters, 0, sizeof(counters));
+	} else if (pthread_equal(t->tid, pthread_self())) {
+		counters = t->stats->live;
+	} else {
+		thread_stats_snapshot(t->stats, &counters);
+	}
 	stat->accepted_valid = 1;
-	stat->accepted = t->accepted_packets;
+	stat->accepted = counters.accepted;
 	stat->filtered_valid = 1;
-	stat->filtered = t->filtered_packets;
+	stat->filtered = counters.filtered;
 	if (!trace_has_dedicated_hasher(trace) && trace->format->get_thread_statistics) {
 		trace->format->get_thread_statistics(trace, t, stat);
 	}
@@ -89,6 +89,35 @@
 #include <ctype.h>
 
 static inline int delay_tracetime(libtrace_t *libtrace, libtrace_packet_t *packet, libtrace_thread_t *t);
+
+/* The most incomplete datagrams each thread holds for reassembly */
+#define REASSEMBLY_MAX_DATAGRAMS 1024
+
+/* The resolution of the per thread timers, in ns */
+#define TIMER_RESOLUTION 1000000
+/* Packets played back in tracetime that are due within this many ns are
+ * released straight away */
+#define TRACETIME_SLACK 50000
+#define ERF_TO_NS(erf) (((erf) >> 32) * 1000000000 + \
+		((((erf) & 0xffffffff) * 1000000000) >> 32))
+
+/* A timer added by trace_add_timer() */
+struct libtrace_thread_timer_t {
+	libtrace_timer_t timer;
+	libtrace_thread_t *thread;
+	fn_cb_timer fn;
+	void *data;
+};
+
+static inline void run_thread_timers(libtrace_thread_t *t);
+static libtrace_thread_timer_t *thread_add_timer(libtrace_thread_t *t,
+		uint64_t expiry, uint64_t period, fn_cb_timer fn, void *data);
+static void thread_timer_release(libtrace_timer_t *timer);
+static void result_timer_fired(libtrace_timer_t *timer, uint64_t expiry,
+		void *data);
+static void tick_timer_fired(libtrace_t *trace, libtrace_thread_t *t,
+		void *global, void *tls, uint64_t ts, void *data);
+
 extern int libtrace_parallel;
 
 struct mem_stats {
@@ -157,8 +186,65 @@ static void print_memory_stats() {
 static void print_memory_stats() {}
 #endif
 
+#ifdef ENABLE_LATENCY_HISTOGRAMS
+/* The number of SIGUSR1s received, compared against each trace's count of
+ * dumps to see if it needs to print its histograms */
+static volatile sig_atomic_t latency_signals = 0;
+
+static void latency_signal_handler(int sig UNUSED) {
+	latency_signals++;
+}
+
+/* Starts timing a stage, if this thread is timing stages */
+static inline uint64_t stage_begin(libtrace_thread_t *t) {
+	return t->latency ? stage_clock() : 0;
+}
+
+static inline void stage_end(libtrace_thread_t *t, libtrace_stage_t stage,
+                             uint64_t begin) {
+	if (t->latency)
+		latency_record(&t->latency->stages[stage], stage_clock() - begin);
+}
+
+/* Prints the histograms if a SIGUSR1 has arrived since they were last
+ * printed, this is left to the first perpkt thread */
+static inline void check_latency_dump(libtrace_t *trace, libtrace_thread_t *t) {
+	if (t->perpkt_num == 0 &&
+			(trace->config.latency_histograms & LATENCY_DUMP_ON_SIGUSR1) &&
+			trace->latency_dumps != latency_signals) {
+		trace->latency_dumps = latency_signals;
+		trace_dump_latency_histograms(trace, stderr);
+	}
+}
+#else
+static inline uint64_t stage_begin(libtrace_thread_t *t UNUSED) {
+	return 0;
+}
+
+static inline void stage_end(libtrace_thread_t *t UNUSED,
+                             libtrace_stage_t stage UNUSED,
+                             uint64_t begin UNUSED) {}
+
+static inline void check_latency_dump(libtrace_t *trace UNUSED,
+                                      libtrace_thread_t *t UNUSED) {}
+#endif
+
 static const libtrace_generic_t gen_zero = {0};
 
+/* Passes any results collected for the batch result callback on to it, must
+ * only be called by the reporter */
+static void flush_results(libtrace_t *trace) {
+	libtrace_thread_t *t = &trace->reporter_thread;
+	int count = trace->result_batch_count;
+
+	if (!count)
+		return;
+	trace->result_batch_count = 0;
+	(*trace->reporter_cbs->message_result_batch)(trace, t,
+			trace->global_blob, t->user_data, trace->result_batch,
+			count);
+}
+
 /* This should optimise away the switch to nothing in the explict cases */
 inline void send_message(libtrace_t *trace, libtrace_thread_t *thread,
                 const enum libtrace_messages type,
@@ -221,7 +307,12 @@ inline void send_message(libtrace_t *trace, libtrace_thread_t *thread,
                                         thread->user_data, type, data, sender);
 		return;
 	case MESSAGE_RESULT:
-                if (cbs->message_result)
+                if (cbs->message_result_batch) {
+                        trace->result_batch[trace->result_batch_count++] =
+                                        *data.res;
+                        if (trace->result_batch_count == LIBTRACE_RESULT_BATCH)
+                                flush_results(trace);
+                } else if (cbs->message_result)
                         (*cbs->message_result)(trace, thread,
                                         trace->global_blob, thread->user_data,
                                         data.res);
@@ -286,6 +377,114 @@ DLLEXPORT int trace_get_perpkt_thread_id(libtrace_thread_t *thread) {
         return thread->perpkt_num;
 }
 
+DLLEXPORT int trace_get_thread_counters(libtrace_t *trace, int thread,
+		libtrace_thread_counters_t *counters) {
+	if (!trace) {
+		fprintf(stderr, "NULL trace passed into trace_get_thread_counters()\n");
+		return -1;
+	}
+	if (!counters) {
+		trace_set_err(trace, TRACE_ERR_NULL, "NULL counters passed into "
+			"trace_get_thread_counters()");
+		return -1;
+	}
+	if (!trace->perpkt_stats || thread < 0 ||
+			thread >= trace->perpkt_thread_count) {
+		trace_set_err(trace, TRACE_ERR_THREAD, "No processing thread %d "
+			"in trace_get_thread_counters()", thread);
+		return -1;
+	}
+	thread_stats_snapshot(&trace->perpkt_stats[thread], counters);
+	return 0;
+}
+
+DLLEXPORT int trace_get_counters(libtrace_t *trace,
+		libtrace_thread_counters_t *counters) {
+	libtrace_thread_counters_t thread;
+	int i;
+
+	if (!trace) {
+		fprintf(stderr, "NULL trace passed into trace_get_counters()\n");
+		return -1;
+	}
+	if (!counters) {
+		trace_set_err(trace, TRACE_ERR_NULL, "NULL counters passed into "
+			"trace_get_counters()");
+		return -1;
+	}
+	memset(counters, 0, sizeof(libtrace_thread_counters_t));
+	if (!trace->perpkt_stats)
+		return 0;
+	for (i = 0; i < trace->perpkt_thread_count; i++) {
+		thread_stats_snapshot(&trace->perpkt_stats[i], &thread);
+		thread_stats_add(counters, &thread);
+	}
+	return 0;
+}
+
+DLLEXPORT int trace_get_stage_latency(libtrace_t *trace, int thread,
+		libtrace_stage_t stage, libtrace_latency_summary_t *summary) {
+	if (!trace) {
+		fprintf(stderr, "NULL trace passed into trace_get_stage_latency()\n");
+		return -1;
+	}
+	if (!summary || stage < 0 || stage >= LIBTRACE_STAGE_COUNT) {
+		trace_set_err(trace, TRACE_ERR_NULL, "Bad summary or stage "
+			"passed into trace_get_stage_latency()");
+		return -1;
+	}
+	if (!trace->latency) {
+		trace_set_err(trace, TRACE_ERR_BAD_STATE, "Stage latencies are "
+			"not being recorded in trace_get_stage_latency()");
+		return -1;
+	}
+	if (thread == -1) {
+		latency_set_summarise(trace->latency, 0, trace->latency->count,
+				stage, summary);
+	} else if (thread >= 0 && thread < trace->perpkt_thread_count) {
+		latency_set_summarise(trace->latency, thread, thread + 1,
+				stage, summary);
+	} else {
+		trace_set_err(trace, TRACE_ERR_THREAD, "No processing thread %d "
+			"in trace_get_stage_latency()", thread);
+		return -1;
+	}
+	return 0;
+}
+
+DLLEXPORT void trace_dump_latency_histograms(libtrace_t *trace, FILE *out) {
+	static const char *stages[LIBTRACE_STAGE_COUNT] = {"read", "hasher",
+		"ring_wait", "callback", "publish", "combiner"};
+	libtrace_latency_summary_t s;
+	char name[20];
+	int stage, i;
+
+	if (!trace || !trace->latency)
+		return;
+	fprintf(out, "%-10s %-10s %12s %10s %10s %10s %10s %10s %10s %10s\n",
+			"stage", "thread", "count", "min(ns)", "mean", "p50",
+			"p90", "p99", "p99.9", "max");
+	for (stage = 0; stage < LIBTRACE_STAGE_COUNT; stage++) {
+		for (i = 0; i < trace->latency->count; i++) {
+			latency_set_summarise(trace->latency, i, i + 1, stage, &s);
+			if (s.count == 0)
+				continue;
+			if (i < trace->perpkt_thread_count)
+				snprintf(name, sizeof(name), "perpkt-%d", i);
+			else if (i == trace->perpkt_thread_count)
+				snprintf(name, sizeof(name), "hasher");
+			else
+				snprintf(name, sizeof(name), "reporter");
+			fprintf(out, "%-10s %-10s %12"PRIu64" %10"PRIu64
+					" %10"PRIu64" %10"PRIu64" %10"PRIu64
+					" %10"PRIu64" %10"PRIu64" %10"PRIu64"\n",
+					stages[stage], name, s.count, s.min,
+					s.mean, s.p50, s.p90, s.p99, s.p999,
+					s.max);
+		}
+	}
+}
+
 /**
  * Changes the overall traces state and signals the condition.
  *
@@ -379,10 +578,13 @@ static inline bool trace_supports_parallel(libtrace_t *trace)
 }
 
 void libtrace_zero_thread(libtrace_thread_t * t) {
-	t->accepted_packets = 0;
-	t->filtered_packets = 0;
+	t->stats = NULL;
+	t->latency = NULL;
 	t->recorded_first = false;
-	t->tracetime_offset_usec = 0;
+	t->tracetime_offset = 0;
+	t->timers = NULL;
+	t->reassembly = NULL;
+	t->tcp = NULL;
 	t->user_data = 0;
 	t->format_data = 0;
 	libtrace_zero_ringbuffer(&t->rbuffer);
@@ -481,6 +683,106 @@ static void trace_thread_pause(libtrace_t *trace, libtrace_thread_t *t) {
 	ASSERT_RET(pthread_mutex_unlock(&trace->libtrace_lock), == 0);
 }
 
+/**
+ * Publishes a perpkt thread's counters, along with how much work is queued
+ * up for it, so that they can be read by other threads.
+ */
+static void publish_thread_stats(libtrace_t *trace, libtrace_thread_t *t) {
+	int messages = libtrace_message_queue_count(&t->messages);
+	uint64_t depth = messages > 0 ? messages : 0;
+
+	if (trace_has_dedicated_hasher(trace))
+		depth += libtrace_ringbuffer_count(&t->rbuffer);
+	if (t->reassembly)
+		t->stats->live.dropped +=
+			reassembly_take_discarded(t->reassembly);
+	thread_stats_publish(t->stats, depth);
+}
+
+/* Passes TCP payload that the thread's tracker has put in order to the
+ * user */
+static void tcp_payload_ready(void *data, libtrace_tcp_stream_t *stream,
+                              int direction, const uint8_t *payload,
+                              size_t len, int flags) {
+	libtrace_thread_t *t = (libtrace_thread_t *) data;
+	libtrace_t *trace = t->trace;
+
+	(*trace->perpkt_cbs->message_tcp_payload)(trace, t, trace->global_blob,
+		t->user_data, stream, direction, payload, len, flags);
+}
+
+/**
+ * Gives a packet to the packet callback, after any TCP payload it puts in
+ * order has been delivered.
+ *
+ * @param trace The trace
+ * @param t The current thread
+ * @param packet The packet
+ * @return The packet returned by the callback, which may be null
+ */
+static inline libtrace_packet_t *deliver_packet(libtrace_t *trace,
+                                                libtrace_thread_t *t,
+                                                libtrace_packet_t *packet) {
+	if (t->tcp)
+		tcp_tracker_add(t->tcp, packet);
+	if (trace->perpkt_cbs->message_packet) {
+		uint64_t begin = stage_begin(t);
+
+		/* Time a sample of the calls, the clock isn't free */
+		if ((t->stats->live.accepted & 63) == 0) {
+			uint64_t start = libtrace_message_queue_clock();
+
+			packet = (*trace->perpkt_cbs->message_packet)(trace, t,
+				trace->global_blob, t->user_data, packet);
+			thread_stats_latency(t->stats,
+				libtrace_message_queue_clock() - start);
+		} else {
+			packet = (*trace->perpkt_cbs->message_packet)(trace, t,
+				trace->global_blob, t->user_data, packet);
+		}
+		stage_end(t, LIBTRACE_STAGE_CALLBACK, begin);
+	}
+	return packet;
+}
+
+/**
+ * Passes a packet through the thread's reassembly table on its way to the
+ * user. Fragments are held until their datagram is complete, at which point
+ * the datagram is sent to the user in a packet of its own.
+ *
+ * @param trace The trace
+ * @param t The current thread
+ * @param packet A pointer to the packet, which may be set to null upon return
+ */
+static void dispatch_reassembled(libtrace_t *trace, libtrace_thread_t *t,
+                                 libtrace_packet_t **packet) {
+	libtrace_packet_t *whole = NULL;
+
+	switch (reassembly_add(t->reassembly, *packet)) {
+	case REASSEMBLY_NOT_FRAGMENT:
+		*packet = deliver_packet(trace, t, *packet);
+		return;
+	case REASSEMBLY_HELD:
+		return;
+	case REASSEMBLY_COMPLETE:
+		break;
+	}
+
+	/* The whole datagram goes in a packet from the freelist so that the
+	 * user can keep it or free it like any other */
+	libtrace_ocache_alloc(&trace->packet_freelist, (void **) &whole, 1, 1);
+	if (reassembly_build(t->reassembly, whole,
+				trace_get_timeval(*packet)) < 0) {
+		libtrace_ocache_free(&trace->packet_freelist, (void **) &whole, 1, 1);
+		return;
+	}
+	whole->order = (*packet)->order;
+	whole->error = trace_get_capture_length(whole);
+	whole = deliver_packet(trace, t, whole);
+	if (whole)
+		trace_free_packet(trace, whole);
+}
+
 /**
  * Sends a packet to the user, expects either a valid packet or a TICK packet.
  *
@@ -504,8 +806,10 @@ static inline int dispatch_packet(libtrace_t *trace,
 			if (delay_tracetime(trace, packet[0], t) == READ_MESSAGE)
 				return READ_MESSAGE;
 		}
+		t->stats->live.received++;
                 if (!IS_LIBTRACE_META_PACKET((*packet))) {
-        		t->accepted_packets++;
+        		t->stats->live.accepted++;
+        		t->stats->live.bytes += trace_get_wire_length(*packet);
                 }
 
 		/* If packet is meta call the meta callback */
@@ -518,11 +822,10 @@ static inline int dispatch_packet(libtrace_t *trace,
 				*packet = (*trace->perpkt_cbs->message_packet)(trace, t,
 					trace->global_blob, t->user_data, *packet);
 			}
+		} else if (t->reassembly) {
+			dispatch_reassembled(trace, t, packet);
 		} else {
-			if (trace->perpkt_cbs->message_packet) {
-				*packet = (*trace->perpkt_cbs->message_packet)(trace, t,
-					trace->global_blob, t->user_data, *packet);
-			}
+			*packet = deliver_packet(trace, t, *packet);
 		}
 		trace_fin_packet(*packet);
 	} else {
@@ -649,6 +952,7 @@ static int trace_perpkt_thread_pause(libtrace_t *trace, libtrace_thread_t *t,
 		}
 	}
 	libtrace_ocache_free(&trace->packet_freelist, (void **) &packet, 1, 1);
+	publish_thread_stats(trace, t);
 
 	/* Now we do the actual pause, this returns when we resumed */
 	trace_thread_pause(trace, t);
@@ -697,6 +1001,48 @@ static void* perpkt_threads_entry(void *data) {
 		}
 	}
 
+	t->timers = malloc(sizeof(libtrace_timer_wheel_t));
+	if (!t->timers) {
+		trace_set_err(trace, TRACE_ERR_OUT_OF_MEMORY, "Unable to allocate timers in perpkt_threads_entry()");
+		thread_change_state(trace, t, THREAD_FINISHED, false);
+		pthread_exit(NULL);
+	}
+	libtrace_timer_wheel_init(t->timers, TIMER_RESOLUTION,
+			libtrace_message_queue_clock());
+	libtrace_timer_init(&t->result_timer, result_timer_fired, t);
+	if (trace->config.tick_interval > 0) {
+		uint64_t interval = trace->config.tick_interval * 1000000ULL;
+		uint64_t now = libtrace_message_queue_clock();
+
+		/* The first tick after now on the shared grid */
+		thread_add_timer(t, trace->timer_base + interval *
+				((now - trace->timer_base) / interval + 1),
+				interval, tick_timer_fired, NULL);
+	}
+
+	if (trace->config.reassembly_timeout > 0) {
+		t->reassembly = reassembly_create(
+				trace->config.reassembly_timeout,
+				REASSEMBLY_MAX_DATAGRAMS);
+		if (!t->reassembly) {
+			trace_set_err(trace, TRACE_ERR_OUT_OF_MEMORY, "Unable to allocate reassembly table in perpkt_threads_entry()");
+			thread_change_state(trace, t, THREAD_FINISHED, false);
+			pthread_exit(NULL);
+		}
+	}
+
+	if (trace->perpkt_cbs->message_tcp_payload) {
+		t->tcp = tcp_tracker_create(trace->config.tcp_max_streams,
+				trace->config.tcp_memory_limit,
+				trace->config.tcp_idle_timeout,
+				tcp_payload_ready, t);
+		if (!t->tcp) {
+			trace_set_err(trace, TRACE_ERR_OUT_OF_MEMORY, "Unable to allocate TCP tracker in perpkt_threads_entry()");
+			thread_change_state(trace, t, THREAD_FINISHED, false);
+			pthread_exit(NULL);
+		}
+	}
+
 	/* Fill our buffer with empty packets */
 	memset(&packets, 0, sizeof(void*) * trace->config.burst_size);
 	libtrace_ocache_alloc(&trace->packet_freelist, (void **) packets,
@@ -711,6 +1057,8 @@ static void* perpkt_threads_entry(void *data) {
 
 	for (;;) {
 
+		run_thread_timers(t);
+
 		if (libtrace_message_queue_try_get(&t->messages, &message) != LIBTRACE_MQ_FAILED) {
 			int ret;
 			switch (message.code) {
@@ -732,6 +1080,7 @@ static void* perpkt_threads_entry(void *data) {
 			}
                         send_message(trace, t, message.code, message.data, 
                                         message.sender);
+			check_latency_dump(trace, t);
 
 			/* Continue and the empty messages out before packets */
 			continue;
@@ -758,10 +1107,19 @@ static void* perpkt_threads_entry(void *data) {
 				if (nb_packets > 0)
 					nb_packets = 1;
 			} else {
+				uint64_t begin = stage_begin(t);
+
 				nb_packets = trace->pread(trace, t, packets, trace->config.burst_size);
+				if (nb_packets > 0) {
+					stage_end(t, trace_has_dedicated_hasher(trace) ?
+						LIBTRACE_STAGE_RING_WAIT :
+						LIBTRACE_STAGE_READ, begin);
+				}
 			}
 			offset = 0;
 			empty = 0;
+			if (nb_packets > 0)
+				thread_stats_burst(t->stats, nb_packets);
 		}
 
 		/* Handle error/message cases */
@@ -776,6 +1134,8 @@ static void* perpkt_threads_entry(void *data) {
 			}
 			dispatch_packets(trace, t, packets, nb_packets, &empty,
 			                 &offset, trace->tracetime);
+			publish_thread_stats(trace, t);
+			check_latency_dump(trace, t);
 		} else {
 			switch (nb_packets) {
 			case READ_EOF:
@@ -801,6 +1161,12 @@ error:
 eof:
 	/* ~~~~~~~~~~~~~~ Trace is finished do tear down ~~~~~~~~~~~~~~~~~~~~~ */
 
+	// End any TCP streams while the user can still see them
+	if (t->tcp) {
+		tcp_tracker_destroy(t->tcp);
+		t->tcp = NULL;
+	}
+
 	// Let the per_packet function know we have stopped
 	send_message(trace, t, MESSAGE_PAUSING, gen_zero, t);
 	send_message(trace, t, MESSAGE_STOPPING, gen_zero, t);
@@ -813,6 +1179,17 @@ eof:
 		}
 	}
 
+	libtrace_timer_wheel_cancel(t->timers, &t->result_timer);
+	libtrace_timer_wheel_clear(t->timers, thread_timer_release);
+	libtrace_message_queue_set_deadline(&t->messages, 0);
+	free(t->timers);
+	t->timers = NULL;
+	publish_thread_stats(trace, t);
+	if (t->reassembly) {
+		reassembly_destroy(t->reassembly);
+		t->reassembly = NULL;
+	}
+
 	thread_change_state(trace, t, THREAD_FINISHED, true);
 
 	/* Make sure the reporter sees we have finished */
@@ -846,6 +1223,7 @@ static void* hasher_entry(void *data) {
 	libtrace_packet_t * packet;
 	libtrace_message_t message = {0, {.uint64=0}, NULL};
 	int pkt_skipped = 0;
+	uint64_t begin;
 
 	if (!trace_has_dedicated_hasher(trace)) {
 		fprintf(stderr, "Trace does not have hasher associated with it in hasher_entry()\n");
@@ -908,6 +1286,7 @@ static void* hasher_entry(void *data) {
 			continue;
 		}
 
+		begin = stage_begin(t);
 		if ((packet->error = trace_read_packet(trace, packet)) <1) {
 			if (packet->error == READ_MESSAGE) {
 				pkt_skipped = 1;
@@ -916,6 +1295,7 @@ static void* hasher_entry(void *data) {
 				break; /* We are EOF or error'd either way we stop  */
 			}
 		}
+		stage_end(t, LIBTRACE_STAGE_READ, begin);
 
         /* Hold the packet to ensure it buffers do not unexpectedly change. This can happen
 		 * if format module manages its own buffers that may be reused before the packet is
@@ -924,12 +1304,16 @@ static void* hasher_entry(void *data) {
         libtrace_hold_packet(packet);
 
 		/* We are guaranteed to have a hash function i.e. != NULL */
+		begin = stage_begin(t);
 		trace_packet_set_hash(packet, (*trace->hasher)(packet, trace->hasher_data));
+		stage_end(t, LIBTRACE_STAGE_HASHER, begin);
 		thread = trace_packet_get_hash(packet) % trace->perpkt_thread_count;
 		/* Blocking write to the correct queue - I'm the only writer */
 		if (trace->perpkt_threads[thread].state != THREAD_FINISHED) {
 			uint64_t order = trace_packet_get_order(packet);
+			begin = stage_begin(t);
 			libtrace_ringbuffer_write(&trace->perpkt_threads[thread].rbuffer, packet);
+			stage_end(t, LIBTRACE_STAGE_RING_WAIT, begin);
 			if (trace->config.tick_count && order % trace->config.tick_count == 0) {
 				// Write ticks to everyone else
 				libtrace_packet_t * pkts[trace->perpkt_thread_count];
@@ -986,7 +1370,7 @@ static int trace_pread_packet_first_in_first_served(libtrace_t *libtrace,
 	ASSERT_RET(pthread_mutex_lock(&libtrace->read_packet_lock), == 0);
 	/* Read nb_packets */
 	for (i = 0; i < nb_packets; ++i) {
-		if (libtrace_message_queue_count(&t->messages) > 0) {
+		if (libtrace_message_queue_ready(&t->messages)) {
 			if ( i==0 ) {
 				ASSERT_RET(pthread_mutex_unlock(&libtrace->read_packet_lock), == 0);
 				return READ_MESSAGE;
@@ -1033,6 +1417,14 @@ static int trace_pread_packet_first_in_first_served(libtrace_t *libtrace,
 	return i;
 }
 
+/* True once a processing thread has a packet from the hasher or a message */
+static int hasher_thread_ready(void *data) {
+	libtrace_thread_t *t = (libtrace_thread_t *) data;
+
+	return !libtrace_ringbuffer_is_empty(&t->rbuffer) ||
+		libtrace_message_queue_ready(&t->messages);
+}
+
 /**
  * For the case that we have a dedicated hasher thread
  * 1. We read a packet from our buffer
@@ -1053,10 +1445,19 @@ inline static int trace_pread_packet_hasher_thread(libtrace_t *libtrace,
          * and this prevents the tick messages from being triggered. So check
          * for a available packet before continuing.
          */
+	if (t->rbuffer.mode == LIBTRACE_RINGBUFFER_ADAPTIVE) {
+		/* Messages wake us as well as the hasher, and timers are
+		 * handled by waking at the deadline */
+		libtrace_wait(&t->rbuffer.full_waiter,
+		              libtrace->config.wait_spin, hasher_thread_ready,
+		              t, t->messages.deadline);
+		if (libtrace_ringbuffer_is_empty(&t->rbuffer))
+			return READ_MESSAGE;
+	}
         while (libtrace_ringbuffer_is_empty(&t->rbuffer)) {
 
                 /* does libtrace have any messages in the queue */
-                if (libtrace_message_queue_count(&t->messages) > 0) {
+                if (libtrace_message_queue_ready(&t->messages)) {
                     return READ_MESSAGE;
                 }
 
@@ -1218,6 +1619,7 @@ static void* reporter_entry(void *data) {
 	libtrace_message_t message = {0, {.uint64=0}, NULL};
 	libtrace_t *trace = (libtrace_t *)data;
 	libtrace_thread_t *t = &trace->reporter_thread;
+	uint64_t begin;
 
 	/* Wait until all threads are started */
 	ASSERT_RET(pthread_mutex_lock(&trace->libtrace_lock), == 0);
@@ -1245,11 +1647,19 @@ static void* reporter_entry(void *data) {
 		switch (message.code) {
 			// Check for results
 			case MESSAGE_POST_REPORTER:
+				/* Anything published from here on needs
+				 * another message */
+				__atomic_store_n(&trace->reporter_posted, 0,
+				                 __ATOMIC_SEQ_CST);
+				begin = stage_begin(t);
 				trace->combiner.read(trace, &trace->combiner);
+				flush_results(trace);
+				stage_end(t, LIBTRACE_STAGE_COMBINER, begin);
 				break;
 			case MESSAGE_DO_PAUSE:
 				if(trace->combiner.pause) {
 					trace->combiner.pause(trace, &trace->combiner);
+					flush_results(trace);
 				}
 				send_message(trace, t, MESSAGE_PAUSING,
                                                 (libtrace_generic_t) {0}, t);
@@ -1264,7 +1674,10 @@ static void* reporter_entry(void *data) {
 	}
 
 	// Flush out whats left now all our threads have finished
+	begin = stage_begin(t);
 	trace->combiner.read_final(trace, &trace->combiner);
+	flush_results(trace);
+	stage_end(t, LIBTRACE_STAGE_COMBINER, begin);
 
 	// GOODBYE
         send_message(trace, t, MESSAGE_PAUSING,(libtrace_generic_t) {0}, t);
@@ -1275,57 +1688,110 @@ static void* reporter_entry(void *data) {
 	pthread_exit(NULL);
 }
 
-/** Similar to delay_tracetime but send messages to all threads periodically */
-static void* keepalive_entry(void *data) {
-	struct timeval prev, next;
-	libtrace_message_t message = {0, {.uint64=0}, NULL};
-	libtrace_t *trace = (libtrace_t *)data;
-	uint64_t next_release;
-	libtrace_thread_t *t = &trace->keepalive_thread;
+/* Converts a CLOCK_MONOTONIC time, in ns, into an ERF style wall clock
+ * timestamp */
+static uint64_t timer_to_erf(libtrace_t *trace, uint64_t when) {
+	uint64_t usec = tv_to_usec(&trace->timer_base_tv);
+	struct timeval tv;
 
-	/* Wait until all threads are started */
-	ASSERT_RET(pthread_mutex_lock(&trace->libtrace_lock), == 0);
-	if (trace->state == STATE_ERROR) {
-		thread_change_state(trace, t, THREAD_FINISHED, false);
-		ASSERT_RET(pthread_mutex_unlock(&trace->libtrace_lock), == 0);
-		pthread_exit(NULL);
-	}
-	ASSERT_RET(pthread_mutex_unlock(&trace->libtrace_lock), == 0);
+	if (when > trace->timer_base)
+		usec += (when - trace->timer_base) / 1000;
+	tv = usec_to_tv(usec);
+	return (((uint64_t)tv.tv_sec) << 32) +
+		(((uint64_t)tv.tv_usec << 32) / 1000000);
+}
 
-	gettimeofday(&prev, NULL);
-        memset(&message, 0, sizeof(libtrace_message_t));
-	message.code = MESSAGE_TICK_INTERVAL;
+/* Called by the wheel, on the thread that owns the timer */
+static void thread_timer_fired(libtrace_timer_t *timer, uint64_t expiry,
+		void *data) {
+	libtrace_thread_timer_t *tt = (libtrace_thread_timer_t *) data;
+	libtrace_thread_t *t = tt->thread;
+	libtrace_t *trace = t->trace;
+	/* The callback may cancel (and free) a periodic timer */
+	bool oneshot = timer->period == 0;
 
-	while (trace->state != STATE_FINISHED) {
-		fd_set rfds;
-		next_release = tv_to_usec(&prev) + (trace->config.tick_interval * 1000);
-		gettimeofday(&next, NULL);
-		if (next_release > tv_to_usec(&next)) {
-			next = usec_to_tv(next_release - tv_to_usec(&next));
-			// Wait for timeout or a message
-			FD_ZERO(&rfds);
-			FD_SET(libtrace_message_queue_get_fd(&t->messages), &rfds);
-			if (select(libtrace_message_queue_get_fd(&t->messages)+1, &rfds, NULL, NULL, &next) == 1) {
-				libtrace_message_t msg;
-				libtrace_message_queue_get(&t->messages, &msg);
-				if (msg.code != MESSAGE_DO_STOP) {
-					fprintf(stderr, "Unexpected message code in keepalive_entry()\n");
-					pthread_exit(NULL);
-				}
-				goto done;
-			}
-		}
-		prev = usec_to_tv(next_release);
-		if (trace->state == STATE_RUNNING) {
-			message.data.uint64 = ((((uint64_t)prev.tv_sec) << 32) +
-			                       (((uint64_t)prev.tv_usec << 32)/1000000));
-			trace_message_perpkts(trace, &message);
-		}
+	tt->fn(trace, t, trace->global_blob, t->user_data,
+			timer_to_erf(trace, expiry), tt->data);
+	if (oneshot)
+		free(tt);
+}
+
+static void thread_timer_release(libtrace_timer_t *timer) {
+	free(timer->data);
+}
+
+/* Fires any of this thread's timers that are due. This is cheap when
+ * none are, as it only looks at the queue's deadline */
+static inline void run_thread_timers(libtrace_thread_t *t) {
+	uint64_t now;
+
+	if (!t->messages.deadline)
+		return;
+	now = libtrace_message_queue_clock();
+	if (now < t->messages.deadline)
+		return;
+	libtrace_timer_wheel_advance(t->timers, now);
+	libtrace_message_queue_set_deadline(&t->messages,
+			libtrace_timer_wheel_next(t->timers));
+}
+
+/* Adds a timer to this thread's wheel, waking the thread earlier if the
+ * timer is due first */
+static void thread_schedule_timer(libtrace_thread_t *t,
+		libtrace_timer_t *timer, uint64_t expiry, uint64_t period) {
+	libtrace_timer_wheel_add(t->timers, timer, expiry, period);
+	expiry = timer->expires * t->timers->resolution;
+	if (!t->messages.deadline || expiry < t->messages.deadline)
+		libtrace_message_queue_set_deadline(&t->messages, expiry);
+}
+
+/* Wakes the reporter once a result has waited for the latency budget. This
+ * timer lives in the thread itself and is re-armed rather than freed. */
+static void result_timer_fired(libtrace_timer_t *timer UNUSED,
+		uint64_t expiry UNUSED, void *data) {
+	libtrace_thread_t *t = (libtrace_thread_t *) data;
+	notify_reporter(t->trace);
+}
+
+/* Makes sure the reporter hears about a result within the latency budget,
+ * even if the threshold is never reached. The timer covers a thread that
+ * goes idle; a thread busy with a batch of packets does not run its timers,
+ * so the budget is also checked each time it publishes. */
+static void result_latency_check(libtrace_t *trace, libtrace_thread_t *t) {
+	uint64_t now = libtrace_message_queue_clock();
+
+	if (libtrace_timer_is_active(&t->result_timer)) {
+		if (now < t->result_timer.expires * t->timers->resolution)
+			return;
+		notify_reporter(trace);
 	}
-done:
+	/* Moves the timer if it is still in the wheel */
+	thread_schedule_timer(t, &t->result_timer, now +
+			trace->config.reporter_latency * 1000000ULL, 0);
+}
 
-	thread_change_state(trace, t, THREAD_FINISHED, true);
-	pthread_exit(NULL);
+/* Sends MESSAGE_TICK_INTERVAL to this thread. Every thread's ticks are
+ * counted from the same base, so they carry the same timestamps. */
+static void tick_timer_fired(libtrace_t *trace, libtrace_thread_t *t,
+		void *global UNUSED, void *tls UNUSED, uint64_t ts,
+		void *data UNUSED) {
+	if (trace->state == STATE_RUNNING)
+		send_message(trace, t, MESSAGE_TICK_INTERVAL,
+				(libtrace_generic_t){.uint64 = ts}, t);
+}
+
+static libtrace_thread_timer_t *thread_add_timer(libtrace_thread_t *t,
+		uint64_t expiry, uint64_t period, fn_cb_timer fn, void *data) {
+	libtrace_thread_timer_t *tt = malloc(sizeof(libtrace_thread_timer_t));
+
+	if (!tt)
+		return NULL;
+	tt->thread = t;
+	tt->fn = fn;
+	tt->data = data;
+	libtrace_timer_init(&tt->timer, thread_timer_fired, tt);
+	thread_schedule_timer(t, &tt->timer, expiry, period);
+	return tt;
 }
 
 /**
@@ -1339,36 +1805,43 @@ done:
  * @return Either READ_MESSAGE(-2) or 0 is successful
  */
 static inline int delay_tracetime(libtrace_t *libtrace, libtrace_packet_t *packet, libtrace_thread_t *t) {
-	struct timeval curr_tv, pkt_tv;
-	uint64_t next_release = t->tracetime_offset_usec;
-	uint64_t curr_usec;
+	uint64_t erf = trace_get_erf_timestamp(packet);
+	uint64_t release, now;
 
-	if (!t->tracetime_offset_usec) {
+	if (!t->tracetime_offset) {
 		const libtrace_packet_t *first_pkt;
 		const struct timeval *sys_tv;
+		struct timeval pkt_tv;
 		int64_t initial_offset;
 		int stable = trace_get_first_packet(libtrace, NULL, &first_pkt, &sys_tv);
                 if (!first_pkt)
                         return 0;
 		pkt_tv = trace_get_timeval(first_pkt);
-		initial_offset = (int64_t)tv_to_usec(sys_tv) - (int64_t)tv_to_usec(&pkt_tv);
+		/* Work out the offset in wall clock time, then move it onto
+		 * the monotonic clock so that no more wall clock reads are
+		 * needed */
+		initial_offset = ((int64_t)tv_to_usec(sys_tv) -
+				(int64_t)tv_to_usec(&pkt_tv) -
+				(int64_t)tv_to_usec(&libtrace->timer_base_tv)) *
+				1000 + (int64_t)libtrace->timer_base;
 		/* In the unlikely case offset is 0, change it to 1 */
 		if (stable)
-			t->tracetime_offset_usec = initial_offset ? initial_offset: 1;
-		next_release = initial_offset;
-	}
-	/* next_release == offset */
-	pkt_tv = trace_get_timeval(packet);
-	next_release += tv_to_usec(&pkt_tv);
-	gettimeofday(&curr_tv, NULL);
-	curr_usec = tv_to_usec(&curr_tv);
-	if (next_release > curr_usec) {
+			t->tracetime_offset = initial_offset ? initial_offset: 1;
+		release = ERF_TO_NS(erf) + initial_offset;
+	} else {
+		release = ERF_TO_NS(erf) + t->tracetime_offset;
+	}
+
+	/* Closely spaced packets are sent straight away rather than each
+	 * costing a sleep */
+	now = libtrace_message_queue_clock();
+	if (release > now + TRACETIME_SLACK) {
 		int ret, mesg_fd = libtrace_message_queue_get_fd(&t->messages);
-		struct timeval delay_tv = usec_to_tv(next_release-curr_usec);
+		struct timeval delay_tv = usec_to_tv((release - now) / 1000);
 		fd_set rfds;
 		FD_ZERO(&rfds);
 		FD_SET(mesg_fd, &rfds);
-		// We need to wait
+		// We need to wait, the fd also wakes us for any timers
 		ret = select(mesg_fd+1, &rfds, NULL, NULL, &delay_tv);
 		if (ret == 0) {
 			return 0;
@@ -1448,6 +1921,9 @@ static int trace_pread_packet_wrapper(libtrace_t *libtrace,
 
 	if (libtrace->format->pread_packets) {
 		int ret;
+		/* Packets handed back to us may hold a right-sized copy */
+		for (i = 0; i < (int) nb_packets; ++i)
+			trace_release_small_buffer(packets[i]);
 		do {
 			ret=libtrace->format->pread_packets(libtrace, t,
 			                                    packets,
@@ -1461,7 +1937,10 @@ static int trace_pread_packet_wrapper(libtrace_t *libtrace,
 				int remaining;
 				remaining = filter_packets(libtrace,
 				                           packets, ret);
-				t->filtered_packets += ret - remaining;
+				if (t->stats) {
+					t->stats->live.filtered += ret - remaining;
+					t->stats->live.received += ret - remaining;
+				}
 				ret = remaining;
 			}
 			for (i = 0; i < ret; ++i) {
@@ -1475,6 +1954,8 @@ static int trace_pread_packet_wrapper(libtrace_t *libtrace,
 							libtrace->snaplen);
                         	packets[i]->which_trace_start = libtrace->startcount;
 			}
+			if (libtrace->eager_parse)
+				trace_parse_packets(packets, ret);
 		} while(ret == 0);
 		return ret;
 	}
@@ -1531,13 +2012,12 @@ static int trace_prestart(libtrace_t * libtrace, void *global_blob,
 
 	/* Reset delay */
 	for (i = 0; i < libtrace->perpkt_thread_count; ++i) {
-		libtrace->perpkt_threads[i].tracetime_offset_usec = 0;
+		libtrace->perpkt_threads[i].tracetime_offset = 0;
 	}
 
 	/* Reset statistics */
 	for (i = 0; i < libtrace->perpkt_thread_count; ++i) {
-		libtrace->perpkt_threads[i].accepted_packets = 0;
-		libtrace->perpkt_threads[i].filtered_packets = 0;
+		thread_stats_reset(&libtrace->perpkt_stats[i]);
 	}
 	libtrace->accepted_packets = 0;
 	libtrace->filtered_packets = 0;
@@ -1620,8 +2100,18 @@ static void verify_configuration(libtrace_t *libtrace) {
 
 	if (libtrace->config.reporter_thold <= 0)
 		libtrace->config.reporter_thold = 100;
+	if (libtrace->config.result_size <= 0)
+		libtrace->config.result_size = 128;
+	if (libtrace->config.wait_spin <= 0)
+		libtrace->config.wait_spin = LIBTRACE_WAIT_DEFAULT_SPIN;
 	if (libtrace->config.burst_size <= 0)
 		libtrace->config.burst_size = 32;
+	if (libtrace->config.tcp_max_streams <= 0)
+		libtrace->config.tcp_max_streams = 65536;
+	if (libtrace->config.tcp_memory_limit <= 0)
+		libtrace->config.tcp_memory_limit = 64 * 1024 * 1024;
+	if (libtrace->config.tcp_idle_timeout <= 0)
+		libtrace->config.tcp_idle_timeout = 60000;
 	if (libtrace->config.thread_cache_size <= 0)
 		libtrace->config.thread_cache_size = 64;
 	if (libtrace->config.cache_size <= 0)
@@ -1716,12 +2206,25 @@ static int trace_start_thread(libtrace_t *trace,
 		return -1;
 	}
 	libtrace_message_queue_init(&t->messages, sizeof(libtrace_message_t));
+	if (type != THREAD_REPORTER || !trace->config.reporter_polling)
+		libtrace_message_queue_set_spin(&t->messages,
+		                                trace->config.wait_spin);
+	/* Perpkt threads are woken from their reads to run timers */
+	if (type == THREAD_PERPKT)
+		libtrace_message_queue_enable_deadline(&t->messages);
 	if (trace_has_dedicated_hasher(trace) && type == THREAD_PERPKT) {
 		libtrace_ringbuffer_init(&t->rbuffer,
 		                         trace->config.hasher_queue_size,
 		                         trace->config.hasher_polling?
 		                                 LIBTRACE_RINGBUFFER_POLLING:
-		                                 LIBTRACE_RINGBUFFER_BLOCKING);
+		                                 LIBTRACE_RINGBUFFER_ADAPTIVE);
+		libtrace_ringbuffer_set_spin(&t->rbuffer,
+		                             trace->config.wait_spin);
+		/* A thread asleep waiting for packets must also wake up
+		 * for messages */
+		if (!trace->config.hasher_polling)
+			libtrace_message_queue_set_waiter(&t->messages,
+			                                  &t->rbuffer.full_waiter);
 	}
 #if defined(HAVE_PTHREAD_SETNAME_NP) && defined(__linux__)
 	if(name)
@@ -1858,11 +2361,13 @@ DLLEXPORT int trace_pstart(libtrace_t *libtrace, void* global_blob,
                 goto cleanup_none;
         }
 
-        if (per_packet_cbs->message_packet == NULL) {
+        if (per_packet_cbs->message_packet == NULL &&
+                        per_packet_cbs->message_tcp_payload == NULL) {
                 trace_set_err(libtrace, TRACE_ERR_INIT_FAILED, "The per "
                                 "packet callbacks must include a handler "
                                 "for a packet. Please set this using "
-                                "trace_set_packet_cb().");
+                                "trace_set_packet_cb() or "
+                                "trace_set_tcp_payload_cb().");
                 goto cleanup_none;
         }
 
@@ -1885,6 +2390,7 @@ DLLEXPORT int trace_pstart(libtrace_t *libtrace, void* global_blob,
 	libtrace->first_packets.count = 0;
 	libtrace->first_packets.packets = NULL;
 	libtrace->perpkt_threads = NULL;
+	libtrace->perpkt_stats = NULL;
 	/* Set a global which says we are using a parallel trace. This is
 	 * for backwards compatibility due to changes when destroying packets */
 	libtrace_parallel = 1;
@@ -1925,6 +2431,40 @@ DLLEXPORT int trace_pstart(libtrace_t *libtrace, void* global_blob,
 		goto cleanup_none;
 	}
 
+	/* Stage timings, with a slot for the hasher and reporter after the
+	 * perpkt threads */
+	latency_set_destroy(libtrace->latency);
+	libtrace->latency = NULL;
+#ifdef ENABLE_LATENCY_HISTOGRAMS
+	if (libtrace->config.latency_histograms) {
+		libtrace->latency = latency_set_create(
+				libtrace->perpkt_thread_count + 2);
+		if (!libtrace->latency) {
+			trace_set_err(libtrace, TRACE_ERR_OUT_OF_MEMORY,
+			              "trace_pstart failed to allocate memory.");
+			goto cleanup_none;
+		}
+		libtrace->hasher_thread.latency = &libtrace->latency->threads[
+				libtrace->perpkt_thread_count];
+		libtrace->reporter_thread.latency = &libtrace->latency->threads[
+				libtrace->perpkt_thread_count + 1];
+		if (libtrace->config.latency_histograms & LATENCY_DUMP_ON_SIGUSR1) {
+			struct sigaction sa;
+
+			/* Leave the application's own handler alone */
+			libtrace->latency_dumps = latency_signals;
+			if (sigaction(SIGUSR1, NULL, &sa) == 0 &&
+					sa.sa_handler == SIG_DFL) {
+				memset(&sa, 0, sizeof(sa));
+				sa.sa_handler = latency_signal_handler;
+				sigemptyset(&sa.sa_mask);
+				sa.sa_flags = SA_RESTART;
+				sigaction(SIGUSR1, &sa, NULL);
+			}
+		}
+	}
+#endif
+
 	/* --- Start all the threads we need --- */
 	/* Disable signals because it is inherited by the threads we start */
 	sigemptyset(&sig_block_all);
@@ -1945,10 +2485,25 @@ DLLEXPORT int trace_pstart(libtrace_t *libtrace, void* global_blob,
 		libtrace->hasher_thread.type = THREAD_EMPTY;
 	}
 
+	/* Ticks and timers are counted from here */
+	libtrace->timer_base = libtrace_message_queue_clock();
+	gettimeofday(&libtrace->timer_base_tv, NULL);
+
 	/* Start up our perpkt threads */
 	libtrace->perpkt_threads = calloc(sizeof(libtrace_thread_t),
 	                                  libtrace->perpkt_thread_count);
-	if (!libtrace->perpkt_threads) {
+	libtrace->perpkt_stats = thread_stats_create(
+	                                  libtrace->perpkt_thread_count);
+	/* Results may outlive the threads, so the pool is kept until the
+	 * trace is destroyed */
+	if (!libtrace->result_pool)
+		libtrace->result_pool = result_pool_create(
+		                          libtrace->perpkt_thread_count,
+		                          libtrace->config.result_size);
+	libtrace->reporter_posted = 0;
+	libtrace->result_batch_count = 0;
+	if (!libtrace->perpkt_threads || !libtrace->perpkt_stats ||
+	    !libtrace->result_pool) {
 		trace_set_err(libtrace, errno, "trace_pstart "
 		              "failed to allocate memory.");
 		goto cleanup_threads;
@@ -1956,6 +2511,10 @@ DLLEXPORT int trace_pstart(libtrace_t *libtrace, void* global_blob,
 	for (i = 0; i < libtrace->perpkt_thread_count; i++) {
 		snprintf(name, sizeof(name), "perpkt-%d", i);
 		libtrace_zero_thread(&libtrace->perpkt_threads[i]);
+		libtrace->perpkt_threads[i].stats = &libtrace->perpkt_stats[i];
+		if (libtrace->latency)
+			libtrace->perpkt_threads[i].latency =
+				&libtrace->latency->threads[i];
 		ret = trace_start_thread(libtrace, &libtrace->perpkt_threads[i],
 		                   THREAD_PERPKT, perpkt_threads_entry, i,
 		                   name);
@@ -1974,15 +2533,6 @@ DLLEXPORT int trace_pstart(libtrace_t *libtrace, void* global_blob,
 			goto cleanup_threads;
 	}
 
-	/* Start the keepalive thread */
-	if (libtrace->config.tick_interval > 0) {
-		ret = trace_start_thread(libtrace, &libtrace->keepalive_thread,
-		                   THREAD_KEEPALIVE, keepalive_entry, -1,
-		                   "keepalive_thread");
-		if (ret != 0)
-			goto cleanup_threads;
-	}
-
 	/* Init other data structures */
 	libtrace->perpkt_thread_states[THREAD_RUNNING] = libtrace->perpkt_thread_count;
 	ASSERT_RET(pthread_spin_init(&libtrace->first_packets.lock, 0), == 0);
@@ -2034,16 +2584,15 @@ cleanup_threads:
 		free(libtrace->perpkt_threads);
 		libtrace->perpkt_threads = NULL;
 	}
+	thread_stats_destroy(libtrace->perpkt_stats);
+	libtrace->perpkt_stats = NULL;
+	latency_set_destroy(libtrace->latency);
+	libtrace->latency = NULL;
 
 	if (libtrace->reporter_thread.type == THREAD_REPORTER) {
 		pthread_join(libtrace->reporter_thread.tid, NULL);
 		libtrace_zero_thread(&libtrace->reporter_thread);
 	}
-
-	if (libtrace->keepalive_thread.type == THREAD_KEEPALIVE) {
-		pthread_join(libtrace->keepalive_thread.tid, NULL);
-		libtrace_zero_thread(&libtrace->keepalive_thread);
-	}
 	ASSERT_RET(pthread_mutex_lock(&libtrace->libtrace_lock), == 0);
 	libtrace_change_state(libtrace, STATE_NEW, false);
 	if (libtrace->perpkt_thread_states[THREAD_RUNNING] != 0) {
@@ -2103,6 +2652,12 @@ DLLEXPORT int trace_set_meta_packet_cb(libtrace_callback_set_t *cbset,
 	return 0;
 }
 
+DLLEXPORT int trace_set_tcp_payload_cb(libtrace_callback_set_t *cbset,
+                fn_cb_tcp_payload handler) {
+	cbset->message_tcp_payload = handler;
+	return 0;
+}
+
 DLLEXPORT int trace_set_first_packet_cb(libtrace_callback_set_t *cbset,
                 fn_cb_first_packet handler) {
 	cbset->message_first_packet = handler;
@@ -2127,6 +2682,12 @@ DLLEXPORT int trace_set_result_cb(libtrace_callback_set_t *cbset,
 	return 0;
 }
 
+DLLEXPORT int trace_set_result_batch_cb(libtrace_callback_set_t *cbset,
+                fn_cb_result_batch handler) {
+	cbset->message_result_batch = handler;
+	return 0;
+}
+
 DLLEXPORT int trace_set_user_message_cb(libtrace_callback_set_t *cbset,
                 fn_cb_usermessage handler) {
 	cbset->message_user = handler;
@@ -2232,6 +2793,7 @@ DLLEXPORT int trace_ppause(libtrace_t *libtrace)
 			fprintf(stderr, "Reporter thread is running, asking it to pause ...");
 		if (pthread_equal(pthread_self(), libtrace->reporter_thread.tid)) {
                         libtrace->combiner.pause(libtrace, &libtrace->combiner);
+                        flush_results(libtrace);
                         thread_change_state(libtrace, &libtrace->reporter_thread, THREAD_PAUSED, true);
                 
                 } else {
@@ -2368,6 +2930,12 @@ DLLEXPORT int trace_set_hasher(libtrace_t *trace, enum hasher_types type, fn_has
 					toeplitz_init_config(trace->hasher_data, 0);
                                         err = trace_get_err(trace);
 					return 0;
+				case HASHER_FRAGMENT:
+					trace->hasher = (fn_hasher) toeplitz_hash_fragment;
+					trace->hasher_data = calloc(1, sizeof(toeplitz_conf_t));
+					toeplitz_init_config(trace->hasher_data, 0);
+                                        err = trace_get_err(trace);
+					return 0;
 			}
 			return -1;
 		}
@@ -2440,15 +3008,9 @@ DLLEXPORT void trace_join(libtrace_t *libtrace) {
 		}
 	}
 
-	// Wait for the tick (keepalive) thread if it has been started
-	if (libtrace->keepalive_thread.type == THREAD_KEEPALIVE) {
-		libtrace_message_t msg = {0, {.uint64=0}, NULL};
-		msg.code = MESSAGE_DO_STOP;
-		trace_message_thread(libtrace, &libtrace->keepalive_thread, &msg);
-		pthread_join(libtrace->keepalive_thread.tid, NULL);
-	}
-
 	libtrace_change_state(libtrace, STATE_JOINED, true);
+	if (libtrace->config.latency_histograms & LATENCY_DUMP_ON_JOIN)
+		trace_dump_latency_histograms(libtrace, stderr);
 	print_memory_stats();
 }
 
@@ -2521,6 +3083,22 @@ DLLEXPORT int trace_post_reporter(libtrace_t *libtrace)
 	return trace_message_reporter(libtrace, (void *) &message);
 }
 
+/* Tells the reporter there are results to read, unless it has already been
+ * told and has not started reading yet */
+void notify_reporter(libtrace_t *libtrace)
+{
+	/* Pairs with the reporter clearing the flag before it reads, either
+	 * it sees our result or we see the flag cleared */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&libtrace->reporter_posted, __ATOMIC_RELAXED) ||
+	    __atomic_exchange_n(&libtrace->reporter_posted, 1,
+	                        __ATOMIC_SEQ_CST))
+		return;
+	if (trace_post_reporter(libtrace) < 0)
+		__atomic_store_n(&libtrace->reporter_posted, 0,
+		                 __ATOMIC_SEQ_CST);
+}
+
 DLLEXPORT int trace_message_perpkts(libtrace_t * libtrace, libtrace_message_t * message)
 {
 	int i;
@@ -2538,12 +3116,51 @@ DLLEXPORT int trace_message_perpkts(libtrace_t * libtrace, libtrace_message_t *
 	return -missed;
 }
 
+DLLEXPORT libtrace_thread_timer_t *trace_add_timer(libtrace_t *libtrace,
+		libtrace_thread_t *t, uint64_t delay, uint64_t period,
+		fn_cb_timer fn, void *data)
+{
+	libtrace_thread_timer_t *tt;
+
+	if (!t || t->type != THREAD_PERPKT || !t->timers || !fn ||
+			!pthread_equal(t->tid, pthread_self())) {
+		trace_set_err(libtrace, TRACE_ERR_THREAD, "trace_add_timer() "
+			"must be called from the processing thread itself");
+		return NULL;
+	}
+	tt = thread_add_timer(t, libtrace_message_queue_clock() +
+			delay * 1000000ULL, period * 1000000ULL, fn, data);
+	if (!tt)
+		trace_set_err(libtrace, TRACE_ERR_OUT_OF_MEMORY,
+			"Unable to allocate a timer in trace_add_timer()");
+	return tt;
+}
+
+DLLEXPORT int trace_cancel_timer(libtrace_t *libtrace, libtrace_thread_t *t,
+		libtrace_thread_timer_t *timer)
+{
+	if (!t || !timer || timer->thread != t ||
+			!pthread_equal(t->tid, pthread_self())) {
+		trace_set_err(libtrace, TRACE_ERR_THREAD, "trace_cancel_timer() "
+			"must be called from the thread that added the timer");
+		return -1;
+	}
+	/* A one shot timer that has fired is freed once its callback
+	 * returns */
+	if (!libtrace_timer_is_active(&timer->timer))
+		return -1;
+	libtrace_timer_wheel_cancel(t->timers, &timer->timer);
+	free(timer);
+	return 0;
+}
+
 /**
  * Publishes a result to the reduce queue
  * Should only be called by a perpkt thread, i.e. from a perpkt handler
  */
 DLLEXPORT void trace_publish_result(libtrace_t *libtrace, libtrace_thread_t *t, uint64_t key, libtrace_generic_t value, int type) {
 	libtrace_result_t res;
+	uint64_t begin = stage_begin(t);
 	res.type = type;
 	res.key = key;
 	res.value = value;
@@ -2552,9 +3169,27 @@ DLLEXPORT void trace_publish_result(libtrace_t *libtrace, libtrace_thread_t *t,
 		return;
 	}
 	libtrace->combiner.publish(libtrace, t->perpkt_num, &libtrace->combiner, &res);
+	if (libtrace->config.reporter_latency && t->timers)
+		result_latency_check(libtrace, t);
+	stage_end(t, LIBTRACE_STAGE_PUBLISH, begin);
 	return;
 }
 
+DLLEXPORT void *trace_alloc_result(libtrace_t *libtrace, libtrace_thread_t *t,
+		size_t size) {
+	int owner = -1;
+
+	/* Only the thread itself may use its own list */
+	if (t && t->type == THREAD_PERPKT &&
+			pthread_equal(t->tid, pthread_self()))
+		owner = t->perpkt_num;
+	return result_pool_alloc(libtrace->result_pool, owner, size);
+}
+
+DLLEXPORT void trace_free_result(libtrace_t *libtrace UNUSED, void *result) {
+	result_pool_free(result);
+}
+
 DLLEXPORT void trace_set_combiner(libtrace_t *trace, const libtrace_combine_t *combiner, libtrace_generic_t config){
 	if (combiner) {
 		trace->combiner = *combiner;
@@ -2677,6 +3312,27 @@ DLLEXPORT int trace_set_reporter_polling(libtrace_t *trace, bool polling) {
 	return 0;
 }
 
+DLLEXPORT int trace_set_reporter_latency(libtrace_t *trace, size_t msec) {
+	if (!trace_is_configurable(trace)) return -1;
+
+	trace->config.reporter_latency = msec;
+	return 0;
+}
+
+DLLEXPORT int trace_set_result_size(libtrace_t *trace, size_t size) {
+	if (!trace_is_configurable(trace)) return -1;
+
+	trace->config.result_size = size;
+	return 0;
+}
+
+DLLEXPORT int trace_set_wait_spin(libtrace_t *trace, size_t spin) {
+	if (!trace_is_configurable(trace)) return -1;
+
+	trace->config.wait_spin = spin;
+	return 0;
+}
+
 DLLEXPORT int trace_set_reporter_thold(libtrace_t *trace, size_t thold) {
 	if (!trace_is_configurable(trace)) return -1;
 
@@ -2691,6 +3347,53 @@ DLLEXPORT int trace_set_debug_state(libtrace_t *trace, bool debug_state) {
 	return 0;
 }
 
+DLLEXPORT int trace_set_reassembly_timeout(libtrace_t *trace,
+		size_t timeout_ms) {
+	if (!trace_is_configurable(trace)) return -1;
+
+	trace->config.reassembly_timeout = timeout_ms;
+	return 0;
+}
+
+DLLEXPORT int trace_set_tcp_max_streams(libtrace_t *trace,
+		size_t max_streams) {
+	if (!trace_is_configurable(trace)) return -1;
+
+	trace->config.tcp_max_streams = max_streams;
+	return 0;
+}
+
+DLLEXPORT int trace_set_tcp_memory_limit(libtrace_t *trace, size_t bytes) {
+	if (!trace_is_configurable(trace)) return -1;
+
+	trace->config.tcp_memory_limit = bytes;
+	return 0;
+}
+
+DLLEXPORT int trace_set_tcp_idle_timeout(libtrace_t *trace,
+		size_t timeout_ms) {
+	if (!trace_is_configurable(trace)) return -1;
+
+	trace->config.tcp_idle_timeout = timeout_ms;
+	return 0;
+}
+
+DLLEXPORT int trace_set_latency_histograms(libtrace_t *trace, int options) {
+	if (!trace_is_configurable(trace)) return -1;
+
+#ifndef ENABLE_LATENCY_HISTOGRAMS
+	if (options) {
+		trace_set_err(trace, TRACE_ERR_OPTION_UNAVAIL, "libtrace was "
+			"not configured with --enable-latency-histograms");
+		return -1;
+	}
+#endif
+	if (options & (LATENCY_DUMP_ON_JOIN | LATENCY_DUMP_ON_SIGUSR1))
+		options |= LATENCY_RECORD;
+	trace->config.latency_histograms = options;
+	return 0;
+}
+
 static bool config_bool_parse(char *value) {
 	if (strcmp(value, "true") == 0)
 		return true;
@@ -2781,9 +3484,33 @@ static int config_string(struct user_configuration *uc, char *key, char *value)
 	} else if (strcmp(key, "reporter_thold") == 0
 	           || strcmp(key, "rt") == 0) {
 		uc->reporter_thold = strtoll(value, NULL, 10);
+	} else if (strcmp(key, "reporter_latency") == 0
+	           || strcmp(key, "rl") == 0) {
+		uc->reporter_latency = strtoll(value, NULL, 10);
+	} else if (strcmp(key, "result_size") == 0
+	           || strcmp(key, "rs") == 0) {
+		uc->result_size = strtoll(value, NULL, 10);
+	} else if (strcmp(key, "wait_spin") == 0
+	           || strcmp(key, "ws") == 0) {
+		uc->wait_spin = strtoll(value, NULL, 10);
 	} else if (strcmp(key, "debug_state") == 0
 	           || strcmp(key, "ds") == 0) {
 		uc->debug_state = config_bool_parse(value);
+	} else if (strcmp(key, "reassembly_timeout") == 0
+	           || strcmp(key, "rto") == 0) {
+		uc->reassembly_timeout = strtoll(value, NULL, 10);
+	} else if (strcmp(key, "tcp_max_streams") == 0
+	           || strcmp(key, "tms") == 0) {
+		uc->tcp_max_streams = strtoll(value, NULL, 10);
+	} else if (strcmp(key, "tcp_memory_limit") == 0
+	           || strcmp(key, "tml") == 0) {
+		uc->tcp_memory_limit = strtoll(value, NULL, 10);
+	} else if (strcmp(key, "tcp_idle_timeout") == 0
+	           || strcmp(key, "tit") == 0) {
+		uc->tcp_idle_timeout = strtoll(value, NULL, 10);
+	} else if (strcmp(key, "latency_histograms") == 0
+	           || strcmp(key, "lh") == 0) {
+		uc->latency_histograms = strtoll(value, NULL, 10);
 	} else if (strcmp(key, "coremap") == 0) {
 		return config_coremap_parse(value, uc);
 	} else {
@@ -0,0 +1,123 @@
+/*
+ * This file is part of libtrace
+ *
+ * Copyright (c) 2007 The University of Waikato, Hamilton, New Zealand.
+ *
+ * All rights reserved.
+ *
+ * This code has been developed by the University of Waikato WAND
+ * research group. For further information please see http://www.wand.net.nz/
+ *
+ * libtrace is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * libtrace is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libtrace; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * $Id$
+ *
+ */
+
+/* Measures how many results per second can be passed from the per packet
+ * threads of a parallel trace to the reporter through each of the provided
+ * combiners. Every packet of a synthetic trace is published as a result */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "libtrace.h"
+#include "libtrace_parallel.h"
+#include "bench.h"
+
+static libtrace_packet_t *per_packet(libtrace_t *trace, libtrace_thread_t *t,
+		void *global, void *tls, libtrace_packet_t *packet) {
+	(void)global;
+	(void)tls;
+
+	trace_publish_result(trace, t, trace_packet_get_order(packet),
+			(libtrace_generic_t){.sint = trace_get_wire_length(packet)},
+			RESULT_USER);
+	return packet;
+}
+
+static void report_cb(libtrace_t *trace, libtrace_thread_t *sender,
+		void *global, void *tls, libtrace_result_t *res) {
+	long *results = (long *)global;
+	(void)trace;
+	(void)sender;
+	(void)tls;
+
+	if (res->type == RESULT_USER)
+		(*results) ++;
+}
+
+static int bench_combiner(const char *name, const libtrace_combine_t *combiner,
+		const char *uri, int threads, int len, long count) {
+	libtrace_callback_set_t *processing, *reporter;
+	libtrace_t *trace;
+	long results = 0;
+	double start;
+
+	processing = trace_create_callback_set();
+	trace_set_packet_cb(processing, per_packet);
+	reporter = trace_create_callback_set();
+	trace_set_result_cb(reporter, report_cb);
+
+	trace = trace_create(uri);
+	trace_set_perpkt_threads(trace, threads);
+	trace_set_combiner(trace, combiner, (libtrace_generic_t){0});
+
+	start = now();
+	if (trace_is_err(trace) ||
+			trace_pstart(trace, &results, processing, reporter)) {
+		trace_perror(trace, "%s", uri);
+		trace_destroy(trace);
+		return -1;
+	}
+	trace_join(trace);
+	bench_report("combiner", name, len, results, now() - start);
+
+	trace_destroy(trace);
+	trace_destroy_callback_set(processing);
+	trace_destroy_callback_set(reporter);
+	return (results == count) ? 0 : -1;
+}
+
+int main(int argc, char *argv[]) {
+	const char *path = "bench-combiner.out";
+	char uri[1024];
+	long count = 1000000;
+	int threads = 4;
+	int len = 64;
+	int error = 0;
+
+	if (argc > 1)
+		count = atol(argv[1]);
+	if (argc > 2)
+		threads = atoi(argv[2]);
+	if (argc > 3)
+		path = argv[3];
+
+	snprintf(uri, sizeof(uri), "pcapfile:%s", path);
+	if (bench_make_trace(uri, count, len, 0) < 0)
+		return 1;
+
+	error |= bench_combiner("unordered", &combiner_unordered, uri,
+			threads, len, count);
+	error |= bench_combiner("ordered", &combiner_ordered, uri, threads,
+			len, count);
+	error |= bench_combiner("sorted", &combiner_sorted, uri, threads,
+			len, count);
+
+	unlink(path);
+	return error ? 1 : 0;
+}
@@ -0,0 +1,108 @@
+/*
+ * This file is part of libtrace
+ *
+ * Copyright (c) 2007 The University of Waikato, Hamilton, New Zealand.
+ *
+ * All rights reserved.
+ *
+ * This code has been developed by the University of Waikato WAND
+ * research group. For further information please see http://www.wand.net.nz/
+ *
+ * libtrace is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * libtrace is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libtrace; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * $Id$
+ *
+ */
+
+/* Measures how many packet copies per second can be made using
+ * trace_copy_packet(), trace_copy_packet_into() and a packet pool, for
+ * small and full sized ethernet frames */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "libtrace.h"
+#include "bench.h"
+
+#define POOL_SIZE 64
+
+static void bench_copy(libtrace_packet_t *packet, int len, long count) {
+	libtrace_packet_t *copy;
+	double start = now();
+	long i;
+
+	for (i = 0; i < count; i++) {
+		copy = trace_copy_packet(packet);
+		trace_destroy_packet(copy);
+	}
+	bench_report("copy", "copy", len, count, now() - start);
+}
+
+static void bench_copy_into(libtrace_packet_t *packet, int len, long count) {
+	libtrace_packet_t *copy = trace_create_packet();
+	double start = now();
+	long i;
+
+	for (i = 0; i < count; i++) {
+		trace_copy_packet_into(copy, packet);
+	}
+	bench_report("copy", "copy_into", len, count, now() - start);
+	trace_destroy_packet(copy);
+}
+
+static void bench_pool(libtrace_packet_t *packet, int len, long count) {
+	libtrace_packet_pool_t *pool = trace_create_packet_pool(POOL_SIZE);
+	libtrace_packet_t *held[POOL_SIZE];
+	double start = now();
+	long i;
+	int j;
+
+	/* Hold on to a batch of copies at a time, as an application queueing
+	 * packets for later processing would */
+	for (i = 0; i < count; i += POOL_SIZE) {
+		for (j = 0; j < POOL_SIZE; j++)
+			held[j] = trace_packet_pool_copy(pool, packet);
+		for (j = 0; j < POOL_SIZE; j++)
+			trace_packet_pool_release(pool, held[j]);
+	}
+	bench_report("copy", "pool", len, i, now() - start);
+	trace_destroy_packet_pool(pool);
+}
+
+int main(int argc, char *argv[]) {
+	int sizes[] = {64, 1500};
+	unsigned char frame[1500];
+	libtrace_packet_t *packet;
+	long count = 1000000;
+	unsigned int i;
+
+	if (argc > 1)
+		count = atol(argv[1]);
+
+	memset(frame, 0, sizeof(frame));
+	/* Enough of an ethernet header to look like IPv4 */
+	frame[12] = 0x08;
+
+	packet = trace_create_packet();
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		trace_construct_packet(packet, TRACE_TYPE_ETH, frame, sizes[i]);
+		bench_copy(packet, sizes[i], count);
+		bench_copy_into(packet, sizes[i], count);
+		bench_pool(packet, sizes[i], count);
+	}
+	trace_destroy_packet(packet);
+
+	return 0;
+}
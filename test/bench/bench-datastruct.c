@@ -0,0 +1,140 @@
+/*
+ * This file is part of libtrace
+ *
+ * Copyright (c) 2007 The University of Waikato, Hamilton, New Zealand.
+ *
+ * All rights reserved.
+ *
+ * This code has been developed by the University of Waikato WAND
+ * research group. For further information please see http://www.wand.net.nz/
+ *
+ * libtrace is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * libtrace is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libtrace; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * $Id$
+ *
+ */
+
+/* Measures the throughput of the data structures used to move packets
+ * between the threads of a parallel trace: the ring buffer, with a producer
+ * and consumer thread, and the object cache that recycles packets */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "libtrace.h"
+#include "data-struct/ring_buffer.h"
+#include "data-struct/object_cache.h"
+#include "bench.h"
+
+#define RINGBUFFER_SIZE 1024
+#define BULK 32
+#define OBJECT_SIZE 64
+
+struct ring_args {
+	libtrace_ringbuffer_t rb;
+	long count;
+	int bulk;
+};
+
+static void *producer(void *a) {
+	struct ring_args *args = (struct ring_args *)a;
+	void *values[BULK];
+	long i = 0;
+	size_t j, nb;
+
+	while (i < args->count) {
+		if (!args->bulk) {
+			libtrace_ringbuffer_write(&args->rb,
+					(void *)(uintptr_t)(i + 1));
+			i ++;
+			continue;
+		}
+		nb = BULK;
+		if (nb > (size_t)(args->count - i))
+			nb = args->count - i;
+		for (j = 0; j < nb; j++)
+			values[j] = (void *)(uintptr_t)(i + j + 1);
+		i += libtrace_ringbuffer_write_bulk(&args->rb, values, nb, nb);
+	}
+	return NULL;
+}
+
+static void bench_ring(const char *name, int mode, int bulk, long count) {
+	struct ring_args args;
+	void *values[BULK];
+	pthread_t thread;
+	double start;
+	long i = 0;
+
+	libtrace_ringbuffer_init(&args.rb, RINGBUFFER_SIZE, mode);
+	args.count = count;
+	args.bulk = bulk;
+
+	start = now();
+	pthread_create(&thread, NULL, producer, &args);
+	while (i < count) {
+		if (bulk)
+			i += libtrace_ringbuffer_read_bulk(&args.rb, values,
+					BULK, 1);
+		else if (libtrace_ringbuffer_read(&args.rb))
+			i ++;
+	}
+	pthread_join(thread, NULL);
+	bench_report("datastruct", name, 0, count, now() - start);
+
+	libtrace_ringbuffer_destroy(&args.rb);
+}
+
+static void *alloc_object(void) {
+	return malloc(OBJECT_SIZE);
+}
+
+static void bench_ocache(const char *name, size_t batch, long count) {
+	libtrace_ocache_t oc;
+	void *values[BULK];
+	double start;
+	long i;
+
+	libtrace_ocache_init(&oc, alloc_object, free, BULK, RINGBUFFER_SIZE,
+			false);
+
+	start = now();
+	for (i = 0; i < count; i += batch) {
+		libtrace_ocache_alloc(&oc, values, batch, batch);
+		libtrace_ocache_free(&oc, values, batch, batch);
+	}
+	bench_report("datastruct", name, OBJECT_SIZE, i, now() - start);
+
+	libtrace_ocache_unregister_thread(&oc);
+	libtrace_ocache_destroy(&oc);
+}
+
+int main(int argc, char *argv[]) {
+	long count = 10000000;
+
+	if (argc > 1)
+		count = atol(argv[1]);
+
+	bench_ring("ringbuffer_blocking", LIBTRACE_RINGBUFFER_BLOCKING, 0,
+			count);
+	bench_ring("ringbuffer_polling", LIBTRACE_RINGBUFFER_POLLING, 0,
+			count);
+	bench_ring("ringbuffer_bulk", LIBTRACE_RINGBUFFER_POLLING, 1, count);
+	bench_ocache("ocache", 1, count);
+	bench_ocache("ocache_bulk", BULK, count);
+	return 0;
+}
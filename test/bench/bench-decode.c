@@ -0,0 +1,207 @@
+/*
+ * This file is part of libtrace
+ *
+ * Copyright (c) 2007 The University of Waikato, Hamilton, New Zealand.
+ *
+ * All rights reserved.
+ *
+ * This code has been developed by the University of Waikato WAND
+ * research group. For further information please see http://www.wand.net.nz/
+ *
+ * libtrace is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * libtrace is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libtrace; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * $Id$
+ *
+ */
+
+/* Measures the cost of decoding packets: finding the layer 3 and transport
+ * headers, extracting flow keys, checking checksums, hashing with the toeplitz hashers and
+ * applying BPF filters and filter sets.
+ *
+ * libtrace caches the headers it finds, so each operation is done on a
+ * fresh copy of one of a set of synthetic packets. The "copy" case measures
+ * just that copy, and should be subtracted from the others to get the cost
+ * of the operation itself. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "libtrace.h"
+#include "hash_toeplitz.h"
+#include "bench.h"
+
+#define NB_PACKETS 256
+#define BATCH 16
+
+enum op {
+	OP_COPY,
+	OP_LAYER3,
+	OP_TRANSPORT,
+	OP_PORTS,
+	OP_CHECKSUM,
+	OP_TOEPLITZ_UNI,
+	OP_TOEPLITZ_BI,
+	OP_FILTER,
+	OP_FILTER_SET,
+};
+
+static libtrace_packet_t *packets[NB_PACKETS];
+static toeplitz_conf_t uni, bi;
+static libtrace_filter_t *filter;
+static libtrace_filter_set_t *filter_set;
+
+static const char *filters[] = {
+	"tcp",
+	"udp port 53",
+	"net 10.0.0.0/8 and tcp port 80",
+	"vlan",
+	"ip6",
+};
+
+static uint64_t apply(enum op op, libtrace_packet_t *packet) {
+	uint64_t matches[1];
+	uint16_t ethertype, csum;
+	uint8_t proto;
+	uint32_t rem;
+
+	switch (op) {
+		case OP_COPY:
+			return 0;
+		case OP_LAYER3:
+			return (uintptr_t)trace_get_layer3(packet, &ethertype,
+					&rem);
+		case OP_TRANSPORT:
+			return (uintptr_t)trace_get_transport(packet, &proto,
+					&rem);
+		case OP_PORTS:
+			return trace_get_source_port(packet) ^
+				trace_get_destination_port(packet);
+		case OP_CHECKSUM:
+			return (uintptr_t)trace_checksum_transport(packet,
+					&csum) ^ csum;
+		case OP_TOEPLITZ_UNI:
+			return toeplitz_hash_packet(packet, &uni);
+		case OP_TOEPLITZ_BI:
+			return toeplitz_hash_packet(packet, &bi);
+		case OP_FILTER:
+			return trace_apply_filter(filter, packet);
+		case OP_FILTER_SET:
+			trace_apply_filter_set(filter_set, packet, matches);
+			return matches[0];
+	}
+	return 0;
+}
+
+static void bench_op(const char *name, enum op op, int len, long count) {
+	libtrace_packet_t *scratch = trace_create_packet();
+	volatile uint64_t sink = 0;
+	double start;
+	long i;
+
+	/* Filters are compiled the first time they are used */
+	trace_copy_packet_into(scratch, packets[0]);
+	sink += apply(op, scratch);
+
+	start = now();
+	for (i = 0; i < count; i++) {
+		trace_copy_packet_into(scratch, packets[i % NB_PACKETS]);
+		sink += apply(op, scratch);
+	}
+	bench_report("decode", name, len, count, now() - start);
+	trace_destroy_packet(scratch);
+}
+
+static void bench_flow_keys(int len, long count) {
+	static uint8_t ip_version[BATCH], protocol[BATCH];
+	static uint32_t src_ip4[BATCH], dst_ip4[BATCH];
+	static uint8_t src_ip6[BATCH][16], dst_ip6[BATCH][16];
+	static uint16_t src_port[BATCH], dst_port[BATCH];
+	static uint32_t ip_length[BATCH], wire_length[BATCH];
+	static uint64_t timestamp[BATCH];
+	libtrace_flow_keys_t keys = {
+		ip_version, protocol, src_ip4, dst_ip4, src_ip6, dst_ip6,
+		src_port, dst_port, ip_length, wire_length, timestamp
+	};
+	libtrace_packet_t *batch[BATCH];
+	double start;
+	long i;
+	int j;
+
+	for (j = 0; j < BATCH; j++)
+		batch[j] = trace_create_packet();
+
+	start = now();
+	for (i = 0; i < count; i += BATCH) {
+		for (j = 0; j < BATCH; j++)
+			trace_copy_packet_into(batch[j],
+					packets[(i + j) % NB_PACKETS]);
+		trace_get_flow_keys(batch, BATCH, &keys);
+	}
+	bench_report("decode", "flow_keys", len, i, now() - start);
+
+	for (j = 0; j < BATCH; j++)
+		trace_destroy_packet(batch[j]);
+}
+
+int main(int argc, char *argv[]) {
+	int sizes[] = {80, 1500};
+	unsigned char frame[1500];
+	long count = 10000000;
+	unsigned int i, j;
+
+	if (argc > 1)
+		count = atol(argv[1]);
+
+	toeplitz_init_config(&uni, false);
+	toeplitz_init_config(&bi, true);
+
+	for (j = 0; j < NB_PACKETS; j++)
+		packets[j] = trace_create_packet();
+
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		for (j = 0; j < NB_PACKETS; j++) {
+			trace_construct_packet(packets[j],
+					bench_make_frame(frame, sizes[i], j),
+					frame, sizes[i]);
+		}
+
+		bench_op("copy", OP_COPY, sizes[i], count);
+		bench_op("layer3", OP_LAYER3, sizes[i], count);
+		bench_op("transport", OP_TRANSPORT, sizes[i], count);
+		bench_op("ports", OP_PORTS, sizes[i], count);
+		bench_flow_keys(sizes[i], count);
+		bench_op("checksum", OP_CHECKSUM, sizes[i], count);
+		bench_op("toeplitz_uni", OP_TOEPLITZ_UNI, sizes[i], count);
+		bench_op("toeplitz_bi", OP_TOEPLITZ_BI, sizes[i], count);
+
+		/* BPF filters need libpcap, so these may not be available */
+		filter = trace_create_filter(filters[2]);
+		if (filter) {
+			bench_op("filter", OP_FILTER, sizes[i], count);
+			trace_destroy_filter(filter);
+		}
+		filter_set = trace_create_filter_set();
+		if (filter_set) {
+			for (j = 0; j < sizeof(filters) / sizeof(filters[0]); j++)
+				trace_filter_set_add(filter_set, filters[j]);
+			bench_op("filter_set", OP_FILTER_SET, sizes[i], count);
+			trace_destroy_filter_set(filter_set);
+		}
+	}
+
+	for (j = 0; j < NB_PACKETS; j++)
+		trace_destroy_packet(packets[j]);
+	return 0;
+}
@@ -0,0 +1,104 @@
+/*
+ * This file is part of libtrace
+ *
+ * Copyright (c) 2007 The University of Waikato, Hamilton, New Zealand.
+ *
+ * All rights reserved.
+ *
+ * This code has been developed by the University of Waikato WAND
+ * research group. For further information please see http://www.wand.net.nz/
+ *
+ * libtrace is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * libtrace is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libtrace; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * $Id$
+ *
+ */
+
+/* Measures how many packets per second can be read from pcap, pcapng and
+ * ERF files, both uncompressed and gzip compressed, for small and full
+ * sized ethernet frames. The traces are generated beforehand and removed
+ * afterwards */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "libtrace.h"
+#include "bench.h"
+
+static int bench_read(const char *format, const char *path, int level,
+		int len, long count) {
+	libtrace_packet_t *packet;
+	libtrace_t *trace;
+	char uri[1024];
+	char name[64];
+	double start;
+	long read = 0;
+
+	snprintf(uri, sizeof(uri), "%s:%s", format, path);
+	if (bench_make_trace(uri, count, len, level) < 0)
+		return -1;
+
+	/* Opening the file is part of the cost, but the first read is where
+	 * most of the setup happens anyway */
+	start = now();
+	trace = trace_create(uri);
+	if (trace_is_err(trace) || trace_start(trace) == -1) {
+		trace_perror(trace, "%s", uri);
+		trace_destroy(trace);
+		unlink(path);
+		return -1;
+	}
+	packet = trace_create_packet();
+	while (trace_read_packet(trace, packet) > 0) {
+		/* pcapng has a couple of meta-data blocks at the start */
+		if (!IS_LIBTRACE_META_PACKET(packet))
+			read ++;
+	}
+	if (trace_is_err(trace))
+		trace_perror(trace, "%s", uri);
+	trace_destroy_packet(packet);
+	trace_destroy(trace);
+
+	snprintf(name, sizeof(name), "%s-%s", format, level ? "gzip" : "none");
+	bench_report("read", name, len, read, now() - start);
+	unlink(path);
+	return (read == count) ? 0 : -1;
+}
+
+int main(int argc, char *argv[]) {
+	const char *formats[] = {"pcapfile", "pcapng", "erf"};
+	int sizes[] = {64, 1500};
+	const char *path = "bench-read.out";
+	long count = 1000000;
+	unsigned int i, j;
+	int level;
+
+	if (argc > 1)
+		count = atol(argv[1]);
+	if (argc > 2)
+		path = argv[2];
+
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		for (j = 0; j < sizeof(formats) / sizeof(formats[0]); j++) {
+			for (level = 0; level < 2; level++) {
+				if (bench_read(formats[j], path, level,
+						sizes[i], count) < 0)
+					return 1;
+			}
+		}
+	}
+	return 0;
+}
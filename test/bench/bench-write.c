@@ -0,0 +1,118 @@
+/*
+ * This file is part of libtrace
+ *
+ * Copyright (c) 2007 The University of Waikato, Hamilton, New Zealand.
+ *
+ * All rights reserved.
+ *
+ * This code has been developed by the University of Waikato WAND
+ * research group. For further information please see http://www.wand.net.nz/
+ *
+ * libtrace is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * libtrace is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libtrace; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * $Id$
+ *
+ */
+
+/* Measures how many packets per second can be written to pcap, pcapng and
+ * ERF files, both uncompressed and gzip compressed, for small and full
+ * sized ethernet frames */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "libtrace.h"
+#include "bench.h"
+
+static int bench_write(const char *format, const char *path, int compress,
+		libtrace_packet_t *packet, int len, long count) {
+	libtrace_out_t *out;
+	char uri[1024];
+	char name[64];
+	int type = TRACE_OPTION_COMPRESSTYPE_ZLIB;
+	int level = 1;
+	double start;
+	long i;
+
+	snprintf(uri, sizeof(uri), "%s:%s", format, path);
+	out = trace_create_output(uri);
+	if (compress) {
+		trace_config_output(out, TRACE_OPTION_OUTPUT_COMPRESSTYPE,
+				&type);
+		trace_config_output(out, TRACE_OPTION_OUTPUT_COMPRESS, &level);
+	}
+	if (trace_is_err_output(out) || trace_start_output(out) == -1) {
+		trace_perror_output(out, "%s", uri);
+		trace_destroy_output(out);
+		return -1;
+	}
+
+	/* Closing the file is part of the cost, as that is where any
+	 * buffered data ends up being written */
+	start = now();
+	for (i = 0; i < count; i++) {
+		if (trace_write_packet(out, packet) == -1) {
+			trace_perror_output(out, "%s", uri);
+			break;
+		}
+	}
+	trace_destroy_output(out);
+	snprintf(name, sizeof(name), "%s-%s", format,
+			compress ? "gzip" : "none");
+	bench_report("write", name, len, i, now() - start);
+	unlink(path);
+	return 0;
+}
+
+int main(int argc, char *argv[]) {
+	const char *formats[] = {"pcapfile", "pcapng", "erf"};
+	int sizes[] = {64, 1500};
+	unsigned char frame[1500];
+	const char *path = "bench-write.out";
+	libtrace_packet_t *packet;
+	long count = 1000000;
+	unsigned int i, j;
+	int compress;
+
+	if (argc > 1)
+		count = atol(argv[1]);
+	if (argc > 2)
+		path = argv[2];
+
+	/* Something for the compressor to work on */
+	for (i = 0; i < sizeof(frame); i++)
+		frame[i] = (unsigned char)(i % 61);
+	/* Enough of an ethernet header to look like IPv4 */
+	frame[12] = 0x08;
+	frame[13] = 0x00;
+
+	packet = trace_create_packet();
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		trace_construct_packet(packet, TRACE_TYPE_ETH, frame, sizes[i]);
+		for (j = 0; j < sizeof(formats) / sizeof(formats[0]); j++) {
+			for (compress = 0; compress < 2; compress++) {
+				if (bench_write(formats[j], path, compress,
+						packet, sizes[i], count) < 0) {
+					trace_destroy_packet(packet);
+					return 1;
+				}
+			}
+		}
+	}
+	trace_destroy_packet(packet);
+
+	return 0;
+}
@@ -0,0 +1,183 @@
+/*
+ * This file is part of libtrace
+ *
+ * Copyright (c) 2007 The University of Waikato, Hamilton, New Zealand.
+ *
+ * All rights reserved.
+ *
+ * This code has been developed by the University of Waikato WAND
+ * research group. For further information please see http://www.wand.net.nz/
+ *
+ * libtrace is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * libtrace is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libtrace; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * $Id$
+ *
+ */
+
+/* Helpers shared by the benchmarks: timing, reporting and the construction
+ * of synthetic traffic, so that no captured traces are needed */
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "libtrace.h"
+
+static inline double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+/* Every benchmark reports one CSV line per case, in the same columns, so
+ * that the output of run-bench.sh can be compared between releases:
+ *
+ *   bench,case,bytes,packets,packets_per_sec,ns_per_packet
+ *
+ * 'packets' is the number of operations timed, which is not always a
+ * packet (e.g. a ring buffer entry) but is always what the rate refers to.
+ */
+static inline void bench_report(const char *bench, const char *name,
+		int bytes, long count, double elapsed) {
+	if (elapsed <= 0)
+		elapsed = 1e-9;
+	printf("%s,%s,%d,%ld,%.0f,%.2f\n", bench, name, bytes, count,
+			count / elapsed, elapsed * 1e9 / (count ? count : 1));
+	fflush(stdout);
+}
+
+/* A cheap pseudo-random sequence, so that every run sees the same traffic */
+static inline uint32_t bench_rand(uint32_t *state) {
+	*state = *state * 1103515245 + 12345;
+	return *state >> 8;
+}
+
+/* Fills in a synthetic frame of the given length, returning the link type.
+ * The frames cycle through IPv4 TCP, IPv4 UDP, VLAN tagged IPv4 TCP and
+ * IPv6 UDP, with the addresses and ports varied so that hashers and filters
+ * see a spread of flows. len must be at least 80 bytes. */
+static inline libtrace_linktype_t bench_make_frame(unsigned char *frame,
+		int len, long index) {
+	uint32_t state = (uint32_t)index * 2654435761u;
+	uint32_t flow = bench_rand(&state);
+	int kind = index % 4;
+	int l3 = 14;
+	int l4;
+	int iplen;
+
+	memset(frame, 0, len);
+	frame[0] = 0x02;
+	frame[6] = 0x02;
+	frame[11] = flow & 0xff;
+
+	if (kind == 2) {
+		/* 802.1Q tag */
+		frame[12] = 0x81;
+		frame[14] = (flow >> 8) & 0x0f;
+		frame[15] = flow & 0xff;
+		l3 = 18;
+	}
+
+	if (kind == 3) {
+		frame[l3 - 2] = 0x86;
+		frame[l3 - 1] = 0xdd;
+		iplen = len - l3 - 40;
+		frame[l3] = 0x60;
+		frame[l3 + 4] = (iplen >> 8) & 0xff;
+		frame[l3 + 5] = iplen & 0xff;
+		frame[l3 + 6] = 17;
+		frame[l3 + 7] = 64;
+		frame[l3 + 8] = 0x20;
+		frame[l3 + 9] = 0x01;
+		memcpy(&frame[l3 + 20], &flow, sizeof(flow));
+		frame[l3 + 24] = 0x20;
+		frame[l3 + 25] = 0x01;
+		frame[l3 + 39] = index & 0xff;
+		l4 = l3 + 40;
+	} else {
+		frame[l3 - 2] = 0x08;
+		frame[l3 - 1] = 0x00;
+		iplen = len - l3;
+		frame[l3] = 0x45;
+		frame[l3 + 2] = (iplen >> 8) & 0xff;
+		frame[l3 + 3] = iplen & 0xff;
+		frame[l3 + 8] = 64;
+		frame[l3 + 9] = (kind == 1) ? 17 : 6;
+		frame[l3 + 12] = 10;
+		memcpy(&frame[l3 + 13], &flow, 3);
+		frame[l3 + 16] = 192;
+		frame[l3 + 17] = 168;
+		frame[l3 + 18] = (index >> 8) & 0xff;
+		frame[l3 + 19] = index & 0xff;
+		l4 = l3 + 20;
+	}
+
+	/* Source port varies with the flow, destination is a well known one */
+	frame[l4] = 0x80 | ((flow >> 16) & 0x7f);
+	frame[l4 + 1] = (flow >> 24) & 0xff;
+	frame[l4 + 2] = 0;
+	frame[l4 + 3] = (index % 3 == 0) ? 80 : 53;
+	if (frame[l3 + 9] == 6 && kind != 3) {
+		frame[l4 + 12] = 0x50;		/* Data offset */
+		frame[l4 + 13] = 0x10;		/* ACK */
+	} else {
+		frame[l4 + 4] = ((len - l4) >> 8) & 0xff;
+		frame[l4 + 5] = (len - l4) & 0xff;
+	}
+	return TRACE_TYPE_ETH;
+}
+
+/* Writes a synthetic trace of count frames of len bytes to uri, returning
+ * -1 on error. level is the gzip level to use, or 0 for none */
+static inline int bench_make_trace(const char *uri, long count, int len,
+		int level) {
+	int type = TRACE_OPTION_COMPRESSTYPE_ZLIB;
+	libtrace_packet_t *packet;
+	libtrace_out_t *out;
+	unsigned char *frame;
+	long i;
+
+	out = trace_create_output(uri);
+	if (level > 0) {
+		trace_config_output(out, TRACE_OPTION_OUTPUT_COMPRESSTYPE,
+				&type);
+		trace_config_output(out, TRACE_OPTION_OUTPUT_COMPRESS, &level);
+	}
+	if (trace_is_err_output(out) || trace_start_output(out) == -1) {
+		trace_perror_output(out, "%s", uri);
+		trace_destroy_output(out);
+		return -1;
+	}
+
+	frame = malloc(len);
+	packet = trace_create_packet();
+	for (i = 0; i < count; i++) {
+		trace_construct_packet(packet,
+				bench_make_frame(frame, len, i), frame, len);
+		if (trace_write_packet(out, packet) == -1) {
+			trace_perror_output(out, "%s", uri);
+			break;
+		}
+	}
+	trace_destroy_packet(packet);
+	trace_destroy_output(out);
+	free(frame);
+	return (i == count) ? 0 : -1;
+}
+
+#endif
@@ -0,0 +1,88 @@
+#!/bin/sh
+
+# Runs every benchmark and collects the results into a single CSV file, with
+# each line tagged by the git revision that was measured, e.g.
+#
+#   ./run-bench.sh -o results-4.0.20.csv
+#
+# Two result files can then be compared, which prints the change in
+# ns/packet for every case that appears in both:
+#
+#   ./run-bench.sh -c results-4.0.19.csv results-4.0.20.csv
+#
+# The number of packets used by each benchmark is scaled by -s, which is
+# handy for a quick check (e.g. -s 0.1) or for more stable numbers on a
+# fast machine.
+
+usage() {
+	echo "usage: $0 [-o output.csv] [-s scale] [benchmark ...]"
+	echo "       $0 -c old.csv new.csv"
+	exit 1
+}
+
+compare() {
+	# Joins the two files on bench,case,bytes
+	awk -F, '
+		FNR == 1 { next }
+		NR == FNR { old[$2 "," $3 "," $4] = $7; next }
+		($2 "," $3 "," $4) in old {
+			key = $2 "," $3 "," $4
+			change = (old[key] > 0) ? ($7 - old[key]) * 100 / old[key] : 0
+			printf "%-40s %10.2f %10.2f %+8.1f%%\n", key, old[key], $7, change
+		}' "$1" "$2"
+}
+
+OUTPUT=bench-results.csv
+SCALE=1
+while getopts "o:s:c" opt; do
+	case $opt in
+		o) OUTPUT=$OPTARG ;;
+		s) SCALE=$OPTARG ;;
+		c) COMPARE=1 ;;
+		*) usage ;;
+	esac
+done
+shift $((OPTIND - 1))
+
+if [ -n "$COMPARE" ]; then
+	[ $# -eq 2 ] || usage
+	printf "%-40s %10s %10s %9s\n" "bench,case,bytes" "old ns/pkt" "new ns/pkt" "change"
+	compare "$1" "$2"
+	exit 0
+fi
+
+# Benchmark and the number of packets it uses at a scale of 1
+BENCHMARKS="bench-read:1000000 bench-decode:10000000
+	bench-datastruct:10000000 bench-combiner:1000000
+	bench-write:1000000 bench-copy:1000000"
+if [ $# -gt 0 ]; then
+	WANTED="$*"
+fi
+
+libdir=../../lib/.libs:../../libpacketdump/.libs
+export LD_LIBRARY_PATH="$libdir:/usr/local/lib/"
+export DYLD_LIBRARY_PATH="${libdir}"
+
+REVISION=$(git rev-parse --short HEAD 2>/dev/null || echo unknown)
+
+echo "revision,bench,case,bytes,packets,packets_per_sec,ns_per_packet" > "$OUTPUT"
+for entry in $BENCHMARKS; do
+	name=${entry%%:*}
+	count=$(awk "BEGIN { printf \"%d\", ${entry#*:} * $SCALE }")
+	if [ -n "$WANTED" ]; then
+		case " $WANTED " in
+			*" $name "*) ;;
+			*) continue ;;
+		esac
+	fi
+	if [ ! -x "./$name" ]; then
+		echo "$name has not been built, skipping" >&2
+		continue
+	fi
+	echo "Running $name" >&2
+	if ! "./$name" "$count" | sed "s/^/$REVISION,/" >> "$OUTPUT"; then
+		echo "$name failed" >&2
+	fi
+done
+
+cat "$OUTPUT"
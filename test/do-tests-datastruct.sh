@@ -21,6 +21,14 @@ echo Testing deque
 do_test ./test-datastruct-deque
 echo Testing ringbuffer
 do_test ./test-datastruct-ringbuffer
+echo Testing flow table
+do_test ./test-datastruct-flowtable
+echo Testing sketches
+do_test ./test-datastruct-sketch
+echo Testing message queue
+do_test ./test-datastruct-messagequeue
+echo Testing timer wheel
+do_test ./test-datastruct-timerwheel
 echo
 echo "Tests passed: $OK"
 echo "Tests failed: $FAIL"
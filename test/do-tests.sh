@@ -72,6 +72,11 @@ echo \* Read pcapng
 do_test ./test-format pcapng
 do_test ./test-decode pcapng
 
+echo \* Seeking within trace files
+do_test ./test-seek erf
+do_test ./test-seek pcapfile
+do_test ./test-seek pcapng
+
 
 echo \* Testing pcap-bpf
 do_test ./test-pcap-bpf
@@ -104,6 +109,39 @@ do_test ./test-wlen pcapng
 echo \* Testing port numbers
 do_test ./test-ports
 
+echo \* Testing eager header parsing
+do_test ./test-parse
+
+echo \* Testing flow key extraction
+do_test ./test-flow-keys
+
+echo \* Testing filter sets
+do_test ./test-filter-set
+
+echo \* Testing meta-data cursors
+do_test ./test-meta-iter
+
+echo \* Testing checksums
+do_test ./test-checksum
+
+echo \* Testing fragment reassembly
+do_test ./test-reassembly
+
+echo \* Testing TCP stream reordering
+do_test ./test-tcp-stream
+
+echo \* Testing per thread counters
+do_test ./test-thread-counters
+
+echo \* Testing stage latency histograms
+do_test ./test-latency-histograms
+
+echo \* Testing batched results to the reporter
+do_test ./test-reporter-batch
+
+echo \* Testing copying packets into existing packets and pools
+do_test ./test-packet-copy
+
 echo \* Testing fragment parsing
 do_test ./test-fragment
 
@@ -174,6 +212,9 @@ do_test ./test-write pcap
 echo \* Testing write pcapfile
 do_test ./test-write pcapfile 
 
+echo \* Testing block compressed pcapfile
+do_test ./test-bgzf
+
 # Not all types are convertable, for instance libtrace doesn't
 # do rtclient output, and erf doesn't support 802.11
 echo \* Conversions
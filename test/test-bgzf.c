@@ -0,0 +1,155 @@
+/*
+ * This file is part of libtrace
+ *
+ * Copyright (c) 2007 The University of Waikato, Hamilton, New Zealand.
+ *
+ * All rights reserved.
+ *
+ * This code has been developed by the University of Waikato WAND
+ * research group. For further information please see http://www.wand.net.nz/
+ *
+ * libtrace is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * libtrace is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libtrace; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * $Id$
+ *
+ */
+
+/* Writes a block compressed (BGZF) copy of a trace, then checks that it can
+ * be read back and seeked within */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "libtrace.h"
+
+void iferr_out(libtrace_out_t *trace)
+{
+	libtrace_err_t err = trace_get_err_output(trace);
+	if (err.err_num==0)
+		return;
+	printf("Error: %s\n",err.problem);
+	exit(1);
+}
+
+void iferr(libtrace_t *trace)
+{
+	libtrace_err_t err = trace_get_err(trace);
+	if (err.err_num==0)
+		return;
+	printf("Error: %s\n",err.problem);
+	exit(1);
+}
+
+int count_packets(libtrace_t *trace) {
+	libtrace_packet_t *packet;
+	int psize = 0;
+	int count = 0;
+
+	packet=trace_create_packet();
+	while ((psize = trace_read_packet(trace, packet)) > 0) {
+		count ++;
+	}
+	if (psize < 0)
+		iferr(trace);
+	trace_destroy_packet(packet);
+	return count;
+}
+
+int check_count(int count, int expected) {
+	if (count == expected) {
+		printf("success: %d packets read\n",expected);
+		return 0;
+	}
+	printf("failure: %d packets expected, %d seen\n",expected,count);
+	return 1;
+}
+
+int main(int argc, char *argv[]) {
+	const char *in = "pcapfile:traces/100_packets.pcap";
+	const char *out = "pcapfile:traces/100_packets.out.bgzf.pcap.gz";
+	const char *idx = "traces/100_packets.out.bgzf.idx";
+	libtrace_t *trace;
+	libtrace_out_t *output;
+	libtrace_packet_t *packet;
+	int level = 6;
+	int type = TRACE_OPTION_COMPRESSTYPE_ZLIB;
+	/* Small enough that the trace spans several blocks */
+	int blocksize = 1024;
+	int error = 0;
+
+	if (argc > 1)
+		in = argv[1];
+
+	trace = trace_create(in);
+	iferr(trace);
+	trace_start(trace);
+	iferr(trace);
+
+	output = trace_create_output(out);
+	iferr_out(output);
+	trace_config_output(output, TRACE_OPTION_OUTPUT_COMPRESSTYPE, &type);
+	trace_config_output(output, TRACE_OPTION_OUTPUT_COMPRESS, &level);
+	trace_config_output(output, TRACE_OPTION_OUTPUT_COMPRESS_BLOCKSIZE,
+			&blocksize);
+	iferr_out(output);
+	trace_start_output(output);
+	iferr_out(output);
+
+	packet = trace_create_packet();
+	while (trace_read_packet(trace, packet) > 0) {
+		if (trace_write_packet(output, packet) == -1)
+			iferr_out(output);
+	}
+	iferr(trace);
+	trace_destroy_packet(packet);
+	trace_destroy(trace);
+	trace_destroy_output(output);
+
+	/* Read it all back, saving a seek index as we go */
+	trace = trace_create(out);
+	iferr(trace);
+	trace_set_seek_index_interval(trace, 1);
+	trace_set_seek_index_file(trace, idx);
+	iferr(trace);
+	trace_start(trace);
+	iferr(trace);
+	error |= check_count(count_packets(trace), 100);
+
+	/* Between the 96th and 97th packets */
+	trace_seek_erf_timestamp(trace, 4704246759960000000ULL);
+	iferr(trace);
+	error |= check_count(count_packets(trace), 4);
+
+	/* Between the 2nd and 3rd packets */
+	trace_seek_erf_timestamp(trace, 4704246759842650000ULL);
+	iferr(trace);
+	error |= check_count(count_packets(trace), 98);
+	trace_destroy(trace);
+
+	/* Seek straight into a block that hasn't been read yet, using the
+	 * saved index, so the blocks before it have to be found on the way */
+	trace = trace_create(out);
+	iferr(trace);
+	trace_set_seek_index_file(trace, idx);
+	iferr(trace);
+	trace_start(trace);
+	iferr(trace);
+	trace_seek_erf_timestamp(trace, 4704246759960000000ULL);
+	iferr(trace);
+	error |= check_count(count_packets(trace), 4);
+	trace_destroy(trace);
+
+	return error;
+}
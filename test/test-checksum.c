@@ -0,0 +1,326 @@
+/*
+ * This file is part of libtrace
+ *
+ * Copyright (c) 2007 The University of Waikato, Hamilton, New Zealand.
+ *
+ * All rights reserved.
+ *
+ * This code has been developed by the University of Waikato WAND
+ * research group. For further information please see http://www.wand.net.nz/
+ *
+ * libtrace is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * libtrace is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libtrace; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * $Id$
+ *
+ */
+
+/* Checks that trace_verify_checksums() agrees with the per packet checksum
+ * functions, and that the incremental checksum updates match a full
+ * recalculation */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <netinet/in.h>
+#include "libtrace.h"
+
+#define BATCH 100
+#define WORDS ((BATCH + 63) / 64)
+
+void iferr(libtrace_t *trace)
+{
+	libtrace_err_t err = trace_get_err(trace);
+	if (err.err_num==0)
+		return;
+	printf("Error: %s\n",err.problem);
+	exit(1);
+}
+
+int is_set(uint64_t *bitmap, size_t i) {
+	return (bitmap[i / 64] >> (i % 64)) & 1;
+}
+
+/* Compares the bits for packet i against what the per packet functions say,
+ * returning the number of differences. Anything flagged must really be bad,
+ * and every bad IPv4 header must be flagged */
+int check_packet(libtrace_packet_t *packet, uint64_t *l3, uint64_t *tr,
+		size_t i) {
+	uint16_t csum, *stored;
+	int diff = 0;
+
+	/* The calculated checksums are in host byte order */
+	stored = trace_checksum_layer3(packet, &csum);
+	if (is_set(l3, i) && (!stored || ntohs(*stored) == csum))
+		diff ++;
+	if (!is_set(l3, i) && stored && ntohs(*stored) != csum)
+		diff ++;
+
+	stored = trace_checksum_transport(packet, &csum);
+	if (is_set(tr, i) && (!stored || ntohs(*stored) == csum))
+		diff ++;
+	return diff;
+}
+
+int test_trace(const char *uri) {
+	libtrace_t *trace = trace_create(uri);
+	libtrace_packet_t *packets[BATCH];
+	uint64_t l3[WORDS], tr[WORDS];
+	size_t nb, i, bad;
+	int count = 0, diff = 0;
+
+	iferr(trace);
+	trace_start(trace);
+	iferr(trace);
+
+	for (i = 0; i < BATCH; i++)
+		packets[i] = trace_create_packet();
+
+	for (;;) {
+		for (nb = 0; nb < BATCH; nb++) {
+			if (trace_read_packet(trace, packets[nb]) <= 0)
+				break;
+		}
+		if (nb == 0)
+			break;
+
+		bad = trace_verify_checksums(packets, nb, l3, tr);
+		for (i = 0; i < nb; i++) {
+			diff += check_packet(packets[i], l3, tr, i);
+			if (is_set(l3, i) || is_set(tr, i))
+				bad --;
+		}
+		if (bad != 0)
+			diff ++;
+		count += nb;
+	}
+	iferr(trace);
+
+	for (i = 0; i < BATCH; i++)
+		trace_destroy_packet(packets[i]);
+	trace_destroy(trace);
+
+	if (diff) {
+		printf("failure: %s: %d differences in %d packets\n", uri,
+				diff, count);
+		return 1;
+	}
+	return 0;
+}
+
+/* Builds an ethernet frame holding an IPv4 or IPv6 packet with a transport
+ * header of the given protocol and some payload, with correct checksums */
+void make_packet(libtrace_packet_t *packet, int v6, uint8_t proto,
+		int payload) {
+	unsigned char frame[14 + 40 + 20 + 200];
+	int iplen = v6 ? 40 : 20;
+	int tlen = (proto == TRACE_IPPROTO_TCP) ? 20 : 8;
+	int len = 14 + iplen + tlen + payload;
+	unsigned char *ip = frame + 14;
+	unsigned char *t = ip + iplen;
+	uint16_t csum, *stored;
+	int i;
+
+	memset(frame, 0, sizeof(frame));
+	if (v6) {
+		frame[12] = 0x86;
+		frame[13] = 0xdd;
+		ip[0] = 0x60;
+		ip[5] = tlen + payload;
+		ip[6] = proto;
+		ip[7] = 64;
+		ip[8] = 0x20;
+		ip[9] = 0x01;
+		ip[23] = 0x01;
+		ip[24] = 0x20;
+		ip[25] = 0x01;
+		ip[39] = 0x02;
+	} else {
+		frame[12] = 0x08;
+		ip[0] = 0x45;
+		ip[3] = iplen + tlen + payload;
+		ip[8] = 64;
+		ip[9] = proto;
+		ip[12] = 10;
+		ip[15] = 1;
+		ip[16] = 192;
+		ip[17] = 168;
+		ip[18] = 1;
+		ip[19] = 2;
+	}
+	if (proto == TRACE_IPPROTO_TCP) {
+		t[12] = 0x50;
+		t[13] = 0x18;
+	} else if (proto == TRACE_IPPROTO_UDP) {
+		t[5] = tlen + payload;
+	} else {
+		t[0] = 8;
+	}
+	if (proto != TRACE_IPPROTO_ICMP) {
+		t[0] = 0x04;
+		t[1] = 0xd2;
+		t[3] = 0x35;
+	}
+	for (i = 0; i < payload; i++)
+		t[tlen + i] = (unsigned char)(i * 7 + proto);
+
+	trace_construct_packet(packet, TRACE_TYPE_ETH, frame, len);
+	if ((stored = trace_checksum_layer3(packet, &csum)) != NULL)
+		*stored = htons(csum);
+	if ((stored = trace_checksum_transport(packet, &csum)) != NULL)
+		*stored = htons(csum);
+}
+
+/* Breaks the checksums of some of a batch of constructed packets, and checks
+ * that exactly those are flagged */
+int test_constructed(void) {
+	libtrace_packet_t *packets[BATCH];
+	uint64_t l3[WORDS], tr[WORDS];
+	uint8_t protos[] = {TRACE_IPPROTO_TCP, TRACE_IPPROTO_UDP,
+		TRACE_IPPROTO_ICMP};
+	uint16_t csum, *stored;
+	size_t i, expected = 0;
+	int diff = 0;
+
+	for (i = 0; i < BATCH; i++) {
+		int v6 = i % 2;
+		uint8_t proto = protos[(i / 2) % 3];
+
+		if (v6 && proto == TRACE_IPPROTO_ICMP)
+			proto = TRACE_IPPROTO_UDP;
+		packets[i] = trace_create_packet();
+		make_packet(packets[i], v6, proto, (i * 13) % 200);
+	}
+
+	if (trace_verify_checksums(packets, BATCH, l3, tr) != 0)
+		diff ++;
+
+	for (i = 0; i < BATCH; i++) {
+		if (i % 5 == 0) {
+			stored = trace_checksum_transport(packets[i], &csum);
+			*stored ^= htons(0x0100);
+			expected ++;
+		}
+		if (i % 7 == 0 && i % 2 == 0) {
+			stored = trace_checksum_layer3(packets[i], &csum);
+			*stored ^= htons(0x0001);
+			if (i % 5 != 0)
+				expected ++;
+		}
+	}
+
+	if (trace_verify_checksums(packets, BATCH, l3, tr) != expected)
+		diff ++;
+	for (i = 0; i < BATCH; i++) {
+		if (is_set(tr, i) != (i % 5 == 0))
+			diff ++;
+		if (is_set(l3, i) != (i % 7 == 0 && i % 2 == 0))
+			diff ++;
+	}
+
+	for (i = 0; i < BATCH; i++)
+		trace_destroy_packet(packets[i]);
+
+	if (diff) {
+		printf("failure: %d differences in constructed packets\n", diff);
+		return 1;
+	}
+	return 0;
+}
+
+/* Rewrites addresses and ports with the incremental updates, and checks the
+ * result against a full recalculation */
+int test_update(void) {
+	libtrace_packet_t *packet = trace_create_packet();
+	libtrace_ip_t *ip;
+	libtrace_ip6_t *ip6;
+	libtrace_tcp_t *tcp;
+	libtrace_udp_t *udp;
+	struct in6_addr addr;
+	uint32_t old_addr;
+	uint16_t old_port, csum;
+	int diff = 0;
+	int i;
+
+	for (i = 0; i < 1000; i++) {
+		make_packet(packet, 0, TRACE_IPPROTO_TCP, i % 200);
+		ip = trace_get_ip(packet);
+		tcp = trace_get_tcp(packet);
+
+		old_addr = ip->ip_src.s_addr;
+		ip->ip_src.s_addr = htonl(0x0a000000 + i * 7919);
+		ip->ip_sum = trace_checksum_update32(ip->ip_sum, old_addr,
+				ip->ip_src.s_addr);
+		tcp->check = trace_checksum_update32(tcp->check, old_addr,
+				ip->ip_src.s_addr);
+		old_port = tcp->source;
+		tcp->source = htons(i * 31);
+		tcp->check = trace_checksum_update16(tcp->check, old_port,
+				tcp->source);
+
+		if (ntohs(*trace_checksum_layer3(packet, &csum)) != csum)
+			diff ++;
+		if (ntohs(*trace_checksum_transport(packet, &csum)) != csum)
+			diff ++;
+	}
+
+	for (i = 0; i < 1000; i++) {
+		make_packet(packet, 1, TRACE_IPPROTO_UDP, i % 200);
+		ip6 = trace_get_ip6(packet);
+		udp = trace_get_udp(packet);
+
+		memcpy(&addr, &ip6->ip_dst, sizeof(addr));
+		ip6->ip_dst.s6_addr[i % 16] ^= (uint8_t)(i * 37 + 1);
+		ip6->ip_dst.s6_addr[(i * 5) % 16] += 3;
+		udp->check = trace_checksum_update(udp->check, &addr,
+				&ip6->ip_dst, sizeof(addr));
+
+		if (ntohs(*trace_checksum_transport(packet, &csum)) != csum)
+			diff ++;
+	}
+
+	trace_destroy_packet(packet);
+
+	if (diff) {
+		printf("failure: %d differences after checksum updates\n", diff);
+		return 1;
+	}
+	return 0;
+}
+
+int main(int argc, char *argv[]) {
+	const char *uris[] = {
+		"erf:traces/100_packets.erf",
+		"pcapfile:traces/100_packets.pcap",
+		"pcapfile:traces/100_sll.pcap",
+		"pcapfile:traces/vlan.pcap",
+		"pcapfile:traces/10_mpls_ip.pcap",
+		"erf:traces/fragtest.erf.gz",
+		"pcapfile:traces/vxlan.pcap",
+	};
+	int error = 0;
+	unsigned int i;
+
+	if (argc > 1)
+		return test_trace(argv[1]);
+
+	for (i = 0; i < sizeof(uris) / sizeof(uris[0]); i++)
+		error |= test_trace(uris[i]);
+	error |= test_constructed();
+	error |= test_update();
+
+	if (!error)
+		printf("success\n");
+	return error;
+}
@@ -0,0 +1,128 @@
+#include "data-struct/flow_table.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TEST_SIZE 100000
+
+typedef struct counter {
+	uint64_t packets;
+	uint64_t bytes;
+} counter_t;
+
+static void make_tuple(libtrace_flow_tuple_t *tuple, uint32_t i) {
+	memset(tuple, 0, sizeof(libtrace_flow_tuple_t));
+	tuple->ip_version = (i & 1) ? 6 : 4;
+	memcpy(tuple->src_ip, &i, sizeof(i));
+	tuple->dst_ip[0] = 10;
+	tuple->src_port = i & 0xffff;
+	tuple->dst_port = 80;
+	tuple->protocol = 6;
+}
+
+static void add_counters(void *dst, const void *src, void *data) {
+	counter_t *d = (counter_t *)dst;
+	const counter_t *s = (const counter_t *)src;
+	(void)data;
+	d->packets += s->packets;
+	d->bytes += s->bytes;
+}
+
+/**
+ * Tests the flow table: inserting, finding, removing, iterating and merging
+ * a large number of flows.
+ */
+int main() {
+	libtrace_flow_table_t *table, *other;
+	libtrace_flow_tuple_t tuple;
+	const libtrace_flow_tuple_t *found;
+	counter_t *c, *first;
+	size_t iter = 0;
+	uint32_t i, seen = 0;
+	int created;
+	void *value;
+
+	table = libtrace_flow_table_create(sizeof(counter_t), 0);
+	assert(table);
+	assert(libtrace_flow_table_get_size(table) == 0);
+
+	for (i = 0; i < TEST_SIZE; i++) {
+		make_tuple(&tuple, i);
+		c = (counter_t *)libtrace_flow_table_insert(table, &tuple,
+				&created);
+		assert(c && created);
+		assert(c->packets == 0 && c->bytes == 0);
+		c->packets = i;
+		c->bytes = i * 2;
+	}
+	assert(libtrace_flow_table_get_size(table) == TEST_SIZE);
+
+	// Values must not move as the table grows
+	make_tuple(&tuple, 0);
+	first = (counter_t *)libtrace_flow_table_find(table, &tuple);
+	assert(first);
+
+	for (i = 0; i < TEST_SIZE; i++) {
+		make_tuple(&tuple, i);
+		c = (counter_t *)libtrace_flow_table_insert(table, &tuple,
+				&created);
+		assert(c && !created);
+		assert(c->packets == i && c->bytes == i * 2);
+	}
+	make_tuple(&tuple, TEST_SIZE);
+	assert(libtrace_flow_table_find(table, &tuple) == NULL);
+
+	// Remove every other flow, the rest must still be found
+	for (i = 0; i < TEST_SIZE; i += 2) {
+		make_tuple(&tuple, i);
+		assert(libtrace_flow_table_remove(table, &tuple) == 1);
+		assert(libtrace_flow_table_remove(table, &tuple) == 0);
+	}
+	assert(libtrace_flow_table_get_size(table) == TEST_SIZE / 2);
+	for (i = 0; i < TEST_SIZE; i++) {
+		make_tuple(&tuple, i);
+		c = (counter_t *)libtrace_flow_table_find(table, &tuple);
+		if (i % 2 == 0) {
+			assert(c == NULL);
+		} else {
+			assert(c && c->packets == i);
+		}
+	}
+
+	while (libtrace_flow_table_next(table, &iter, &found, &value)) {
+		c = (counter_t *)value;
+		assert(found->ip_version == 6);
+		assert(memcmp(&c->packets, found->src_ip, sizeof(i)) == 0);
+		seen ++;
+	}
+	assert(seen == TEST_SIZE / 2);
+
+	// Merging adds the counters for flows in both tables
+	other = libtrace_flow_table_create(sizeof(counter_t), TEST_SIZE);
+	for (i = 0; i < TEST_SIZE; i++) {
+		make_tuple(&tuple, i);
+		c = (counter_t *)libtrace_flow_table_insert(other, &tuple,
+				NULL);
+		c->packets = 1;
+		c->bytes = 1;
+	}
+	libtrace_flow_table_merge(table, other, add_counters, NULL);
+	assert(libtrace_flow_table_get_size(table) == TEST_SIZE);
+	for (i = 0; i < TEST_SIZE; i++) {
+		make_tuple(&tuple, i);
+		c = (counter_t *)libtrace_flow_table_find(table, &tuple);
+		assert(c);
+		assert(c->packets == ((i % 2) ? i + 1 : 1));
+	}
+
+	libtrace_flow_table_clear(table);
+	assert(libtrace_flow_table_get_size(table) == 0);
+	make_tuple(&tuple, 1);
+	assert(libtrace_flow_table_find(table, &tuple) == NULL);
+	iter = 0;
+	assert(!libtrace_flow_table_next(table, &iter, NULL, NULL));
+
+	libtrace_flow_table_destroy(table);
+	libtrace_flow_table_destroy(other);
+	return 0;
+}
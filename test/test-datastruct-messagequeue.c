@@ -0,0 +1,184 @@
+#include "data-struct/message_queue.h"
+#include <assert.h>
+#include <pthread.h>
+#include <poll.h>
+#include <stdint.h>
+#include <string.h>
+
+#define PRODUCERS 4
+#define TEST_SIZE 100000
+
+struct message {
+	int producer;
+	int seq;
+	char padding[20];
+};
+
+static libtrace_message_queue_t mq;
+
+static void *producer(void *a) {
+	struct message msg;
+	int i;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.producer = (int)(intptr_t)a;
+	for (i = 0; i < TEST_SIZE; i++) {
+		msg.seq = i;
+		assert(libtrace_message_queue_put(&mq, &msg) > 0);
+	}
+	return NULL;
+}
+
+static int readable(int fd) {
+	struct pollfd pfd;
+
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	return poll(&pfd, 1, 0) == 1;
+}
+
+// Messages from several senders arrive intact and in order per sender,
+// including when the ring fills up and messages overflow
+static void test_producers(int blocking) {
+	pthread_t t[PRODUCERS];
+	int next[PRODUCERS];
+	struct message msg;
+	int i, got = 0;
+
+	libtrace_message_queue_init(&mq, sizeof(struct message));
+	memset(next, 0, sizeof(next));
+	for (i = 0; i < PRODUCERS; i++)
+		pthread_create(&t[i], NULL, producer, (void *)(intptr_t)i);
+
+	while (got < PRODUCERS * TEST_SIZE) {
+		if (blocking) {
+			assert(libtrace_message_queue_get(&mq, &msg) > 0);
+		} else if (libtrace_message_queue_try_get(&mq, &msg)
+				== LIBTRACE_MQ_FAILED) {
+			continue;
+		}
+		assert(msg.producer >= 0 && msg.producer < PRODUCERS);
+		assert(msg.seq == next[msg.producer]);
+		next[msg.producer] ++;
+		got ++;
+	}
+
+	for (i = 0; i < PRODUCERS; i++)
+		pthread_join(t[i], NULL);
+	assert(libtrace_message_queue_count(&mq) == 0);
+	assert(libtrace_message_queue_try_get(&mq, &msg) == LIBTRACE_MQ_FAILED);
+	libtrace_message_queue_destroy(&mq);
+}
+
+// The file descriptor is readable exactly when there are messages waiting,
+// even for messages sent before it was asked for
+static void test_fd(void) {
+	struct message msg;
+	int fd;
+
+	memset(&msg, 0, sizeof(msg));
+	libtrace_message_queue_init(&mq, sizeof(struct message));
+	assert(libtrace_message_queue_put(&mq, &msg) == 1);
+	assert(libtrace_message_queue_put(&mq, &msg) == 2);
+
+	fd = libtrace_message_queue_get_fd(&mq);
+	assert(readable(fd));
+	assert(libtrace_message_queue_try_get(&mq, &msg) == 1);
+	assert(readable(fd));
+	assert(libtrace_message_queue_try_get(&mq, &msg) == 0);
+	assert(!readable(fd));
+	assert(libtrace_message_queue_try_get(&mq, &msg) == LIBTRACE_MQ_FAILED);
+	assert(!readable(fd));
+
+	assert(libtrace_message_queue_put(&mq, &msg) == 1);
+	assert(readable(fd));
+	assert(libtrace_message_queue_get(&mq, &msg) == 1);
+	assert(!readable(fd));
+
+	libtrace_message_queue_destroy(&mq);
+}
+
+// Once the deadline passes the queue is ready, and its file descriptor
+// readable where timerfd is available, until the deadline is moved
+static void test_deadline(void) {
+	struct message msg;
+	struct pollfd pfd;
+	int fd;
+
+	memset(&msg, 0, sizeof(msg));
+	libtrace_message_queue_init(&mq, sizeof(struct message));
+	libtrace_message_queue_enable_deadline(&mq);
+	fd = libtrace_message_queue_get_fd(&mq);
+	assert(!libtrace_message_queue_ready(&mq));
+
+	libtrace_message_queue_set_deadline(&mq,
+			libtrace_message_queue_clock() + 20000000);
+	assert(!libtrace_message_queue_ready(&mq));
+	assert(!readable(fd));
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	poll(&pfd, 1, 100);
+	while (!libtrace_message_queue_ready(&mq))
+		;
+	if (mq.poll_fd != -1)
+		assert(readable(fd));
+	assert(libtrace_message_queue_try_get(&mq, &msg) == LIBTRACE_MQ_FAILED);
+
+	libtrace_message_queue_set_deadline(&mq, 0);
+	assert(!libtrace_message_queue_ready(&mq));
+	assert(!readable(fd));
+
+	assert(libtrace_message_queue_put(&mq, &msg) == 1);
+	assert(libtrace_message_queue_ready(&mq));
+	assert(readable(fd));
+	assert(libtrace_message_queue_try_get(&mq, &msg) == 0);
+	assert(!readable(fd));
+
+	libtrace_message_queue_destroy(&mq);
+}
+
+// Sending never waits for the receiver, however far behind it is, and
+// messages that overflowed the ring still come out in order
+static void test_overflow(void) {
+	struct message msg;
+	int i, next = 0;
+
+	memset(&msg, 0, sizeof(msg));
+	libtrace_message_queue_init(&mq, sizeof(struct message));
+	for (i = 0; i < 3 * LIBTRACE_MQ_SIZE; i++) {
+		msg.seq = i;
+		assert(libtrace_message_queue_put(&mq, &msg) == i + 1);
+	}
+
+	// Space in the ring is not used again until the overflow is drained
+	for (; next < LIBTRACE_MQ_SIZE / 2; next++) {
+		assert(libtrace_message_queue_try_get(&mq, &msg) >= 0);
+		assert(msg.seq == next);
+	}
+	for (; i < 4 * LIBTRACE_MQ_SIZE; i++) {
+		msg.seq = i;
+		assert(libtrace_message_queue_put(&mq, &msg) > 0);
+	}
+	while (libtrace_message_queue_try_get(&mq, &msg) != LIBTRACE_MQ_FAILED) {
+		assert(msg.seq == next);
+		next ++;
+	}
+	assert(next == i);
+	assert(libtrace_message_queue_count(&mq) == 0);
+
+	// Anything left over is freed
+	for (i = 0; i < 2 * LIBTRACE_MQ_SIZE; i++)
+		assert(libtrace_message_queue_put(&mq, &msg) > 0);
+	libtrace_message_queue_destroy(&mq);
+}
+
+int main() {
+	test_producers(1);
+	test_producers(0);
+	test_overflow();
+	test_fd();
+	test_deadline();
+	return 0;
+}
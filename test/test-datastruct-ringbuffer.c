@@ -1,6 +1,7 @@
 #include "data-struct/ring_buffer.h"
 #include <pthread.h>
 #include <assert.h>
+#include <unistd.h>
 
 #define TEST_SIZE ((char *) 1000000)
 #define RINGBUFFER_SIZE ((char *) 10000)
@@ -45,6 +46,28 @@ static void * consumer_bulk(void * a) {
 	return 0;
 }
 
+/* Writes slowly enough that the consumer has to go to sleep */
+static void * producer_slow(void * a) {
+	libtrace_ringbuffer_t * rb = (libtrace_ringbuffer_t *) a;
+	char * i;
+	for (i = NULL; i < (char *) 1000; i++) {
+		if ((size_t) i % 100 == 0)
+			usleep(1000);
+		libtrace_ringbuffer_write(rb, i);
+	}
+	return 0;
+}
+
+static void * consumer_slow(void * a) {
+	libtrace_ringbuffer_t * rb = (libtrace_ringbuffer_t *) a;
+	char *i;
+	void *value;
+	for (i = NULL; i < (char *) 1000; i++) {
+		value = libtrace_ringbuffer_read(rb);
+		assert(value == i);
+	}
+	return 0;
+}
 
 /**
  * Tests the ringbuffer data structure, first this establishes that single
@@ -57,20 +80,25 @@ int main() {
 	pthread_t t[4];
 	libtrace_ringbuffer_t rb_block;
 	libtrace_ringbuffer_t rb_polling;
+	libtrace_ringbuffer_t rb_adaptive;
 
 	libtrace_ringbuffer_init(&rb_block, (size_t) RINGBUFFER_SIZE, LIBTRACE_RINGBUFFER_BLOCKING);
 	libtrace_ringbuffer_init(&rb_polling, (size_t) RINGBUFFER_SIZE, LIBTRACE_RINGBUFFER_POLLING);
+	libtrace_ringbuffer_init(&rb_adaptive, (size_t) RINGBUFFER_SIZE, LIBTRACE_RINGBUFFER_ADAPTIVE);
 	assert(libtrace_ringbuffer_is_empty(&rb_block));
 	assert(libtrace_ringbuffer_is_empty(&rb_polling));
+	assert(libtrace_ringbuffer_is_empty(&rb_adaptive));
 
 	for (i = NULL; i < RINGBUFFER_SIZE; i++) {
 		value = (void *) i;
 		libtrace_ringbuffer_write(&rb_block, value);
 		libtrace_ringbuffer_write(&rb_polling, value);
+		libtrace_ringbuffer_write(&rb_adaptive, value);
 	}
 
 	assert(libtrace_ringbuffer_is_full(&rb_block));
 	assert(libtrace_ringbuffer_is_full(&rb_polling));
+	assert(libtrace_ringbuffer_is_full(&rb_adaptive));
 
 	// Full so trying to write should fail
 	assert(!libtrace_ringbuffer_try_write(&rb_block, value));
@@ -79,6 +107,7 @@ int main() {
 	assert(!libtrace_ringbuffer_try_swrite(&rb_polling, value));
 	assert(!libtrace_ringbuffer_try_swrite_bl(&rb_block, value));
 	assert(!libtrace_ringbuffer_try_swrite_bl(&rb_polling, value));
+	assert(!libtrace_ringbuffer_try_write(&rb_adaptive, value));
 
 	// Cycle the buffer a few times
 	for (i = NULL; i < TEST_SIZE; i++) {
@@ -88,9 +117,12 @@ int main() {
 		value = (void *) -1;
 		value = libtrace_ringbuffer_read(&rb_polling);
 		assert(value == (void *) i);
+		value = libtrace_ringbuffer_read(&rb_adaptive);
+		assert(value == (void *) i);
 		value = (void *) (i + (size_t) RINGBUFFER_SIZE);
 		libtrace_ringbuffer_write(&rb_block, value);
 		libtrace_ringbuffer_write(&rb_polling, value);
+		libtrace_ringbuffer_write(&rb_adaptive, value);
 	}
 
 	// Empty it completely
@@ -99,9 +131,12 @@ int main() {
 		assert(value == (void *) i);
 		value = libtrace_ringbuffer_read(&rb_polling);
 		assert(value == (void *) i);
+		value = libtrace_ringbuffer_read(&rb_adaptive);
+		assert(value == (void *) i);
 	}
 	assert(libtrace_ringbuffer_is_empty(&rb_block));
 	assert(libtrace_ringbuffer_is_empty(&rb_polling));
+	assert(libtrace_ringbuffer_is_empty(&rb_adaptive));
 
 	// Empty so trying to read should fail
 	assert(!libtrace_ringbuffer_try_read(&rb_block, &value));
@@ -110,6 +145,7 @@ int main() {
 	assert(!libtrace_ringbuffer_try_sread(&rb_polling, &value));
 	assert(!libtrace_ringbuffer_try_sread_bl(&rb_block, &value));
 	assert(!libtrace_ringbuffer_try_sread_bl(&rb_polling, &value));
+	assert(!libtrace_ringbuffer_try_read(&rb_adaptive, &value));
 
 	// Test thread safety - We only really care about the single producer single
 	// consumer case
@@ -137,5 +173,33 @@ int main() {
 	pthread_join(t[1], NULL);
 	assert(libtrace_ringbuffer_is_empty(&rb_polling));
 
+	pthread_create(&t[0], NULL, &producer, (void *) &rb_adaptive);
+	pthread_create(&t[1], NULL, &consumer, (void *) &rb_adaptive);
+	pthread_join(t[0], NULL);
+	pthread_join(t[1], NULL);
+	assert(libtrace_ringbuffer_is_empty(&rb_adaptive));
+
+	pthread_create(&t[0], NULL, &producer_bulk, (void *) &rb_adaptive);
+	pthread_create(&t[1], NULL, &consumer_bulk, (void *) &rb_adaptive);
+	pthread_join(t[0], NULL);
+	pthread_join(t[1], NULL);
+	assert(libtrace_ringbuffer_is_empty(&rb_adaptive));
+
+	// Without spinning every wait sleeps, so wakeups must not be lost
+	libtrace_ringbuffer_set_spin(&rb_adaptive, 0);
+	pthread_create(&t[0], NULL, &producer_slow, (void *) &rb_adaptive);
+	pthread_create(&t[1], NULL, &consumer_slow, (void *) &rb_adaptive);
+	pthread_join(t[0], NULL);
+	pthread_join(t[1], NULL);
+	assert(libtrace_ringbuffer_is_empty(&rb_adaptive));
+	pthread_create(&t[0], NULL, &producer, (void *) &rb_adaptive);
+	pthread_create(&t[1], NULL, &consumer, (void *) &rb_adaptive);
+	pthread_join(t[0], NULL);
+	pthread_join(t[1], NULL);
+	assert(libtrace_ringbuffer_is_empty(&rb_adaptive));
+
+	libtrace_ringbuffer_destroy(&rb_block);
+	libtrace_ringbuffer_destroy(&rb_polling);
+	libtrace_ringbuffer_destroy(&rb_adaptive);
 	return 0;
 }
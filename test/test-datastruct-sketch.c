@@ -0,0 +1,175 @@
+#include "data-struct/sketch.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TEST_SIZE 100000
+#define HEAVY 10
+
+/* Key i appears TEST_SIZE / (i + 1) times, so a handful of keys carry most
+ * of the weight */
+static uint32_t weight_of(uint32_t i) {
+	return TEST_SIZE / (i + 1);
+}
+
+static void add_packets(void *dst, const void *src, void *data) {
+	(void)data;
+	*(uint64_t *)dst += *(const uint64_t *)src;
+}
+
+static void test_countmin(void) {
+	libtrace_countmin_t *cm, *other;
+	uint64_t total = 0, est;
+	uint32_t i;
+
+	cm = libtrace_countmin_create(1024, 4);
+	other = libtrace_countmin_create(1024, 4);
+	assert(cm && other);
+
+	for (i = 0; i < 1000; i++) {
+		libtrace_countmin_update(cm, &i, sizeof(i), weight_of(i));
+		total += weight_of(i);
+	}
+	for (i = 0; i < 1000; i++) {
+		est = libtrace_countmin_estimate(cm, &i, sizeof(i));
+		// Never an underestimate, and only slightly over
+		assert(est >= weight_of(i));
+		if (i < HEAVY)
+			assert(est <= weight_of(i) + total / 100);
+	}
+
+	// Merging two halves is the same as counting everything in one
+	for (i = 0; i < 1000; i++)
+		libtrace_countmin_update(other, &i, sizeof(i), weight_of(i));
+	assert(libtrace_countmin_merge(cm, other) == 0);
+	i = 0;
+	assert(libtrace_countmin_estimate(cm, &i, sizeof(i)) >= 2 * TEST_SIZE);
+
+	libtrace_countmin_clear(cm);
+	assert(libtrace_countmin_estimate(cm, &i, sizeof(i)) == 0);
+
+	libtrace_countmin_destroy(other);
+	other = libtrace_countmin_create(1024, 3);
+	assert(libtrace_countmin_merge(cm, other) == -1);
+
+	libtrace_countmin_destroy(other);
+	libtrace_countmin_destroy(cm);
+}
+
+static void test_topk(void) {
+	libtrace_topk_t *topk, *other;
+	libtrace_topk_item_t items[64];
+	uint64_t *packets, seen, count;
+	uint32_t i, j, key;
+	size_t n;
+
+	topk = libtrace_topk_create(64, sizeof(uint32_t), sizeof(uint64_t));
+	other = libtrace_topk_create(64, sizeof(uint32_t), sizeof(uint64_t));
+	assert(topk && other);
+	assert(libtrace_topk_get_size(topk) == 0);
+
+	// Interleave the keys so that light ones keep pushing each other out
+	for (j = 0; j < weight_of(0); j++) {
+		for (i = 0; i < 5000 && weight_of(i) > j; i++) {
+			packets = (uint64_t *)libtrace_topk_update(topk, &i, 1);
+			assert(packets);
+			(*packets) ++;
+		}
+	}
+	assert(libtrace_topk_get_size(topk) == 64);
+
+	n = libtrace_topk_get_items(topk, items);
+	assert(n == 64);
+	for (i = 0; i < HEAVY; i++) {
+		memcpy(&key, items[i].key, sizeof(key));
+		assert(key == i);
+		assert(items[i].count >= weight_of(i));
+		assert(items[i].count - items[i].error <= weight_of(i));
+	}
+	for (i = 1; i < n; i++)
+		assert(items[i - 1].count >= items[i].count);
+
+	// The value only covers what was seen since the key was last taken
+	// on, which is exactly the count less the error
+	i = 0;
+	packets = (uint64_t *)libtrace_topk_find(topk, &i);
+	assert(packets && *packets == items[0].count - items[0].error);
+	seen = *packets;
+	i = 4999;
+	assert(libtrace_topk_find(topk, &i) == NULL);
+
+	// Merging in a copy of the heavy keys doubles them
+	for (i = 0; i < HEAVY; i++) {
+		packets = (uint64_t *)libtrace_topk_update(other, &i,
+				weight_of(i));
+		*packets = weight_of(i);
+	}
+	assert(libtrace_topk_merge(topk, other, add_packets, NULL) == 0);
+	i = 0;
+	packets = (uint64_t *)libtrace_topk_find(topk, &i);
+	assert(packets && *packets == seen + weight_of(0));
+	count = items[0].count;
+	n = libtrace_topk_get_items(topk, items);
+	memcpy(&key, items[0].key, sizeof(key));
+	assert(key == 0 && items[0].count == count + weight_of(0));
+
+	libtrace_topk_clear(topk);
+	assert(libtrace_topk_get_size(topk) == 0);
+	assert(libtrace_topk_find(topk, &i) == NULL);
+
+	libtrace_topk_destroy(other);
+	libtrace_topk_destroy(topk);
+}
+
+static void test_hll(void) {
+	libtrace_hll_t *hll, *other;
+	uint64_t est;
+	uint32_t i;
+
+	hll = libtrace_hll_create(14);
+	other = libtrace_hll_create(14);
+	assert(hll && other);
+	assert(libtrace_hll_estimate(hll) == 0);
+	assert(libtrace_hll_create(2) == NULL);
+
+	// Small counts are exact or very nearly
+	for (i = 0; i < 100; i++) {
+		libtrace_hll_add(hll, &i, sizeof(i));
+		libtrace_hll_add(hll, &i, sizeof(i));
+	}
+	est = libtrace_hll_estimate(hll);
+	assert(est >= 98 && est <= 102);
+
+	for (i = 0; i < TEST_SIZE; i++)
+		libtrace_hll_add(hll, &i, sizeof(i));
+	est = libtrace_hll_estimate(hll);
+	assert(est >= TEST_SIZE * 0.96 && est <= TEST_SIZE * 1.04);
+
+	// Half overlapping with what is already there
+	for (i = TEST_SIZE / 2; i < TEST_SIZE * 3 / 2; i++)
+		libtrace_hll_add(other, &i, sizeof(i));
+	assert(libtrace_hll_merge(hll, other) == 0);
+	est = libtrace_hll_estimate(hll);
+	assert(est >= TEST_SIZE * 1.5 * 0.96 && est <= TEST_SIZE * 1.5 * 1.04);
+
+	libtrace_hll_clear(hll);
+	assert(libtrace_hll_estimate(hll) == 0);
+
+	libtrace_hll_destroy(other);
+	other = libtrace_hll_create(10);
+	assert(libtrace_hll_merge(hll, other) == -1);
+
+	libtrace_hll_destroy(other);
+	libtrace_hll_destroy(hll);
+}
+
+/**
+ * Tests the Count-Min, Space-Saving and HyperLogLog sketches against a
+ * skewed stream of keys with known counts.
+ */
+int main() {
+	test_countmin();
+	test_topk();
+	test_hll();
+	return 0;
+}
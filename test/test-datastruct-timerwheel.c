@@ -0,0 +1,173 @@
+#include "data-struct/timer_wheel.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define RES 1000
+#define TEST_SIZE 2000
+
+struct test_timer {
+	libtrace_timer_t timer;
+	/* The expiry we expect to see next, in ticks */
+	uint64_t due;
+	uint64_t period;
+	int fired;
+	int cancel;
+};
+
+static uint64_t wheel_now;
+static libtrace_timer_wheel_t wheel;
+static struct test_timer timers[TEST_SIZE];
+
+static void fired(libtrace_timer_t *timer, uint64_t expiry, void *data) {
+	struct test_timer *tt = (struct test_timer *) data;
+
+	assert(&tt->timer == timer);
+	// Never early, and never later than the advance that passed it
+	assert(expiry == tt->due * RES);
+	assert(expiry <= wheel_now);
+	tt->fired ++;
+	if (tt->period) {
+		tt->due += tt->period;
+		// Missed periods are skipped
+		while (tt->due * RES <= wheel_now)
+			tt->due += tt->period;
+	}
+	if (tt->cancel)
+		libtrace_timer_wheel_cancel(&wheel, timer);
+}
+
+/* The earliest expiry of any active timer, 0 if there are none */
+static uint64_t earliest(void) {
+	uint64_t best = 0;
+	int i;
+
+	for (i = 0; i < TEST_SIZE; i++) {
+		if (libtrace_timer_is_active(&timers[i].timer) &&
+				(!best || timers[i].due < best))
+			best = timers[i].due;
+	}
+	return best * RES;
+}
+
+static void check_fired(void) {
+	int i;
+
+	for (i = 0; i < TEST_SIZE; i++) {
+		if (libtrace_timer_is_active(&timers[i].timer))
+			assert(timers[i].due * RES > wheel_now);
+	}
+	assert(libtrace_timer_wheel_next(&wheel) == earliest());
+}
+
+static void test_random(void) {
+	uint64_t step;
+	int i, round;
+
+	srand(1);
+	wheel_now = 5 * RES;
+	libtrace_timer_wheel_init(&wheel, RES, wheel_now);
+	assert(libtrace_timer_wheel_next(&wheel) == 0);
+
+	// Spread over every level, plus some beyond the end of the wheel
+	for (i = 0; i < TEST_SIZE; i++) {
+		uint64_t delta = 1 + (rand() % (1 << (6 * (1 + i % 5))));
+
+		libtrace_timer_init(&timers[i].timer, fired, &timers[i]);
+		timers[i].due = wheel_now / RES + delta;
+		timers[i].period = (i % 3 == 0) ? 1 + rand() % 5000 : 0;
+		timers[i].fired = 0;
+		timers[i].cancel = 0;
+		libtrace_timer_wheel_add(&wheel, &timers[i].timer,
+				timers[i].due * RES, timers[i].period * RES);
+	}
+	assert(wheel.count == TEST_SIZE);
+	check_fired();
+
+	for (round = 0; round < 3000; round++) {
+		// Mostly small steps, with the occasional big jump
+		if (round % 100 == 99)
+			step = rand() % (1 << 20);
+		else
+			step = rand() % 200;
+		wheel_now += step * RES + rand() % RES;
+		libtrace_timer_wheel_advance(&wheel, wheel_now);
+		check_fired();
+
+		// Move some timers around
+		i = rand() % TEST_SIZE;
+		if (rand() % 2) {
+			libtrace_timer_wheel_cancel(&wheel, &timers[i].timer);
+		} else {
+			timers[i].due = wheel_now / RES + 1 + rand() % 100000;
+			libtrace_timer_wheel_add(&wheel, &timers[i].timer,
+					timers[i].due * RES,
+					timers[i].period * RES);
+		}
+	}
+
+	libtrace_timer_wheel_clear(&wheel, NULL);
+	assert(wheel.count == 0);
+	assert(libtrace_timer_wheel_next(&wheel) == 0);
+	for (i = 0; i < TEST_SIZE; i++)
+		assert(!libtrace_timer_is_active(&timers[i].timer));
+}
+
+static void test_periodic(void) {
+	struct test_timer *tt = &timers[0];
+
+	wheel_now = 0;
+	libtrace_timer_wheel_init(&wheel, RES, 0);
+	libtrace_timer_init(&tt->timer, fired, tt);
+	tt->due = 10;
+	tt->period = 10;
+	tt->fired = 0;
+	tt->cancel = 0;
+	libtrace_timer_wheel_add(&wheel, &tt->timer, 10 * RES, 10 * RES);
+
+	// Every tick, one at a time
+	for (wheel_now = 0; wheel_now <= 1000 * RES; wheel_now += RES)
+		libtrace_timer_wheel_advance(&wheel, wheel_now);
+	assert(tt->fired == 100);
+
+	// Only fires once after falling a long way behind
+	wheel_now += 100000 * RES;
+	assert(libtrace_timer_wheel_advance(&wheel, wheel_now) == 1);
+	assert(tt->fired == 101);
+	assert(tt->due * RES > wheel_now);
+
+	// Cancelling from within the callback
+	tt->cancel = 1;
+	wheel_now = tt->due * RES;
+	assert(libtrace_timer_wheel_advance(&wheel, wheel_now) == 1);
+	assert(!libtrace_timer_is_active(&tt->timer));
+	assert(wheel.count == 0);
+}
+
+static void test_past(void) {
+	struct test_timer *tt = &timers[0];
+
+	wheel_now = 100 * RES;
+	libtrace_timer_wheel_init(&wheel, RES, wheel_now);
+	libtrace_timer_init(&tt->timer, fired, tt);
+	tt->period = 0;
+	tt->fired = 0;
+	tt->cancel = 0;
+
+	// Something already due fires on the next tick
+	tt->due = 101;
+	libtrace_timer_wheel_add(&wheel, &tt->timer, 50 * RES, 0);
+	assert(libtrace_timer_wheel_next(&wheel) == 101 * RES);
+	assert(libtrace_timer_wheel_advance(&wheel, wheel_now) == 0);
+	wheel_now += RES;
+	assert(libtrace_timer_wheel_advance(&wheel, wheel_now) == 1);
+	assert(tt->fired == 1);
+	assert(!libtrace_timer_is_active(&tt->timer));
+}
+
+int main(void) {
+	test_random();
+	test_periodic();
+	test_past();
+	return 0;
+}
@@ -0,0 +1,131 @@
+/*
+ * This file is part of libtrace
+ *
+ * Copyright (c) 2007 The University of Waikato, Hamilton, New Zealand.
+ *
+ * All rights reserved.
+ *
+ * This code has been developed by the University of Waikato WAND
+ * research group. For further information please see http://www.wand.net.nz/
+ *
+ * libtrace is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * libtrace is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libtrace; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * $Id$
+ *
+ */
+
+/* Checks that applying a set of filters gives the same answers as applying
+ * each of the filters on its own */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "libtrace.h"
+
+void iferr(libtrace_t *trace)
+{
+	libtrace_err_t err = trace_get_err(trace);
+	if (err.err_num==0)
+		return;
+	printf("Error: %s\n",err.problem);
+	exit(1);
+}
+
+int main(int argc, char *argv[]) {
+	const char *uri = "pcapfile:traces/100_packets.pcap";
+	/* Includes duplicates, which should share a program, and a filter
+	 * that doesn't compile */
+	const char *exprs[] = {
+		"port 80", "tcp", "udp", "port 80", "not tcp", "host 10.1.1.1",
+		"this is not a filter", "ip",
+	};
+	int nfilters = sizeof(exprs) / sizeof(exprs[0]);
+	libtrace_filter_t *filters[sizeof(exprs) / sizeof(exprs[0])];
+	libtrace_filter_set_t *set, *good;
+	libtrace_packet_t *packet;
+	libtrace_t *trace;
+	uint64_t matches[1];
+	int count = 0, matched = 0, errors = 0, diff = 0;
+	int i, ret, expected;
+
+	if (argc > 1)
+		uri = argv[1];
+
+	/* The same filters without the bad one, to check the number
+	 * matched */
+	set = trace_create_filter_set();
+	good = trace_create_filter_set();
+	for (i = 0; i < nfilters; i++) {
+		filters[i] = trace_create_filter(exprs[i]);
+		if (trace_filter_set_add(set, exprs[i]) != i)
+			diff ++;
+		if (i != 6)
+			trace_filter_set_add(good, exprs[i]);
+	}
+	if (trace_filter_set_count(set) != nfilters)
+		diff ++;
+
+	trace = trace_create(uri);
+	iferr(trace);
+	trace_start(trace);
+	iferr(trace);
+
+	packet = trace_create_packet();
+	while (trace_read_packet(trace, packet) > 0) {
+		ret = trace_apply_filter_set(set, packet, matches);
+		if (ret < 0) {
+			/* Every packet should see the bad filter, but only
+			 * the first sets an error on the trace */
+			if (errors == 0 && trace_get_err(trace).err_num == 0)
+				diff ++;
+			errors ++;
+		}
+		expected = 0;
+		for (i = 0; i < nfilters; i++) {
+			int single = 0;
+			if (i != 6)
+				single = trace_apply_filter(filters[i], packet);
+			if ((single > 0) != ((matches[0] >> i) & 1))
+				diff ++;
+			if (single > 0)
+				expected ++;
+		}
+		if (trace_apply_filter_set(good, packet, matches) != expected)
+			diff ++;
+		if (matches[0] & 1)
+			matched ++;
+		count ++;
+	}
+	iferr(trace);
+
+	/* Once applied, the set can't be changed */
+	if (trace_filter_set_add(set, "icmp") != -1)
+		diff ++;
+
+	trace_destroy_packet(packet);
+	trace_destroy(trace);
+	trace_destroy_filter_set(set);
+	trace_destroy_filter_set(good);
+	for (i = 0; i < nfilters; i++)
+		trace_destroy_filter(filters[i]);
+
+	if (diff || errors != count || matched != 54) {
+		printf("failure: %d differences, %d errors, %d of %d packets matched port 80\n",
+				diff, errors, matched, count);
+		return 1;
+	}
+	printf("success: %d packets matched port 80\n", matched);
+	return 0;
+}
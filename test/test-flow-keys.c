@@ -0,0 +1,220 @@
+/*
+ * This file is part of libtrace
+ *
+ * Copyright (c) 2007 The University of Waikato, Hamilton, New Zealand.
+ *
+ * All rights reserved.
+ *
+ * This code has been developed by the University of Waikato WAND
+ * research group. For further information please see http://www.wand.net.nz/
+ *
+ * libtrace is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * libtrace is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libtrace; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * $Id$
+ *
+ */
+
+/* Checks that the flow keys extracted from a batch of packets agree with
+ * the per packet libtrace functions */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include "libtrace.h"
+
+#define BATCH 16
+
+uint8_t ip_version[BATCH];
+uint8_t protocol[BATCH];
+uint32_t src_ip4[BATCH], dst_ip4[BATCH];
+uint8_t src_ip6[BATCH][16], dst_ip6[BATCH][16];
+uint16_t src_port[BATCH], dst_port[BATCH];
+uint32_t ip_length[BATCH], wire_length[BATCH];
+uint64_t timestamp[BATCH];
+
+libtrace_flow_keys_t keys = {
+	ip_version, protocol, src_ip4, dst_ip4, src_ip6, dst_ip6,
+	src_port, dst_port, ip_length, wire_length, timestamp
+};
+
+void iferr(libtrace_t *trace)
+{
+	libtrace_err_t err = trace_get_err(trace);
+	if (err.err_num==0)
+		return;
+	printf("Error: %s\n",err.problem);
+	exit(1);
+}
+
+/* Compares entry i of the flow keys against what the regular functions say
+ * about the packet, returning the number of differences */
+int check_key(libtrace_packet_t *packet, size_t i) {
+	struct sockaddr_storage src, dst;
+	struct sockaddr *s, *d;
+	int diff = 0;
+
+	s = trace_get_source_address(packet, (struct sockaddr *)&src);
+	d = trace_get_destination_address(packet, (struct sockaddr *)&dst);
+
+	if (s && s->sa_family == AF_INET) {
+		if (ip_version[i] != 4 ||
+				((struct sockaddr_in *)s)->sin_addr.s_addr !=
+				src_ip4[i] ||
+				((struct sockaddr_in *)d)->sin_addr.s_addr !=
+				dst_ip4[i])
+			diff ++;
+	} else if (s && s->sa_family == AF_INET6) {
+		if (ip_version[i] != 6 ||
+				memcmp(&((struct sockaddr_in6 *)s)->sin6_addr,
+					src_ip6[i], 16) != 0 ||
+				memcmp(&((struct sockaddr_in6 *)d)->sin6_addr,
+					dst_ip6[i], 16) != 0)
+			diff ++;
+	} else if (ip_version[i] != 0) {
+		diff ++;
+	}
+
+	if (src_port[i] != trace_get_source_port(packet) ||
+			dst_port[i] != trace_get_destination_port(packet))
+		diff ++;
+	if (wire_length[i] != trace_get_wire_length(packet) ||
+			timestamp[i] != trace_get_erf_timestamp(packet))
+		diff ++;
+	if (ip_version[i] == 0 && (protocol[i] != 0 || ip_length[i] != 0))
+		diff ++;
+	return diff;
+}
+
+int test_trace(const char *uri) {
+	libtrace_t *trace = trace_create(uri);
+	libtrace_packet_t *packets[BATCH];
+	size_t nb = 0, i;
+	int count = 0, ip = 0, diff = 0;
+
+	iferr(trace);
+	trace_start(trace);
+	iferr(trace);
+
+	for (i = 0; i < BATCH; i++)
+		packets[i] = trace_create_packet();
+
+	for (;;) {
+		for (nb = 0; nb < BATCH; nb++) {
+			if (trace_read_packet(trace, packets[nb]) <= 0)
+				break;
+		}
+		if (nb == 0)
+			break;
+
+		ip += trace_get_flow_keys(packets, nb, &keys);
+		for (i = 0; i < nb; i++)
+			diff += check_key(packets[i], i);
+		count += nb;
+	}
+	iferr(trace);
+
+	for (i = 0; i < BATCH; i++)
+		trace_destroy_packet(packets[i]);
+	trace_destroy(trace);
+
+	if (diff || ip == 0) {
+		printf("failure: %s: %d differences in %d packets (%d IP)\n",
+				uri, diff, count, ip);
+		return 1;
+	}
+	return 0;
+}
+
+/* Builds an ethernet frame holding an IPv6 packet with an 8 byte transport
+ * header of the given protocol */
+void make_ip6(libtrace_packet_t *packet, uint8_t proto) {
+	unsigned char frame[14 + 40 + 8];
+
+	memset(frame, 0, sizeof(frame));
+	frame[12] = 0x86;
+	frame[13] = 0xdd;
+	frame[14] = 0x60;
+	frame[14 + 5] = 8;		/* Payload length */
+	frame[14 + 6] = proto;
+	frame[14 + 8] = 0x20;		/* Source 2001::1 */
+	frame[14 + 9] = 0x01;
+	frame[14 + 23] = 0x01;
+	frame[14 + 24] = 0x20;		/* Destination 2001::2 */
+	frame[14 + 25] = 0x01;
+	frame[14 + 39] = 0x02;
+	frame[54] = 0x04;		/* Source port 1234 */
+	frame[55] = 0xd2;
+	frame[57] = 0x35;		/* Destination port 53 */
+
+	trace_construct_packet(packet, TRACE_TYPE_ETH, frame, sizeof(frame));
+}
+
+int test_ip6(void) {
+	libtrace_packet_t *packets[2];
+	int diff = 0;
+
+	packets[0] = trace_create_packet();
+	packets[1] = trace_create_packet();
+	make_ip6(packets[0], TRACE_IPPROTO_UDP);
+	make_ip6(packets[1], TRACE_IPPROTO_ICMPV6);
+
+	if (trace_get_flow_keys(packets, 2, &keys) != 2)
+		diff ++;
+	diff += check_key(packets[0], 0);
+	diff += check_key(packets[1], 1);
+
+	if (protocol[0] != TRACE_IPPROTO_UDP || src_port[0] != 1234 ||
+			dst_port[0] != 53 || ip_length[0] != 48 ||
+			src_ip6[0][15] != 1 || dst_ip6[0][15] != 2)
+		diff ++;
+	if (protocol[1] != TRACE_IPPROTO_ICMPV6 || src_port[1] != 0 ||
+			dst_port[1] != 0)
+		diff ++;
+
+	trace_destroy_packet(packets[0]);
+	trace_destroy_packet(packets[1]);
+
+	if (diff) {
+		printf("failure: %d differences in IPv6 packets\n", diff);
+		return 1;
+	}
+	return 0;
+}
+
+int main(int argc, char *argv[]) {
+	const char *uris[] = {
+		"erf:traces/100_packets.erf",
+		"pcapfile:traces/100_sll.pcap",
+		"pcapfile:traces/vlan.pcap",
+		"pcapfile:traces/10_mpls_ip.pcap",
+		"erf:traces/fragtest.erf.gz",
+		"pcapfile:traces/8021x.pcap",
+	};
+	int error = 0;
+	unsigned int i;
+
+	if (argc > 1)
+		return test_trace(argv[1]);
+
+	for (i = 0; i < sizeof(uris) / sizeof(uris[0]); i++)
+		error |= test_trace(uris[i]);
+	error |= test_ip6();
+
+	if (!error)
+		printf("success\n");
+	return error;
+}
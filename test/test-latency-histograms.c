@@ -0,0 +1,156 @@
+/*
+ * This file is part of libtrace
+ *
+ * Copyright (c) 2007 The University of Waikato, Hamilton, New Zealand.
+ *
+ * All rights reserved.
+ *
+ * This code has been developed by the University of Waikato WAND
+ * research group. For further information please see http://www.wand.net.nz/
+ *
+ * libtrace is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * libtrace is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libtrace; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * $Id$
+ *
+ */
+
+
+/* Checks that the stage latency histograms see every packet callback and
+ * published result, when libtrace is built with them */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "libtrace_parallel.h"
+
+#define URI "pcapfile:traces/100_packets.pcap"
+#define THREADS 2
+
+static int results = 0;
+
+void iferr(libtrace_t *trace)
+{
+	libtrace_err_t err = trace_get_err(trace);
+	if (err.err_num==0)
+		return;
+	printf("Error: %s\n",err.problem);
+	exit(1);
+}
+
+static libtrace_packet_t *per_packet(libtrace_t *trace,
+		libtrace_thread_t *t, void *global, void *tls,
+		libtrace_packet_t *packet) {
+	/* Publish a result for every other packet */
+	if (trace_packet_get_order(packet) % 2 == 0) {
+		trace_publish_result(trace, t, trace_packet_get_order(packet),
+				(libtrace_generic_t){.uint64 = 1},
+				RESULT_USER);
+	}
+	return packet;
+}
+
+static void per_result(libtrace_t *trace, libtrace_thread_t *sender,
+		void *global, void *tls, libtrace_result_t *result) {
+	results ++;
+}
+
+static int check_stage(libtrace_t *trace, libtrace_stage_t stage,
+		uint64_t expected) {
+	libtrace_latency_summary_t s;
+
+	if (trace_get_stage_latency(trace, -1, stage, &s) < 0) {
+		printf("failure: no summary for stage %d\n", stage);
+		return 1;
+	}
+	if ((expected && s.count != expected) || (!expected && !s.count)) {
+		printf("failure: stage %d timed %" PRIu64 " times\n", stage,
+				s.count);
+		return 1;
+	}
+	if (s.count && !(s.min <= s.p50 && s.p50 <= s.p90 &&
+				s.p90 <= s.p99 && s.p99 <= s.p999 &&
+				s.p999 <= s.max && s.min <= s.mean &&
+				s.mean <= s.max)) {
+		printf("failure: stage %d percentiles out of order\n", stage);
+		return 1;
+	}
+	return 0;
+}
+
+int main(int argc, char *argv[]) {
+	libtrace_t *trace;
+	libtrace_callback_set_t *pktcbs, *rptcbs;
+	libtrace_latency_summary_t s;
+	uint64_t callbacks = 0;
+	int error = 0, i;
+
+	trace = trace_create(URI);
+	iferr(trace);
+	if (trace_set_latency_histograms(trace, LATENCY_RECORD) < 0) {
+		/* Not built with --enable-latency-histograms */
+		if (trace_get_err(trace).err_num != TRACE_ERR_OPTION_UNAVAIL) {
+			iferr(trace);
+			return 1;
+		}
+		trace_destroy(trace);
+		printf("success: not compiled in\n");
+		return 0;
+	}
+	trace_set_perpkt_threads(trace, THREADS);
+	pktcbs = trace_create_callback_set();
+	trace_set_packet_cb(pktcbs, per_packet);
+	rptcbs = trace_create_callback_set();
+	trace_set_result_cb(rptcbs, per_result);
+
+	if (trace_pstart(trace, NULL, pktcbs, rptcbs) < 0) {
+		iferr(trace);
+		return 1;
+	}
+	trace_join(trace);
+	iferr(trace);
+
+	error |= check_stage(trace, LIBTRACE_STAGE_CALLBACK, 100);
+	error |= check_stage(trace, LIBTRACE_STAGE_PUBLISH, 50);
+	error |= check_stage(trace, LIBTRACE_STAGE_READ, 0);
+	error |= check_stage(trace, LIBTRACE_STAGE_COMBINER, 0);
+	/* No hasher thread was needed */
+	if (trace_get_stage_latency(trace, -1, LIBTRACE_STAGE_HASHER, &s) < 0 ||
+			s.count != 0)
+		error = 1;
+	if (results != 50) {
+		printf("failure: %d results\n", results);
+		error = 1;
+	}
+
+	/* The threads add up to the total */
+	for (i = 0; i < THREADS; i++) {
+		if (trace_get_stage_latency(trace, i, LIBTRACE_STAGE_CALLBACK,
+					&s) < 0)
+			error = 1;
+		callbacks += s.count;
+	}
+	if (callbacks != 100 || trace_get_stage_latency(trace, THREADS,
+				LIBTRACE_STAGE_CALLBACK, &s) != -1)
+		error = 1;
+
+	trace_destroy(trace);
+	trace_destroy_callback_set(pktcbs);
+	trace_destroy_callback_set(rptcbs);
+
+	if (!error)
+		printf("success\n");
+	return error;
+}
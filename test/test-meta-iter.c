@@ -0,0 +1,222 @@
+/*
+ * This file is part of libtrace
+ *
+ * Copyright (c) 2007 The University of Waikato, Hamilton, New Zealand.
+ *
+ * All rights reserved.
+ *
+ * This code has been developed by the University of Waikato WAND
+ * research group. For further information please see http://www.wand.net.nz/
+ *
+ * libtrace is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * libtrace is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libtrace; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * $Id$
+ *
+ */
+
+/* Checks that walking meta packets with a meta-data cursor finds the same
+ * fields as trace_get_all_metadata(), and that the per-interface meta-data
+ * cache agrees with the interface getters */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "libtrace.h"
+
+void iferr(libtrace_t *trace)
+{
+	libtrace_err_t err = trace_get_err(trace);
+	if (err.err_num==0)
+		return;
+	printf("Error: %s\n",err.problem);
+	exit(1);
+}
+
+/* Compares the cursor against a full copy of the meta-data, returning the
+ * number of differences */
+int compare(libtrace_packet_t *packet) {
+	libtrace_meta_t *all = trace_get_all_metadata(packet);
+	libtrace_meta_iter_t iter;
+	libtrace_meta_item_t item;
+	int diff = 0;
+	int i = 0;
+
+	if (trace_meta_iter_start(&iter, packet) < 0) {
+		if (all)
+			trace_destroy_meta(all);
+		return all != NULL;
+	}
+
+	while (trace_meta_iter_next(&iter, &item) == 1) {
+		if (all == NULL || i >= all->num) {
+			diff ++;
+			break;
+		}
+		if (item.section != all->items[i].section ||
+				item.option != all->items[i].option ||
+				item.datatype != all->items[i].datatype)
+			diff ++;
+		/* Strings and addresses are left alone by both */
+		if (item.datatype == TRACE_META_STRING &&
+				(item.len != all->items[i].len ||
+				 memcmp(item.data, all->items[i].data,
+					 item.len) != 0))
+			diff ++;
+		i ++;
+	}
+	if (all && i != all->num)
+		diff ++;
+	if (all)
+		trace_destroy_meta(all);
+	return diff;
+}
+
+/* Checks the cached interface meta-data against the getters for the first
+ * interface described by a meta packet */
+int check_interface(libtrace_t *trace, libtrace_packet_t *packet) {
+	const libtrace_interface_meta_t *intf;
+	char name[256];
+	int diff = 0;
+
+	if (trace_get_interface_name(packet, name, sizeof(name), 0) == NULL)
+		return 0;
+
+	/* pcapng interfaces are numbered in order, so the one just read is
+	 * the last one */
+	if (trace_get_format(packet) == TRACE_FORMAT_PCAPNG) {
+		uint32_t ifid = 0;
+		while (trace_get_interface_meta(trace, ifid + 1))
+			ifid ++;
+		intf = trace_get_interface_meta(trace, ifid);
+	} else {
+		intf = trace_get_interface_meta(trace, 0);
+	}
+
+	if (intf == NULL || intf->name == NULL ||
+			strcmp(intf->name, name) != 0)
+		diff ++;
+	if (intf && intf->speed != trace_get_interface_speed(packet, 0))
+		diff ++;
+	if (intf && intf->ipv4 != trace_get_interface_ipv4(packet, 0))
+		diff ++;
+	return diff;
+}
+
+int test_trace(const char *uri, int expect_interfaces) {
+	libtrace_t *trace = trace_create(uri);
+	libtrace_packet_t *packet = trace_create_packet();
+	char small[4];
+	int meta = 0;
+	int diff = 0;
+
+	iferr(trace);
+	trace_start(trace);
+	iferr(trace);
+
+	while (trace_read_packet(trace, packet) > 0) {
+		if (!IS_LIBTRACE_META_PACKET(packet))
+			continue;
+		meta ++;
+		diff += compare(packet);
+		diff += check_interface(trace, packet);
+
+		/* Must be truncated to fit, including the terminator */
+		if (trace_get_interface_name(packet, small, sizeof(small), 0)
+				&& strlen(small) >= sizeof(small))
+			diff ++;
+	}
+	iferr(trace);
+
+	if (expect_interfaces && trace_get_interface_meta(trace, 0) == NULL)
+		diff ++;
+	if (trace_get_interface_meta(trace, 100000) != NULL)
+		diff ++;
+
+	trace_destroy_packet(packet);
+	trace_destroy(trace);
+
+	if (diff || meta == 0) {
+		printf("failure: %s: %d differences in %d meta packets\n", uri,
+				diff, meta);
+		return 1;
+	}
+	return 0;
+}
+
+/* Reads the whole trace, returning the name of interface 0 once the trace
+ * has been read, or NULL if it has not been described */
+char *read_interface_name(const char *uri, int discard) {
+	libtrace_t *trace = trace_create(uri);
+	libtrace_packet_t *packet = trace_create_packet();
+	const libtrace_interface_meta_t *first = NULL, *intf;
+	char *name = NULL;
+	int on = 1;
+
+	iferr(trace);
+	if (discard)
+		trace_config(trace, TRACE_OPTION_DISCARD_META, &on);
+	trace_start(trace);
+	iferr(trace);
+
+	while (trace_read_packet(trace, packet) > 0) {
+		if (first == NULL)
+			first = trace_get_interface_meta(trace, 0);
+	}
+	iferr(trace);
+
+	/* Whatever was returned earlier is still there to use */
+	intf = trace_get_interface_meta(trace, 0);
+	if ((first == NULL || first->valid) && intf && intf->name)
+		name = strdup(intf->name);
+
+	trace_destroy_packet(packet);
+	trace_destroy(trace);
+	return name;
+}
+
+/* Interfaces should be described whether meta packets are kept or not */
+int test_discard(const char *uri) {
+	char *kept = read_interface_name(uri, 0);
+	char *discarded = read_interface_name(uri, 1);
+	int error = 0;
+
+	if (kept == NULL || discarded == NULL ||
+			strcmp(kept, discarded) != 0) {
+		printf("failure: %s: interface %s with meta packets, %s "
+				"without\n", uri, kept ? kept : "unknown",
+				discarded ? discarded : "unknown");
+		error = 1;
+	}
+	free(kept);
+	free(discarded);
+	return error;
+}
+
+int main(int argc, char *argv[]) {
+	int error = 0;
+
+	if (argc > 1)
+		return test_trace(argv[1], 0);
+
+	error |= test_trace("pcapng:traces/100_packets.pcapng", 1);
+	error |= test_trace("pcapng:traces/complex.pcapng", 1);
+	error |= test_trace("erf:traces/provenance.erf", 0);
+	error |= test_discard("pcapng:traces/complex.pcapng");
+	error |= test_discard("erf:traces/provenance.erf");
+
+	if (!error)
+		printf("success\n");
+	return error;
+}
@@ -0,0 +1,202 @@
+/*
+ * This file is part of libtrace
+ *
+ * Copyright (c) 2007 The University of Waikato, Hamilton, New Zealand.
+ *
+ * All rights reserved.
+ *
+ * This code has been developed by the University of Waikato WAND
+ * research group. For further information please see http://www.wand.net.nz/
+ *
+ * libtrace is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * libtrace is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libtrace; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * $Id$
+ *
+ */
+
+
+/* Checks copying packets into existing packets and through a packet pool */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "libtrace.h"
+
+#define URI "pcapfile:traces/100_packets.pcap"
+
+void iferr(libtrace_t *trace)
+{
+	libtrace_err_t err = trace_get_err(trace);
+	if (err.err_num==0)
+		return;
+	printf("Error: %s\n",err.problem);
+	exit(1);
+}
+
+libtrace_t *open_trace(void) {
+	libtrace_t *trace = trace_create(URI);
+
+	iferr(trace);
+	trace_start(trace);
+	iferr(trace);
+	return trace;
+}
+
+void read_packet(libtrace_t *trace, libtrace_packet_t *packet) {
+	if (trace_read_packet(trace, packet) <= 0) {
+		iferr(trace);
+		printf("Error: %s ended early\n", URI);
+		exit(1);
+	}
+}
+
+/* Returns non-zero if the copy doesn't hold the same record as the
+ * original */
+int differs(libtrace_packet_t *copy, libtrace_packet_t *packet) {
+	size_t framing = trace_get_framing_length(packet);
+	size_t caplen = trace_get_capture_length(packet);
+
+	return copy->trace != packet->trace || !copy->header ||
+		trace_get_framing_length(copy) != framing ||
+		trace_get_capture_length(copy) != caplen ||
+		memcmp(copy->header, packet->header, framing) != 0 ||
+		memcmp(copy->payload, packet->payload, caplen) != 0;
+}
+
+/* A destination whose buffer is too small must be given a bigger one */
+int test_grow(libtrace_packet_t *packet) {
+	libtrace_packet_t *dest = trace_create_packet();
+	size_t needed = trace_get_framing_length(packet) +
+		trace_get_capture_length(packet);
+	int error = 0;
+
+	dest->buffer = malloc(8);
+	dest->buf_size = 8;
+
+	if (trace_copy_packet_into(dest, packet) != 0 ||
+			differs(dest, packet)) {
+		printf("failure: copy into a small buffer\n");
+		error = 1;
+	} else if (dest->buf_size < needed) {
+		printf("failure: buf_size is %zu after copying %zu bytes\n",
+				dest->buf_size, needed);
+		error = 1;
+	}
+	trace_destroy_packet(dest);
+	return error;
+}
+
+/* A destination still held by a format module must be released first. If
+ * it isn't, its old trace still thinks the packet is its own and finishes
+ * it (clearing the copy) when it is paused. */
+int test_release(libtrace_packet_t *packet) {
+	libtrace_t *other = open_trace();
+	libtrace_packet_t *dest = trace_create_packet();
+	int error = 0;
+
+	read_packet(other, dest);
+	read_packet(other, dest);
+	if (trace_copy_packet_into(dest, packet) != 0) {
+		printf("failure: copy into a packet from another trace\n");
+		error = 1;
+	}
+	trace_pause(other);
+	iferr(other);
+	if (!error && differs(dest, packet)) {
+		printf("failure: copy was not released from its old trace\n");
+		error = 1;
+	}
+	trace_destroy(other);
+	trace_destroy_packet(dest);
+	return error;
+}
+
+/* Packets handed back to a pool must be reused, buffer and all */
+int test_pool(libtrace_packet_t *packet) {
+	libtrace_packet_pool_t *pool = trace_create_packet_pool(2);
+	libtrace_packet_t *copy, *again;
+	void *buffer;
+	int error = 0;
+
+	copy = trace_packet_pool_copy(pool, packet);
+	if (!copy || differs(copy, packet)) {
+		printf("failure: copy from an empty pool\n");
+		trace_destroy_packet_pool(pool);
+		return 1;
+	}
+	buffer = copy->buffer;
+	trace_packet_pool_release(pool, copy);
+
+	again = trace_packet_pool_copy(pool, packet);
+	if (again != copy || again->buffer != buffer) {
+		printf("failure: released packet was not reused\n");
+		error = 1;
+	} else if (differs(again, packet)) {
+		printf("failure: copy into a reused packet\n");
+		error = 1;
+	}
+	trace_packet_pool_release(pool, again);
+	trace_destroy_packet_pool(pool);
+	return error;
+}
+
+/* Packets read before the trace was last restarted can't be copied */
+int test_stale(libtrace_t *trace, libtrace_packet_t *packet) {
+	libtrace_packet_pool_t *pool = trace_create_packet_pool(1);
+	libtrace_packet_t *dest = trace_create_packet();
+	libtrace_packet_t *last = trace_create_packet();
+	int error = 0;
+
+	/* Pausing finishes the last packet read, so make sure that isn't the
+	 * one we are testing */
+	read_packet(trace, last);
+	trace_pause(trace);
+	iferr(trace);
+	trace_start(trace);
+	iferr(trace);
+
+	if (trace_copy_packet_into(dest, packet) != -1) {
+		printf("failure: copied a packet from an earlier start\n");
+		error = 1;
+	}
+	if (trace_packet_pool_copy(pool, packet) != NULL) {
+		printf("failure: pool copied a packet from an earlier start\n");
+		error = 1;
+	}
+	trace_destroy_packet(last);
+	trace_destroy_packet(dest);
+	trace_destroy_packet_pool(pool);
+	return error;
+}
+
+int main(void) {
+	libtrace_t *trace = open_trace();
+	libtrace_packet_t *packet = trace_create_packet();
+	int error = 0;
+
+	read_packet(trace, packet);
+
+	error |= test_grow(packet);
+	error |= test_release(packet);
+	error |= test_pool(packet);
+	error |= test_stale(trace, packet);
+
+	trace_destroy_packet(packet);
+	trace_destroy(trace);
+
+	if (!error)
+		printf("success\n");
+	return error;
+}
@@ -0,0 +1,157 @@
+/*
+ * This file is part of libtrace
+ *
+ * Copyright (c) 2007 The University of Waikato, Hamilton, New Zealand.
+ *
+ * All rights reserved.
+ *
+ * This code has been developed by the University of Waikato WAND
+ * research group. For further information please see http://www.wand.net.nz/
+ *
+ * libtrace is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * libtrace is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libtrace; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * $Id$
+ *
+ */
+
+/* Reads the same trace twice side by side, once with eager parsing enabled,
+ * and checks that every header lookup gives the same answer either way */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "libtrace.h"
+
+void iferr(libtrace_t *trace)
+{
+	libtrace_err_t err = trace_get_err(trace);
+	if (err.err_num==0)
+		return;
+	printf("Error: %s\n",err.problem);
+	exit(1);
+}
+
+libtrace_t *open_trace(const char *uri, bool eager) {
+	libtrace_t *trace = trace_create(uri);
+	iferr(trace);
+	if (eager)
+		trace_set_eager_parse(trace, true);
+	iferr(trace);
+	trace_start(trace);
+	iferr(trace);
+	return trace;
+}
+
+/* Checks that two headers are at the same place within their packets */
+int same_place(libtrace_packet_t *a, void *ha, libtrace_packet_t *b, void *hb) {
+	if (ha == NULL || hb == NULL)
+		return ha == hb;
+	return (char *)ha - (char *)a->buffer == (char *)hb - (char *)b->buffer;
+}
+
+/* Compares the headers found in two copies of the same packet, returning
+ * the number of differences */
+int compare(libtrace_packet_t *a, libtrace_packet_t *b) {
+	libtrace_linktype_t la, lb;
+	uint16_t ea = 0, eb = 0;
+	uint8_t pa = 0, pb = 0;
+	uint32_t ra = 0, rb = 0;
+	void *ha, *hb;
+	int diff = 0;
+	int i;
+
+	/* Ask more than once, so that the cached answers are checked too */
+	for (i = 0; i < 2; i++) {
+		ha = trace_get_layer2(a, &la, &ra);
+		hb = trace_get_layer2(b, &lb, &rb);
+		if (!same_place(a, ha, b, hb) || (ha && (la != lb || ra != rb)))
+			diff ++;
+
+		ha = trace_get_layer3(a, &ea, &ra);
+		hb = trace_get_layer3(b, &eb, &rb);
+		if (!same_place(a, ha, b, hb) || (ha && (ea != eb || ra != rb)))
+			diff ++;
+
+		ha = trace_get_transport(a, &pa, &ra);
+		hb = trace_get_transport(b, &pb, &rb);
+		if (!same_place(a, ha, b, hb) || (ha && (pa != pb || ra != rb)))
+			diff ++;
+
+		if (trace_get_source_port(a) != trace_get_source_port(b) ||
+			trace_get_destination_port(a) !=
+				trace_get_destination_port(b))
+			diff ++;
+	}
+	return diff;
+}
+
+int test_trace(const char *uri) {
+	libtrace_t *lazy = open_trace(uri, false);
+	libtrace_t *eager = open_trace(uri, true);
+	libtrace_packet_t *a = trace_create_packet();
+	libtrace_packet_t *b = trace_create_packet();
+	int count = 0;
+	int diff = 0;
+
+	while (trace_read_packet(eager, a) > 0) {
+		if (trace_read_packet(lazy, b) <= 0) {
+			diff ++;
+			break;
+		}
+		diff += compare(a, b);
+		count ++;
+	}
+	iferr(eager);
+	iferr(lazy);
+
+	trace_destroy_packet(a);
+	trace_destroy_packet(b);
+	trace_destroy(eager);
+	trace_destroy(lazy);
+
+	if (diff) {
+		printf("failure: %s: %d differences in %d packets\n", uri,
+				diff, count);
+		return 1;
+	}
+	return 0;
+}
+
+int main(int argc, char *argv[]) {
+	const char *uris[] = {
+		"erf:traces/100_packets.erf",
+		"pcapfile:traces/100_packets.pcap",
+		"pcapfile:traces/100_sll.pcap",
+		"pcapfile:traces/10_packets_radiotap.pcap",
+		"pcapfile:traces/vlan.pcap",
+		"pcapfile:traces/qinq.pcap",
+		"pcapfile:traces/mpls.pcap",
+		"pcapfile:traces/10_mpls_ip.pcap",
+		"erf:traces/fragtest.erf.gz",
+		"pcapfile:traces/vxlan.pcap",
+	};
+	int error = 0;
+	unsigned int i;
+
+	if (argc > 1)
+		return test_trace(argv[1]);
+
+	for (i = 0; i < sizeof(uris) / sizeof(uris[0]); i++)
+		error |= test_trace(uris[i]);
+
+	if (!error)
+		printf("success\n");
+	return error;
+}
@@ -0,0 +1,394 @@
+/*
+ * This file is part of libtrace
+ *
+ * Copyright (c) 2007 The University of Waikato, Hamilton, New Zealand.
+ *
+ * All rights reserved.
+ *
+ * This code has been developed by the University of Waikato WAND
+ * research group. For further information please see http://www.wand.net.nz/
+ *
+ * libtrace is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * libtrace is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libtrace; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * $Id$
+ *
+ */
+
+/* Writes a trace of fragmented IPv4 and IPv6 datagrams, with the fragments
+ * interleaved, reordered and duplicated, then checks that a parallel trace
+ * with reassembly enabled delivers every datagram exactly once and intact */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "libtrace_parallel.h"
+
+#define TRACE_FILE "traces/fragments.out.pcap"
+#define NB_DATAGRAMS 200
+/* The identification of a datagram that is left to expire */
+#define EXPIRED 9999
+/* The identification of a datagram with a fragment past its end */
+#define OVERRUN 9998
+#define GROUP 4
+#define TIMEOUT_MS 100
+
+struct record {
+	uint32_t ts_usec;
+	uint32_t len;
+	unsigned char frame[1600];
+};
+
+static struct record records[NB_DATAGRAMS * 8];
+static int nb_records = 0;
+static uint32_t clock_usec = 0;
+
+static int seen[NB_DATAGRAMS];
+static int bad = 0;
+static int fragments = 0;
+static int delivered = 0;
+
+void iferr(libtrace_t *trace)
+{
+	libtrace_err_t err = trace_get_err(trace);
+	if (err.err_num==0)
+		return;
+	printf("Error: %s\n",err.problem);
+	exit(1);
+}
+
+/* The length of the UDP payload of datagram i */
+int data_length(uint32_t i) {
+	if (i >= NB_DATAGRAMS)
+		return 3000;
+	return 100 + (i * 397) % 6000;
+}
+
+/* Builds datagram i, with correct checksums, into a packet */
+void make_datagram(libtrace_packet_t *packet, uint32_t id, int v6) {
+	static unsigned char frame[14 + 40 + 8 + 6100];
+	int len = data_length(id);
+	int iplen = v6 ? 40 : 20;
+	unsigned char *ip = frame + 14;
+	unsigned char *udp = ip + iplen;
+	uint16_t csum, *stored;
+	int j;
+
+	memset(frame, 0, sizeof(frame));
+	if (v6) {
+		frame[12] = 0x86;
+		frame[13] = 0xdd;
+		ip[0] = 0x60;
+		ip[4] = (8 + len) >> 8;
+		ip[5] = (8 + len) & 0xff;
+		ip[6] = TRACE_IPPROTO_UDP;
+		ip[7] = 64;
+		ip[8] = 0x20;
+		ip[9] = 0x01;
+		ip[23] = 0x01;
+		ip[24] = 0x20;
+		ip[25] = 0x01;
+		ip[39] = 0x02;
+	} else {
+		frame[12] = 0x08;
+		ip[0] = 0x45;
+		ip[2] = (20 + 8 + len) >> 8;
+		ip[3] = (20 + 8 + len) & 0xff;
+		ip[4] = id >> 8;
+		ip[5] = id & 0xff;
+		ip[8] = 64;
+		ip[9] = TRACE_IPPROTO_UDP;
+		ip[12] = 10;
+		ip[15] = 1;
+		ip[16] = 10;
+		ip[19] = 2;
+	}
+	udp[0] = 0x04;
+	udp[1] = 0xd2;
+	udp[3] = 0x35;
+	udp[4] = (8 + len) >> 8;
+	udp[5] = (8 + len) & 0xff;
+	memcpy(udp + 8, &id, sizeof(id));
+	for (j = sizeof(id); j < len; j++)
+		udp[8 + j] = (unsigned char)(id * 31 + j);
+
+	trace_construct_packet(packet, TRACE_TYPE_ETH, frame,
+			14 + iplen + 8 + len);
+	if ((stored = trace_checksum_layer3(packet, &csum)) != NULL)
+		*stored = htons(csum);
+	if ((stored = trace_checksum_transport(packet, &csum)) != NULL)
+		*stored = htons(csum);
+}
+
+/* Sets the fragment offset and more fragments flag of an IPv4 header, and
+ * fixes its checksum */
+void set_ip_offset(unsigned char *ip, int offset, int more) {
+	uint16_t off = offset / 8 | (more ? 0x2000 : 0);
+	uint32_t sum = 0;
+	int j;
+
+	ip[6] = off >> 8;
+	ip[7] = off & 0xff;
+	ip[10] = ip[11] = 0;
+	for (j = 0; j < 20; j += 2)
+		sum += (ip[j] << 8) | ip[j + 1];
+	while (sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+	sum = ~sum & 0xffff;
+	ip[10] = sum >> 8;
+	ip[11] = sum & 0xff;
+}
+
+/* Splits a datagram into fragments, unless it is small enough to send as
+ * it is. Returns the number of fragments */
+int fragment(libtrace_packet_t *packet, uint32_t id, int v6,
+		struct record *out) {
+	libtrace_linktype_t linktype;
+	uint32_t remaining;
+	unsigned char *frame = trace_get_packet_buffer(packet, &linktype,
+			&remaining);
+	int iplen = v6 ? 40 : 20;
+	int max = v6 ? 1448 : 1480;
+	int payload = remaining - 14 - iplen;
+	int offset, n = 0;
+
+	if (payload <= max) {
+		memcpy(out->frame, frame, remaining);
+		out->len = remaining;
+		return 1;
+	}
+
+	for (offset = 0; offset < payload; offset += max) {
+		struct record *r = &out[n++];
+		int len = payload - offset < max ? payload - offset : max;
+		int more = offset + len < payload;
+		unsigned char *ip = r->frame + 14;
+
+		memcpy(r->frame, frame, 14 + iplen);
+		if (v6) {
+			unsigned char *frag = ip + 40;
+
+			ip[4] = (8 + len) >> 8;
+			ip[5] = (8 + len) & 0xff;
+			ip[6] = TRACE_IPPROTO_FRAGMENT;
+			frag[0] = TRACE_IPPROTO_UDP;
+			frag[1] = 0;
+			frag[2] = offset >> 8;
+			frag[3] = (offset & 0xf8) | more;
+			frag[4] = id >> 24;
+			frag[5] = id >> 16;
+			frag[6] = id >> 8;
+			frag[7] = id;
+			memcpy(frag + 8, frame + 14 + iplen + offset, len);
+			r->len = 14 + 40 + 8 + len;
+		} else {
+			ip[2] = (20 + len) >> 8;
+			ip[3] = (20 + len) & 0xff;
+			set_ip_offset(ip, offset, more);
+			memcpy(ip + 20, frame + 14 + iplen + offset, len);
+			r->len = 14 + 20 + len;
+		}
+	}
+	return n;
+}
+
+/* Adds a record to the trace, a millisecond after the one before */
+void add_record(const struct record *r) {
+	records[nb_records] = *r;
+	records[nb_records].ts_usec = clock_usec;
+	clock_usec += 1000;
+	nb_records ++;
+}
+
+/* Writes out the fragments, interleaving the datagrams in groups and
+ * reversing or repeating the fragments of some of them. Two datagrams are
+ * never complete, one expires and one has a fragment past its end. */
+void write_trace(void) {
+	libtrace_packet_t *packet = trace_create_packet();
+	static struct record frags[GROUP][8];
+	static struct record late[8];
+	int counts[GROUP];
+	int i, g, k, idx, late_count;
+	uint32_t hdr[6] = {0xa1b2c3d4, 0x00040002, 0, 0, 65535, 1};
+	FILE *f;
+
+	/* One datagram starts first and finishes after a gap that is longer
+	 * than the timeout, so it should never be completed */
+	make_datagram(packet, EXPIRED, 0);
+	late_count = fragment(packet, EXPIRED, 0, late);
+	add_record(&late[0]);
+
+	/* Another has a fragment well past the end given by its last
+	 * fragment. Counting blocks alone would see it as complete, with a
+	 * hole between the first and last fragments. */
+	make_datagram(packet, OVERRUN, 0);
+	fragment(packet, OVERRUN, 0, frags[0]);
+	add_record(&frags[0][0]);
+	frags[0][1] = frags[0][0];
+	set_ip_offset(frags[0][1].frame + 14, 8000, 1);
+	add_record(&frags[0][1]);
+	set_ip_offset(frags[0][1].frame + 14, 2960, 0);
+	add_record(&frags[0][1]);
+
+	for (i = 0; i < NB_DATAGRAMS; i += GROUP) {
+		for (g = 0; g < GROUP; g++) {
+			make_datagram(packet, i + g, (i + g) % 2);
+			counts[g] = fragment(packet, i + g, (i + g) % 2,
+					frags[g]);
+		}
+
+		/* Round robin across the group */
+		for (k = 0; k < 8; k++) {
+			for (g = 0; g < GROUP; g++) {
+				if (k >= counts[g])
+					continue;
+				idx = ((i + g) % 3 == 0) ? counts[g] - 1 - k : k;
+				add_record(&frags[g][idx]);
+				if ((i + g) % 7 == 0 && counts[g] > 1 && k == 0)
+					add_record(&frags[g][idx]);
+			}
+		}
+	}
+
+	clock_usec += (TIMEOUT_MS + 1) * 1000;
+	for (k = 1; k < late_count; k++)
+		add_record(&late[k]);
+	trace_destroy_packet(packet);
+
+	f = fopen(TRACE_FILE, "w");
+	if (!f) {
+		perror(TRACE_FILE);
+		exit(1);
+	}
+	fwrite(hdr, sizeof(hdr), 1, f);
+	for (k = 0; k < nb_records; k++) {
+		uint32_t rec[4] = {1000000000 + records[k].ts_usec / 1000000,
+			records[k].ts_usec % 1000000, records[k].len,
+			records[k].len};
+		fwrite(rec, sizeof(rec), 1, f);
+		fwrite(records[k].frame, records[k].len, 1, f);
+	}
+	fclose(f);
+}
+
+/* Checks that a packet is one of the datagrams, whole and undamaged */
+int check_datagram(libtrace_packet_t *packet) {
+	libtrace_udp_t *udp;
+	unsigned char *data;
+	uint16_t csum, *stored;
+	uint32_t remaining, id;
+	uint8_t proto, more;
+	int j, len;
+
+	if (trace_get_fragment_offset(packet, &more) != 0 || more) {
+		__sync_fetch_and_add(&fragments, 1);
+		return 1;
+	}
+	udp = (libtrace_udp_t *)trace_get_transport(packet, &proto,
+			&remaining);
+	if (!udp || proto != TRACE_IPPROTO_UDP || remaining < 12)
+		return 1;
+	data = (unsigned char *)(udp + 1);
+	memcpy(&id, data, sizeof(id));
+	if (id >= NB_DATAGRAMS)
+		return 1;
+
+	len = data_length(id);
+	if (ntohs(udp->len) != 8 + len || remaining != 8 + (uint32_t)len)
+		return 1;
+	for (j = sizeof(id); j < len; j++) {
+		if (data[j] != (unsigned char)(id * 31 + j))
+			return 1;
+	}
+	stored = trace_checksum_layer3(packet, &csum);
+	if (stored && ntohs(*stored) != csum)
+		return 1;
+	stored = trace_checksum_transport(packet, &csum);
+	if (!stored || ntohs(*stored) != csum)
+		return 1;
+
+	__sync_fetch_and_add(&seen[id], 1);
+	return 0;
+}
+
+static libtrace_packet_t *per_packet(libtrace_t *trace, libtrace_thread_t *t,
+		void *global, void *tls, libtrace_packet_t *packet) {
+	__sync_fetch_and_add(&delivered, 1);
+	if (check_datagram(packet))
+		__sync_fetch_and_add(&bad, 1);
+	return packet;
+}
+
+int test_reassembly(int threads, enum hasher_types hasher, size_t timeout) {
+	libtrace_callback_set_t *processing;
+	libtrace_t *trace;
+	int i, missing = 0;
+
+	memset(seen, 0, sizeof(seen));
+	bad = fragments = delivered = 0;
+
+	trace = trace_create("pcapfile:" TRACE_FILE);
+	iferr(trace);
+	processing = trace_create_callback_set();
+	trace_set_packet_cb(processing, per_packet);
+	trace_set_perpkt_threads(trace, threads);
+	if (hasher != HASHER_BALANCE)
+		trace_set_hasher(trace, hasher, NULL, NULL);
+	trace_set_reassembly_timeout(trace, timeout);
+
+	trace_pstart(trace, NULL, processing, NULL);
+	iferr(trace);
+	trace_join(trace);
+	iferr(trace);
+	trace_destroy(trace);
+	trace_destroy_callback_set(processing);
+
+	if (timeout == 0) {
+		/* Everything should come through as it is */
+		if (delivered != nb_records) {
+			printf("failure: %d of %d packets without reassembly\n",
+					delivered, nb_records);
+			return 1;
+		}
+		return 0;
+	}
+
+	for (i = 0; i < NB_DATAGRAMS; i++) {
+		if (seen[i] != 1)
+			missing ++;
+	}
+	if (missing || bad || fragments || delivered != NB_DATAGRAMS) {
+		printf("failure: %d threads: %d missing, %d bad, %d fragments, "
+				"%d delivered\n", threads, missing, bad,
+				fragments, delivered);
+		return 1;
+	}
+	return 0;
+}
+
+int main(int argc, char *argv[]) {
+	int error = 0;
+
+	write_trace();
+
+	error |= test_reassembly(1, HASHER_BALANCE, 0);
+	error |= test_reassembly(1, HASHER_BALANCE, TIMEOUT_MS);
+	error |= test_reassembly(4, HASHER_FRAGMENT, TIMEOUT_MS);
+
+	if (!error)
+		printf("success\n");
+	return error;
+}
@@ -0,0 +1,196 @@
+/*
+ * This file is part of libtrace
+ *
+ * Copyright (c) 2007 The University of Waikato, Hamilton, New Zealand.
+ *
+ * All rights reserved.
+ *
+ * This code has been developed by the University of Waikato WAND
+ * research group. For further information please see http://www.wand.net.nz/
+ *
+ * libtrace is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * libtrace is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libtrace; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * $Id$
+ *
+ */
+
+/* Checks that results reach a batch result callback in order, that the
+ * latency budget wakes the reporter before the threshold is reached and
+ * that results from the result pool are all freed */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "libtrace_parallel.h"
+
+#define URI "pcapfile:traces/100_packets.pcap"
+#define THREADS 4
+
+struct item {
+	uint64_t order;
+	uint64_t published;
+	char padding[32];
+};
+
+static int outstanding = 0;
+static int results = 0;
+static uint64_t max_wait = 0;
+static int batches = 0;
+static int max_batch = 0;
+static int misordered = 0;
+static uint64_t last_key = 0;
+
+/* In milliseconds */
+static uint64_t now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+void iferr(libtrace_t *trace)
+{
+	libtrace_err_t err = trace_get_err(trace);
+	if (err.err_num==0)
+		return;
+	printf("Error: %s\n",err.problem);
+	exit(1);
+}
+
+static libtrace_packet_t *per_packet(libtrace_t *trace,
+		libtrace_thread_t *t, void *global, void *tls,
+		libtrace_packet_t *packet) {
+	struct item *item;
+	int slow = *(int *)global;
+
+	item = trace_alloc_result(trace, t, sizeof(struct item));
+	if (!item)
+		return packet;
+	item->order = trace_packet_get_order(packet);
+	item->published = now();
+	__atomic_add_fetch(&outstanding, 1, __ATOMIC_SEQ_CST);
+	trace_publish_result(trace, t, item->order,
+			(libtrace_generic_t){.ptr = item}, RESULT_USER);
+	/* Take long enough that results would wait a while without the
+	 * latency budget */
+	if (slow)
+		usleep(5000);
+	return packet;
+}
+
+static void per_batch(libtrace_t *trace, libtrace_thread_t *sender,
+		void *global, void *tls, libtrace_result_t *res, int count) {
+	struct item *item;
+	int i;
+
+	batches ++;
+	if (count > max_batch)
+		max_batch = count;
+	for (i = 0; i < count; i++) {
+		if (res[i].type != RESULT_USER)
+			continue;
+		item = (struct item *) res[i].value.ptr;
+		if (item->order != res[i].key ||
+				(results && res[i].key <= last_key))
+			misordered ++;
+		last_key = res[i].key;
+		if (now() - item->published > max_wait)
+			max_wait = now() - item->published;
+		results ++;
+		trace_free_result(trace, item);
+		__atomic_sub_fetch(&outstanding, 1, __ATOMIC_SEQ_CST);
+	}
+}
+
+static int run(const libtrace_combine_t *combiner, int slow) {
+	libtrace_callback_set_t *processing, *reporter;
+	libtrace_t *trace;
+	void *buf;
+
+	outstanding = results = 0;
+	max_wait = 0;
+	batches = max_batch = misordered = 0;
+	last_key = 0;
+
+	processing = trace_create_callback_set();
+	trace_set_packet_cb(processing, per_packet);
+	reporter = trace_create_callback_set();
+	trace_set_result_batch_cb(reporter, per_batch);
+
+	trace = trace_create(URI);
+	iferr(trace);
+	trace_set_perpkt_threads(trace, THREADS);
+	trace_set_combiner(trace, combiner, (libtrace_generic_t){0});
+	/* Never reached, so only the latency budget or the end of the trace
+	 * will wake the reporter */
+	trace_set_reporter_thold(trace, 1000);
+	if (slow)
+		trace_set_reporter_latency(trace, 1);
+	trace_set_result_size(trace, sizeof(struct item));
+
+	trace_pstart(trace, &slow, processing, reporter);
+	iferr(trace);
+	trace_join(trace);
+	iferr(trace);
+
+	/* Memory for results can be had from any thread */
+	buf = trace_alloc_result(trace, NULL, 1000);
+	if (!buf) {
+		printf("failure: could not allocate a result\n");
+		return 1;
+	}
+	trace_free_result(trace, buf);
+
+	trace_destroy(trace);
+	trace_destroy_callback_set(processing);
+	trace_destroy_callback_set(reporter);
+
+	if (results != 100 || outstanding != 0) {
+		printf("failure: %d results, %d not freed\n", results,
+				outstanding);
+		return 1;
+	}
+	if (max_batch > LIBTRACE_RESULT_BATCH) {
+		printf("failure: batch of %d results\n", max_batch);
+		return 1;
+	}
+	return 0;
+}
+
+int main(void) {
+	int error = 0;
+
+	/* Everything arrives at the end, in order and in full batches */
+	error |= run(&combiner_ordered, 0);
+	if (misordered || max_batch != LIBTRACE_RESULT_BATCH) {
+		printf("failure: %d out of order, largest batch %d\n",
+				misordered, max_batch);
+		error = 1;
+	}
+
+	/* The latency budget gets results to the reporter early, where
+	 * otherwise they would wait for a thread to finish */
+	error |= run(&combiner_unordered, 1);
+	if (max_wait > 50) {
+		printf("failure: a result waited %d ms\n", (int) max_wait);
+		error = 1;
+	}
+
+	if (!error)
+		printf("success\n");
+	return error;
+}
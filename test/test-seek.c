@@ -35,7 +35,9 @@
 #include <string.h>
 #include <sys/time.h>
 #include <sys/types.h>
+#include <sys/wait.h>
 #include <time.h>
+#include <unistd.h>
 
 #include <netinet/in.h>
 #include <netinet/in_systm.h>
@@ -59,45 +61,149 @@ void iferr(libtrace_t *trace)
 	exit(1);
 }
 
-int main(int argc, char *argv[]) {
-        char *uri = "erf:traces/100_packets.erf";
-        int psize = 0;
-	int error = 0;
-	int count = 0;
-	libtrace_packet_t *packet;
-
-	trace = trace_create(uri);
-	iferr(trace);
+const char *lookup_uri(const char *type) {
+	if (strchr(type,':'))
+		return type;
+	if (!strcmp(type,"erf"))
+		return "erf:traces/100_packets.erf";
+	if (!strcmp(type,"pcapfile"))
+		return "pcapfile:traces/100_packets.pcap";
+	if (!strcmp(type,"pcapng"))
+		return "pcapng:traces/100_packets.pcapng";
+	return type;
+}
 
-	trace_start(trace);
-	iferr(trace);
+/* Counts the packets remaining in the trace, ignoring meta packets */
+int count_packets(libtrace_t *trace) {
+	libtrace_packet_t *packet;
+	int psize = 0;
+	int count = 0;
 
-	trace_seek_erf_timestamp(trace,4704246759960519168ULL);
-	iferr(trace);
-	
 	packet=trace_create_packet();
-        for (;;) {
+	for (;;) {
 		if ((psize = trace_read_packet(trace, packet)) <0) {
-			error = 1;
+			iferr(trace);
+			count = -1;
 			break;
 		}
 		if (psize == 0) {
-			error = 0;
 			break;
 		}
+		if (IS_LIBTRACE_META_PACKET(packet))
+			continue;
 		count ++;
-        }
+	}
 	trace_destroy_packet(packet);
-	if (error == 0) {
-		if (count == 4) {
-			printf("success: 4 packets read\n");
-		} else {
-			printf("failure: 4 packets expected, %d seen\n",count);
+	return count;
+}
+
+/* Seeking in a trace read from a pipe, where the reader can't tell where it
+ * is, has to fail rather than quietly skipping packets */
+int test_no_tell(void) {
+	libtrace_t *piped;
+	libtrace_packet_t *packet;
+	libtrace_err_t err;
+	char uri[64];
+	int fds[2];
+	int error = 0;
+	int i;
+	pid_t child;
+
+	if (pipe(fds) < 0) {
+		perror("pipe");
+		return 1;
+	}
+	child = fork();
+	if (child == 0) {
+		FILE *in = fopen("traces/100_packets.pcap", "r");
+		char buf[4096];
+		size_t n;
+
+		close(fds[0]);
+		while (in && (n = fread(buf, 1, sizeof(buf), in)) > 0) {
+			if (write(fds[1], buf, n) < 0)
+				break;
+		}
+		_exit(0);
+	}
+	close(fds[1]);
+
+	snprintf(uri, sizeof(uri), "pcapfile:/dev/fd/%d", fds[0]);
+	piped = trace_create(uri);
+	iferr(piped);
+	trace_start(piped);
+	iferr(piped);
+
+	packet = trace_create_packet();
+	for (i = 0; i < 3; i++) {
+		if (trace_read_packet(piped, packet) <= 0) {
+			iferr(piped);
+			printf("failure: unable to read from %s\n", uri);
+			error = 1;
+		}
+	}
+	trace_destroy_packet(packet);
+
+	if (trace_seek_erf_timestamp(piped, 4704246759960519168ULL) != -1) {
+		printf("failure: seeking without tell succeeded\n");
+		error = 1;
+	} else {
+		err = trace_get_err(piped);
+		if (err.err_num != TRACE_ERR_WANDIO_FAILED) {
+			printf("failure: seeking without tell gave error %d\n",
+					err.err_num);
 			error = 1;
+		} else {
+			printf("success: seeking without tell failed\n");
 		}
+	}
+
+	trace_destroy(piped);
+	close(fds[0]);
+	waitpid(child, NULL, 0);
+	return error;
+}
+
+int main(int argc, char *argv[]) {
+	const char *uri = "erf:traces/100_packets.erf";
+	int error = 0;
+	int count = 0;
+
+	if (argc > 1)
+		uri = lookup_uri(argv[1]);
+
+	trace = trace_create(uri);
+	iferr(trace);
+
+	trace_start(trace);
+	iferr(trace);
+
+	/* The timestamp of the 97th packet, as stored in the ERF trace */
+	trace_seek_erf_timestamp(trace,4704246759960519168ULL);
+	iferr(trace);
+
+	count = count_packets(trace);
+	if (count == 4) {
+		printf("success: 4 packets read\n");
 	} else {
-		iferr(trace);
+		printf("failure: 4 packets expected, %d seen\n",count);
+		error = 1;
 	}
+
+	/* Now go backwards, to between the 2nd and 3rd packets */
+	trace_seek_erf_timestamp(trace,4704246759842650000ULL);
+	iferr(trace);
+
+	count = count_packets(trace);
+	if (count == 98) {
+		printf("success: 98 packets read\n");
+	} else {
+		printf("failure: 98 packets expected, %d seen\n",count);
+		error = 1;
+	}
+
         trace_destroy(trace);
+
+	error |= test_no_tell();
         return error;
 }
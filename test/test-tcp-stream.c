@@ -0,0 +1,421 @@
+/*
+ * This file is part of libtrace
+ *
+ * Copyright (c) 2007 The University of Waikato, Hamilton, New Zealand.
+ *
+ * All rights reserved.
+ *
+ * This code has been developed by the University of Waikato WAND
+ * research group. For further information please see http://www.wand.net.nz/
+ *
+ * libtrace is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * libtrace is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libtrace; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * $Id$
+ *
+ */
+
+/* Writes a trace of interleaved TCP connections over IPv4 and IPv6, with
+ * segments reordered, duplicated, overlapping and lost, then checks that
+ * the TCP payload callback delivers each direction of each connection in
+ * order and exactly once */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "libtrace_parallel.h"
+
+#define TRACE_FILE "traces/tcpstreams.out.pcap"
+#define NB_STREAMS 64
+#define MAX_SEGS 12
+#define MAX_RECORDS 48
+#define GROUP 8
+#define SERVER_PORT 80
+#define CLIENT_PORT 1024
+
+#define TCP_FIN 0x01
+#define TCP_SYN 0x02
+#define TCP_RST 0x04
+#define TCP_ACK 0x10
+
+struct record {
+	uint32_t ts_usec;
+	uint32_t len;
+	unsigned char frame[1600];
+};
+
+/* What has been delivered for each stream */
+struct expect {
+	uint32_t offset[2];
+	int fin[2];
+	int end;
+	int gaps;
+	/* Set once a gap has been skipped, after which the offset of the
+	 * payload is unknown */
+	int lost[2];
+	int errors;
+};
+
+static struct record records[NB_STREAMS * MAX_RECORDS];
+static int nb_records = 0;
+static uint32_t clock_usec = 0;
+static struct expect expect[NB_STREAMS];
+/* Set when the memory limit is low enough to force gaps anywhere */
+static int forced_gaps = 0;
+
+void iferr(libtrace_t *trace)
+{
+	libtrace_err_t err = trace_get_err(trace);
+	if (err.err_num==0)
+		return;
+	printf("Error: %s\n",err.problem);
+	exit(1);
+}
+
+/* The shape of each stream */
+static int nb_segs(int id, int dir) {
+	return 8 + (id + dir) % 5;
+}
+
+static uint32_t seg_len(int id, int dir, int k) {
+	return 1 + (id * 131 + dir * 71 + k * 97) % 1400;
+}
+
+static uint32_t seg_offset(int id, int dir, int k) {
+	uint32_t offset = 0;
+	int j;
+
+	for (j = 0; j < k; j++)
+		offset += seg_len(id, dir, j);
+	return offset;
+}
+
+static uint32_t isn(int id, int dir) {
+	/* Some of the clients wrap around part way through */
+	return dir ? (uint32_t)id << 24 : 0xfffff000 + id * 100;
+}
+
+static int is_v6(int id) { return id % 2; }
+static int is_reversed(int id) { return id % 3 == 0; }
+static int is_lost(int id) { return id % 11 == 4; }
+static int is_repeated(int id) { return id % 5 == 0 && !is_lost(id); }
+static int is_reset(int id) { return id % 13 == 12; }
+/* One stream starts after its handshake, with its first segment in order */
+static int is_midstream(int id) { return id == NB_STREAMS - 2; }
+
+static unsigned char payload_byte(int id, int dir, uint32_t offset) {
+	return (unsigned char)(id * 7 + dir * 101 + offset * 13 + offset / 251);
+}
+
+/* Builds a segment of stream id, sent in direction dir, holding the
+ * payload from offset */
+static void make_segment(struct record *r, int id, int dir, uint32_t offset,
+		uint32_t len, uint8_t flags) {
+	unsigned char *frame = r->frame;
+	unsigned char *ip = frame + 14;
+	unsigned char *src, *dst, *tcp;
+	uint32_t seq = isn(id, dir) + 1 + offset;
+	int addrlen, j;
+
+	if (flags & TCP_SYN)
+		seq --;
+
+	memset(frame, 0, 14 + 40 + 20);
+	if (is_v6(id)) {
+		frame[12] = 0x86;
+		frame[13] = 0xdd;
+		ip[0] = 0x60;
+		ip[4] = (20 + len) >> 8;
+		ip[5] = (20 + len) & 0xff;
+		ip[6] = TRACE_IPPROTO_TCP;
+		ip[7] = 64;
+		src = ip + 8;
+		dst = ip + 24;
+		tcp = ip + 40;
+		addrlen = 16;
+	} else {
+		frame[12] = 0x08;
+		ip[0] = 0x45;
+		ip[2] = (20 + 20 + len) >> 8;
+		ip[3] = (20 + 20 + len) & 0xff;
+		ip[8] = 64;
+		ip[9] = TRACE_IPPROTO_TCP;
+		src = ip + 12;
+		dst = ip + 16;
+		tcp = ip + 20;
+		addrlen = 4;
+	}
+
+	/* The client is 10.0.1.id or 2001::id+2, the server 10.0.0.1 or
+	 * 2001::1 */
+	if (addrlen == 16) {
+		src[0] = dst[0] = 0x20;
+		src[1] = dst[1] = 0x01;
+	} else {
+		src[0] = dst[0] = 10;
+	}
+	if (dir == TCP_FROM_CLIENT) {
+		src[addrlen - 2] = addrlen == 4;
+		src[addrlen - 1] = addrlen == 4 ? id : id + 2;
+		dst[addrlen - 1] = 1;
+		tcp[0] = (CLIENT_PORT + id) >> 8;
+		tcp[1] = (CLIENT_PORT + id) & 0xff;
+		tcp[3] = SERVER_PORT;
+	} else {
+		dst[addrlen - 2] = addrlen == 4;
+		dst[addrlen - 1] = addrlen == 4 ? id : id + 2;
+		src[addrlen - 1] = 1;
+		tcp[1] = SERVER_PORT;
+		tcp[2] = (CLIENT_PORT + id) >> 8;
+		tcp[3] = (CLIENT_PORT + id) & 0xff;
+	}
+	tcp[4] = seq >> 24;
+	tcp[5] = seq >> 16;
+	tcp[6] = seq >> 8;
+	tcp[7] = seq;
+	tcp[12] = 0x50;
+	tcp[13] = flags;
+
+	for (j = 0; j < (int)len; j++)
+		tcp[20 + j] = payload_byte(id, dir, offset + j);
+	r->len = tcp + 20 + len - frame;
+	/* Short frames are padded, which must not be taken as payload */
+	if (r->len < 60) {
+		memset(frame + r->len, 0xee, 60 - r->len);
+		r->len = 60;
+	}
+}
+
+/* Builds the packets of a stream in the order they are sent */
+static int make_stream(int id, struct record *out) {
+	int order[2][MAX_SEGS];
+	int n = 0, dir, k, j;
+
+	if (!is_midstream(id)) {
+		make_segment(&out[n++], id, TCP_FROM_CLIENT, 0, 0, TCP_SYN);
+		make_segment(&out[n++], id, TCP_FROM_SERVER, 0, 0,
+				TCP_SYN | TCP_ACK);
+		make_segment(&out[n++], id, TCP_FROM_CLIENT, 0, 0, TCP_ACK);
+	}
+
+	/* Reverse some of the segments in windows of four */
+	for (dir = 0; dir < 2; dir++) {
+		for (k = 0; k < MAX_SEGS; k++) {
+			j = k;
+			if (is_reversed(id))
+				j = (k & ~3) + 3 - (k & 3);
+			order[dir][k] = j;
+		}
+	}
+
+	for (k = 0; k < MAX_SEGS; k++) {
+		for (dir = 0; dir < 2; dir++) {
+			int seg = order[dir][k];
+
+			if (seg >= nb_segs(id, dir))
+				continue;
+			if (is_lost(id) && dir == TCP_FROM_CLIENT && seg == 3)
+				continue;
+			make_segment(&out[n++], id, dir,
+					seg_offset(id, dir, seg),
+					seg_len(id, dir, seg), TCP_ACK);
+			if (is_repeated(id) && seg == 1)
+				out[n] = out[n - 1], n++;
+			/* A retransmission that overlaps two segments */
+			if (is_repeated(id) && seg == 3)
+				make_segment(&out[n++], id, dir,
+					seg_offset(id, dir, 2) +
+					seg_len(id, dir, 2) / 2,
+					seg_len(id, dir, 2) -
+					seg_len(id, dir, 2) / 2 +
+					seg_len(id, dir, 3) / 2, TCP_ACK);
+		}
+	}
+
+	if (is_reset(id)) {
+		make_segment(&out[n++], id, TCP_FROM_SERVER,
+				seg_offset(id, 1, nb_segs(id, 1)), 0, TCP_RST);
+	} else {
+		for (dir = 0; dir < 2; dir++)
+			make_segment(&out[n++], id, dir,
+					seg_offset(id, dir, nb_segs(id, dir)),
+					0, TCP_FIN | TCP_ACK);
+		/* The last ACK comes after the stream has finished */
+		make_segment(&out[n++], id, TCP_FROM_CLIENT,
+				seg_offset(id, 0, nb_segs(id, 0)) + 1, 0,
+				TCP_ACK);
+	}
+	return n;
+}
+
+/* Adds a record to the trace, a millisecond after the one before */
+void add_record(const struct record *r) {
+	records[nb_records] = *r;
+	records[nb_records].ts_usec = clock_usec;
+	clock_usec += 1000;
+	nb_records ++;
+}
+
+/* Writes out the streams, interleaving them in groups */
+void write_trace(void) {
+	static struct record packets[GROUP][MAX_RECORDS];
+	int counts[GROUP];
+	int i, g, k;
+	uint32_t hdr[6] = {0xa1b2c3d4, 0x00040002, 0, 0, 65535, 1};
+	FILE *f;
+
+	for (i = 0; i < NB_STREAMS; i += GROUP) {
+		for (g = 0; g < GROUP; g++)
+			counts[g] = make_stream(i + g, packets[g]);
+		for (k = 0; k < MAX_RECORDS; k++) {
+			for (g = 0; g < GROUP; g++) {
+				if (k < counts[g])
+					add_record(&packets[g][k]);
+			}
+		}
+	}
+
+	f = fopen(TRACE_FILE, "w");
+	if (!f) {
+		perror(TRACE_FILE);
+		exit(1);
+	}
+	fwrite(hdr, sizeof(hdr), 1, f);
+	for (k = 0; k < nb_records; k++) {
+		uint32_t rec[4] = {1000000000 + records[k].ts_usec / 1000000,
+			records[k].ts_usec % 1000000, records[k].len,
+			records[k].len};
+		fwrite(rec, sizeof(rec), 1, f);
+		fwrite(records[k].frame, records[k].len, 1, f);
+	}
+	fclose(f);
+}
+
+static void tcp_payload(libtrace_t *trace, libtrace_thread_t *t,
+		void *global, void *tls, libtrace_tcp_stream_t *stream,
+		int dir, const uint8_t *data, size_t len, int flags) {
+	int id = stream->client_port - CLIENT_PORT;
+	struct expect *e;
+	size_t j;
+
+	if (id < 0 || id >= NB_STREAMS || stream->server_port != SERVER_PORT ||
+			stream->ip_version != (is_v6(id) ? 6 : 4)) {
+		printf("unexpected stream %u -> %u\n", stream->client_port,
+				stream->server_port);
+		exit(1);
+	}
+	e = &expect[id];
+	if (stream->user_data == NULL)
+		stream->user_data = e;
+	if (stream->user_data != e || e->end)
+		e->errors ++;
+
+	if (flags & TCP_PAYLOAD_END) {
+		e->end ++;
+		return;
+	}
+	if (flags & TCP_PAYLOAD_FIN) {
+		e->fin[dir] ++;
+		return;
+	}
+	if (e->fin[dir] || len == 0)
+		e->errors ++;
+
+	if (flags & TCP_PAYLOAD_GAP) {
+		e->gaps ++;
+		/* Only the lost segment can be skipped over, unless the
+		 * stream has been flushed to save memory */
+		if (!forced_gaps && is_lost(id) && dir == TCP_FROM_CLIENT &&
+				e->offset[dir] == seg_offset(id, dir, 3))
+			e->offset[dir] += seg_len(id, dir, 3);
+		else
+			e->lost[dir] = 1;
+	}
+	if (e->lost[dir])
+		return;
+	for (j = 0; j < len; j++) {
+		if (data[j] != payload_byte(id, dir, e->offset[dir] + j)) {
+			e->errors ++;
+			break;
+		}
+	}
+	e->offset[dir] += len;
+}
+
+int test_streams(int threads, size_t memory_limit) {
+	libtrace_callback_set_t *processing;
+	libtrace_t *trace;
+	int i, dir, failed = 0, gaps = 0;
+
+	memset(expect, 0, sizeof(expect));
+	forced_gaps = memory_limit != 0;
+
+	trace = trace_create("pcapfile:" TRACE_FILE);
+	iferr(trace);
+	processing = trace_create_callback_set();
+	trace_set_tcp_payload_cb(processing, tcp_payload);
+	trace_set_perpkt_threads(trace, threads);
+	trace_set_hasher(trace, HASHER_BIDIRECTIONAL, NULL, NULL);
+	if (memory_limit)
+		trace_set_tcp_memory_limit(trace, memory_limit);
+
+	trace_pstart(trace, NULL, processing, NULL);
+	iferr(trace);
+	trace_join(trace);
+	iferr(trace);
+	trace_destroy(trace);
+	trace_destroy_callback_set(processing);
+
+	for (i = 0; i < NB_STREAMS; i++) {
+		struct expect *e = &expect[i];
+
+		gaps += e->gaps;
+		if (e->errors || e->end != 1)
+			failed ++;
+		for (dir = 0; dir < 2 && !memory_limit; dir++) {
+			if (e->offset[dir] != seg_offset(i, dir,
+						nb_segs(i, dir)) ||
+					e->fin[dir] != !is_reset(i))
+				failed ++;
+		}
+		if (!memory_limit && e->gaps != is_lost(i))
+			failed ++;
+	}
+	if (memory_limit && gaps == 0)
+		failed ++;
+
+	if (failed) {
+		printf("failure: %d threads, %zu byte limit: %d streams "
+				"failed\n", threads, memory_limit, failed);
+		return 1;
+	}
+	return 0;
+}
+
+int main(int argc, char *argv[]) {
+	int error = 0;
+
+	write_trace();
+
+	error |= test_streams(1, 0);
+	error |= test_streams(4, 0);
+	/* Too little buffer space for the reordering, so gaps are forced */
+	error |= test_streams(1, 4096);
+
+	if (!error)
+		printf("success\n");
+	return error;
+}
@@ -0,0 +1,214 @@
+/*
+ * This file is part of libtrace
+ *
+ * Copyright (c) 2007 The University of Waikato, Hamilton, New Zealand.
+ *
+ * All rights reserved.
+ *
+ * This code has been developed by the University of Waikato WAND
+ * research group. For further information please see http://www.wand.net.nz/
+ *
+ * libtrace is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * libtrace is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libtrace; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * $Id$
+ *
+ */
+
+
+/* Checks the per thread counters of a parallel trace add up to what is
+ * read sequentially, and that snapshots taken while the threads are busy
+ * are consistent */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "libtrace_parallel.h"
+
+#define URI "pcapfile:traces/100_packets.pcap"
+#define FILTER "tcp"
+#define THREADS 4
+
+void iferr(libtrace_t *trace)
+{
+	libtrace_err_t err = trace_get_err(trace);
+	if (err.err_num==0)
+		return;
+	printf("Error: %s\n",err.problem);
+	exit(1);
+}
+
+static libtrace_packet_t *per_packet(libtrace_t *trace,
+		libtrace_thread_t *t, void *global, void *tls,
+		libtrace_packet_t *packet) {
+	/* Slow enough that the counters are read while the threads run */
+	usleep(200);
+	return packet;
+}
+
+/* Counts what the parallel trace should see by reading it sequentially */
+static void count_expected(uint64_t *accepted, uint64_t *filtered,
+		uint64_t *bytes) {
+	libtrace_t *trace = trace_create(URI);
+	libtrace_filter_t *filter = trace_create_filter(FILTER);
+	libtrace_packet_t *packet = trace_create_packet();
+
+	iferr(trace);
+	trace_start(trace);
+	iferr(trace);
+	*accepted = *filtered = *bytes = 0;
+	while (trace_read_packet(trace, packet) > 0) {
+		if (trace_apply_filter(filter, packet) > 0) {
+			(*accepted) ++;
+			*bytes += trace_get_wire_length(packet);
+		} else {
+			(*filtered) ++;
+		}
+	}
+	iferr(trace);
+	trace_destroy_packet(packet);
+	trace_destroy_filter(filter);
+	trace_destroy(trace);
+}
+
+static uint64_t sum(const uint64_t *buckets) {
+	uint64_t total = 0;
+	int i;
+
+	for (i = 0; i < LIBTRACE_COUNTER_BUCKETS; i++)
+		total += buckets[i];
+	return total;
+}
+
+/* Things that hold for any snapshot taken after a batch */
+static int check_consistent(const libtrace_thread_counters_t *c) {
+	int error = 0;
+
+	if (c->received != c->accepted + c->filtered)
+		error = 1;
+	if (sum(c->burst_sizes) != c->bursts)
+		error = 1;
+	if (c->queue_depth > c->queue_depth_max)
+		error = 1;
+	if (error) {
+		printf("inconsistent snapshot: received %" PRIu64
+				" accepted %" PRIu64 " filtered %" PRIu64
+				" bursts %" PRIu64 "\n", c->received,
+				c->accepted, c->filtered, c->bursts);
+	}
+	return error;
+}
+
+/* Polls the counters until the trace finishes, making sure every snapshot
+ * is consistent and that they never go backwards */
+static int poll_counters(libtrace_t *trace) {
+	libtrace_thread_counters_t last[THREADS], now;
+	int error = 0, polls = 0, i;
+
+	memset(last, 0, sizeof(last));
+	while (!error && !trace_has_finished(trace)) {
+		for (i = 0; i < THREADS; i++) {
+			if (trace_get_thread_counters(trace, i, &now) < 0)
+				return 1;
+			error |= check_consistent(&now);
+			/* Every 64th packet is timed */
+			if (sum(now.callback_latency) != now.accepted / 64) {
+				printf("thread %d timed %" PRIu64 " calls\n",
+						i, sum(now.callback_latency));
+				error = 1;
+			}
+			if (now.received < last[i].received ||
+					now.bytes < last[i].bytes) {
+				printf("counters of thread %d went backwards\n",
+						i);
+				error = 1;
+			}
+			last[i] = now;
+		}
+		polls ++;
+	}
+	if (polls == 0)
+		printf("warning: the trace finished before it was polled\n");
+	return error;
+}
+
+int main(int argc, char *argv[]) {
+	libtrace_t *trace;
+	libtrace_callback_set_t *pktcbs;
+	libtrace_filter_t *filter;
+	libtrace_thread_counters_t total, thread;
+	libtrace_stat_t *stats;
+	uint64_t accepted, filtered, bytes, received = 0;
+	int error = 0, i;
+
+	count_expected(&accepted, &filtered, &bytes);
+	if (accepted == 0 || filtered == 0) {
+		printf("failure: expected both accepted and filtered packets\n");
+		return 1;
+	}
+
+	trace = trace_create(URI);
+	iferr(trace);
+	filter = trace_create_filter(FILTER);
+	trace_config(trace, TRACE_OPTION_FILTER, filter);
+	trace_set_perpkt_threads(trace, THREADS);
+	pktcbs = trace_create_callback_set();
+	trace_set_packet_cb(pktcbs, per_packet);
+
+	if (trace_pstart(trace, NULL, pktcbs, NULL) < 0) {
+		iferr(trace);
+		return 1;
+	}
+	error |= poll_counters(trace);
+	trace_join(trace);
+	iferr(trace);
+
+	trace_get_counters(trace, &total);
+	error |= check_consistent(&total);
+	if (total.accepted != accepted || total.filtered != filtered ||
+			total.bytes != bytes) {
+		printf("failure: accepted %" PRIu64 "/%" PRIu64
+				" filtered %" PRIu64 "/%" PRIu64
+				" bytes %" PRIu64 "/%" PRIu64 "\n",
+				total.accepted, accepted, total.filtered,
+				filtered, total.bytes, bytes);
+		error = 1;
+	}
+	for (i = 0; i < THREADS; i++) {
+		trace_get_thread_counters(trace, i, &thread);
+		received += thread.received;
+	}
+	if (received != total.received)
+		error = 1;
+	if (trace_get_thread_counters(trace, THREADS, &thread) != -1)
+		error = 1;
+
+	/* The library's own statistics come from the same counters */
+	stats = trace_get_statistics(trace, NULL);
+	if (!stats->accepted_valid || stats->accepted != accepted ||
+			!stats->filtered_valid || stats->filtered != filtered) {
+		printf("failure: statistics disagree with the counters\n");
+		error = 1;
+	}
+
+	trace_destroy(trace);
+	trace_destroy_filter(filter);
+	trace_destroy_callback_set(pktcbs);
+
+	if (!error)
+		printf("success\n");
+	return error;
+}
@@ -57,6 +57,106 @@ void iferr(libtrace_t *trace)
 	exit(1);
 }
 
+/* Checks that the fields found through the packet agree with the accessors
+ * that are given the header */
+void check_packet_fields(libtrace_packet_t *packet, void *l,
+		libtrace_linktype_t lt) {
+	uint64_t tsft;
+	uint16_t freq;
+	uint8_t rate, sdb;
+	int8_t sdbm;
+	uint8_t *p;
+
+	p = trace_get_radiotap_field(packet, TRACE_RADIOTAP_TSFT);
+	assert((p != NULL) == trace_get_wireless_tsft(l, lt, &tsft));
+	assert(!p || memcmp(p, &tsft, sizeof(tsft)) == 0);
+	p = trace_get_radiotap_field(packet, TRACE_RADIOTAP_RATE);
+	assert((p != NULL) == trace_get_wireless_rate(l, lt, &rate));
+	assert(!p || *p == rate);
+	p = trace_get_radiotap_field(packet, TRACE_RADIOTAP_CHANNEL);
+	assert((p != NULL) == trace_get_wireless_freq(l, lt, &freq));
+	assert(!p || (p[0] | (p[1] << 8)) == freq);
+	p = trace_get_radiotap_field(packet, TRACE_RADIOTAP_DBM_ANTSIGNAL);
+	assert((p != NULL) == trace_get_wireless_signal_strength_dbm(l, lt,
+				&sdbm));
+	assert(!p || (int8_t)*p == sdbm);
+	p = trace_get_radiotap_field(packet, TRACE_RADIOTAP_DB_ANTNOISE);
+	assert((p != NULL) == trace_get_wireless_noise_strength_db(l, lt,
+				&sdb));
+}
+
+/* Checks a header with an extended bitmap, a vendor namespace and a second
+ * Radiotap namespace, where each field's place depends on all of them */
+void test_namespaces(void) {
+	unsigned char frame[48 + 24];
+	libtrace_packet_t *packet = trace_create_packet();
+	uint32_t words[3] = {
+		/* TSFT, flags, channel, dBm signal, vendor namespace, ext */
+		0xc000002b,
+		/* A vendor field, Radiotap namespace, ext */
+		0xa0000001,
+		/* dBm signal for a second antenna, antenna, MCS */
+		0x00080820
+	};
+	libtrace_linktype_t lt;
+	unsigned char *p;
+	int8_t sdbm;
+	uint8_t antenna;
+	void *l;
+	int i;
+
+	memset(frame, 0, sizeof(frame));
+	frame[2] = 48;
+	for (i = 0; i < 3; i++) {
+		frame[4 + i * 4] = words[i];
+		frame[5 + i * 4] = words[i] >> 8;
+		frame[6 + i * 4] = words[i] >> 16;
+		frame[7 + i * 4] = words[i] >> 24;
+	}
+	frame[16] = 0x11;		/* TSFT, aligned to 8 from the start */
+	frame[24] = 0x10;		/* Flags, which say there is an FCS */
+	frame[26] = 0x6c;		/* Channel, 2412 MHz */
+	frame[27] = 0x09;
+	frame[30] = (uint8_t)-40;	/* dBm signal */
+	frame[32] = 0x00;		/* Vendor OUI, sub namespace and */
+	frame[33] = 0x11;		/* a skip length of 5 */
+	frame[34] = 0x22;
+	frame[36] = 5;
+	frame[43] = (uint8_t)-70;	/* Second dBm signal */
+	frame[44] = 2;			/* Antenna */
+	frame[45] = 0x07;		/* MCS */
+	frame[47] = 5;
+
+	trace_construct_packet(packet, TRACE_TYPE_80211_RADIO, frame,
+			sizeof(frame));
+	l = trace_get_packet_buffer(packet, &lt, NULL);
+	assert(lt == TRACE_TYPE_80211_RADIO);
+
+	p = trace_get_radiotap_field(packet, TRACE_RADIOTAP_TSFT);
+	assert(p && p - (unsigned char *)l == 16 && *p == 0x11);
+	p = trace_get_radiotap_field(packet, TRACE_RADIOTAP_CHANNEL);
+	assert(p && p[0] == 0x6c && p[1] == 0x09);
+	p = trace_get_radiotap_field(packet, TRACE_RADIOTAP_MCS);
+	assert(p && p[0] == 0x07 && p[2] == 5);
+	assert(!trace_get_radiotap_field(packet, TRACE_RADIOTAP_RATE));
+	assert(!trace_get_radiotap_field(packet, TRACE_RADIOTAP_EXT));
+
+	/* The first instance of a field is the one that is used */
+	assert(trace_get_wireless_signal_strength_dbm(l, lt, &sdbm));
+	assert(sdbm == -40);
+	assert(trace_get_wireless_antenna(l, lt, &antenna));
+	assert(antenna == 2);
+	check_packet_fields(packet, l, lt);
+
+	/* A header that ends part way through a field doesn't have it */
+	frame[2] = 46;
+	trace_construct_packet(packet, TRACE_TYPE_80211_RADIO, frame,
+			sizeof(frame));
+	assert(trace_get_radiotap_field(packet, TRACE_RADIOTAP_ANTENNA));
+	assert(!trace_get_radiotap_field(packet, TRACE_RADIOTAP_MCS));
+
+	trace_destroy_packet(packet);
+}
 
 int main(int argc UNUSED, char *argv[] UNUSED) {
 	libtrace_t *trace;
@@ -101,6 +201,7 @@ int main(int argc UNUSED, char *argv[] UNUSED) {
 	assert(!trace_get_wireless_tx_attenuation(l,lt,&tmp16));
 	assert(!trace_get_wireless_tx_attenuation_db(l,lt,&tmp16));
 	assert(!trace_get_wireless_tx_power_dbm(l,lt,(int8_t *)&tmp8));
+	check_packet_fields(packet, l, lt);
 
 	/* Check that the functions are returning the right values for
 	 * this trace
@@ -116,6 +217,7 @@ int main(int argc UNUSED, char *argv[] UNUSED) {
 		assert(wirelen == caplen + 4);
 		if(trace_get_wireless_freq(l,lt,&freq)) 
 			total_freq += freq;
+		check_packet_fields(packet, l, lt);
 	}
 
 	assert(total_freq == expected_freq);
@@ -145,9 +247,12 @@ int main(int argc UNUSED, char *argv[] UNUSED) {
 	assert(!trace_get_wireless_tx_attenuation(l,lt,&tmp16));
 	assert(!trace_get_wireless_tx_attenuation_db(l,lt,&tmp16));
 	assert(!trace_get_wireless_tx_power_dbm(l,lt,(int8_t *)&tmp8));
+	assert(!trace_get_radiotap_field(packet, TRACE_RADIOTAP_TSFT));
 
 
 	trace_destroy_packet(packet);
         trace_destroy(trace);
+
+	test_namespaces();
 	return 0;
 }
@@ -42,9 +42,9 @@
 #include <arpa/inet.h>
 #include <time.h>
 
-#include <map>
-
 #include "libtrace_parallel.h"
+#include "data-struct/flow_table.h"
+#include "data-struct/sketch.h"
 
 typedef struct end_counter {
 	uint64_t src_bytes;
@@ -58,29 +58,17 @@ typedef struct end_counter {
 
 } end_counter_t;
 
-typedef struct mac_addr {
-	uint8_t addr[6];
-} mac_addr_t;
-
-struct v6comp {
-	bool operator() (const struct in6_addr &a, const struct in6_addr &b) const {
-		if (memcmp(&a, &b, sizeof(struct in6_addr)) < 0)
-			return true;
-		return false;
-	}
-};
-	
-struct maccomp {
-	bool operator() (const mac_addr_t &a, const mac_addr_t &b) const {
-		if (memcmp(&a, &b, sizeof(mac_addr_t)) < 0)
-			return true;
-		return false;
-	}
-};
+/* Endpoints are kept in a flow table, using only the source address of the
+ * tuple. The counters live in the table itself, so there is no allocation
+ * per endpoint. */
+typedef libtrace_flow_table_t EndMap;
 
-typedef std::map<uint32_t, end_counter_t *> IP4EndMap;
-typedef std::map<struct in6_addr, end_counter_t *, v6comp> IP6EndMap;
-typedef std::map<mac_addr_t, end_counter_t *, maccomp> MacEndMap;
+/* In approximate mode only the endpoints with the most bytes are kept, in a
+ * fixed size top-k, and the total number of endpoints is estimated */
+typedef struct end_sketch {
+        libtrace_topk_t *top;
+        libtrace_hll_t *distinct;
+} end_sketch_t;
 
 enum {
 	MODE_MAC,
@@ -94,22 +82,18 @@ typedef struct traceend_global {
         int threads;
         int track_source;
         int track_dest;
+        size_t approx;
+        int failed;
 } global_t;
 
 typedef struct traceend_local {
-        union {
-                IP4EndMap *ipv4;
-                IP6EndMap *ipv6;
-                MacEndMap *mac;
-        } map;
+        EndMap *map;
+        end_sketch_t sketch;
 } local_t;
 
 typedef struct traceend_result_local {
-        union {
-                IP4EndMap *ipv4;
-                IP6EndMap *ipv6;
-                MacEndMap *mac;
-        } map;
+        EndMap *map;
+        end_sketch_t sketch;
         int threads_reported;
 } result_t;
 
@@ -122,6 +106,7 @@ static int usage(char *argv0)
         "-f --filter=bpf        Only output packets that match filter\n"
         "-H --help     		Print this message\n"
         "-A --address=addr     	Specifies which address type to match (mac, v4, v6)\n"
+        "-k --approx=num        Only report (approximately) the num endpoints with the most bytes\n"
         ,argv0);
         exit(1);
 }
@@ -134,22 +119,50 @@ static void cleanup_signal(int sig)
         }
 }
 
+static void destroy_storage(EndMap *map, end_sketch_t *sketch) {
+        libtrace_flow_table_destroy(map);
+        libtrace_topk_destroy(sketch->top);
+        libtrace_hll_destroy(sketch->distinct);
+}
+
+static int create_storage(global_t *glob, EndMap **map,
+                end_sketch_t *sketch) {
+        if (glob->approx) {
+                *map = NULL;
+                sketch->top = libtrace_topk_create(glob->approx,
+                                sizeof(libtrace_flow_tuple_t),
+                                sizeof(end_counter_t));
+                sketch->distinct = libtrace_hll_create(14);
+                if (sketch->top && sketch->distinct)
+                        return 0;
+        } else {
+                *map = libtrace_flow_table_create(sizeof(end_counter_t), 0);
+                sketch->top = NULL;
+                sketch->distinct = NULL;
+                if (*map)
+                        return 0;
+        }
+
+        fprintf(stderr, "Unable to allocate memory for endpoint counters\n");
+        destroy_storage(*map, sketch);
+        glob->failed = 1;
+        return -1;
+}
+
 static void *cb_starting(libtrace_t *trace UNUSED, libtrace_thread_t *t UNUSED,
                 void *global) {
 
         global_t *glob = (global_t *)global;
         local_t *local = (local_t *)malloc(sizeof(local_t));
 
-        switch(glob->mode) {
-                case MODE_IPV4:
-                        local->map.ipv4 = new IP4EndMap();
-                        break;
-                case MODE_IPV6:
-                        local->map.ipv6 = new IP6EndMap();
-                        break;
-                case MODE_MAC:
-                        local->map.mac = new MacEndMap();
-                        break;
+        if (!local) {
+                fprintf(stderr, "Unable to allocate memory for endpoint counters\n");
+                glob->failed = 1;
+                return NULL;
+        }
+        if (create_storage(glob, &local->map, &local->sketch) < 0) {
+                free(local);
+                return NULL;
         }
         return local;
 
@@ -161,32 +174,44 @@ static void cb_stopping(libtrace_t *trace, libtrace_thread_t *t,
         local_t *local = (local_t *)tls;
         libtrace_generic_t gen;
 
+        if (!local)
+                return;
+
         gen.ptr = local;
         trace_publish_result(trace, t, 0, gen, RESULT_USER);
 }
 
-static inline end_counter_t *create_counter() {
-	end_counter_t *c = (end_counter_t *)malloc(sizeof(end_counter_t));
-
-	c->src_bytes = 0;
-	c->src_pbytes = 0;
-	c->src_pkts = 0;
-	c->dst_pkts = 0;
-	c->dst_bytes = 0;
-	c->dst_pbytes = 0;
-
-	c->last_active = 0.0;
-	return c;
+/* Finds the counter for an address, creating it if this is the first time
+ * the address has been seen. In approximate mode the bytes are also used to
+ * decide which addresses are worth keeping. */
+static inline end_counter_t *get_counter(local_t *local, const void *addr,
+                size_t len, uint8_t version, uint16_t bytes) {
+        libtrace_flow_tuple_t key;
+
+        memset(&key, 0, sizeof(key));
+        memcpy(key.src_ip, addr, len);
+        key.ip_version = version;
+        if (local->sketch.top) {
+                libtrace_hll_add(local->sketch.distinct, &key, sizeof(key));
+                return (end_counter_t *)libtrace_topk_update(
+                                local->sketch.top, &key, bytes);
+        }
+        return (end_counter_t *)libtrace_flow_table_insert(local->map, &key,
+                        NULL);
 }
 
-static inline char *mac_string(mac_addr_t m, char *str) {
+static inline char *mac_string(const uint8_t *m, char *str) {
 	snprintf(str, 80, "%02x:%02x:%02x:%02x:%02x:%02x", 
-		m.addr[0], m.addr[1], m.addr[2], m.addr[3], m.addr[4],
-		m.addr[5]);
+		m[0], m[1], m[2], m[3], m[4], m[5]);
 	return str;
 }
 
-static inline void combine_counters(end_counter_t *c, end_counter_t *c2) {
+static void combine_counters(void *dst, const void *src, void *data) {
+
+        end_counter_t *c = (end_counter_t *)dst;
+        const end_counter_t *c2 = (const end_counter_t *)src;
+
+        (void)data;
 
         c->src_pkts += c2->src_pkts;
         c->src_bytes += c2->src_bytes;
@@ -197,163 +222,81 @@ static inline void combine_counters(end_counter_t *c, end_counter_t *c2) {
 
 }
 
-static void combine_mac_maps(MacEndMap *dst, MacEndMap *src) {
-
-        MacEndMap::iterator it;
-        MacEndMap::iterator found;
-
-        for (it = src->begin(); it != src->end(); it++) {
-                found = dst->find(it->first);
-
-                if (found == dst->end()) {
-                        (*dst)[it->first] = it->second;
-                        continue;
-                }
-
-                combine_counters(found->second, it->second);
-                free(it->second);
-        }
-
-}
-
-static void combine_ipv4_maps(IP4EndMap *dst, IP4EndMap *src) {
-
-        IP4EndMap::iterator it;
-        IP4EndMap::iterator found;
-
-        for (it = src->begin(); it != src->end(); it++) {
-                found = dst->find(it->first);
-
-                if (found == dst->end()) {
-                        (*dst)[it->first] = it->second;
-                        continue;
-                }
-
-                combine_counters(found->second, it->second);
-                free(it->second);
-        }
-
-}
-
-static void combine_ipv6_maps(IP6EndMap *dst, IP6EndMap *src) {
-
-        IP6EndMap::iterator it;
-        IP6EndMap::iterator found;
-
-        for (it = src->begin(); it != src->end(); it++) {
-                found = dst->find(it->first);
-
-                if (found == dst->end()) {
-                        (*dst)[it->first] = it->second;
-                        continue;
-                }
-
-                combine_counters(found->second, it->second);
-                free(it->second);
-        }
-
-}
-
-static void dump_ipv4_map(IP4EndMap *ipv4, bool destroy) {
-	IP4EndMap::iterator it;
+static void dump_counter(global_t *glob, const libtrace_flow_tuple_t *key,
+		end_counter_t *c) {
 	struct in_addr in;
+	char str[128];
 	char timestr[80];
 	struct tm *tm;
 	time_t t;
-	for (it = ipv4->begin(); it != ipv4->end(); it++) {
-		in.s_addr = it->first;
-		t = (time_t)(it->second->last_active);
-		tm = localtime(&t);
-		strftime(timestr, 80, "%d/%m,%H:%M:%S", tm);
-		printf("%16s %16s %16" PRIu64 " %16" PRIu64 " %16" PRIu64 " %16" PRIu64 " %16" PRIu64 " %16" PRIu64 "\n", 
-				inet_ntoa(in),
-				timestr,
-				it->second->src_pkts,
-				it->second->src_bytes,
-				it->second->src_pbytes,
-				it->second->dst_pkts,
-				it->second->dst_bytes,
-				it->second->dst_pbytes);
-                if (destroy) {
-                       free(it->second);
-                }
+
+	t = (time_t)(c->last_active);
+	tm = localtime(&t);
+	strftime(timestr, 80, "%d/%m,%H:%M:%S", tm);
+	switch (glob->mode) {
+		case MODE_IPV4:
+			memcpy(&in.s_addr, key->src_ip, sizeof(in.s_addr));
+			printf("%16s ", inet_ntoa(in));
+			break;
+		case MODE_IPV6:
+			printf("%40s ", inet_ntop(AF_INET6, key->src_ip,
+					str, sizeof(str)));
+			break;
+		case MODE_MAC:
+			printf("%18s ", mac_string(key->src_ip, str));
+			break;
 	}
+	printf("%16s %16" PRIu64 " %16" PRIu64 " %16" PRIu64 " %16" PRIu64 " %16" PRIu64 " %16" PRIu64 "\n", 
+			timestr,
+			c->src_pkts,
+			c->src_bytes,
+			c->src_pbytes,
+			c->dst_pkts,
+			c->dst_bytes,
+			c->dst_pbytes);
 }
 
-static void dump_ipv6_map(IP6EndMap *ipv6, bool destroy) {
-	IP6EndMap::iterator it;
-	struct in6_addr in;
-	char ip6_addr[128];
-	char timestr[80];
-	struct tm *tm;
-	time_t t;
+static void dump_map(global_t *glob, EndMap *map) {
+	const libtrace_flow_tuple_t *key;
+	void *value;
+	size_t iter = 0;
 
-	for (it = ipv6->begin(); it != ipv6->end(); it++) {
-		in = it->first;
-		t = (time_t)(it->second->last_active);
-		tm = localtime(&t);
-		strftime(timestr, 80, "%d/%m,%H:%M:%S", tm);
-		printf("%40s %16s %16" PRIu64 " %16" PRIu64 " %16" PRIu64 " %16" PRIu64 " %16" PRIu64 " %16" PRIu64 "\n", 
-				inet_ntop(AF_INET6, &in, ip6_addr, 128),
-				timestr,
-				it->second->src_pkts,
-				it->second->src_bytes,
-				it->second->src_pbytes,
-				it->second->dst_pkts,
-				it->second->dst_bytes,
-				it->second->dst_pbytes);
-                if (destroy) {
-                       free(it->second);
-                }
-	}
+	while (libtrace_flow_table_next(map, &iter, &key, &value))
+		dump_counter(glob, key, (end_counter_t *)value);
 }
 
-static void dump_mac_map(MacEndMap *mac, bool destroy) {
-	MacEndMap::iterator it;
-	char str[80];
-	char timestr[80];
-	struct tm *tm;
-	time_t t;
+/* Dumps the tracked endpoints, most bytes first. Their counters only cover
+ * the time they were being tracked. */
+static void dump_sketch(global_t *glob, end_sketch_t *sketch) {
+	libtrace_topk_item_t *items;
+	size_t i, n;
 
-	for (it = mac->begin(); it != mac->end(); it++) {
-		t = (time_t)(it->second->last_active);
-		tm = localtime(&t);
-		strftime(timestr, 80, "%d/%m,%H:%M:%S", tm);
-		printf("%18s %16s %16" PRIu64 " %16" PRIu64 " %16" PRIu64 " %16" PRIu64 " %16" PRIu64 " %16" PRIu64 "\n", 
-				mac_string(it->first, str),
-				timestr,
-				it->second->src_pkts,
-				it->second->src_bytes,
-				it->second->src_pbytes,
-				it->second->dst_pkts,
-				it->second->dst_bytes,
-				it->second->dst_pbytes);
-                if (destroy) {
-                       free(it->second);
-                }
-	}
+	items = (libtrace_topk_item_t *)malloc(glob->approx *
+			sizeof(libtrace_topk_item_t));
+	if (!items)
+		return;
+	n = libtrace_topk_get_items(sketch->top, items);
+	for (i = 0; i < n; i++)
+		dump_counter(glob, (const libtrace_flow_tuple_t *)items[i].key,
+				(end_counter_t *)items[i].value);
+	free(items);
+	fprintf(stderr, "Approximately %" PRIu64 " endpoints seen\n",
+			libtrace_hll_estimate(sketch->distinct));
 }
 
 static void update_ipv6(global_t *glob,
                 local_t *local, libtrace_ip6_t *ip, uint16_t ip_len,
                 uint32_t rem, uint32_t plen, 	double ts) {
 
-	struct in6_addr key;
-	IP6EndMap::iterator it;
 	end_counter_t *c = NULL;
 
 	if (rem < sizeof(libtrace_ip6_t))
 		return;
         if (glob->track_source) {
-                key = ip->ip_src;
-
-                it = local->map.ipv6->find(key);
-                if (it == local->map.ipv6->end()) {
-                        c = create_counter();
-                        (*(local->map.ipv6))[key] = c;
-                } else {
-                        c = it->second;
-                }
+                c = get_counter(local, &ip->ip_src, sizeof(ip->ip_src), 6,
+                                ip_len);
+                if (!c)
+                        return;
 
                 c->src_pkts ++;
                 c->src_pbytes += plen;
@@ -363,15 +306,10 @@ static void update_ipv6(global_t *glob,
         }
 
         if (glob->track_dest) {
-                key = ip->ip_dst;
-
-                it = local->map.ipv6->find(key);
-                if (it == local->map.ipv6->end()) {
-                        c = create_counter();
-                        (*(local->map.ipv6))[key] = c;
-                } else {
-                        c = it->second;
-                }
+                c = get_counter(local, &ip->ip_dst, sizeof(ip->ip_dst), 6,
+                                ip_len);
+                if (!c)
+                        return;
 
                 c->dst_pkts ++;
                 c->dst_pbytes += plen;
@@ -385,20 +323,12 @@ static void update_mac(global_t *glob, local_t *local,
                 uint8_t *src, uint8_t *dst, uint16_t ip_len,
 		uint32_t plen, double ts) {
 
-	mac_addr_t key;
 	end_counter_t *c = NULL;
-	MacEndMap::iterator it;
 
         if (glob->track_source) {
-                memcpy(&(key.addr), src, sizeof(key.addr));
-                it = local->map.mac->find(key);
-
-                if (it == local->map.mac->end()) {
-                        c = create_counter();
-                        (*(local->map.mac))[key] = c;
-                } else {
-                        c = it->second;
-                }
+                c = get_counter(local, src, 6, 0, ip_len);
+                if (!c)
+                        return;
 
                 c->src_pkts ++;
                 c->src_pbytes += plen;
@@ -407,15 +337,9 @@ static void update_mac(global_t *glob, local_t *local,
         }
 
         if (glob->track_dest) {
-                memcpy(&key.addr, dst, sizeof(key.addr));
-                it = local->map.mac->find(key);
-
-                if (it == local->map.mac->end()) {
-                        c = create_counter();
-                        (*(local->map.mac))[key] = c;
-                } else {
-                        c = it->second;
-                }
+                c = get_counter(local, dst, 6, 0, ip_len);
+                if (!c)
+                        return;
 
                 c->dst_pkts ++;
                 c->dst_pbytes += plen;
@@ -428,23 +352,17 @@ static void update_ipv4(global_t *glob,
                 local_t *local, libtrace_ip_t *ip, uint16_t ip_len,
                 uint32_t rem, uint32_t plen, double ts) {
 
-	uint32_t key;
-	IP4EndMap::iterator it;
 	end_counter_t *c = NULL;
 
 	if (rem < sizeof(libtrace_ip_t))
 		return;
 
         if (glob->track_source) {
-                key = ip->ip_src.s_addr;
-
-                it = local->map.ipv4->find(key);
-                if (it == local->map.ipv4->end()) {
-                        c = create_counter();
-                        (*(local->map.ipv4))[key] = c;
-                } else {
-                        c = it->second;
-                }
+                c = get_counter(local, &ip->ip_src.s_addr,
+                                sizeof(ip->ip_src.s_addr), 4,
+                                ip_len);
+                if (!c)
+                        return;
 
                 c->src_pkts ++;
                 c->src_pbytes += plen;
@@ -454,15 +372,11 @@ static void update_ipv4(global_t *glob,
         }
 
         if (glob->track_dest) {
-                key = ip->ip_dst.s_addr;
-
-                it = local->map.ipv4->find(key);
-                if (it == local->map.ipv4->end()) {
-                        c = create_counter();
-                        (*(local->map.ipv4))[key] = c;
-                } else {
-                        c = it->second;
-                }
+                c = get_counter(local, &ip->ip_dst.s_addr,
+                                sizeof(ip->ip_dst.s_addr), 4,
+                                ip_len);
+                if (!c)
+                        return;
 
                 c->dst_pkts ++;
                 c->dst_pbytes += plen;
@@ -478,44 +392,46 @@ static void *cb_result_starting(libtrace_t *trace UNUSED,
         global_t *glob = (global_t *)global;
         result_t *res = (result_t *)malloc(sizeof(result_t));
 
-        switch(glob->mode) {
-                case MODE_IPV4:
-                        res->map.ipv4 = new IP4EndMap();
-                        break;
-                case MODE_IPV6:
-                        res->map.ipv6 = new IP6EndMap();
-                        break;
-                case MODE_MAC:
-                        res->map.mac = new MacEndMap();
-                        break;
+        if (!res) {
+                fprintf(stderr, "Unable to allocate memory for endpoint counters\n");
+                glob->failed = 1;
+                return NULL;
+        }
+        if (create_storage(glob, &res->map, &res->sketch) < 0) {
+                free(res);
+                return NULL;
         }
         res->threads_reported = 0;
         return res;
 }
 
-static void cb_result(libtrace_t *trace UNUSED,
+static void cb_result(libtrace_t *trace,
                 libtrace_thread_t *sender UNUSED, void *global,
                 void *tls, libtrace_result_t *result) {
 
-        global_t *glob = (global_t *)global;
         result_t *res = (result_t *)tls;
         local_t *recvd = (local_t *)(result->value.ptr);
 
+        if (!res) {
+                /* Nowhere to put the results, so don't bother reading
+                 * any further */
+                trace_pstop(trace);
+                destroy_storage(recvd->map, &recvd->sketch);
+                free(recvd);
+                return;
+        }
 
-        switch(glob->mode) {
-                case MODE_IPV4:
-                        combine_ipv4_maps(res->map.ipv4, recvd->map.ipv4);
-                        delete(recvd->map.ipv4);
-                        break;
-                case MODE_IPV6:
-                        combine_ipv6_maps(res->map.ipv6, recvd->map.ipv6);
-                        delete(recvd->map.ipv6);
-                        break;
-                case MODE_MAC:
-                        combine_mac_maps(res->map.mac, recvd->map.mac);
-                        delete(recvd->map.mac);
-                        break;
+        (void)global;
+        if (res->sketch.top) {
+                libtrace_topk_merge(res->sketch.top, recvd->sketch.top,
+                                combine_counters, NULL);
+                libtrace_hll_merge(res->sketch.distinct,
+                                recvd->sketch.distinct);
+        } else {
+                libtrace_flow_table_merge(res->map, recvd->map,
+                                combine_counters, NULL);
         }
+        destroy_storage(recvd->map, &recvd->sketch);
         res->threads_reported ++;
         free(recvd);
 }
@@ -525,20 +441,15 @@ static void cb_result_stopping(libtrace_t *trace UNUSED,
 
         global_t *glob = (global_t *)global;
         result_t *res = (result_t *)tls;
-        switch(glob->mode) {
-                case MODE_IPV4:
-                        dump_ipv4_map(res->map.ipv4, 1);
-                        delete(res->map.ipv4);
-                        break;
-                case MODE_IPV6:
-                        dump_ipv6_map(res->map.ipv6, 1);
-                        delete(res->map.ipv6);
-                        break;
-                case MODE_MAC:
-                        dump_mac_map(res->map.mac, 1);
-                        delete(res->map.mac);
-                        break;
-        }
+
+        if (!res)
+                return;
+
+        if (res->sketch.top)
+                dump_sketch(glob, &res->sketch);
+        else
+                dump_map(glob, res->map);
+        destroy_storage(res->map, &res->sketch);
         free(res);
 }
 
@@ -558,6 +469,12 @@ static libtrace_packet_t *cb_packet(libtrace_t *trace, libtrace_thread_t *t,
 	libtrace_ip6_t *ip6 = NULL;
 	uint8_t *src_mac, *dst_mac;
 
+	/* This thread couldn't allocate its counters */
+	if (!local) {
+		trace_pstop(trace);
+		return packet;
+	}
+
 	header = trace_get_layer3(packet, &ethertype, &rem);
 
 	if (header == NULL || rem == 0)
@@ -611,6 +528,8 @@ int main(int argc, char *argv[]) {
         glob.mode = MODE_IPV4;
         glob.track_source = 1;
         glob.track_dest = 1;
+        glob.approx = 0;
+        glob.failed = 0;
 
         while(1) {
                 int option_index;
@@ -618,13 +537,14 @@ int main(int argc, char *argv[]) {
                         { "filter",        1, 0, 'f' },
                         { "help", 	   0, 0, 'H' },
 			{ "addresses", 	   1, 0, 'A' },	
+			{ "approx", 	   1, 0, 'k' },
 			{ "threads", 	   1, 0, 't' },	
 			{ "ignore-dest", 	   0, 0, 'D' },	
 			{ "ignore-source", 	   0, 0, 'S' },	
                         { NULL,            0, 0, 0   },
                 };
 
-                int c=getopt_long(argc, argv, "A:f:t:HDS",
+                int c=getopt_long(argc, argv, "A:f:k:t:HDS",
                                 long_options, &option_index);
 
                 if (c==-1)
@@ -647,6 +567,13 @@ int main(int argc, char *argv[]) {
                                 break;
                         case 'f': filter=trace_create_filter(optarg);
                         	break;
+                        case 'k':
+                                if (atoi(optarg) <= 0) {
+                                        fprintf(stderr, "Number of endpoints must be >0\n");
+                                        return 1;
+                                }
+                                glob.approx = atoi(optarg);
+                                break;
 			case 'H':
                                 usage(argv[0]);
                                 break;
@@ -729,6 +656,14 @@ int main(int argc, char *argv[]) {
                         break;
                 }
 
+                if (glob.failed) {
+                        currenttrace = NULL;
+                        trace_destroy(input);
+                        trace_destroy_callback_set(pktcbs);
+                        trace_destroy_callback_set(repcbs);
+                        return 1;
+                }
+
                 currenttrace = NULL;
                 trace_destroy(input);
                 trace_destroy_callback_set(pktcbs);
@@ -48,6 +48,10 @@
  * (provided the terms of the LGPL are met).
  */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include "config.h"
 
 #include <stdio.h>
@@ -61,6 +65,9 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <pthread.h>
+#include <inttypes.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
 
 #include <libtrace_parallel.h>
 #include <libtrace.h>
@@ -85,8 +92,16 @@ struct global_params {
     uint16_t firstport;
     int readercount;
     uint16_t mtu;
+    int batchsize;
+    int gso;
 };
 
+/* UDP_SEGMENT can coalesce at most this many bytes into one send */
+#define GSO_MAX_BYTES (65000)
+/* ... and the kernel will split one send into at most this many datagrams
+ * (UDP_MAX_SEGMENTS), rejecting the send with EINVAL if there are more */
+#define GSO_MAX_SEGMENTS (64)
+
 struct beacon_params {
     uint16_t beaconport;
     struct global_params *gparams;
@@ -106,8 +121,25 @@ typedef struct read_thread_data {
     struct addrinfo *target;
     uint32_t lastsend;
 
+    /* Finished datagrams are queued up so that a whole batch can be sent
+     * with a single system call. Each datagram is built in place in its
+     * slot, so pbuffer always points at the next free slot. */
+    uint8_t *dgrams;
+    struct iovec *iovs;
+    struct mmsghdr *msgs;
+    int *msgsegs;
+    char *msgctrl;
+    int queued;
+    int gso;
+
+    uint64_t sent_dgrams;
+    uint64_t sent_bytes;
+    uint64_t dropped_dgrams;
+
 } read_thread_data_t;
 
+#define GSO_CTRL_SIZE (CMSG_SPACE(sizeof(uint16_t)))
+
 volatile int halted = 0;
 
 static void cleanup_signal(int signal UNUSED) {
@@ -219,10 +251,35 @@ static void *init_reader_thread(libtrace_t *trace UNUSED,
     struct global_params *gparams = (struct global_params *)global;
 
     rdata = calloc(1, sizeof(read_thread_data_t));
+    if (rdata == NULL) {
+        fprintf(stderr, "tracemcast: unable to allocate memory for reader thread %d\n",
+                trace_get_perpkt_thread_id(t));
+        return NULL;
+    }
     rdata->threadid = trace_get_perpkt_thread_id(t);
     rdata->mcastport = gparams->firstport + rdata->threadid;
     rdata->mcastfd = -1;
-    rdata->pbuffer = calloc(gparams->mtu, sizeof(uint8_t));
+    rdata->dgrams = calloc((size_t)gparams->batchsize * gparams->mtu,
+            sizeof(uint8_t));
+    rdata->iovs = calloc(gparams->batchsize, sizeof(struct iovec));
+    rdata->msgs = calloc(gparams->batchsize, sizeof(struct mmsghdr));
+    rdata->msgsegs = calloc(gparams->batchsize, sizeof(int));
+    rdata->msgctrl = calloc(gparams->batchsize, GSO_CTRL_SIZE);
+    if (!rdata->dgrams || !rdata->iovs || !rdata->msgs || !rdata->msgsegs ||
+            !rdata->msgctrl) {
+        fprintf(stderr, "tracemcast: unable to allocate %d datagram buffers for reader thread %d\n",
+                gparams->batchsize, rdata->threadid);
+        free(rdata->dgrams);
+        free(rdata->iovs);
+        free(rdata->msgs);
+        free(rdata->msgsegs);
+        free(rdata->msgctrl);
+        free(rdata);
+        return NULL;
+    }
+    rdata->queued = 0;
+    rdata->gso = gparams->gso;
+    rdata->pbuffer = rdata->dgrams;
     rdata->writeptr = rdata->pbuffer;
     rdata->seqno = 1;
     rdata->target = NULL;
@@ -241,38 +298,196 @@ static void *init_reader_thread(libtrace_t *trace UNUSED,
         rdata->mcastfd = -1;
     }
 
+#ifdef UDP_SEGMENT
+    /* Check that the kernel can segment for us, then turn it back off
+     * for the socket as a whole -- it is asked for per message instead */
+    if (rdata->gso && rdata->mcastfd != -1) {
+        int segsize = gparams->mtu;
+
+        if (setsockopt(rdata->mcastfd, SOL_UDP, UDP_SEGMENT, &segsize,
+                    sizeof(segsize)) != 0) {
+            fprintf(stderr, "tracemcast: UDP segmentation offload is not available for reader thread %d: %s\n",
+                    rdata->threadid, strerror(errno));
+            rdata->gso = 0;
+        } else {
+            segsize = 0;
+            setsockopt(rdata->mcastfd, SOL_UDP, UDP_SEGMENT, &segsize,
+                    sizeof(segsize));
+        }
+    }
+#else
+    rdata->gso = 0;
+#endif
+
     return rdata;
 }
 
-static void send_ndag_packet(read_thread_data_t *rdata) {
+/* Groups the queued datagrams, starting from 'first', into messages. Without
+ * GSO every datagram is a message of its own. With GSO, a run of datagrams of
+ * the same size (plus one shorter one to finish the run) can go in a single
+ * message, which the kernel will split back into datagrams. */
+static int build_messages(read_thread_data_t *rdata, int first) {
+
+    int nmsgs = 0;
+    int i = first, j;
+    size_t segsize, total;
+    struct msghdr *mh;
+
+    while (i < rdata->queued) {
+        segsize = rdata->iovs[i].iov_len;
+        total = segsize;
+        j = i + 1;
+        while (rdata->gso && j < rdata->queued &&
+                rdata->iovs[j - 1].iov_len == segsize &&
+                rdata->iovs[j].iov_len <= segsize &&
+                total + rdata->iovs[j].iov_len <= GSO_MAX_BYTES &&
+                j - i < GSO_MAX_SEGMENTS) {
+            total += rdata->iovs[j].iov_len;
+            j ++;
+        }
 
-    rdata->encaphdr->recordcount = ntohs(rdata->reccount);
+        mh = &(rdata->msgs[nmsgs].msg_hdr);
+        memset(mh, 0, sizeof(struct msghdr));
+        mh->msg_name = rdata->target->ai_addr;
+        mh->msg_namelen = rdata->target->ai_addrlen;
+        mh->msg_iov = &(rdata->iovs[i]);
+        mh->msg_iovlen = j - i;
+
+#ifdef UDP_SEGMENT
+        if (j - i > 1) {
+            struct cmsghdr *cm;
+
+            mh->msg_control = rdata->msgctrl + nmsgs * GSO_CTRL_SIZE;
+            mh->msg_controllen = GSO_CTRL_SIZE;
+            cm = CMSG_FIRSTHDR(mh);
+            cm->cmsg_level = SOL_UDP;
+            cm->cmsg_type = UDP_SEGMENT;
+            cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+            *((uint16_t *)CMSG_DATA(cm)) = (uint16_t)segsize;
+        }
+#endif
+        rdata->msgsegs[nmsgs] = j - i;
+        nmsgs ++;
+        i = j;
+    }
+    return nmsgs;
+}
+
+/* Sends every queued datagram. The socket is never allowed to block the
+ * capture, so anything that does not fit in the send buffer is dropped. */
+static void flush_ndag_packets(read_thread_data_t *rdata) {
+
+    int nmsgs, done = 0, donesegs = 0;
+    int ret, i;
+    size_t k;
+
+    if (rdata->queued == 0 || rdata->target == NULL) {
+        rdata->queued = 0;
+        rdata->pbuffer = rdata->dgrams;
+        rdata->writeptr = rdata->pbuffer;
+        return;
+    }
+
+    nmsgs = build_messages(rdata, 0);
+    while (done < nmsgs) {
+#if HAVE_DECL_SENDMMSG
+        ret = sendmmsg(rdata->mcastfd, rdata->msgs + done, nmsgs - done,
+                MSG_DONTWAIT);
+#else
+        ret = sendmsg(rdata->mcastfd, &(rdata->msgs[done].msg_hdr),
+                MSG_DONTWAIT);
+        if (ret >= 0) {
+            ret = 1;
+        }
+#endif
+        if (ret < 0 && errno == EINVAL && rdata->gso) {
+            /* The kernel or the device won't segment these for us after
+             * all, so send everything that is left one datagram at a
+             * time from now on */
+            fprintf(stderr, "tracemcast: UDP segmentation offload rejected for thread %d, sending without it\n",
+                    rdata->threadid);
+            rdata->gso = 0;
+            nmsgs = build_messages(rdata, donesegs);
+            done = 0;
+            continue;
+        }
+        if (ret <= 0) {
+            if (ret < 0 && errno != EAGAIN && errno != EWOULDBLOCK &&
+                    errno != ENOBUFS) {
+                fprintf(stderr, "tracemcast: thread %d failed to send multicast ERF packet: %s\n",
+                        rdata->threadid, strerror(errno));
+            }
+            for (i = done; i < nmsgs; i++) {
+                rdata->dropped_dgrams += rdata->msgsegs[i];
+            }
+            break;
+        }
 
-    if (sendto(rdata->mcastfd, rdata->pbuffer,
-            (rdata->writeptr - rdata->pbuffer), 0, rdata->target->ai_addr,
-            rdata->target->ai_addrlen) < 0) {
-        fprintf(stderr, "tracemcast: thread %d failed to send multicast ERF packet: %s\n",
-                rdata->threadid, strerror(errno));
+        for (i = done; i < done + ret; i++) {
+            struct msghdr *mh = &(rdata->msgs[i].msg_hdr);
+            rdata->sent_dgrams += rdata->msgsegs[i];
+            donesegs += rdata->msgsegs[i];
+            for (k = 0; k < mh->msg_iovlen; k++) {
+                rdata->sent_bytes += mh->msg_iov[k].iov_len;
+            }
+        }
+        done += ret;
     }
 
+    rdata->queued = 0;
+    rdata->pbuffer = rdata->dgrams;
     rdata->writeptr = rdata->pbuffer;
+}
+
+/* Finishes off the datagram that is currently being filled and queues it,
+ * sending the whole queue if it is now full */
+static void send_ndag_packet(read_thread_data_t *rdata,
+        struct global_params *gparams) {
+
+    rdata->encaphdr->recordcount = ntohs(rdata->reccount);
+
+    rdata->iovs[rdata->queued].iov_base = rdata->pbuffer;
+    rdata->iovs[rdata->queued].iov_len = rdata->writeptr - rdata->pbuffer;
+    rdata->queued ++;
+
+    rdata->seqno ++;
+    if (rdata->seqno == 0) {
+        rdata->seqno ++;
+    }
     rdata->encaphdr = NULL;
     rdata->reccount = 0;
 
+    if (rdata->queued >= gparams->batchsize) {
+        flush_ndag_packets(rdata);
+    } else {
+        rdata->pbuffer = rdata->dgrams + rdata->queued * gparams->mtu;
+        rdata->writeptr = rdata->pbuffer;
+    }
 }
 
 static void halt_reader_thread(libtrace_t *trace UNUSED,
-        libtrace_thread_t *t UNUSED, void *global UNUSED, void *tls) {
+        libtrace_thread_t *t UNUSED, void *global, void *tls) {
 
     read_thread_data_t *rdata = (read_thread_data_t *)tls;
 
-    if (rdata->writeptr > rdata->pbuffer) {
-        send_ndag_packet(rdata);
+    if (rdata == NULL) {
+        return;
     }
 
-    if (rdata->pbuffer) {
-        free(rdata->pbuffer);
+    if (rdata->writeptr > rdata->pbuffer) {
+        send_ndag_packet(rdata, (struct global_params *)global);
     }
+    flush_ndag_packets(rdata);
+
+    fprintf(stderr, "tracemcast: thread %d sent %" PRIu64 " datagrams (%"
+            PRIu64 " bytes), dropped %" PRIu64 "\n", rdata->threadid,
+            rdata->sent_dgrams, rdata->sent_bytes, rdata->dropped_dgrams);
+
+    free(rdata->dgrams);
+    free(rdata->iovs);
+    free(rdata->msgs);
+    free(rdata->msgsegs);
+    free(rdata->msgctrl);
     if (rdata->target) {
         freeaddrinfo(rdata->target);
     }
@@ -319,20 +534,27 @@ static uint16_t construct_erf_header(read_thread_data_t *rdata,
 }
 
 static void tick_reader_thread(libtrace_t *trace UNUSED,
-        libtrace_thread_t *t UNUSED, void *global UNUSED, void *tls,
+        libtrace_thread_t *t UNUSED, void *global, void *tls,
         uint64_t order) {
 
     read_thread_data_t *rdata = (read_thread_data_t *)tls;
 
+    if (rdata == NULL) {
+        return;
+    }
+
     if (rdata->writeptr > rdata->pbuffer &&
             (order >> 32) >= rdata->lastsend + 3) {
 
-        send_ndag_packet(rdata);
+        send_ndag_packet(rdata, (struct global_params *)global);
         rdata->lastsend = (order >> 32);
     }
+
+    /* Don't let finished datagrams wait for more than a tick */
+    flush_ndag_packets(rdata);
 }
 
-static libtrace_packet_t *packet_reader_thread(libtrace_t *trace UNUSED,
+static libtrace_packet_t *packet_reader_thread(libtrace_t *trace,
         libtrace_thread_t *t UNUSED, void *global, void *tls,
         libtrace_packet_t *packet) {
 
@@ -343,6 +565,12 @@ static libtrace_packet_t *packet_reader_thread(libtrace_t *trace UNUSED,
     void *l2;
     uint64_t erfts;
 
+    /* This thread couldn't be set up, so give up on the whole capture */
+    if (rdata == NULL) {
+        trace_pstop(trace);
+        return packet;
+    }
+
     if (IS_LIBTRACE_META_PACKET(packet)) {
         return packet;
     }
@@ -361,7 +589,7 @@ static libtrace_packet_t *packet_reader_thread(libtrace_t *trace UNUSED,
         if (rdata->writeptr > rdata->pbuffer + sizeof(ndag_common_t) +
                 sizeof(ndag_encap_t)) {
 
-            send_ndag_packet(rdata);
+            send_ndag_packet(rdata, gparams);
             rdata->lastsend = (erfts >> 32);
         }
     }
@@ -401,7 +629,7 @@ static libtrace_packet_t *packet_reader_thread(libtrace_t *trace UNUSED,
     /* if the buffer is close to full, just send the buffer anyway */
     if (gparams->mtu - (rdata->writeptr - rdata->pbuffer) -
             (dag_record_size + 2) < 64) {
-        send_ndag_packet(rdata);
+        send_ndag_packet(rdata, gparams);
         rdata->lastsend = (erfts >> 32);
     }
 
@@ -409,7 +637,7 @@ static libtrace_packet_t *packet_reader_thread(libtrace_t *trace UNUSED,
 }
 
 static void start_libtrace_reader(struct global_params *gparams, char *uri,
-        char *filterstring) {
+        char *filterstring, int flushms) {
 
 
     libtrace_filter_t *filt = NULL;
@@ -429,9 +657,8 @@ static void start_libtrace_reader(struct global_params *gparams, char *uri,
     trace_set_packet_cb(pktcbs, packet_reader_thread);
     trace_set_tick_interval_cb(pktcbs, tick_reader_thread);
 
-    if (trace_get_information(currenttrace)->live) {
-        trace_set_tick_interval(currenttrace, 1000);
-    } else {
+    trace_set_tick_interval(currenttrace, flushms);
+    if (!trace_get_information(currenttrace)->live) {
         trace_set_tracetime(currenttrace, true);
     }
 
@@ -560,6 +787,9 @@ static void usage(char *prog) {
             "   -s --srcaddr=address    Send multicast on the interface for this IP address\n"
             "   -M --mtu=bytes          Limit multicast message size to this number of bytes\n"
             "   -t --threads=count      Use this number of packet processing threads\n"
+            "   -b --batch=count        Send up to this many multicast messages at once\n"
+            "   -l --latency=ms         Hold multicast messages for at most this many ms\n"
+            "   -G --gso                Use UDP segmentation offload for batches\n"
             "   -h --help               Show this usage statement\n");
 }
 
@@ -571,6 +801,9 @@ int main(int argc, char *argv[]) {
     struct global_params gparams;
     struct beacon_params bparams;
     int threads = 1;
+    int batchsize = 16;
+    int flushms = 10;
+    int gso = 0;
     struct timeval tv;
     uint16_t mtu = NDAG_MAX_DGRAM_SIZE;
     pthread_t beacontid = 0;
@@ -590,11 +823,14 @@ int main(int argc, char *argv[]) {
             { "srcaddr",    1, 0, 's' },
             { "threads",    1, 0, 't' },
             { "mtu",        1, 0, 'M' },
+            { "batch",      1, 0, 'b' },
+            { "latency",    1, 0, 'l' },
+            { "gso",        0, 0, 'G' },
             { "help",       0, 0, 'h' },
             { NULL,         0, 0, 0 },
         };
 
-        int c = getopt_long(argc, argv, "M:t:f:m:g:p:s:h", long_options,
+        int c = getopt_long(argc, argv, "M:t:f:m:g:p:s:b:l:Gh", long_options,
                 &optindex);
         if (c == -1) {
             break;
@@ -622,6 +858,15 @@ int main(int argc, char *argv[]) {
             case 't':
                 threads = (int)strtoul(optarg, NULL, 0);
                 break;
+            case 'b':
+                batchsize = (int)strtoul(optarg, NULL, 0);
+                break;
+            case 'l':
+                flushms = (int)strtoul(optarg, NULL, 0);
+                break;
+            case 'G':
+                gso = 1;
+                break;
             case 'h':
             default:
                 usage(argv[0]);
@@ -654,6 +899,16 @@ int main(int argc, char *argv[]) {
     } else if (mtu < 536) {
         mtu = 536;
     }
+    if (batchsize < 1) {
+        batchsize = 1;
+    } else if (batchsize > 1024) {
+        batchsize = 1024;
+    }
+    if (flushms < 1) {
+        flushms = 1;
+    } else if (flushms > 1000) {
+        flushms = 1000;
+    }
 
 
     gettimeofday(&tv, NULL);
@@ -661,6 +916,8 @@ int main(int argc, char *argv[]) {
             (tv.tv_usec / 1000.0));
     gparams.readercount = threads;
     gparams.mtu = mtu;
+    gparams.batchsize = batchsize;
+    gparams.gso = gso;
 
     gparams.firstport = 10000 + (rand() % 52000);
 
@@ -690,7 +947,7 @@ int main(int argc, char *argv[]) {
         goto endmcast;
     }
 
-    start_libtrace_reader(&gparams, argv[optind], filterstring);
+    start_libtrace_reader(&gparams, argv[optind], filterstring, flushms);
 
 endmcast:
     halted = 1;
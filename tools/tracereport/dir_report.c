@@ -29,19 +29,45 @@
 #include <inttypes.h>
 #include <lt_inttypes.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include "libtrace.h"
 #include "tracereport.h"
 #include "report.h"
 
+struct dir_state {
+	uint64_t bytes[8];
+	uint64_t packets[8];
+};
+
 static uint64_t dir_bytes[8];
 static uint64_t dir_packets[8];
 
-void dir_per_packet(struct libtrace_packet_t *packet)
+void *dir_create(void)
+{
+	return calloc(1, sizeof(struct dir_state));
+}
+
+void dir_per_packet(void *state, struct libtrace_packet_t *packet)
 {
-	if (trace_get_direction(packet)==-1)
+	struct dir_state *st = (struct dir_state *)state;
+	libtrace_direction_t dir = trace_get_direction(packet);
+
+	if (dir==-1)
 		return;
-	dir_bytes[trace_get_direction(packet)]+=trace_get_wire_length(packet);
-	++dir_packets[trace_get_direction(packet)];
+	st->bytes[dir]+=trace_get_wire_length(packet);
+	++st->packets[dir];
+}
+
+void dir_combine(void *state)
+{
+	struct dir_state *st = (struct dir_state *)state;
+	int i;
+
+	for(i=0;i<8;++i) {
+		dir_bytes[i] += st->bytes[i];
+		dir_packets[i] += st->packets[i];
+	}
+	free(st);
 }
 
 void dir_report(void)
@@ -29,14 +29,25 @@
 #include <inttypes.h>
 #include <lt_inttypes.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include "libtrace.h"
 #include "tracereport.h"
 #include "report.h"
 
+struct ecn_state {
+	stat_t stat[3][4];
+};
+
 static stat_t ecn_stat[3][4] = {{{0,0}}} ;
 
-void ecn_per_packet(struct libtrace_packet_t *packet)
+void *ecn_create(void)
+{
+	return calloc(1, sizeof(struct ecn_state));
+}
+
+void ecn_per_packet(void *state, struct libtrace_packet_t *packet)
 {
+	struct ecn_state *st = (struct ecn_state *)state;
 	struct libtrace_ip *ip = trace_get_ip(packet);
 	libtrace_direction_t dir = trace_get_direction(packet);
 	int ecn;
@@ -48,8 +59,18 @@ void ecn_per_packet(struct libtrace_packet_t *packet)
 		dir = TRACE_DIR_OTHER;
 	
 	ecn = ip->ip_tos & 0x2;
-	ecn_stat[dir][ecn].count++;
-	ecn_stat[dir][ecn].bytes+=trace_get_wire_length(packet);
+	st->stat[dir][ecn].count++;
+	st->stat[dir][ecn].bytes+=trace_get_wire_length(packet);
+}
+
+void ecn_combine(void *state)
+{
+	struct ecn_state *st = (struct ecn_state *)state;
+	int i;
+
+	for (i = 0; i < 3; i++)
+		stat_add(ecn_stat[i], st->stat[i], 4);
+	free(st);
 }
 
 void ecn_report(void)
@@ -32,52 +32,49 @@
 #include <stdlib.h>
 #include "libtrace.h"
 #include "tracereport.h"
-#include "contain.h"
 #include "report.h"
+#include "data-struct/flow_table.h"
 
 static uint64_t flow_count=0;
+static libtrace_flow_table_t *flows = NULL;
 
-struct fivetuple_t {
-	uint32_t ipa;
-	uint32_t ipb;
-	uint16_t porta;
-	uint16_t portb;
-	uint8_t prot;
-};
-
-static int fivetuplecmp(struct fivetuple_t a, struct fivetuple_t b)
+void *flow_create(void)
 {
-	if (a.porta != b.porta) return a.porta-b.porta;
-	if (a.portb != b.portb) return a.portb-b.portb;
-	if (a.ipa != b.ipa) return a.ipa-b.ipa;
-	if (a.ipb != b.ipb) return a.ipb-b.ipb;
-	return a.prot - b.prot;
+	return libtrace_flow_table_create(0, 0);
 }
 
-static int flowset_cmp(const splay *a, const splay *b);
-SET_CREATE(flowset,struct fivetuple_t,fivetuplecmp)
-
-void flow_per_packet(struct libtrace_packet_t *packet)
+void flow_per_packet(void *state, struct libtrace_packet_t *packet)
 {
-	struct libtrace_ip *ip = trace_get_ip(packet);
-	struct fivetuple_t ft;
-	if (!ip)
+	libtrace_flow_tuple_t ft;
+
+	if (!state || !libtrace_flow_tuple_from_packet(packet, &ft))
 		return;
-	ft.ipa=ip->ip_src.s_addr;
-	ft.ipb=ip->ip_dst.s_addr;
-	ft.porta=trace_get_source_port(packet);
-	ft.portb=trace_get_destination_port(packet);
-	ft.prot = 0;
 
-	if (!SET_CONTAINS(flowset,ft)) {
-		SET_INSERT(flowset,ft);
-		flow_count++;
+	libtrace_flow_table_insert((libtrace_flow_table_t *)state, &ft, NULL);
+}
+
+void flow_combine(void *state)
+{
+	libtrace_flow_table_t *table = (libtrace_flow_table_t *)state;
+
+	if (!table)
+		return;
+	if (!flows) {
+		flows = table;
+	} else {
+		/* A flow seen by more than one thread is still one flow */
+		libtrace_flow_table_merge(flows, table, NULL, NULL);
+		libtrace_flow_table_destroy(table);
 	}
+	flow_count = libtrace_flow_table_get_size(flows);
 }
 
 void flow_report(void)
 {
 	FILE *out = fopen("flows.rpt", "w");
+
+	libtrace_flow_table_destroy(flows);
+	flows = NULL;
 	if (!out) {
 		perror("fopen");
 		return;
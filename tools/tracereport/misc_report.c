@@ -27,6 +27,7 @@
 
 #include <inttypes.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdbool.h>
 #include <time.h>
 #include <string.h>
@@ -34,6 +35,15 @@
 #include "tracereport.h"
 #include "report.h"
 
+struct misc_state {
+	double starttime;
+	double endtime;
+	bool has_starttime;
+	bool has_endtime;
+	uint64_t packets;
+	uint64_t capture_bytes;
+};
+
 static double starttime;
 static double endtime;
 static bool has_starttime = false;
@@ -42,16 +52,42 @@ static uint64_t packets = 0;
 
 static uint64_t capture_bytes = 0;
 
-void misc_per_packet(struct libtrace_packet_t *packet)
+void *misc_create(void)
+{
+	return calloc(1, sizeof(struct misc_state));
+}
+
+void misc_per_packet(void *state, struct libtrace_packet_t *packet)
 {
+	struct misc_state *st = (struct misc_state *)state;
 	double ts = trace_get_seconds(packet);
-	if (ts != 0 && (!has_starttime || starttime > ts))
-		starttime = ts;
-	if (ts != 0 && (!has_endtime || endtime < ts))
-		endtime = ts;
-	has_starttime = has_endtime = true;
-	++packets;
-	capture_bytes += trace_get_capture_length(packet) + trace_get_framing_length(packet);
+	if (ts != 0 && (!st->has_starttime || st->starttime > ts)) {
+		st->starttime = ts;
+		st->has_starttime = true;
+	}
+	if (ts != 0 && (!st->has_endtime || st->endtime < ts)) {
+		st->endtime = ts;
+		st->has_endtime = true;
+	}
+	++st->packets;
+	st->capture_bytes += trace_get_capture_length(packet) + trace_get_framing_length(packet);
+}
+
+void misc_combine(void *state)
+{
+	struct misc_state *st = (struct misc_state *)state;
+
+	if (st->has_starttime && (!has_starttime || starttime > st->starttime)) {
+		starttime = st->starttime;
+		has_starttime = true;
+	}
+	if (st->has_endtime && (!has_endtime || endtime < st->endtime)) {
+		endtime = st->endtime;
+		has_endtime = true;
+	}
+	packets += st->packets;
+	capture_bytes += st->capture_bytes;
+	free(st);
 }
 
 static char *ts_to_date(double ts)
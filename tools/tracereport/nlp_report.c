@@ -29,14 +29,25 @@
 #include <inttypes.h>
 #include <lt_inttypes.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include "libtrace.h"
 #include "tracereport.h"
 #include "report.h"
 
+struct nlp_state {
+	stat_t stat[3][65536];
+};
+
 static stat_t nlp_stat[3][65536] = {{{0,0}}} ;
 
-void nlp_per_packet(struct libtrace_packet_t *packet)
+void *nlp_create(void)
+{
+	return calloc(1, sizeof(struct nlp_state));
+}
+
+void nlp_per_packet(void *state, struct libtrace_packet_t *packet)
 {
+	struct nlp_state *st = (struct nlp_state *)state;
 	uint16_t ethertype;
 	void *link;
 	libtrace_direction_t dir = trace_get_direction(packet);
@@ -49,8 +60,18 @@ void nlp_per_packet(struct libtrace_packet_t *packet)
 	if (dir != TRACE_DIR_INCOMING && dir != TRACE_DIR_OUTGOING)
 		dir = TRACE_DIR_OTHER;
 	
-	nlp_stat[dir][ethertype].count++;
-	nlp_stat[dir][ethertype].bytes+=trace_get_wire_length(packet);
+	st->stat[dir][ethertype].count++;
+	st->stat[dir][ethertype].bytes+=trace_get_wire_length(packet);
+}
+
+void nlp_combine(void *state)
+{
+	struct nlp_state *st = (struct nlp_state *)state;
+	int i;
+
+	for (i = 0; i < 3; i++)
+		stat_add(nlp_stat[i], st->stat[i], 65536);
+	free(st);
 }
 
 void nlp_report(void){
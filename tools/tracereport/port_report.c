@@ -33,15 +33,25 @@
 #include <string.h>
 #include "libtrace.h"
 #include "tracereport.h"
-#include "contain.h"
 #include "report.h"
 
+struct port_state {
+	stat_t *ports[3][256];
+	bool seen[3];
+};
+
 stat_t *ports[3][256] = {{NULL}};
 char protn[256]={0};
 static bool suppress[3] = {true,true,true};
 
-void port_per_packet(struct libtrace_packet_t *packet)
+void *port_create(void)
+{
+	return calloc(1, sizeof(struct port_state));
+}
+
+void port_per_packet(void *state, struct libtrace_packet_t *packet)
 {
+	struct port_state *st = (struct port_state *)state;
 	uint8_t proto;
 	int port;
 	libtrace_direction_t dir = trace_get_direction(packet);
@@ -58,12 +68,36 @@ void port_per_packet(struct libtrace_packet_t *packet)
 		? trace_get_source_port(packet)
 		: trace_get_destination_port(packet);
 
-	if (!ports[dir][proto])
-		ports[dir][proto]=calloc(65536,sizeof(stat_t));
-	ports[dir][proto][port].bytes+=trace_get_wire_length(packet);
-	ports[dir][proto][port].count++;
-	protn[proto]=1;
-	suppress[dir] = false;
+	if (!st->ports[dir][proto])
+		st->ports[dir][proto]=calloc(65536,sizeof(stat_t));
+	st->ports[dir][proto][port].bytes+=trace_get_wire_length(packet);
+	st->ports[dir][proto][port].count++;
+	st->seen[dir] = true;
+}
+
+void port_combine(void *state)
+{
+	struct port_state *st = (struct port_state *)state;
+	int i,j;
+
+	for (i = 0; i < 3; i++) {
+		for (j = 0; j < 256; j++) {
+			if (!st->ports[i][j])
+				continue;
+			protn[j]=1;
+			if (!ports[i][j]) {
+				/* First thread to see this protocol, so just
+				 * take its counters */
+				ports[i][j] = st->ports[i][j];
+				continue;
+			}
+			stat_add(ports[i][j], st->ports[i][j], 65536);
+			free(st->ports[i][j]);
+		}
+		if (st->seen[i])
+			suppress[i] = false;
+	}
+	free(st);
 }
 
 
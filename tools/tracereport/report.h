@@ -28,19 +28,51 @@
 #ifndef REPORT_H
 #define REPORT_H
 
-void dir_per_packet(struct libtrace_packet_t *packet);
-void error_per_packet(struct libtrace_packet_t *packet);
-void flow_per_packet(struct libtrace_packet_t *packet);
-void misc_per_packet(struct libtrace_packet_t *packet);
-void port_per_packet(struct libtrace_packet_t *packet);
-void protocol_per_packet(struct libtrace_packet_t *packet);
-void tos_per_packet(struct libtrace_packet_t *packet);
-void ttl_per_packet(struct libtrace_packet_t *packet);
-void tcpopt_per_packet(struct libtrace_packet_t *packet);
-void synopt_per_packet(struct libtrace_packet_t *packet);
-void nlp_per_packet(struct libtrace_packet_t *packet);
-void ecn_per_packet(struct libtrace_packet_t *packet);
-void tcpseg_per_packet(struct libtrace_packet_t *packet);
+/* Each report keeps its counters in a state created for every processing
+ * thread. When a thread finishes, its state is combined into the report's
+ * totals (which also frees the state), and the report is written from the
+ * totals once every trace has been read. */
+void *dir_create(void);
+void *error_create(void);
+void *flow_create(void);
+void *misc_create(void);
+void *port_create(void);
+void *protocol_create(void);
+void *tos_create(void);
+void *ttl_create(void);
+void *tcpopt_create(void);
+void *synopt_create(void);
+void *nlp_create(void);
+void *ecn_create(void);
+void *tcpseg_create(void);
+
+void dir_per_packet(void *state, struct libtrace_packet_t *packet);
+void error_per_packet(void *state, struct libtrace_packet_t *packet);
+void flow_per_packet(void *state, struct libtrace_packet_t *packet);
+void misc_per_packet(void *state, struct libtrace_packet_t *packet);
+void port_per_packet(void *state, struct libtrace_packet_t *packet);
+void protocol_per_packet(void *state, struct libtrace_packet_t *packet);
+void tos_per_packet(void *state, struct libtrace_packet_t *packet);
+void ttl_per_packet(void *state, struct libtrace_packet_t *packet);
+void tcpopt_per_packet(void *state, struct libtrace_packet_t *packet);
+void synopt_per_packet(void *state, struct libtrace_packet_t *packet);
+void nlp_per_packet(void *state, struct libtrace_packet_t *packet);
+void ecn_per_packet(void *state, struct libtrace_packet_t *packet);
+void tcpseg_per_packet(void *state, struct libtrace_packet_t *packet);
+
+void dir_combine(void *state);
+void error_combine(void *state);
+void flow_combine(void *state);
+void misc_combine(void *state);
+void port_combine(void *state);
+void protocol_combine(void *state);
+void tos_combine(void *state);
+void ttl_combine(void *state);
+void tcpopt_combine(void *state);
+void synopt_combine(void *state);
+void nlp_combine(void *state);
+void ecn_combine(void *state);
+void tcpseg_combine(void *state);
 
 void drops_per_trace(libtrace_t *trace);
 
@@ -29,6 +29,7 @@
 #include <inttypes.h>
 #include <lt_inttypes.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include "libtrace.h"
 #include "tracereport.h"
 #include "report.h"
@@ -61,12 +62,47 @@ struct opt_counter {
 	uint64_t other;
 };
 
+struct synopt_state {
+	struct opt_counter syn_counts;
+	struct opt_counter synack_counts;
+	uint64_t total_syns;
+	uint64_t total_synacks;
+};
+
 struct opt_counter syn_counts = {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0};
 struct opt_counter synack_counts = {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0};
 
 uint64_t total_syns = 0;
 uint64_t total_synacks = 0;
 
+void *synopt_create(void)
+{
+	return calloc(1, sizeof(struct synopt_state));
+}
+
+/* Every field of an opt_counter is a uint64_t, so they can be added up
+ * without naming each one */
+static void add_counts(struct opt_counter *dst, const struct opt_counter *src)
+{
+	uint64_t *d = (uint64_t *)dst;
+	const uint64_t *s = (const uint64_t *)src;
+	size_t i;
+
+	for (i = 0; i < sizeof(struct opt_counter) / sizeof(uint64_t); i++)
+		d[i] += s[i];
+}
+
+void synopt_combine(void *state)
+{
+	struct synopt_state *st = (struct synopt_state *)state;
+
+	add_counts(&syn_counts, &st->syn_counts);
+	add_counts(&synack_counts, &st->synack_counts);
+	total_syns += st->total_syns;
+	total_synacks += st->total_synacks;
+	free(st);
+}
+
 static void classify_packet(struct tcp_opts opts, struct opt_counter *counts) {
 	if (!opts.mss && !opts.sack && !opts.winscale && !opts.ts && !opts.ttcp && !opts.other)
 	{
@@ -125,8 +161,9 @@ static void classify_packet(struct tcp_opts opts, struct opt_counter *counts) {
 		counts->other ++;	
 }
 
-void synopt_per_packet(struct libtrace_packet_t *packet)
+void synopt_per_packet(void *state, struct libtrace_packet_t *packet)
 {
+	struct synopt_state *st = (struct synopt_state *)state;
 	struct libtrace_tcp *tcp = trace_get_tcp(packet);
 	unsigned char *opt_ptr;
 	libtrace_direction_t dir = trace_get_direction(packet);
@@ -180,11 +217,11 @@ void synopt_per_packet(struct libtrace_packet_t *packet)
 	}
 
 	if (tcp->ack) {
-		total_synacks ++;
-		classify_packet(opts_seen, &synack_counts);
+		st->total_synacks ++;
+		classify_packet(opts_seen, &st->synack_counts);
 	} else {
-		total_syns ++;
-		classify_packet(opts_seen, &syn_counts);
+		st->total_syns ++;
+		classify_packet(opts_seen, &st->syn_counts);
 	}
 }
 
@@ -29,14 +29,25 @@
 #include <inttypes.h>
 #include <lt_inttypes.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include "libtrace.h"
 #include "tracereport.h"
 #include "report.h"
 
+struct tcpopt_state {
+	stat_t stat[3][256];
+};
+
 static stat_t tcpopt_stat[3][256] = {{{0,0}}};
 
-void tcpopt_per_packet(struct libtrace_packet_t *packet)
+void *tcpopt_create(void)
+{
+	return calloc(1, sizeof(struct tcpopt_state));
+}
+
+void tcpopt_per_packet(void *state, struct libtrace_packet_t *packet)
 {
+	struct tcpopt_state *st = (struct tcpopt_state *)state;
 	struct libtrace_tcp *tcp = trace_get_tcp(packet);
 	unsigned char *opt_ptr;
 	libtrace_direction_t dir = trace_get_direction(packet);
@@ -61,12 +72,22 @@ void tcpopt_per_packet(struct libtrace_packet_t *packet)
 		/* I don't think we need to count NO-OPs */
 		if (type == 1)
 			continue;
-		tcpopt_stat[dir][type].count++;
-		tcpopt_stat[dir][type].bytes+= tcp_payload;
+		st->stat[dir][type].count++;
+		st->stat[dir][type].bytes+= tcp_payload;
 	}
 	
 }
 
+void tcpopt_combine(void *state)
+{
+	struct tcpopt_state *st = (struct tcpopt_state *)state;
+	int i;
+
+	for (i = 0; i < 3; i++)
+		stat_add(tcpopt_stat[i], st->stat[i], 256);
+	free(st);
+}
+
 
 void tcpopt_report(void)
 {
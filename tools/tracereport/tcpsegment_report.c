@@ -29,17 +29,29 @@
 #include <inttypes.h>
 #include <lt_inttypes.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include "libtrace.h"
 #include "tracereport.h"
 #include "report.h"
 
 #define MAX_SEG_SIZE 10000
 
+struct tcpseg_state {
+	stat_t stat[3][MAX_SEG_SIZE + 1];
+	bool seen[3];
+};
+
 static stat_t tcpseg_stat[3][MAX_SEG_SIZE + 1] = {{{0,0}}} ;
 static bool suppress[3] = {true,true,true};
 
-void tcpseg_per_packet(struct libtrace_packet_t *packet)
+void *tcpseg_create(void)
 {
+	return calloc(1, sizeof(struct tcpseg_state));
+}
+
+void tcpseg_per_packet(void *state, struct libtrace_packet_t *packet)
+{
+	struct tcpseg_state *st = (struct tcpseg_state *)state;
 	struct libtrace_tcp *tcp = trace_get_tcp(packet);
 	libtrace_ip_t *ip = trace_get_ip(packet);
 	libtrace_direction_t dir = trace_get_direction(packet);
@@ -62,9 +74,22 @@ void tcpseg_per_packet(struct libtrace_packet_t *packet)
 	}
 
 
-	tcpseg_stat[dir][ss].count++;
-	tcpseg_stat[dir][ss].bytes+=trace_get_wire_length(packet);
-	suppress[dir] = false;
+	st->stat[dir][ss].count++;
+	st->stat[dir][ss].bytes+=trace_get_wire_length(packet);
+	st->seen[dir] = true;
+}
+
+void tcpseg_combine(void *state)
+{
+	struct tcpseg_state *st = (struct tcpseg_state *)state;
+	int i;
+
+	for (i = 0; i < 3; i++) {
+		stat_add(tcpseg_stat[i], st->stat[i], MAX_SEG_SIZE + 1);
+		if (st->seen[i])
+			suppress[i] = false;
+	}
+	free(st);
 }
 
 void tcpseg_report(void)
@@ -28,15 +28,27 @@
 #include <inttypes.h>
 #include <lt_inttypes.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include "libtrace.h"
 #include "tracereport.h"
 #include "report.h"
 
+struct tos_state {
+	stat_t stat[3][256];
+	bool seen[3];
+};
+
 static stat_t tos_stat[3][256] = {{{0,0}}} ;
 static bool suppress[3] = {true,true,true};
 
-void tos_per_packet(struct libtrace_packet_t *packet)
+void *tos_create(void)
 {
+	return calloc(1, sizeof(struct tos_state));
+}
+
+void tos_per_packet(void *state, struct libtrace_packet_t *packet)
+{
+	struct tos_state *st = (struct tos_state *)state;
 	struct libtrace_ip *ip = trace_get_ip(packet);
 	libtrace_direction_t dir = trace_get_direction(packet);
 	
@@ -46,9 +58,22 @@ void tos_per_packet(struct libtrace_packet_t *packet)
 	if (dir != TRACE_DIR_INCOMING && dir != TRACE_DIR_OUTGOING)
 		dir = TRACE_DIR_OTHER;
 	
-	tos_stat[dir][ip->ip_tos].count++;
-	tos_stat[dir][ip->ip_tos].bytes+=trace_get_wire_length(packet);
-	suppress[dir] = false;
+	st->stat[dir][ip->ip_tos].count++;
+	st->stat[dir][ip->ip_tos].bytes+=trace_get_wire_length(packet);
+	st->seen[dir] = true;
+}
+
+void tos_combine(void *state)
+{
+	struct tos_state *st = (struct tos_state *)state;
+	int i;
+
+	for (i = 0; i < 3; i++) {
+		stat_add(tos_stat[i], st->stat[i], 256);
+		if (st->seen[i])
+			suppress[i] = false;
+	}
+	free(st);
 }
 
 
@@ -41,25 +41,124 @@
 #include <signal.h>
 
 #include "libtrace.h"
+#include "libtrace_parallel.h"
 #include "tracereport.h"
 #include "report.h"
 
 struct libtrace_t *trace;
 uint32_t reports_required = 0;
 int packets_read = 0;
+int count = -1;
+int threads = 4;
 
 static volatile int done=0;
 
+/* The reports that look at every packet, in the order they are run */
+typedef struct report_module {
+	report_type_t type;
+	void *(*create)(void);
+	void (*per_packet)(void *state, struct libtrace_packet_t *packet);
+	void (*combine)(void *state);
+} report_module_t;
+
+static report_module_t modules[] = {
+	{ REPORT_TYPE_MISC, misc_create, misc_per_packet, misc_combine },
+	{ REPORT_TYPE_ERROR, error_create, error_per_packet, error_combine },
+	{ REPORT_TYPE_PORT, port_create, port_per_packet, port_combine },
+	{ REPORT_TYPE_PROTO, protocol_create, protocol_per_packet,
+		protocol_combine },
+	{ REPORT_TYPE_TOS, tos_create, tos_per_packet, tos_combine },
+	{ REPORT_TYPE_TTL, ttl_create, ttl_per_packet, ttl_combine },
+	{ REPORT_TYPE_FLOW, flow_create, flow_per_packet, flow_combine },
+	{ REPORT_TYPE_TCPOPT, tcpopt_create, tcpopt_per_packet,
+		tcpopt_combine },
+	{ REPORT_TYPE_SYNOPT, synopt_create, synopt_per_packet,
+		synopt_combine },
+	{ REPORT_TYPE_NLP, nlp_create, nlp_per_packet, nlp_combine },
+	{ REPORT_TYPE_DIR, dir_create, dir_per_packet, dir_combine },
+	{ REPORT_TYPE_ECN, ecn_create, ecn_per_packet, ecn_combine },
+	{ REPORT_TYPE_TCPSEG, tcpseg_create, tcpseg_per_packet,
+		tcpseg_combine },
+};
+
+#define MODULE_COUNT (sizeof(modules) / sizeof(modules[0]))
+
+/* The state of each report for a single processing thread */
+typedef struct thread_state {
+	void *reports[MODULE_COUNT];
+} thread_state_t;
+
 static void cleanup_signal(int sig UNUSED)
 {
 	done=1;
-	trace_interrupt();
+	if (trace)
+		trace_pstop(trace);
+}
+
+static void *cb_starting(libtrace_t *trace UNUSED,
+		libtrace_thread_t *t UNUSED, void *global UNUSED)
+{
+	thread_state_t *state = calloc(1, sizeof(thread_state_t));
+	size_t i;
+
+	for (i = 0; i < MODULE_COUNT; i++) {
+		if (reports_required & modules[i].type)
+			state->reports[i] = modules[i].create();
+	}
+	return state;
+}
+
+static libtrace_packet_t *cb_packet(libtrace_t *trace,
+		libtrace_thread_t *t UNUSED, void *global UNUSED, void *tls,
+		libtrace_packet_t *packet)
+{
+	thread_state_t *state = (thread_state_t *)tls;
+	size_t i;
+
+	if (IS_LIBTRACE_META_PACKET(packet))
+		return packet;
+
+	if (count >= 0 && __sync_fetch_and_add(&packets_read, 1) >= count) {
+		/* Already read the maximum number of packets */
+		trace_pstop(trace);
+		return packet;
+	}
+
+	for (i = 0; i < MODULE_COUNT; i++) {
+		if (state->reports[i])
+			modules[i].per_packet(state->reports[i], packet);
+	}
+	return packet;
+}
+
+static void cb_stopping(libtrace_t *trace, libtrace_thread_t *t,
+		void *global UNUSED, void *tls)
+{
+	libtrace_generic_t gen;
+
+	/* Hand our reports over to the reporter to be combined */
+	gen.ptr = tls;
+	trace_publish_result(trace, t, 0, gen, RESULT_USER);
+}
+
+static void cb_result(libtrace_t *trace UNUSED,
+		libtrace_thread_t *sender UNUSED, void *global UNUSED,
+		void *tls UNUSED, libtrace_result_t *result)
+{
+	thread_state_t *state = (thread_state_t *)result->value.ptr;
+	size_t i;
+
+	for (i = 0; i < MODULE_COUNT; i++) {
+		if (state->reports[i])
+			modules[i].combine(state->reports[i]);
+	}
+	free(state);
 }
 
 /* Process a trace, counting packets that match filter(s) */
-static void run_trace(char *uri, libtrace_filter_t *filter, int count) 
+static void run_trace(char *uri, libtrace_filter_t *filter)
 {
-	struct libtrace_packet_t *packet = trace_create_packet();
+	libtrace_callback_set_t *pktcbs, *repcbs;
 
 	/* Already read the maximum number of packets - don't need to read
 	 * anything from this trace */
@@ -77,57 +176,37 @@ static void run_trace(char *uri, libtrace_filter_t *filter, int count)
 		trace_config(trace,TRACE_OPTION_FILTER,filter);
 	}
 
-	if (trace_start(trace)==-1) {
-		trace_perror(trace,"trace_start");
+	trace_set_combiner(trace, &combiner_unordered, (libtrace_generic_t){0});
+	trace_set_perpkt_threads(trace, threads);
+
+	pktcbs = trace_create_callback_set();
+	trace_set_starting_cb(pktcbs, cb_starting);
+	trace_set_packet_cb(pktcbs, cb_packet);
+	trace_set_stopping_cb(pktcbs, cb_stopping);
+
+	repcbs = trace_create_callback_set();
+	trace_set_result_cb(repcbs, cb_result);
+
+	if (trace_pstart(trace, NULL, pktcbs, repcbs)==-1) {
+		trace_perror(trace,"trace_pstart");
+		trace_destroy(trace);
+		trace = NULL;
+		trace_destroy_callback_set(pktcbs);
+		trace_destroy_callback_set(repcbs);
 		return;
 	}
 
-	while (1) {
-		int psize;
-		
-		if (count >= 0 && packets_read >= count)
-			break;
-		if (done)
-			break;
-		if ((psize = trace_read_packet(trace, packet)) <1) {
-			break;
-		}
-                if (IS_LIBTRACE_META_PACKET(packet))
-                        continue;
-
-		if (reports_required & REPORT_TYPE_MISC)
-			misc_per_packet(packet);
-		if (reports_required & REPORT_TYPE_ERROR)
-			error_per_packet(packet);
-		if (reports_required & REPORT_TYPE_PORT)
-			port_per_packet(packet);
-		if (reports_required & REPORT_TYPE_PROTO)
-			protocol_per_packet(packet);
-		if (reports_required & REPORT_TYPE_TOS)
-			tos_per_packet(packet);
-		if (reports_required & REPORT_TYPE_TTL)
-			ttl_per_packet(packet);
-		if (reports_required & REPORT_TYPE_FLOW)
-			flow_per_packet(packet);
-		if (reports_required & REPORT_TYPE_TCPOPT)
-			tcpopt_per_packet(packet);
-		if (reports_required & REPORT_TYPE_SYNOPT)
-			synopt_per_packet(packet);
-		if (reports_required & REPORT_TYPE_NLP)
-			nlp_per_packet(packet);
-		if (reports_required & REPORT_TYPE_DIR)
-			dir_per_packet(packet);
-		if (reports_required & REPORT_TYPE_ECN)
-			ecn_per_packet(packet);
-		if (reports_required & REPORT_TYPE_TCPSEG)
-			tcpseg_per_packet(packet);
-
-		packets_read ++;
-	}
+	trace_join(trace);
+
+	if (trace_is_err(trace))
+		trace_perror(trace,"%s",uri);
+
 	if (reports_required & REPORT_TYPE_DROPS)
 		drops_per_trace(trace);
-        trace_destroy_packet(packet);
 	trace_destroy(trace);
+	trace = NULL;
+	trace_destroy_callback_set(pktcbs);
+	trace_destroy_callback_set(repcbs);
 }
 
 static void usage(char *argv0)
@@ -136,6 +215,7 @@ static void usage(char *argv0)
 	"%s flags traceuri [traceuri...]\n"
 	"-f --filter=bpf	\tApply BPF filter. Can be specified multiple times\n"
 	"-c --count=N		Stop after reading N packets\n"
+	"-j --threads=N		Use N threads to process packets (default 4)\n"
 	"-e --error		Report packet errors (e.g. checksum failures, rxerrors)\n"
 	"-F --flow		Report flows\n"
 	"-m --misc		Report misc information (start/end times, duration, pps)\n"
@@ -160,7 +240,6 @@ int main(int argc, char *argv[]) {
 	int opt;
 	char *filterstring=NULL;
 	struct sigaction sigact;
-	int count = -1;
 
 	libtrace_filter_t *filter = NULL;/*trace_bpf_setfilter(filterstring); */
 
@@ -175,6 +254,7 @@ int main(int argc, char *argv[]) {
 			{ "flow", 		0, 0, 'F' },
 			{ "filter",		1, 0, 'f' },
 			{ "help",		0, 0, 'H' },
+			{ "threads",		1, 0, 'j' },
 			{ "misc",		0, 0, 'm' },
 			{ "nlp",		0, 0, 'n' },
 			{ "tcpoptions",		0, 0, 'O' },
@@ -186,7 +266,7 @@ int main(int argc, char *argv[]) {
 			{ "ttl", 		0, 0, 't' },
 			{ NULL, 		0, 0, 0 }
 		};
-		opt = getopt_long(argc, argv, "Df:HemFPpTtOondCsc:", 
+		opt = getopt_long(argc, argv, "Df:HemFPpTtOondCsc:j:", 
 				long_options, &option_index);
 		if (opt == -1)
 			break;
@@ -216,6 +296,11 @@ int main(int argc, char *argv[]) {
 			case 'H':
 				usage(argv[0]);
 				break;
+			case 'j':
+				threads = atoi(optarg);
+				if (threads <= 0)
+					threads = 1;
+				break;
 			case 'm':
 				reports_required |= REPORT_TYPE_MISC;
 				break;
@@ -278,7 +363,7 @@ int main(int argc, char *argv[]) {
 		 * we are - printing to stderr because we use stdout for
 		 * genuine output at the moment */
 		fprintf(stderr, "Reading from trace: %s\n", argv[i]);
-		run_trace(argv[i],filter, count);
+		run_trace(argv[i],filter);
 	}
 
 	if (reports_required & REPORT_TYPE_MISC)
@@ -71,11 +71,17 @@ uint8_t report_drops = 0;
 
 struct filter_t {
 	char *expr;
-	struct libtrace_filter_t *filter;
 	uint64_t count;
 	uint64_t bytes;
 } *filters = NULL;
 
+/* All of the filters, so that each packet is only decoded once no matter
+ * how many filters there are */
+libtrace_filter_set_t *filter_set = NULL;
+/* Set once a filter that failed to compile has been reported, the set
+ * fails the same way for every packet after that */
+int filter_failed = 0;
+
 uint64_t packet_count=UINT64_MAX;
 uint32_t packet_interval=UINT32_MAX;
 pthread_mutex_t ts_lock;
@@ -169,8 +175,10 @@ static void cb_result(libtrace_t *trace, libtrace_thread_t *sender UNUSED,
 	result_t *res;
         libtrace_stat_t *stats = NULL;
 
-        if (stopped)
+        if (stopped) {
+                trace_free_result(trace, result->value.ptr);
                 return;
+        }
 
         ts = result->key;
         res = result->value.ptr;
@@ -196,7 +204,7 @@ static void cb_result(libtrace_t *trace, libtrace_thread_t *sender UNUSED,
                 filters[j].count += res->filters[j].count;
                 filters[j].bytes += res->filters[j].bytes;
         }
-        free(res);
+        trace_free_result(trace, res);
         if (stats) {
                 free(stats);
         }
@@ -211,14 +219,26 @@ static void cb_result(libtrace_t *trace, libtrace_thread_t *sender UNUSED,
 typedef struct threadlocal {
         result_t *results;
         uint64_t last_key;
+        uint64_t *matches;
 } thread_data_t;
 
-static void *cb_starting(libtrace_t *trace UNUSED,
-        libtrace_thread_t *t UNUSED, void *global UNUSED)
+/* One of these is published for every interval, so they come from the
+ * result pool rather than malloc() */
+static result_t *new_results(libtrace_t *trace, libtrace_thread_t *t) {
+        size_t len = sizeof(result_t) + sizeof(statistic_t) * filter_count;
+        result_t *res = (result_t *)trace_alloc_result(trace, t, len);
+
+        if (res)
+                memset(res, 0, len);
+        return res;
+}
+
+static void *cb_starting(libtrace_t *trace,
+        libtrace_thread_t *t, void *global UNUSED)
 {
         thread_data_t *td = calloc(1, sizeof(thread_data_t));
-	td->results = calloc(1, sizeof(result_t) +
-                        sizeof(statistic_t) * filter_count);
+	td->results = new_results(trace, t);
+        td->matches = calloc((filter_count + 63) / 64 + 1, sizeof(uint64_t));
         return td;
 }
 
@@ -262,26 +282,26 @@ static libtrace_packet_t *cb_packet(libtrace_t *trace, libtrace_thread_t *t,
                                 tmp, RESULT_USER);
                 trace_post_reporter(trace);
                 td->last_key += (uint64_t)packet_interval << 32;
-                td->results = calloc(1, sizeof(result_t) +
-                                sizeof(statistic_t) * filter_count);
+                td->results = new_results(trace, t);
         }
         wlen = trace_get_wire_length(packet);
         if (wlen == 0) {
                 /* Don't count ERF provenance and similar packets */
                 return packet;
         }
-        for(i=0;i<filter_count;++i) {
-                int filter_ret;
-                if (filters[i].filter == NULL)
-                        continue;
-                filter_ret = trace_apply_filter(filters[i].filter, packet);
-                if (filter_ret > 0) {
-                        td->results->filters[i].count++;
-                        td->results->filters[i].bytes+=wlen;
-                } else if (filter_ret < 0) {
-                        trace_perror(trace, "trace_apply_filter");
-                        fprintf(stderr, "Removing filter from filterlist\n");
-                        filters[i].filter = NULL;
+        if (filter_count > 0) {
+                int filter_ret = trace_apply_filter_set(filter_set, packet,
+                                td->matches);
+                if (filter_ret < 0 &&
+                                !__sync_lock_test_and_set(&filter_failed, 1)) {
+                        trace_perror(trace, "trace_apply_filter_set");
+                        fprintf(stderr, "Ignoring filters that failed to compile\n");
+                }
+                for(i=0;i<filter_count;++i) {
+                        if (td->matches[i / 64] & (1ULL << (i % 64))) {
+                                td->results->filters[i].count++;
+                                td->results->filters[i].bytes+=wlen;
+                        }
                 }
         }
 
@@ -298,8 +318,12 @@ static void cb_stopping(libtrace_t *trace, libtrace_thread_t *t,
                 libtrace_generic_t tmp = {.ptr = td->results};
                 trace_publish_result(trace, t, td->last_key, tmp, RESULT_USER);
                 trace_post_reporter(trace);
-                td->results = NULL;
+        } else {
+                trace_free_result(trace, td->results);
         }
+        td->results = NULL;
+        free(td->matches);
+        td->matches = NULL;
 }
 
 static void cb_tick(libtrace_t *trace, libtrace_thread_t *t,
@@ -312,8 +336,7 @@ static void cb_tick(libtrace_t *trace, libtrace_thread_t *t,
                 trace_publish_result(trace, t, td->last_key, tmp, RESULT_USER);
                 trace_post_reporter(trace);
                 td->last_key += (uint64_t)packet_interval << 32;
-                td->results = calloc(1, sizeof(result_t) +
-                                sizeof(statistic_t) * filter_count);
+                td->results = new_results(trace, t);
         }
 }
 
@@ -454,7 +477,9 @@ int main(int argc, char *argv[]) {
 				++filter_count;
 				filters=realloc(filters,filter_count*sizeof(struct filter_t));
 				filters[filter_count-1].expr=strdup(optarg);
-				filters[filter_count-1].filter=trace_create_filter(optarg);
+				if (!filter_set)
+					filter_set=trace_create_filter_set();
+				trace_filter_set_add(filter_set, optarg);
 				filters[filter_count-1].count=0;
 				filters[filter_count-1].bytes=0;
 				break;
@@ -538,7 +563,7 @@ int main(int argc, char *argv[]) {
 		/* Clean up after ourselves */
 		output_destroy(output);
 	}
-
+	trace_destroy_filter_set(filter_set);
 
 	return 0;
 }
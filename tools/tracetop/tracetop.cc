@@ -31,22 +31,20 @@
 #define __STDC_FORMAT_MACROS 1
 #include "config.h"
 #include "libtrace.h"
+#include "data-struct/flow_table.h"
+#include "data-struct/sketch.h"
 #include <stdio.h>
 #include <getopt.h>
 #include <stdlib.h>
-#include <map>
 #include <queue>
+#include <vector>
 #include <inttypes.h>
 #include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
 #include <netdb.h>
 #include <string.h>
 #include <assert.h>
-#ifdef HAVE_NETPACKET_PACKET_H
-#include <netpacket/packet.h>
-#include <net/ethernet.h>
-#else
-#include <net/if_dl.h>
-#endif
 
 #if HAVE_NCURSES_NCURSES_H
 #include <ncurses/ncurses.h>
@@ -70,172 +68,41 @@ bool wide_display = false;
 
 uint64_t total_bytes=0;
 uint64_t total_packets=0;
+/* Packets that could not be added to the flow table */
+uint64_t untracked_packets=0;
 
-int cmp_sockaddr_in6(const struct sockaddr_in6 *a, const struct sockaddr_in6 *b)
-{
-	if (a->sin6_port != b->sin6_port)
-		return a->sin6_port - b->sin6_port;
-	return memcmp(a->sin6_addr.s6_addr,b->sin6_addr.s6_addr,sizeof(a->sin6_addr.s6_addr));
-}
-
-int cmp_sockaddr_in(const struct sockaddr_in *a, const struct sockaddr_in *b)
-{
-	if (a->sin_port != b->sin_port)
-		return a->sin_port - b->sin_port;
-	return a->sin_addr.s_addr - b->sin_addr.s_addr;
-}
-
-#ifdef HAVE_NETPACKET_PACKET_H
-int cmp_sockaddr_ll(const struct sockaddr_ll *a, const struct sockaddr_ll *b)
-{
-	return memcmp(a->sll_addr, b->sll_addr, b->sll_halen);
-}
-#else
-int cmp_sockaddr_dl(const struct sockaddr_dl *a, const struct sockaddr_dl *b)
-{
-	return memcmp(a->sdl_data, b->sdl_data, b->sdl_alen);
-}
-
-#endif
-
-
-int cmp_sockaddr(const struct sockaddr *a, const struct sockaddr *b)
-{
-	if (a->sa_family != b->sa_family) {
-		return a->sa_family - b->sa_family;
-	}
-	switch (a->sa_family) {
-		case AF_INET:
-			return cmp_sockaddr_in((struct sockaddr_in *)a,(struct sockaddr_in*)b);
-		case AF_INET6:
-			return cmp_sockaddr_in6((struct sockaddr_in6 *)a,(struct sockaddr_in6*)b);
-#ifdef HAVE_NETPACKET_PACKET_H
-		case AF_PACKET:
-			return cmp_sockaddr_ll((struct sockaddr_ll *)a,(struct sockaddr_ll*)b);
-#else
-		case AF_LINK:
-			return cmp_sockaddr_dl((struct sockaddr_dl *)a, (struct sockaddr_dl *)b);
-#endif
-		case AF_UNSPEC:
-			return 0; /* Can't compare UNSPEC's! */
-		default:
-			fprintf(stderr,"Don't know how to compare family %d\n",a->sa_family);
-			abort();
-	}
-}
-
-char *trace_sockaddr2string(const struct sockaddr *a, socklen_t salen, char *buffer, size_t bufflen)
-{
-	static char intbuffer[NI_MAXHOST];
-	char *mybuf = buffer ? buffer : intbuffer;
-	size_t mybufflen = buffer ? bufflen : sizeof(intbuffer);
-	int err;
-
-	/* Some systems (FreeBSD and Solaris, I'm looking at you) have a bug
-	 * where they can't deal with the idea of a sockaddr_storage being
-	 * passed into getnameinfo. Linux just deals by looking
-	 * at sa_family and figuring out what sockaddr it is really.
-	 *
-	 * Anyway, the fix appears to be to manually hax the sockaddr length
-	 * to be the right value for the underlying family.
-	 */
-	switch (a->sa_family) {
-		case AF_INET:
-			salen = sizeof(struct sockaddr_in);
-			if ((err=getnameinfo(a, salen, mybuf, mybufflen, NULL, 0, NI_NUMERICHOST))!=0) {
-				strncpy(mybuf,gai_strerror(err),mybufflen);
-			}
-			break;
-		case AF_INET6:
-			salen = sizeof(struct sockaddr_in6);
-			if ((err=getnameinfo(a, salen, mybuf, mybufflen, NULL, 0, NI_NUMERICHOST))!=0) {
-				strncpy(mybuf,gai_strerror(err),mybufflen);
-			}
-			break;
-#ifdef HAVE_NETPACKET_PACKET_H
-		case AF_PACKET:
-			trace_ether_ntoa(((struct sockaddr_ll*)a)->sll_addr, mybuf);
-			break;
-#else
-		case AF_LINK:
-			trace_ether_ntoa((uint8_t *)((struct sockaddr_dl *)a)->sdl_data, mybuf);
-			break;
-#endif
-		default:
-			snprintf(mybuf,mybufflen,"Unknown family %d",a->sa_family);
-	}
-	return mybuf;
-}
-
-static void set_port_for_sockaddr(struct sockaddr *sa,uint16_t port)
-{
-	switch (sa->sa_family) {
-		case AF_INET:
-			((struct sockaddr_in *)sa)->sin_port = htons(port);
-			break;
-		case AF_INET6:
-			((struct sockaddr_in6 *)sa)->sin6_port = htons(port);
-			break;
-	}
-}
-
-static void clear_addr_for_sockaddr(struct sockaddr *sa)
-{
-	switch (sa->sa_family) {
-		case AF_INET:
-			((struct sockaddr_in *)sa)->sin_addr.s_addr = 0;
-			break;
-		case AF_INET6:
-			memset((void*)&((struct sockaddr_in6 *)sa)->sin6_addr,0,sizeof(((struct sockaddr_in6 *)sa)->sin6_addr));
-			break;
-	}
-}
+/* The ip_version given to keys holding MAC addresses rather than IP
+ * addresses, so that traffic that isn't IP is still shown per host */
+#define MAC_KEY 0xff
 
-static uint16_t get_port_from_sockaddr(struct sockaddr *sa)
+/* Formats an address from a flow tuple for display */
+static const char *tuple_addr_string(uint8_t ip_version, const uint8_t *addr,
+		char *buffer, size_t bufflen)
 {
-	switch (sa->sa_family) {
-		case AF_INET:
-			return ntohs(((struct sockaddr_in *)sa)->sin_port);
-			break;
-		case AF_INET6:
-			return ntohs(((struct sockaddr_in6 *)sa)->sin6_port);
-			break;
+	switch (ip_version) {
+		case 4:
+			return inet_ntop(AF_INET, addr, buffer, bufflen);
+		case 6:
+			return inet_ntop(AF_INET6, addr, buffer, bufflen);
+		case MAC_KEY:
+			return trace_ether_ntoa(addr, buffer);
 	}
-
-	return 0;
+	snprintf(buffer, bufflen, "Not IP");
+	return buffer;
 }
 
-struct flowkey_t {
-	struct sockaddr_storage sip;
-	struct sockaddr_storage dip;
-	uint16_t sport;
-	uint16_t dport;
-	uint8_t protocol;
-
-	bool operator <(const flowkey_t &b) const {
-		int c;
-
-		if (use_sip) {
-			c = cmp_sockaddr((struct sockaddr*)&sip,(struct sockaddr*)&b.sip);
-			if (c != 0) return c<0;
-		}
-		if (use_dip) {
-			c = cmp_sockaddr((struct sockaddr*)&dip,(struct sockaddr*)&b.dip);
-			if (c != 0) return c<0;
-		}
-
-		return protocol < b.protocol;
-	}
-};
-
 struct flowdata_t {
 	uint64_t packets;
 	uint64_t bytes;
 };
 
-typedef std::map<flowkey_t,flowdata_t> flows_t;
+libtrace_flow_table_t *flows = NULL;
 
-flows_t flows;
+/* In approximate mode only the heaviest flows are tracked, so memory use
+ * stays fixed however many flows there are */
+size_t approx_flows = 0;
+libtrace_topk_t *top_flows = NULL;
+libtrace_hll_t *distinct_flows = NULL;
 
 const char *nice_bandwidth(double bytespersec)
 {
@@ -257,44 +124,56 @@ const char *nice_bandwidth(double bytespersec)
 
 static void per_packet(libtrace_packet_t *packet)
 {
-	flowkey_t flowkey;
-	flows_t::iterator it;
+	libtrace_flow_tuple_t flowkey;
+	flowdata_t *flowdata;
 
         if (IS_LIBTRACE_META_PACKET(packet))
                 return;
 
-	if (trace_get_source_address(packet,(struct sockaddr*)&flowkey.sip)==NULL)
-		flowkey.sip.ss_family = AF_UNSPEC;
-
-	if (trace_get_destination_address(packet,(struct sockaddr*)&flowkey.dip)==NULL)
-		flowkey.dip.ss_family = AF_UNSPEC;
+	libtrace_flow_tuple_from_packet(packet, &flowkey);
+	if (flowkey.ip_version == 0) {
+		uint8_t *smac = trace_get_source_mac(packet);
+		uint8_t *dmac = trace_get_destination_mac(packet);
+
+		if (smac)
+			memcpy(flowkey.src_ip, smac, 6);
+		if (dmac)
+			memcpy(flowkey.dst_ip, dmac, 6);
+		if (smac || dmac)
+			flowkey.ip_version = MAC_KEY;
+	}
 
 	if (!use_sip)
-		clear_addr_for_sockaddr((struct sockaddr *)&flowkey.sip);
+		memset(flowkey.src_ip, 0, sizeof(flowkey.src_ip));
 
 	if (!use_dip)
-		clear_addr_for_sockaddr((struct sockaddr *)&flowkey.dip);
+		memset(flowkey.dst_ip, 0, sizeof(flowkey.dst_ip));
 
 	if (!use_sport)
-		set_port_for_sockaddr((struct sockaddr *)&flowkey.sip,0);
+		flowkey.src_port = 0;
 
 	if (!use_dport) 
-		set_port_for_sockaddr((struct sockaddr *)&flowkey.dip,0);
+		flowkey.dst_port = 0;
 
-	if (use_protocol && trace_get_transport(packet,&flowkey.protocol, NULL) == NULL)
+	if (!use_protocol)
+		flowkey.protocol = 0;
+	else if (trace_get_transport(packet, &flowkey.protocol, NULL) == NULL)
 		flowkey.protocol = 255;
 
-
-	it = flows.find(flowkey);
-	if (it == flows.end()) {
-		flowdata_t flowdata = { 0, 0 };
-		flows_t::value_type insdata(flowkey,flowdata);
-		std::pair<flows_t::iterator,bool> ins= flows.insert(insdata);
-		it = ins.first;
+	if (top_flows) {
+		flowdata = (flowdata_t *)libtrace_topk_update(top_flows,
+				&flowkey, trace_get_wire_length(packet));
+		libtrace_hll_add(distinct_flows, &flowkey, sizeof(flowkey));
+	} else {
+		flowdata = (flowdata_t *)libtrace_flow_table_insert(flows,
+				&flowkey, NULL);
+		if (!flowdata)
+			++untracked_packets;
+	}
+	if (flowdata) {
+		++flowdata->packets;
+		flowdata->bytes+=trace_get_wire_length(packet);
 	}
-
-	++it->second.packets;
-	it->second.bytes+=trace_get_wire_length(packet);
 
 	++total_packets;
 	total_bytes+=trace_get_wire_length(packet);
@@ -304,9 +183,7 @@ static void per_packet(libtrace_packet_t *packet)
 struct flow_data_t {
 	uint64_t bytes;
 	uint64_t packets;
-	struct sockaddr_storage sip;
-	struct sockaddr_storage dip;
-	uint8_t protocol;
+	libtrace_flow_tuple_t key;
 
 	bool operator< (const flow_data_t &b) const {
 		if (bytes != b.bytes) return bytes < b.bytes;
@@ -319,18 +196,38 @@ static void do_report()
 	typedef  std::priority_queue<flow_data_t> pq_t;
 	int row,col;
 	pq_t pq;
-	for(flows_t::const_iterator it=flows.begin();it!=flows.end();++it) {
+	const libtrace_flow_tuple_t *key;
+	void *value;
+	size_t iter = 0;
+	if (top_flows) {
+		std::vector<libtrace_topk_item_t> items(approx_flows);
+		size_t n = libtrace_topk_get_items(top_flows, &items[0]);
+		for (size_t i = 0; i < n; i++) {
+			flow_data_t data;
+			/* The byte count is an upper bound, while the packet
+			 * count only covers the time the flow was tracked */
+			data.bytes = items[i].count;
+			data.packets = ((flowdata_t *)items[i].value)->packets;
+			data.key = *(const libtrace_flow_tuple_t *)items[i].key;
+			pq.push(data);
+		}
+	}
+	while (flows && libtrace_flow_table_next(flows, &iter, &key, &value)) {
 		flow_data_t data;
-		data.bytes = it->second.bytes,
-		data.packets = it->second.packets,
-		data.sip = it->first.sip;
-		data.dip = it->first.dip;
-		data.protocol = it->first.protocol;
+		data.bytes = ((flowdata_t *)value)->bytes;
+		data.packets = ((flowdata_t *)value)->packets;
+		data.key = *key;
 		pq.push(data);
 	}
 	getmaxyx(stdscr,row,col);
 	move(0,0);
 	printw("Total Bytes: %10" PRIu64 " (%s)\tTotal Packets: %10" PRIu64, total_bytes, nice_bandwidth(total_bytes/interval), total_packets);
+	if (distinct_flows)
+		printw("\tFlows: ~%" PRIu64,
+				libtrace_hll_estimate(distinct_flows));
+	if (untracked_packets)
+		printw("\tOut of memory, packets not shown: %" PRIu64,
+				untracked_packets);
 	clrtoeol();
 	attrset(A_REVERSE);
 	move(1,0);
@@ -374,9 +271,9 @@ static void do_report()
 		move(i+1,0);
 		if (use_sip) {
 			printw("%*s", wide_display ? 42 : 20, 
-					trace_sockaddr2string(
-						(struct sockaddr*)&pq.top().sip,
-						sizeof(struct sockaddr_storage),
+					tuple_addr_string(
+						pq.top().key.ip_version,
+						pq.top().key.src_ip,
 						sipstr,sizeof(sipstr)));
 			if (use_sport)
 				printw("/");
@@ -384,12 +281,12 @@ static void do_report()
 				printw("\t");
 		}
 		if (use_sport)
-			printw("%-5d  ", get_port_from_sockaddr((struct sockaddr*)&pq.top().sip));
+			printw("%-5d  ", pq.top().key.src_port);
 		if (use_dip) {
 			printw("%*s", wide_display ? 42 : 20, 
-					trace_sockaddr2string(
-						(struct sockaddr*)&pq.top().dip,
-						sizeof(struct sockaddr_storage),
+					tuple_addr_string(
+						pq.top().key.ip_version,
+						pq.top().key.dst_ip,
 						dipstr,sizeof(dipstr)));
 			if (use_dport)
 				printw("/");
@@ -397,13 +294,13 @@ static void do_report()
 				printw("\t");
 		}
 		if (use_dport)
-			printw("%-5d  ", get_port_from_sockaddr((struct sockaddr*)&pq.top().dip));
+			printw("%-5d  ", pq.top().key.dst_port);
 		if (use_protocol) {
-			struct protoent *proto = getprotobynumber(pq.top().protocol);
+			struct protoent *proto = getprotobynumber(pq.top().key.protocol);
 			if (proto) 
 				printw("%-10s  ", proto->p_name);
 			else
-				printw("%10d  ",pq.top().protocol);
+				printw("%10d  ",pq.top().key.protocol);
 		}
 		switch (display_as) {
 			case BYTES:
@@ -423,9 +320,15 @@ static void do_report()
 		}
 		pq.pop();
 	}
-	flows.clear();
+	if (top_flows) {
+		libtrace_topk_clear(top_flows);
+		libtrace_hll_clear(distinct_flows);
+	} else {
+		libtrace_flow_table_clear(flows);
+	}
 	total_packets = 0;
 	total_bytes = 0;
+	untracked_packets = 0;
 
 	clrtobot();
 	refresh();
@@ -537,6 +440,9 @@ static void usage(char *argv0)
 	fprintf(stderr," --wide\n");
 	fprintf(stderr," -w\n");
 	fprintf(stderr,"\t\tExpand IP address fields to fit IPv6 addresses\n");
+	fprintf(stderr," --approx flows\n");
+	fprintf(stderr," -a flows\n");
+	fprintf(stderr,"\t\tOnly track the heaviest flows, using a fixed amount of memory\n");
 }
 
 int main(int argc, char *argv[])
@@ -561,16 +467,24 @@ int main(int argc, char *argv[])
 			{ "interval",		1, 0, 'i' },
 			{ "fast",		0, 0, 'F' },
 			{ "wide", 		0, 0, 'w' },
+			{ "approx",		1, 0, 'a' },
 			{ NULL,			0, 0, 0 }
 		};
 
-		int c= getopt_long(argc, argv, "BPf:Fs:p:hHi:w12345",
+		int c= getopt_long(argc, argv, "a:BPf:Fs:p:hHi:w12345",
 				long_options, &option_index);
 
 		if (c==-1)
 			break;
 
 		switch (c) {
+			case 'a':
+				if (atoi(optarg) <= 0) {
+					fprintf(stderr,"Number of flows must be >0\n");
+					return 1;
+				}
+				approx_flows = atoi(optarg);
+				break;
 			case 'f':
 				filter=trace_create_filter(optarg);
 				break;
@@ -622,6 +536,22 @@ int main(int argc, char *argv[])
 		return 1;
 	}
 
+	if (approx_flows) {
+		top_flows = libtrace_topk_create(approx_flows,
+				sizeof(libtrace_flow_tuple_t), sizeof(flowdata_t));
+		distinct_flows = libtrace_hll_create(14);
+		if (!top_flows || !distinct_flows) {
+			fprintf(stderr,"Unable to create flow sketches\n");
+			return 1;
+		}
+	} else {
+		flows = libtrace_flow_table_create(sizeof(flowdata_t), 0);
+		if (!flows) {
+			fprintf(stderr,"Unable to create flow table\n");
+			return 1;
+		}
+	}
+
 	initscr(); cbreak(); noecho();
 
 	while (!quit && optind<argc) {
@@ -672,6 +602,9 @@ int main(int argc, char *argv[])
 
 	endwin();
 	endprotoent();
+	libtrace_flow_table_destroy(flows);
+	libtrace_topk_destroy(top_flows);
+	libtrace_hll_destroy(distinct_flows);
 
 	return 0;
 }